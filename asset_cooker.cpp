@@ -0,0 +1,208 @@
+// Asset cooker. Walks shaders/, models/ and cubemap/ and writes every asset the app loads into one
+// memory mappable archive, 'assets.pack' (see asset_pack.h):
+//   shaders                  -> GLSL source as is
+//   models (.obj)            -> the processed mesh cache ('<model>.obj.meshcache'), imported with Assimp if it's stale
+//   images (.png, .jpg, ...) -> the image, plus its '.ktx2' from the texture transcoder when that is up to date
+// The app mounts the pack at startup and only falls back to the loose files for assets the pack doesn't have.
+// Run it again after changing any asset; the app doesn't check the pack against the sources.
+//
+// usage: ./cooker [--output file] [directory...]
+
+#include "mesh_importer.h"
+#include "mesh_cache.h"
+#include "asset_pack.h"
+
+#include <filesystem>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+using namespace std;
+namespace fs = std::filesystem;
+
+struct CookedAsset {
+    string path;        // name inside the pack
+    string sourcePath;  // file the payload is read from
+};
+
+bool hasExtension(const fs::path &path, const vector<string> &extensions)
+{
+    string extension = path.extension().string();
+    for (char &c : extension)
+        c = static_cast<char>(tolower(c));
+    return std::find(extensions.begin(), extensions.end(), extension) != extensions.end();
+}
+
+// makes sure the mesh cache of a model is current, importing the model if it isn't
+bool cookModel(const string &path)
+{
+    string cachePath = MeshCache::cachePath(path);
+    uint64_t key = MeshCache::sourceKey(path, MODEL_IMPORT_FLAGS);
+    MeshCache cache;
+    if (cache.open(cachePath, key))
+        return true;
+
+    vector<ImportedMesh> meshes;
+    if (!MeshImporter::load(path, meshes))
+        return false;
+    cout << "imported    " << path << endl;
+    return MeshCache::write(cachePath, key, meshes);
+}
+
+// collects what goes into the pack from one directory tree
+int collect(const string &root, vector<CookedAsset> &assets)
+{
+    static const vector<string> images = { ".png", ".jpg", ".jpeg", ".tga", ".bmp" };
+    int failures = 0;
+    for (const fs::directory_entry &entry : fs::recursive_directory_iterator(root))
+    {
+        if (!entry.is_regular_file())
+            continue;
+        string path = normalizeAssetPath(entry.path().generic_string());
+
+        if (hasExtension(entry.path(), { ".obj" }))
+        {
+            if (!cookModel(path))
+            {
+                cout << "ERROR::COOKER:: could not import " << path << endl;
+                failures++;
+                continue;
+            }
+            assets.push_back({ MeshCache::cachePath(path), MeshCache::cachePath(path) });
+        }
+        else if (hasExtension(entry.path(), images))
+        {
+            assets.push_back({ path, path });
+            fs::path compressed = path + ".ktx2";
+            if (fs::exists(compressed))
+            {
+                if (fs::last_write_time(compressed) >= entry.last_write_time())
+                    assets.push_back({ compressed.generic_string(), compressed.generic_string() });
+                else
+                    cout << "stale       " << compressed.generic_string() << ", run the transcoder again" << endl;
+            }
+        }
+        else if (path.compare(0, 8, "shaders/") == 0)
+            assets.push_back({ path, path });
+        // MTL files, mesh caches and transcoded textures only get in through their model or image
+    }
+    return failures;
+}
+
+// writes the table of contents and the payloads, through a temporary file like the mesh cache
+bool writePack(const string &packPath, vector<CookedAsset> &assets)
+{
+    std::sort(assets.begin(), assets.end(), [](const CookedAsset &a, const CookedAsset &b) { return a.path < b.path; });
+    assets.erase(std::unique(assets.begin(), assets.end(), [](const CookedAsset &a, const CookedAsset &b) { return a.path == b.path; }), assets.end());
+
+    AssetPackHeader header;
+    memcpy(header.magic, ASSET_PACK_MAGIC, 4);
+    header.version = ASSET_PACK_VERSION;
+    header.entryCount = static_cast<uint32_t>(assets.size());
+    header.padding = 0;
+
+    vector<AssetPackEntry> entries(assets.size());
+    uint64_t offset = sizeof(AssetPackHeader) + entries.size() * sizeof(AssetPackEntry);
+    for (size_t i = 0; i < assets.size(); i++)
+    {
+        AssetPackEntry &entry = entries[i];
+        memset(&entry, 0, sizeof(entry));
+        if (assets[i].path.size() >= sizeof(entry.path))
+        {
+            cout << "ERROR::COOKER:: path too long for the pack: " << assets[i].path << endl;
+            return false;
+        }
+        memcpy(entry.path, assets[i].path.data(), assets[i].path.size());
+        offset = (offset + ASSET_PACK_ALIGNMENT - 1) / ASSET_PACK_ALIGNMENT * ASSET_PACK_ALIGNMENT;
+        entry.offset = offset;
+        entry.size = fs::file_size(assets[i].sourcePath);
+        offset += entry.size;
+    }
+
+    string tempPath = packPath + ".tmp";
+    ofstream out(tempPath, ios::binary | ios::trunc);
+    if (!out)
+    {
+        cout << "ERROR::COOKER:: could not write " << tempPath << endl;
+        return false;
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(AssetPackEntry));
+    for (size_t i = 0; i < assets.size(); i++)
+    {
+        static const char zeros[ASSET_PACK_ALIGNMENT] = {};
+        uint64_t position = static_cast<uint64_t>(out.tellp());
+        out.write(zeros, static_cast<std::streamsize>(entries[i].offset - position));
+
+        MappedFile source(assets[i].sourcePath);
+        if (entries[i].size > 0 && (!source.isOpen() || source.size() != entries[i].size))
+        {
+            cout << "ERROR::COOKER:: could not read " << assets[i].sourcePath << endl;
+            out.close();
+            std::remove(tempPath.c_str());
+            return false;
+        }
+        out.write(reinterpret_cast<const char*>(source.data()), static_cast<std::streamsize>(entries[i].size));
+    }
+    out.close();
+    if (!out)
+    {
+        cout << "ERROR::COOKER:: could not write " << tempPath << endl;
+        std::remove(tempPath.c_str());
+        return false;
+    }
+
+    // rename doesn't replace an existing file on every platform
+    std::remove(packPath.c_str());
+    if (std::rename(tempPath.c_str(), packPath.c_str()) != 0)
+    {
+        std::remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    auto start = chrono::steady_clock::now();
+    string packPath = ASSET_PACK_DEFAULT_PATH;
+    vector<string> roots;
+    for (int i = 1; i < argc; i++)
+    {
+        string argument = argv[i];
+        if (argument == "--output" && i + 1 < argc)
+            packPath = argv[++i];
+        else
+            roots.push_back(argument);
+    }
+    if (roots.empty())
+        roots = { "shaders", "models", "cubemap" };
+
+    vector<CookedAsset> assets;
+    int failures = 0;
+    for (const string &root : roots)
+    {
+        if (!fs::exists(root))
+        {
+            cout << "ERROR::COOKER:: no such directory " << root << endl;
+            failures++;
+            continue;
+        }
+        failures += collect(root, assets);
+    }
+    if (failures > 0)
+    {
+        cout << failures << " asset(s) failed, " << packPath << " not written" << endl;
+        return 1;
+    }
+    if (!writePack(packPath, assets))
+        return 1;
+
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    cout << "COOKER:: wrote " << packPath << ", " << assets.size() << " assets, "
+         << fs::file_size(packPath) / (1024.0 * 1024.0) << " MB in " << ms << " ms" << endl;
+    return 0;
+}
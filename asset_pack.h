@@ -0,0 +1,194 @@
+#ifndef ASSET_PACK_H
+#define ASSET_PACK_H
+
+#include "mapped_file.h"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+#include <cstdint>
+using namespace std;
+
+// Single read-only archive of cooked scene content, written by the asset cooker as 'assets.pack'.
+// Layout (all offsets from the start of the file):
+//   AssetPackHeader
+//   AssetPackEntry[entryCount], sorted by path
+//   payloads, each aligned to ASSET_PACK_ALIGNMENT
+// The whole pack is memory mapped once at startup. Payloads are used in place, so mesh data and compressed
+// texture levels go to GL straight from the mapping. Bump ASSET_PACK_VERSION whenever the layout changes.
+const uint32_t ASSET_PACK_VERSION = 1;
+const char ASSET_PACK_MAGIC[4] = { 'A', 'P', 'A', 'K' };
+const uint64_t ASSET_PACK_ALIGNMENT = 64;
+const char ASSET_PACK_DEFAULT_PATH[] = "assets.pack";
+
+struct AssetPackHeader {
+    char     magic[4];
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t padding;
+};
+
+struct AssetPackEntry {
+    char     path[240];
+    uint64_t offset;
+    uint64_t size;
+};
+
+// normalizes separators and removes '.' and 'dir/..' segments so one file always maps to one key
+inline string normalizeAssetPath(const string &path)
+{
+    vector<string> parts;
+    string part;
+    bool absolute = !path.empty() && (path[0] == '/' || path[0] == '\\');
+    for (size_t i = 0; i <= path.size(); i++)
+    {
+        if (i == path.size() || path[i] == '/' || path[i] == '\\')
+        {
+            if (part == "..")
+            {
+                if (!parts.empty() && parts.back() != "..")
+                    parts.pop_back();
+                else
+                    parts.push_back(part);
+            }
+            else if (!part.empty() && part != ".")
+                parts.push_back(part);
+            part.clear();
+        }
+        else
+            part += path[i];
+    }
+    string resolved = absolute ? "/" : "";
+    for (size_t i = 0; i < parts.size(); i++)
+        resolved += (i > 0 ? "/" : "") + parts[i];
+    return resolved;
+}
+
+// The mounted pack. Lookups are a binary search over the table of contents and safe from any thread
+// while the pack stays mounted.
+class AssetPack
+{
+public:
+    static AssetPack &instance()
+    {
+        static AssetPack pack;
+        return pack;
+    }
+
+    // maps and validates a pack, returns false (and leaves nothing mounted) if it's missing or damaged
+    bool mount(const string &path)
+    {
+        unmount();
+        if (!file.open(path))
+            return false;
+
+        if (file.size() < sizeof(AssetPackHeader))
+            return invalidate(path);
+        const AssetPackHeader *header = reinterpret_cast<const AssetPackHeader*>(file.data());
+        if (memcmp(header->magic, ASSET_PACK_MAGIC, 4) != 0 || header->version != ASSET_PACK_VERSION)
+            return invalidate(path);
+        if (sizeof(AssetPackHeader) + uint64_t(header->entryCount) * sizeof(AssetPackEntry) > file.size())
+            return invalidate(path);
+
+        entries = reinterpret_cast<const AssetPackEntry*>(file.data() + sizeof(AssetPackHeader));
+        count = header->entryCount;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            const AssetPackEntry &entry = entries[i];
+            if (entry.path[sizeof(entry.path) - 1] != '\0' || entry.offset + entry.size > file.size()
+                || (i > 0 && strcmp(entries[i - 1].path, entry.path) >= 0))
+                return invalidate(path);
+        }
+        return true;
+    }
+
+    void unmount()
+    {
+        file.close();
+        entries = nullptr;
+        count = 0;
+    }
+
+    bool isMounted() const { return entries != nullptr; }
+    unsigned int entryCount() const { return count; }
+    size_t size() const { return file.size(); }
+
+    // finds a file by its path relative to the working directory
+    bool find(const string &path, const unsigned char *&data, size_t &size) const
+    {
+        if (!entries)
+            return false;
+        string key = normalizeAssetPath(path);
+        const AssetPackEntry *end = entries + count;
+        const AssetPackEntry *it = std::lower_bound(entries, end, key, [](const AssetPackEntry &entry, const string &value) {
+            return strcmp(entry.path, value.c_str()) < 0;
+        });
+        if (it == end || key != it->path)
+            return false;
+        data = file.data() + it->offset;
+        size = static_cast<size_t>(it->size);
+        return true;
+    }
+
+    bool contains(const string &path) const
+    {
+        const unsigned char *data;
+        size_t size;
+        return find(path, data, size);
+    }
+
+private:
+    MappedFile file;
+    const AssetPackEntry *entries = nullptr;
+    uint32_t count = 0;
+
+    AssetPack() {}
+
+    bool invalidate(const string &path)
+    {
+        std::cout << "ERROR::ASSET_PACK:: " << path << " is damaged or from another version, ignoring it" << std::endl;
+        unmount();
+        return false;
+    }
+};
+
+// Read-only view of an asset file. Served from the mounted pack when the pack has the file,
+// memory mapped from disk otherwise.
+class AssetFile
+{
+public:
+    AssetFile() {}
+    explicit AssetFile(const string &path) { open(path); }
+
+    AssetFile(const AssetFile&) = delete;
+    AssetFile& operator=(const AssetFile&) = delete;
+
+    bool open(const string &path)
+    {
+        close();
+        if (AssetPack::instance().find(path, packed, packedSize))
+            return true;
+        packed = nullptr;
+        return file.open(path);
+    }
+
+    void close()
+    {
+        file.close();
+        packed = nullptr;
+        packedSize = 0;
+    }
+
+    bool isOpen() const { return packed != nullptr || file.isOpen(); }
+    bool fromPack() const { return packed != nullptr; }
+    const unsigned char* data() const { return packed ? packed : file.data(); }
+    size_t size() const { return packed ? packedSize : file.size(); }
+
+private:
+    MappedFile file;
+    const unsigned char *packed = nullptr;
+    size_t packedSize = 0;
+};
+#endif
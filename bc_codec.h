@@ -0,0 +1,341 @@
+#ifndef BC_CODEC_H
+#define BC_CODEC_H
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+using namespace std;
+
+// CPU encoders and decoders for the block compressed formats used by the texture transcoder.
+//   BC1: RGB, 4 bits per texel
+//   BC3: RGBA, BC1 colour plus a BC4 alpha block, 8 bits per texel
+//   BC5: two independent BC4 channels (RG), 8 bits per texel. Used for normal maps, z is rebuilt in the shader.
+// Images are tightly packed RGBA8 rows. Blocks at the right and bottom edges repeat the last texel.
+// The decoders exist so the encoders can be checked on the CPU, the GPU decodes at draw time.
+
+enum BCFormat {
+    BC_FORMAT_BC1,
+    BC_FORMAT_BC3,
+    BC_FORMAT_BC5
+};
+
+inline unsigned int bcBlockBytes(BCFormat format)
+{
+    return format == BC_FORMAT_BC1 ? 8 : 16;
+}
+
+// size of a compressed image, 4x4 texel blocks rounded up
+inline size_t bcImageBytes(BCFormat format, int width, int height)
+{
+    return size_t((width + 3) / 4) * ((height + 3) / 4) * bcBlockBytes(format);
+}
+
+namespace bc {
+
+inline uint16_t packRGB565(const float colour[3])
+{
+    int r = std::min(31, std::max(0, int(colour[0] * 31.0f / 255.0f + 0.5f)));
+    int g = std::min(63, std::max(0, int(colour[1] * 63.0f / 255.0f + 0.5f)));
+    int b = std::min(31, std::max(0, int(colour[2] * 31.0f / 255.0f + 0.5f)));
+    return uint16_t((r << 11) | (g << 5) | b);
+}
+
+inline void unpackRGB565(uint16_t packed, int colour[3])
+{
+    int r = (packed >> 11) & 31;
+    int g = (packed >> 5) & 63;
+    int b = packed & 31;
+    colour[0] = (r << 3) | (r >> 2);
+    colour[1] = (g << 2) | (g >> 4);
+    colour[2] = (b << 3) | (b >> 2);
+}
+
+// copies the 4x4 block at (bx, by) out of an RGBA8 image, clamping at the edges
+inline void fetchBlock(const unsigned char *rgba, int width, int height, int bx, int by, unsigned char block[16][4])
+{
+    for (int y = 0; y < 4; y++)
+    {
+        int sy = std::min(by * 4 + y, height - 1);
+        for (int x = 0; x < 4; x++)
+        {
+            int sx = std::min(bx * 4 + x, width - 1);
+            memcpy(block[y * 4 + x], rgba + (size_t(sy) * width + sx) * 4, 4);
+        }
+    }
+}
+
+// Encodes the colour of 16 texels. Endpoints are the extremes along the principal axis of the colours,
+// pulled in slightly to reduce the error of the interpolated points. Always uses the four colour mode.
+inline void encodeColourBlock(const unsigned char block[16][4], unsigned char out[8])
+{
+    float mean[3] = { 0.0f, 0.0f, 0.0f };
+    for (int i = 0; i < 16; i++)
+        for (int c = 0; c < 3; c++)
+            mean[c] += block[i][c] / 16.0f;
+
+    float cov[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+    for (int i = 0; i < 16; i++)
+    {
+        float d[3] = { block[i][0] - mean[0], block[i][1] - mean[1], block[i][2] - mean[2] };
+        cov[0] += d[0] * d[0]; cov[1] += d[0] * d[1]; cov[2] += d[0] * d[2];
+        cov[3] += d[1] * d[1]; cov[4] += d[1] * d[2]; cov[5] += d[2] * d[2];
+    }
+
+    // principal axis by power iteration
+    float axis[3] = { 1.0f, 1.0f, 1.0f };
+    for (int iteration = 0; iteration < 8; iteration++)
+    {
+        float next[3] = {
+            cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+            cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+            cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]
+        };
+        float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+        if (length < 1e-6f)
+            break;
+        for (int c = 0; c < 3; c++)
+            axis[c] = next[c] / length;
+    }
+
+    float minT = 1e30f, maxT = -1e30f;
+    for (int i = 0; i < 16; i++)
+    {
+        float t = (block[i][0] - mean[0]) * axis[0] + (block[i][1] - mean[1]) * axis[1] + (block[i][2] - mean[2]) * axis[2];
+        minT = std::min(minT, t);
+        maxT = std::max(maxT, t);
+    }
+    float inset = (maxT - minT) / 32.0f;
+    minT += inset;
+    maxT -= inset;
+
+    float high[3], low[3];
+    for (int c = 0; c < 3; c++)
+    {
+        high[c] = mean[c] + axis[c] * maxT;
+        low[c] = mean[c] + axis[c] * minT;
+    }
+    uint16_t c0 = packRGB565(high);
+    uint16_t c1 = packRGB565(low);
+    // c0 > c1 selects the four colour mode, equal endpoints only need index 0
+    if (c0 < c1)
+        std::swap(c0, c1);
+
+    int palette[4][3];
+    unpackRGB565(c0, palette[0]);
+    unpackRGB565(c1, palette[1]);
+    for (int c = 0; c < 3; c++)
+    {
+        palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+
+    uint32_t indices = 0;
+    if (c0 != c1)
+    {
+        for (int i = 0; i < 16; i++)
+        {
+            int best = 0, bestError = 1 << 30;
+            for (int p = 0; p < 4; p++)
+            {
+                int dr = block[i][0] - palette[p][0], dg = block[i][1] - palette[p][1], db = block[i][2] - palette[p][2];
+                int error = dr * dr + dg * dg + db * db;
+                if (error < bestError)
+                {
+                    bestError = error;
+                    best = p;
+                }
+            }
+            indices |= uint32_t(best) << (i * 2);
+        }
+    }
+    out[0] = c0 & 0xFF; out[1] = c0 >> 8;
+    out[2] = c1 & 0xFF; out[3] = c1 >> 8;
+    memcpy(out + 4, &indices, 4);
+}
+
+inline void decodeColourBlock(const unsigned char in[8], unsigned char block[16][4])
+{
+    uint16_t c0 = uint16_t(in[0] | (in[1] << 8));
+    uint16_t c1 = uint16_t(in[2] | (in[3] << 8));
+    int palette[4][3];
+    unpackRGB565(c0, palette[0]);
+    unpackRGB565(c1, palette[1]);
+    for (int c = 0; c < 3; c++)
+    {
+        if (c0 > c1)
+        {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+        else
+        {
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+            // transparent black in the three colour mode, alpha is ignored here
+            palette[3][c] = 0;
+        }
+    }
+
+    uint32_t indices;
+    memcpy(&indices, in + 4, 4);
+    for (int i = 0; i < 16; i++)
+    {
+        int p = (indices >> (i * 2)) & 3;
+        for (int c = 0; c < 3; c++)
+            block[i][c] = static_cast<unsigned char>(palette[p][c]);
+    }
+}
+
+// Encodes one channel of 16 texels as a BC4 block, using the eight value mode between the channel extremes
+inline void encodeChannelBlock(const unsigned char block[16][4], int channel, unsigned char out[8])
+{
+    int low = 255, high = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        low = std::min(low, int(block[i][channel]));
+        high = std::max(high, int(block[i][channel]));
+    }
+    out[0] = static_cast<unsigned char>(high);
+    out[1] = static_cast<unsigned char>(low);
+
+    uint64_t indices = 0;
+    if (high != low)
+    {
+        int palette[8];
+        palette[0] = high;
+        palette[1] = low;
+        for (int p = 1; p < 7; p++)
+            palette[p + 1] = ((7 - p) * high + p * low) / 7;
+        for (int i = 0; i < 16; i++)
+        {
+            int best = 0, bestError = 1 << 30;
+            for (int p = 0; p < 8; p++)
+            {
+                int error = std::abs(int(block[i][channel]) - palette[p]);
+                if (error < bestError)
+                {
+                    bestError = error;
+                    best = p;
+                }
+            }
+            indices |= uint64_t(best) << (i * 3);
+        }
+    }
+    for (int b = 0; b < 6; b++)
+        out[2 + b] = static_cast<unsigned char>(indices >> (b * 8));
+}
+
+inline void decodeChannelBlock(const unsigned char in[8], int channel, unsigned char block[16][4])
+{
+    int a0 = in[0], a1 = in[1];
+    int palette[8];
+    palette[0] = a0;
+    palette[1] = a1;
+    if (a0 > a1)
+    {
+        for (int p = 1; p < 7; p++)
+            palette[p + 1] = ((7 - p) * a0 + p * a1) / 7;
+    }
+    else
+    {
+        for (int p = 1; p < 5; p++)
+            palette[p + 1] = ((5 - p) * a0 + p * a1) / 5;
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+    uint64_t indices = 0;
+    for (int b = 0; b < 6; b++)
+        indices |= uint64_t(in[2 + b]) << (b * 8);
+    for (int i = 0; i < 16; i++)
+        block[i][channel] = static_cast<unsigned char>(palette[(indices >> (i * 3)) & 7]);
+}
+
+} // namespace bc
+
+// compresses an RGBA8 image into the given format
+inline vector<unsigned char> bcEncode(BCFormat format, const unsigned char *rgba, int width, int height)
+{
+    int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+    vector<unsigned char> out(bcImageBytes(format, width, height));
+    unsigned char *dst = out.data();
+    unsigned char block[16][4];
+    for (int by = 0; by < blocksY; by++)
+    {
+        for (int bx = 0; bx < blocksX; bx++)
+        {
+            bc::fetchBlock(rgba, width, height, bx, by, block);
+            if (format == BC_FORMAT_BC1)
+            {
+                bc::encodeColourBlock(block, dst);
+            }
+            else if (format == BC_FORMAT_BC3)
+            {
+                bc::encodeChannelBlock(block, 3, dst);
+                bc::encodeColourBlock(block, dst + 8);
+            }
+            else
+            {
+                bc::encodeChannelBlock(block, 0, dst);
+                bc::encodeChannelBlock(block, 1, dst + 8);
+            }
+            dst += bcBlockBytes(format);
+        }
+    }
+    return out;
+}
+
+// expands a compressed image back to RGBA8. BC1 decodes opaque, BC5 leaves blue at 0.
+inline vector<unsigned char> bcDecode(BCFormat format, const unsigned char *data, int width, int height)
+{
+    int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+    vector<unsigned char> rgba(size_t(width) * height * 4);
+    const unsigned char *src = data;
+    unsigned char block[16][4];
+    for (int by = 0; by < blocksY; by++)
+    {
+        for (int bx = 0; bx < blocksX; bx++)
+        {
+            memset(block, 0, sizeof(block));
+            for (int i = 0; i < 16; i++)
+                block[i][3] = 255;
+            if (format == BC_FORMAT_BC1)
+            {
+                bc::decodeColourBlock(src, block);
+            }
+            else if (format == BC_FORMAT_BC3)
+            {
+                bc::decodeChannelBlock(src, 3, block);
+                bc::decodeColourBlock(src + 8, block);
+            }
+            else
+            {
+                bc::decodeChannelBlock(src, 0, block);
+                bc::decodeChannelBlock(src + 8, 1, block);
+            }
+            for (int y = 0; y < 4 && by * 4 + y < height; y++)
+                for (int x = 0; x < 4 && bx * 4 + x < width; x++)
+                    memcpy(&rgba[(size_t(by * 4 + y) * width + bx * 4 + x) * 4], block[y * 4 + x], 4);
+            src += bcBlockBytes(format);
+        }
+    }
+    return rgba;
+}
+
+// Peak signal to noise ratio in dB between two RGBA8 images over the first `channels` channels
+inline double computePSNR(const unsigned char *a, const unsigned char *b, int width, int height, int channels)
+{
+    double sum = 0.0;
+    size_t count = size_t(width) * height;
+    for (size_t i = 0; i < count; i++)
+        for (int c = 0; c < channels; c++)
+        {
+            double d = double(a[i * 4 + c]) - double(b[i * 4 + c]);
+            sum += d * d;
+        }
+    double mse = sum / (double(count) * channels);
+    if (mse <= 0.0)
+        return 99.0;
+    return 10.0 * std::log10(255.0 * 255.0 / mse);
+}
+#endif
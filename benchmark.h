@@ -0,0 +1,331 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <glad/glad.h>
+
+#include "camera_path.h"
+#include "golden_images.h"
+#include "frame_recorder.h"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+using namespace std;
+
+const char BENCHMARK_DEFAULT_PATH[] = "benchmarks/flythrough.path";
+
+// Settings of a --bench run, from the command line:
+//   --bench [camera path]  render offscreen along the path instead of opening a window (default BENCHMARK_DEFAULT_PATH)
+//   --warmup N             frames drawn before measuring, once every texture has streamed in (default 60)
+//   --frames N             frames measured (default 600)
+//   --step SECONDS         virtual time between frames, for the camera and the animation (default 1/60)
+//   --stress N             stress mode with N extra buildings and robots
+//   --lights N             N city lights
+//   --output FILE          also write the JSON report to FILE
+//   --golden [tests]       render the poses of a golden image list offscreen and compare them with their references
+//                          instead (golden_images.h, default GOLDEN_DEFAULT_TESTS)
+//   --update               with --golden, write the references instead of comparing
+//   --record DIR           record every frame into DIR from the start (frame_recorder.h); with --bench the recording
+//                          follows the virtual clock, one image per step
+//   --record-format FORMAT png (default) or y4m
+struct BenchmarkOptions {
+    bool enabled = false;
+    string cameraPath = BENCHMARK_DEFAULT_PATH;
+    int warmupFrames = 60;
+    int measuredFrames = 600;
+    double timeStep = 1.0 / 60.0;
+    int stressInstances = 0;
+    int cityLights = 0;
+    string outputPath;
+    bool golden = false;
+    string goldenTests = GOLDEN_DEFAULT_TESTS;
+    bool updateGolden = false;
+    string recordDirectory;
+    RecordFormat recordFormat = RECORD_PNG;
+
+    // both modes draw offscreen behind an invisible window
+    bool offscreen() const { return enabled || golden; }
+};
+
+// Fills options from argv; false, after printing why, on anything it doesn't understand
+inline bool parseBenchmarkArguments(int argc, char **argv, BenchmarkOptions &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        string argument = argv[i];
+        bool hasValue = i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0;
+        if (argument == "--bench")
+        {
+            options.enabled = true;
+            if (hasValue)
+                options.cameraPath = argv[++i];
+        }
+        else if (argument == "--golden")
+        {
+            options.golden = true;
+            if (hasValue)
+                options.goldenTests = argv[++i];
+        }
+        else if (argument == "--update")
+            options.updateGolden = true;
+        else if (argument == "--output" && hasValue)
+            options.outputPath = argv[++i];
+        else if (argument == "--record" && hasValue)
+            options.recordDirectory = argv[++i];
+        else if (argument == "--record-format" && hasValue && (strcmp(argv[i + 1], "png") == 0 || strcmp(argv[i + 1], "y4m") == 0))
+            options.recordFormat = strcmp(argv[++i], "y4m") == 0 ? RECORD_Y4M : RECORD_PNG;
+        else if ((argument == "--warmup" || argument == "--frames" || argument == "--stress" || argument == "--lights") && hasValue)
+        {
+            int value = std::max(atoi(argv[++i]), 0);
+            if (argument == "--warmup")
+                options.warmupFrames = value;
+            else if (argument == "--frames")
+                options.measuredFrames = std::max(value, 1);
+            else if (argument == "--stress")
+                options.stressInstances = value;
+            else
+                options.cityLights = value;
+        }
+        else if (argument == "--step" && hasValue)
+            options.timeStep = std::max(atof(argv[++i]), 1e-4);
+        else
+        {
+            cout << "Unknown argument " << argument << endl
+                 << "usage: app [--bench [camera path]] [--warmup N] [--frames N] [--step seconds] [--stress N] [--lights N] [--output file]" << endl
+                 << "       app --golden [tests] [--update]" << endl
+                 << "       either, or none, with [--record directory] [--record-format png|y4m]" << endl;
+            return false;
+        }
+    }
+    if (options.enabled && options.golden)
+    {
+        cout << "--bench and --golden can't run together" << endl;
+        return false;
+    }
+    return true;
+}
+
+// The colour and depth renderbuffers a benchmark or golden image run draws into instead of a window's framebuffer
+class BenchmarkTarget
+{
+public:
+    int width = 0, height = 0;
+
+    BenchmarkTarget(int width, int height)
+        : width(width), height(height)
+    {
+        glGenRenderbuffers(2, renderbuffers);
+        glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            cout << "ERROR::BENCHMARK:: offscreen framebuffer incomplete" << endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    ~BenchmarkTarget()
+    {
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteRenderbuffers(2, renderbuffers);
+    }
+
+    // the GL objects are owned, a copy would delete them twice
+    BenchmarkTarget(const BenchmarkTarget&) = delete;
+    BenchmarkTarget& operator=(const BenchmarkTarget&) = delete;
+
+    void bind()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glViewport(0, 0, width, height);
+    }
+
+    GLuint framebufferId() const { return framebuffer; }
+
+private:
+    GLuint framebuffer = 0;
+    GLuint renderbuffers[2] = {};
+};
+
+// Order statistics of one measured quantity
+struct BenchmarkSummary {
+    double p50 = 0.0, p95 = 0.0, p99 = 0.0, mean = 0.0, min = 0.0, max = 0.0;
+};
+
+inline BenchmarkSummary summarize(vector<double> values)
+{
+    BenchmarkSummary summary;
+    if (values.empty())
+        return summary;
+    std::sort(values.begin(), values.end());
+    // nearest rank
+    auto percentile = [&](double p) { return values[std::min(values.size() - 1, static_cast<size_t>(p * values.size()))]; };
+    summary.p50 = percentile(0.50);
+    summary.p95 = percentile(0.95);
+    summary.p99 = percentile(0.99);
+    summary.min = values.front();
+    summary.max = values.back();
+    for (double value : values)
+        summary.mean += value;
+    summary.mean /= values.size();
+    return summary;
+}
+
+// Runs a --bench session: hands out the virtual clock and the camera of every frame, waits for the scene to settle
+// (textures streamed in, then the warm-up frames) and measures the frames after that. The CPU time of a frame is the
+// wall time from one beginFrame() to the next; its GPU time comes from a pair of GL_TIMESTAMP queries around it,
+// one pair per measured frame, read only once everything has been drawn, so measuring never waits for the GPU.
+// Timestamps rather than GL_TIME_ELAPSED, which GpuTimer already uses around the scene pass and which can't nest.
+class Benchmark
+{
+public:
+    BenchmarkOptions options;
+    CameraPath path;
+
+    explicit Benchmark(const BenchmarkOptions &options)
+        : options(options)
+    {
+    }
+
+    ~Benchmark()
+    {
+        if (!queries.empty())
+            glDeleteQueries(static_cast<GLsizei>(queries.size()), queries.data());
+    }
+
+    Benchmark(const Benchmark&) = delete;
+    Benchmark& operator=(const Benchmark&) = delete;
+
+    bool load()
+    {
+        if (!path.load(options.cameraPath))
+            return false;
+        queries.resize(options.measuredFrames * 2);
+        glGenQueries(static_cast<GLsizei>(queries.size()), queries.data());
+        return true;
+    }
+
+    // Starts a frame; settled says whether the scene has everything it will ever have (textures streamed). The
+    // virtual clock stays at 0 until then, so every run measures the same frames.
+    void beginFrame(bool settled)
+    {
+        auto now = chrono::steady_clock::now();
+        if (measuring())
+            cpuMilliseconds.push_back(chrono::duration<double, milli>(now - frameStart).count());
+        frameStart = now;
+        if (settled || frame > 0)
+            frame++;
+        if (measuring())
+            glQueryCounter(queries[(frame - firstMeasuredFrame()) * 2], GL_TIMESTAMP);
+    }
+
+    // Ends a frame with what it drew. With GPU culling the compute pass picks the detail levels and the CPU never
+    // learns the triangle count; the report has none then.
+    void endFrame(unsigned int drawCalls, unsigned int triangles, bool gpuCulling)
+    {
+        if (!measuring())
+            return;
+        this->gpuCulling = this->gpuCulling || gpuCulling;
+        glQueryCounter(queries[(frame - firstMeasuredFrame()) * 2 + 1], GL_TIMESTAMP);
+        this->drawCalls.push_back(drawCalls);
+        this->triangles.push_back(triangles);
+    }
+
+    // virtual time of the current frame, in seconds
+    double time() const { return frame > 0 ? (frame - 1) * options.timeStep : 0.0; }
+    CameraKey camera() const { return path.sample(static_cast<float>(time())); }
+
+    // true from the beginFrame() after the last measured frame
+    bool done() const { return frame >= firstMeasuredFrame() + options.measuredFrames; }
+
+    // Waits for the GPU, reads every frame's timestamps and prints the report as JSON, to the output file as well
+    // if there is one
+    void report(const char *renderer, int width, int height)
+    {
+        glFinish();
+        vector<double> gpuMilliseconds;
+        for (size_t i = 0; i < drawCalls.size(); i++)
+        {
+            GLuint64 begin = 0, end = 0;
+            glGetQueryObjectui64v(queries[i * 2], GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+            gpuMilliseconds.push_back((end - begin) / 1e6);
+        }
+        vector<double> drawCallValues(drawCalls.begin(), drawCalls.end()), triangleValues(triangles.begin(), triangles.end());
+
+        ostringstream json;
+        json << "{\n"
+             << "  \"cameraPath\": " << jsonString(options.cameraPath) << ",\n"
+             << "  \"renderer\": " << jsonString(renderer ? renderer : "") << ",\n"
+             << "  \"resolution\": [" << width << ", " << height << "],\n"
+             << "  \"warmupFrames\": " << options.warmupFrames << ",\n"
+             << "  \"measuredFrames\": " << cpuMilliseconds.size() << ",\n"
+             << "  \"timeStep\": " << options.timeStep << ",\n"
+             << "  \"stressInstances\": " << options.stressInstances << ",\n"
+             << "  \"cityLights\": " << options.cityLights << ",\n"
+             << "  \"gpuCulling\": " << (gpuCulling ? "true" : "false") << ",\n";
+        writeSummary(json, "cpuMs", summarize(cpuMilliseconds), false);
+        writeSummary(json, "gpuMs", summarize(gpuMilliseconds), false);
+        writeSummary(json, "drawCalls", summarize(drawCallValues), false);
+        if (gpuCulling)
+            json << "  \"triangles\": null\n";
+        else
+            writeSummary(json, "triangles", summarize(triangleValues), true);
+        json << "}\n";
+
+        cout << json.str();
+        if (!options.outputPath.empty())
+        {
+            ofstream out(options.outputPath, ios::trunc);
+            out << json.str();
+            if (!out)
+                cout << "ERROR::BENCHMARK:: could not write " << options.outputPath << endl;
+        }
+    }
+
+private:
+    // frames begun since the scene settled, 0 before
+    int frame = 0;
+    chrono::steady_clock::time_point frameStart;
+    vector<GLuint> queries;
+    vector<double> cpuMilliseconds;
+    vector<unsigned int> drawCalls, triangles;
+    bool gpuCulling = false;
+
+    int firstMeasuredFrame() const { return options.warmupFrames + 1; }
+    bool measuring() const
+    {
+        return frame >= firstMeasuredFrame() && frame < firstMeasuredFrame() + options.measuredFrames;
+    }
+
+    static string jsonString(const string &text)
+    {
+        string quoted = "\"";
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                quoted += '\\';
+            if (static_cast<unsigned char>(c) >= 0x20)
+                quoted += c;
+        }
+        return quoted + "\"";
+    }
+
+    static void writeSummary(ostream &json, const char *name, const BenchmarkSummary &summary, bool last)
+    {
+        json << "  \"" << name << "\": { \"p50\": " << summary.p50 << ", \"p95\": " << summary.p95 << ", \"p99\": " << summary.p99
+             << ", \"mean\": " << summary.mean << ", \"min\": " << summary.min << ", \"max\": " << summary.max << " }" << (last ? "\n" : ",\n");
+    }
+};
+#endif
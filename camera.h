@@ -108,6 +108,15 @@ public:
         updateCameraVectors();
     }
 
+    // places the camera directly, e.g. from a scripted camera path
+    void SetPose(glm::vec3 position, float yaw, float pitch)
+    {
+        Position = position;
+        Yaw = yaw;
+        Pitch = pitch;
+        updateCameraVectors();
+    }
+
     // processes input received from a mouse scroll-wheel event. Only requires input on the vertical wheel-axis
     void ProcessMouseScroll(float yoffset)
     {
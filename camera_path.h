@@ -0,0 +1,96 @@
+#ifndef CAMERA_PATH_H
+#define CAMERA_PATH_H
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+using namespace std;
+
+// One key of a camera path: when, where, and where to look (degrees, as Camera's Yaw and Pitch)
+struct CameraKey {
+    float time;
+    glm::vec3 position;
+    float yaw;
+    float pitch;
+};
+
+// A camera spline read from a text file, one key per line, times in seconds and increasing:
+//   time  x y z  yaw pitch
+// Blank lines and lines starting with '#' are skipped. The camera moves through every key on a Catmull-Rom spline
+// (yaw and pitch too, so write yaw without jumps from 359 to 0) and the path loops after the last key.
+class CameraPath
+{
+public:
+    bool load(const string &path)
+    {
+        keys.clear();
+        ifstream file(path);
+        if (!file)
+        {
+            cout << "ERROR::CAMERA_PATH:: could not open " << path << endl;
+            return false;
+        }
+        string line;
+        unsigned int lineNumber = 0;
+        while (getline(file, line))
+        {
+            lineNumber++;
+            size_t start = line.find_first_not_of(" \t\r");
+            if (start == string::npos || line[start] == '#')
+                continue;
+            istringstream values(line);
+            CameraKey key;
+            if (!(values >> key.time >> key.position.x >> key.position.y >> key.position.z >> key.yaw >> key.pitch)
+                || (!keys.empty() && key.time <= keys.back().time))
+            {
+                cout << "ERROR::CAMERA_PATH:: " << path << ":" << lineNumber << " is not a key after the one before" << endl;
+                keys.clear();
+                return false;
+            }
+            keys.push_back(key);
+        }
+        if (keys.empty())
+            cout << "ERROR::CAMERA_PATH:: " << path << " has no keys" << endl;
+        return !keys.empty();
+    }
+
+    float duration() const { return keys.empty() ? 0.0f : keys.back().time; }
+
+    // the camera at a time, wrapped around the path's duration
+    CameraKey sample(float time) const
+    {
+        if (keys.size() < 2)
+            return keys.empty() ? CameraKey{ time, glm::vec3(0.0f), -90.0f, 0.0f } : keys[0];
+        time = keys[0].time + fmod(std::max(time, 0.0f), duration() - keys[0].time);
+        size_t next = std::upper_bound(keys.begin(), keys.end(), time, [](float t, const CameraKey &key) { return t < key.time; }) - keys.begin();
+        size_t i1 = std::min(std::max<size_t>(next, 1), keys.size() - 1) - 1;
+        size_t i0 = i1 > 0 ? i1 - 1 : i1;
+        size_t i2 = i1 + 1;
+        size_t i3 = std::min(i2 + 1, keys.size() - 1);
+        float t = (time - keys[i1].time) / (keys[i2].time - keys[i1].time);
+
+        CameraKey key;
+        key.time = time;
+        key.position = catmullRom(keys[i0].position, keys[i1].position, keys[i2].position, keys[i3].position, t);
+        key.yaw = catmullRom(keys[i0].yaw, keys[i1].yaw, keys[i2].yaw, keys[i3].yaw, t);
+        key.pitch = std::min(std::max(catmullRom(keys[i0].pitch, keys[i1].pitch, keys[i2].pitch, keys[i3].pitch, t), -89.0f), 89.0f);
+        return key;
+    }
+
+private:
+    vector<CameraKey> keys;
+
+    template <typename T>
+    static T catmullRom(const T &p0, const T &p1, const T &p2, const T &p3, float t)
+    {
+        float t2 = t * t, t3 = t2 * t;
+        return 0.5f * ((2.0f * p1) + (p2 - p0) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 + (3.0f * p1 - p0 - 3.0f * p2 + p3) * t3);
+    }
+};
+#endif
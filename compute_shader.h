@@ -0,0 +1,145 @@
+#ifndef COMPUTE_SHADER_H
+#define COMPUTE_SHADER_H
+
+#include <glad/glad.h>
+
+#include "asset_pack.h"
+#include "shader_uniforms.h"
+
+#include <string>
+#include <iostream>
+
+// GL 4.3 compute shaders and shader storage buffers, which the GL 3.3 loader doesn't know
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER 0x91B9
+#endif
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#endif
+#ifndef GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT
+#define GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT 0x00000001
+#endif
+#ifndef GL_SHADER_STORAGE_BARRIER_BIT
+#define GL_SHADER_STORAGE_BARRIER_BIT 0x00002000
+#endif
+#ifndef GL_COMMAND_BARRIER_BIT
+#define GL_COMMAND_BARRIER_BIT 0x00000040
+#endif
+#ifndef GL_BUFFER_UPDATE_BARRIER_BIT
+#define GL_BUFFER_UPDATE_BARRIER_BIT 0x00000200
+#endif
+typedef void (APIENTRYP DispatchComputeProc)(GLuint groupsX, GLuint groupsY, GLuint groupsZ);
+typedef void (APIENTRYP MemoryBarrierProc)(GLbitfield barriers);
+
+// A compute program, built from one GLSL file the way Shader builds its vertex and fragment programs: read from the
+// mounted asset pack or from disk, uniforms reflected once after linking.
+class ComputeShader
+{
+public:
+    unsigned int ID = 0;
+
+    // Loads glDispatchCompute and glMemoryBarrier if the context has GL 4.3; without them nothing may be built.
+    static bool load(GLADloadproc loader)
+    {
+        if (GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 3))
+        {
+            dispatchEntry() = reinterpret_cast<DispatchComputeProc>(loader("glDispatchCompute"));
+            barrierEntry() = reinterpret_cast<MemoryBarrierProc>(loader("glMemoryBarrier"));
+        }
+        return supported();
+    }
+
+    static bool supported() { return dispatchEntry() != nullptr && barrierEntry() != nullptr; }
+
+    explicit ComputeShader(const char* computePath)
+    {
+        std::string computeCode;
+        AssetFile file(computePath);
+        if (file.isOpen())
+            computeCode.assign(reinterpret_cast<const char*>(file.data()), file.size());
+        else
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: can't open " << computePath << std::endl;
+        const char* cShaderCode = computeCode.c_str();
+        unsigned int compute = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(compute, 1, &cShaderCode, NULL);
+        glCompileShader(compute);
+        checkCompileErrors(compute, "COMPUTE");
+        ID = glCreateProgram();
+        glAttachShader(ID, compute);
+        glLinkProgram(ID);
+        checkCompileErrors(ID, "PROGRAM");
+        uniforms.reflect(ID);
+        glDeleteShader(compute);
+    }
+
+    ~ComputeShader()
+    {
+        glDeleteProgram(ID);
+    }
+
+    // the program is owned, a copy would delete it twice
+    ComputeShader(const ComputeShader&) = delete;
+    ComputeShader& operator=(const ComputeShader&) = delete;
+
+    void use()
+    {
+        glUseProgram(ID);
+    }
+
+    // location of an active uniform, -1 if the program has none by that name. No GL call.
+    GLint location(UniformName name) const
+    {
+        const UniformTable::Entry* entry = uniforms.find(name);
+        return entry ? entry->location : -1;
+    }
+
+    void dispatch(GLuint groupsX, GLuint groupsY = 1, GLuint groupsZ = 1) const
+    {
+        dispatchEntry()(groupsX, groupsY, groupsZ);
+    }
+
+    static void memoryBarrier(GLbitfield barriers)
+    {
+        barrierEntry()(barriers);
+    }
+
+private:
+    UniformTable uniforms;
+
+    static DispatchComputeProc &dispatchEntry()
+    {
+        static DispatchComputeProc proc = nullptr;
+        return proc;
+    }
+
+    static MemoryBarrierProc &barrierEntry()
+    {
+        static MemoryBarrierProc proc = nullptr;
+        return proc;
+    }
+
+    void checkCompileErrors(GLuint shader, std::string type)
+    {
+        GLint success;
+        GLchar infoLog[1024];
+        if (type != "PROGRAM")
+        {
+            glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+            if (!success)
+            {
+                glGetShaderInfoLog(shader, 1024, NULL, infoLog);
+                std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
+            }
+        }
+        else
+        {
+            glGetProgramiv(shader, GL_LINK_STATUS, &success);
+            if (!success)
+            {
+                glGetProgramInfoLog(shader, 1024, NULL, infoLog);
+                std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
+            }
+        }
+    }
+};
+#endif
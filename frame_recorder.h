@@ -0,0 +1,371 @@
+#ifndef FRAME_RECORDER_H
+#define FRAME_RECORDER_H
+
+#include <glad/glad.h>
+
+#include "png_writer.h"
+#include "profiler.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+using namespace std;
+
+// what a recording is written as: one PNG per frame, or a single raw YUV 4:2:0 stream (.y4m) most video tools read
+enum RecordFormat {
+    RECORD_PNG,
+    RECORD_Y4M
+};
+
+// Pixel pack buffers in the readback ring. A frame's buffer is mapped once its fence has signalled, normally two or
+// three frames later; if the buffer a new frame needs hasn't come back from the GPU and the encoders yet, that frame
+// is dropped instead of waited for.
+const int FRAME_RECORDER_SLOTS = 4;
+
+const char FRAME_RECORDER_DEFAULT_ROOT[] = "recordings";
+
+// the first of root/take_001, root/take_002, ... that doesn't exist yet
+inline string nextRecordingDirectory(const string &root = FRAME_RECORDER_DEFAULT_ROOT)
+{
+    char name[32];
+    for (unsigned int take = 1;; take++)
+    {
+        snprintf(name, sizeof(name), "/take_%03u", take);
+        if (!filesystem::exists(root + name))
+            return root + name;
+    }
+}
+
+// Records the frames drawn into a framebuffer without stalling the render thread. capture() queues a glReadPixels
+// into the next buffer of a ring of pixel pack buffers and a fence behind it, and maps the buffers whose fences have
+// signalled; the encoder threads convert the mapped pixels, hand the buffer back and write the file. The GL thread
+// only issues commands, polls fences and maps and unmaps, so a frame costs it well under a millisecond.
+class FrameRecorder
+{
+public:
+    // frames since start(): read back, written, and dropped because the ring was full (the GPU or the encoders behind)
+    unsigned int captured = 0;
+    atomic<unsigned int> written{ 0 };
+    unsigned int dropped = 0;
+    // render thread time spent in capture(), average and worst
+    double captureMs = 0.0;
+    double maxCaptureMs = 0.0;
+
+    FrameRecorder() {}
+
+    ~FrameRecorder()
+    {
+        stop();
+    }
+
+    // the buffers and threads are owned
+    FrameRecorder(const FrameRecorder&) = delete;
+    FrameRecorder& operator=(const FrameRecorder&) = delete;
+
+    bool recording() const { return !slots.empty(); }
+    const string &outputPath() const { return path; }
+    int frameWidth() const { return width; }
+    int frameHeight() const { return height; }
+
+    // Starts recording width x height frames into directory (frame_000000.png, ...) or directory/recording.y4m at
+    // framesPerSecond. False if the output can't be created.
+    bool start(const string &directory, RecordFormat format, int width, int height, int framesPerSecond)
+    {
+        stop();
+        std::error_code error;
+        filesystem::create_directories(directory, error);
+        this->directory = directory;
+        this->format = format;
+        this->width = width;
+        this->height = height;
+        if (format == RECORD_Y4M)
+        {
+            path = directory + "/recording.y4m";
+            y4m.open(path, ios::binary | ios::trunc);
+            if (!y4m)
+            {
+                cout << "ERROR::FRAME_RECORDER:: could not write " << path << endl;
+                return false;
+            }
+            y4m << "YUV4MPEG2 W" << width << " H" << height << " F" << framesPerSecond << ":1 Ip A1:1 C420jpeg\n";
+        }
+        else
+            path = directory + "/frame_%06u.png";
+
+        captured = dropped = 0;
+        written = 0;
+        frame = 0;
+        captureMs = maxCaptureMs = 0.0;
+        next = 0;
+        slots = vector<Slot>(FRAME_RECORDER_SLOTS);
+        for (Slot &slot : slots)
+        {
+            glGenBuffers(1, &slot.buffer);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+            glBufferData(GL_PIXEL_PACK_BUFFER, frameBytes(), nullptr, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        // a Y4M stream is written in order, PNGs can be compressed side by side
+        stopping = false;
+        unsigned int encoders = format == RECORD_Y4M ? 1u : std::max(1u, std::min(4u, thread::hardware_concurrency() / 2));
+        for (unsigned int i = 0; i < encoders; i++)
+            encoderThreads.emplace_back(&FrameRecorder::encoderLoop, this);
+        cout << "FRAME_RECORDER:: recording " << width << "x" << height << " to " << path << " with " << encoders << " encoder threads" << endl;
+        return true;
+    }
+
+    // Reads back the frame just drawn into framebuffer (0 for the window's back buffer). Call once a frame on the
+    // GL thread, before the swap.
+    void capture(GLuint framebuffer)
+    {
+        if (!recording())
+            return;
+        PROFILE_ZONE("Capture frame");
+        auto start = chrono::steady_clock::now();
+        collect(false);
+
+        Slot &slot = slots[next];
+        if (slot.state.load(memory_order_acquire) != SLOT_FREE)
+            dropped++;
+        else
+        {
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+            glReadBuffer(framebuffer == 0 ? GL_BACK : GL_COLOR_ATTACHMENT0);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+            glPixelStorei(GL_PACK_ALIGNMENT, 4);
+            glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            slot.frame = frame;
+            slot.state.store(SLOT_READING, memory_order_release);
+            order.push_back(next);
+            next = (next + 1) % FRAME_RECORDER_SLOTS;
+            captured++;
+        }
+        frame++;
+
+        double milliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        captureMs = captured + dropped == 1 ? milliseconds : captureMs * 0.95 + milliseconds * 0.05;
+        maxCaptureMs = std::max(maxCaptureMs, milliseconds);
+    }
+
+    // Finishes the frames in flight, waiting for them this time, and stops the encoders
+    void stop()
+    {
+        if (!recording())
+            return;
+        while (!order.empty() || busySlots() > 0)
+        {
+            collect(true);
+            if (busySlots() > 0)
+                this_thread::sleep_for(chrono::milliseconds(1));
+        }
+        {
+            lock_guard<mutex> lock(queueMutex);
+            stopping = true;
+        }
+        jobAvailable.notify_all();
+        for (thread &encoder : encoderThreads)
+            encoder.join();
+        encoderThreads.clear();
+        for (Slot &slot : slots)
+            glDeleteBuffers(1, &slot.buffer);
+        slots.clear();
+        if (y4m.is_open())
+            y4m.close();
+        cout << "FRAME_RECORDER:: wrote " << written << " of " << captured + dropped << " frames to " << path << ", " << dropped
+             << " dropped (readback ring full), capture " << captureMs << " ms a frame on the render thread (" << maxCaptureMs << " ms worst)" << endl;
+    }
+
+private:
+    enum SlotState {
+        SLOT_FREE,
+        SLOT_READING,    // glReadPixels issued, fence pending
+        SLOT_MAPPED,     // mapped and queued for an encoder
+        SLOT_RELEASED    // the encoder is done with the mapping, unmap on the GL thread
+    };
+
+    struct Slot {
+        GLuint buffer = 0;
+        GLsync fence = nullptr;
+        unsigned int frame = 0;
+        const unsigned char *pixels = nullptr;
+        atomic<int> state{ SLOT_FREE };
+    };
+
+    string directory, path;
+    RecordFormat format = RECORD_PNG;
+    int width = 0, height = 0;
+    unsigned int frame = 0;
+
+    // GL thread only: the ring, and the slots being read back in frame order
+    vector<Slot> slots;
+    int next = 0;
+    deque<int> order;
+
+    vector<thread> encoderThreads;
+    mutex queueMutex;
+    condition_variable jobAvailable;
+    deque<int> jobs;
+    bool stopping = false;
+    ofstream y4m;
+
+    size_t frameBytes() const { return static_cast<size_t>(width) * height * 4; }
+
+    int busySlots() const
+    {
+        int busy = 0;
+        for (const Slot &slot : slots)
+            busy += slot.state.load(memory_order_acquire) != SLOT_FREE ? 1 : 0;
+        return busy;
+    }
+
+    // Unmaps what the encoders have finished with and maps, oldest first, the slots whose fences have signalled;
+    // wait blocks on the fences instead of polling them
+    void collect(bool wait)
+    {
+        for (Slot &slot : slots)
+            if (slot.state.load(memory_order_acquire) == SLOT_RELEASED)
+            {
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+                slot.pixels = nullptr;
+                slot.state.store(SLOT_FREE, memory_order_release);
+            }
+        while (!order.empty())
+        {
+            Slot &slot = slots[order.front()];
+            GLenum status = glClientWaitSync(slot.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 1000000000ull : 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                break;
+            glDeleteSync(slot.fence);
+            slot.fence = nullptr;
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+            slot.pixels = static_cast<const unsigned char*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, frameBytes(), GL_MAP_READ_BIT));
+            slot.state.store(SLOT_MAPPED, memory_order_release);
+            {
+                lock_guard<mutex> lock(queueMutex);
+                jobs.push_back(order.front());
+            }
+            jobAvailable.notify_one();
+            order.pop_front();
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    void encoderLoop()
+    {
+        PROFILE_THREAD("Frame encoder");
+        vector<unsigned char> converted;
+        while (true)
+        {
+            int index;
+            {
+                unique_lock<mutex> lock(queueMutex);
+                jobAvailable.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (jobs.empty())
+                    return;
+                index = jobs.front();
+                jobs.pop_front();
+            }
+            Slot &slot = slots[index];
+            unsigned int frameNumber = slot.frame;
+            bool readable = slot.pixels != nullptr;
+            {
+                PROFILE_ZONE("Convert frame");
+                if (readable && format == RECORD_Y4M)
+                    convertYuv420(slot.pixels, converted);
+                else if (readable)
+                    convertRgb(slot.pixels, converted);
+            }
+            // the buffer goes back to the ring before the slow part
+            slot.state.store(SLOT_RELEASED, memory_order_release);
+            if (!readable)
+                continue;
+
+            PROFILE_ZONE("Encode frame");
+            if (format == RECORD_Y4M)
+            {
+                y4m << "FRAME\n";
+                y4m.write(reinterpret_cast<const char*>(converted.data()), converted.size());
+            }
+            else
+            {
+                char name[64];
+                snprintf(name, sizeof(name), "/frame_%06u.png", frameNumber);
+                if (!pngWrite(directory + name, converted.data(), width, height, 3))
+                {
+                    cout << "ERROR::FRAME_RECORDER:: could not write " << directory + name << endl;
+                    continue;
+                }
+            }
+            written++;
+        }
+    }
+
+    // top row first RGB from GL's bottom row first RGBA
+    void convertRgb(const unsigned char *pixels, vector<unsigned char> &rgb) const
+    {
+        rgb.resize(static_cast<size_t>(width) * height * 3);
+        for (int y = 0; y < height; y++)
+        {
+            const unsigned char *source = pixels + static_cast<size_t>(height - 1 - y) * width * 4;
+            unsigned char *target = rgb.data() + static_cast<size_t>(y) * width * 3;
+            for (int x = 0; x < width; x++)
+            {
+                target[x * 3] = source[x * 4];
+                target[x * 3 + 1] = source[x * 4 + 1];
+                target[x * 3 + 2] = source[x * 4 + 2];
+            }
+        }
+    }
+
+    // BT.601 studio range Y plane, then the U and V planes at half resolution (2x2 averages), top row first
+    void convertYuv420(const unsigned char *pixels, vector<unsigned char> &yuv) const
+    {
+        int chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+        size_t lumaSize = static_cast<size_t>(width) * height, chromaSize = static_cast<size_t>(chromaWidth) * chromaHeight;
+        yuv.resize(lumaSize + 2 * chromaSize);
+        unsigned char *luma = yuv.data(), *u = luma + lumaSize, *v = u + chromaSize;
+        auto pixel = [&](int x, int y) { return pixels + (static_cast<size_t>(height - 1 - y) * width + x) * 4; };
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+            {
+                const unsigned char *p = pixel(x, y);
+                luma[static_cast<size_t>(y) * width + x] = static_cast<unsigned char>((66 * p[0] + 129 * p[1] + 25 * p[2] + 128) / 256 + 16);
+            }
+        for (int cy = 0; cy < chromaHeight; cy++)
+            for (int cx = 0; cx < chromaWidth; cx++)
+            {
+                int r = 0, g = 0, b = 0, count = 0;
+                for (int y = cy * 2; y < std::min(cy * 2 + 2, height); y++)
+                    for (int x = cx * 2; x < std::min(cx * 2 + 2, width); x++)
+                    {
+                        const unsigned char *p = pixel(x, y);
+                        r += p[0];
+                        g += p[1];
+                        b += p[2];
+                        count++;
+                    }
+                r /= count;
+                g /= count;
+                b /= count;
+                u[static_cast<size_t>(cy) * chromaWidth + cx] = static_cast<unsigned char>((-38 * r - 74 * g + 112 * b + 128) / 256 + 128);
+                v[static_cast<size_t>(cy) * chromaWidth + cx] = static_cast<unsigned char>((112 * r - 94 * g - 18 * b + 128) / 256 + 128);
+            }
+    }
+};
+#endif
@@ -0,0 +1,86 @@
+// CPU benchmark for frustum culling. Culls one million random boxes against the app's camera frustum with every
+// kernel of frustum_culler.h this build has (scalar, SSE with four boxes per iteration, AVX with eight when
+// compiled with -mavx or -march=native), checks that they agree with the scalar one and prints the time per pass
+// and per box. The last line runs the whole FrustumCuller::cullInstances path the app uses for instanced models,
+// transforming a model space box by one matrix per instance first.
+//
+// usage: ./frustum_benchmark [boxes] [passes]
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "frustum_culler.h"
+
+#include <iostream>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+using namespace std;
+
+template <typename Cull>
+void measure(const char* label, size_t boxes, int passes, const vector<uint8_t> *reference, vector<uint8_t> &visible, Cull cull)
+{
+    size_t inside = cull(); // warm up
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < passes; i++)
+        inside = cull();
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / passes;
+
+    size_t mismatches = 0;
+    if (reference)
+        for (size_t i = 0; i < boxes; i++)
+            mismatches += (*reference)[i] != visible[i] ? 1 : 0;
+    cout << label << ": " << ms << " ms per pass, " << ms * 1e6 / boxes << " ns per box, " << inside << " visible";
+    if (reference)
+        cout << ", " << mismatches << " differ from scalar";
+    cout << endl;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+    int passes = argc > 2 ? atoi(argv[2]) : 20;
+    if (count == 0)
+        count = 1000000;
+    if (passes <= 0)
+        passes = 20;
+
+    // the app's camera: 45 degrees, 800x600, 0.1 to 100, at the origin looking down -z
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 100.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    Frustum frustum(projection * view);
+
+    // boxes scattered around the camera, a few percent of them in view
+    mt19937 random(1234);
+    uniform_real_distribution<float> position(-150.0f, 150.0f), size(0.25f, 4.0f);
+    BoxesSoA boxes;
+    boxes.reserve(count);
+    vector<glm::mat4> transforms(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        glm::vec3 center(position(random), position(random), position(random));
+        boxes.push(center, glm::vec3(size(random), size(random), size(random)));
+        transforms[i] = glm::translate(glm::mat4(1.0f), center);
+    }
+
+    cout << "FRUSTUM_BENCHMARK:: " << count << " boxes, " << passes << " passes, cullBoxes uses " << cullBoxesKernel() << endl;
+    vector<uint8_t> reference(count), visible(count);
+    measure("scalar", count, passes, nullptr, reference, [&]() { return cullBoxesScalar(frustum, boxes, 0, count, reference.data()); });
+#ifdef FRUSTUM_CULLER_SSE
+    measure("SSE   ", count, passes, &reference, visible, [&]() { return cullBoxesSSE(frustum, boxes, visible.data()); });
+#endif
+#ifdef FRUSTUM_CULLER_AVX
+    measure("AVX   ", count, passes, &reference, visible, [&]() { return cullBoxesAVX(frustum, boxes, visible.data()); });
+#endif
+
+    // unit boxes under per-instance matrices, the way Model::DrawInstanced culls
+    FrustumCuller culler;
+    vector<glm::mat4> visibleTransforms;
+    measure("cullInstances", count, passes, nullptr, visible, [&]() {
+        culler.beginFrame(projection * view);
+        culler.cullInstances(glm::vec3(-1.0f), glm::vec3(1.0f), transforms, visibleTransforms);
+        return static_cast<size_t>(culler.visible);
+    });
+    return 0;
+}
@@ -0,0 +1,271 @@
+#ifndef FRUSTUM_CULLER_H
+#define FRUSTUM_CULLER_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRUSTUM_CULLER_SSE 1
+#include <immintrin.h>
+#endif
+#if defined(__AVX__)
+#define FRUSTUM_CULLER_AVX 1
+#endif
+using namespace std;
+
+// The six planes of a view frustum, extracted from a view-projection matrix (Gribb and Hartmann). Each plane is
+// normalized and points inwards: a point p is inside when dot(plane.xyz, p) + plane.w >= 0 for all of them.
+struct Frustum {
+    glm::vec4 planes[6];
+
+    Frustum() = default;
+
+    explicit Frustum(const glm::mat4 &viewProjection)
+    {
+        // glm is column major, row i of the matrix is (m[0][i], m[1][i], m[2][i], m[3][i])
+        glm::vec4 row[4];
+        for (int i = 0; i < 4; i++)
+            row[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+        planes[0] = row[3] + row[0];   // left
+        planes[1] = row[3] - row[0];   // right
+        planes[2] = row[3] + row[1];   // bottom
+        planes[3] = row[3] - row[1];   // top
+        planes[4] = row[3] + row[2];   // near
+        planes[5] = row[3] - row[2];   // far
+        for (glm::vec4 &plane : planes)
+            plane /= glm::length(glm::vec3(plane));
+    }
+
+    // false only if the box is entirely outside one of the planes. Boxes near a frustum corner may pass while
+    // outside, which only costs a draw.
+    bool intersects(const glm::vec3 &center, const glm::vec3 &extent) const
+    {
+        for (const glm::vec4 &plane : planes)
+        {
+            // summed in the same order as the SIMD kernels, so all of them agree on boxes touching a plane
+            float distance = (plane.x * center.x + plane.y * center.y) + (plane.z * center.z + plane.w);
+            float radius = (std::abs(plane.x) * extent.x + std::abs(plane.y) * extent.y) + std::abs(plane.z) * extent.z;
+            if (distance + radius < 0.0f)
+                return false;
+        }
+        return true;
+    }
+};
+
+// World space boxes as centre and half extent, one array per component, so the kernels below load four or eight
+// boxes' x (or y, z) with one instruction.
+struct BoxesSoA {
+    vector<float> centerX, centerY, centerZ;
+    vector<float> extentX, extentY, extentZ;
+
+    size_t size() const { return centerX.size(); }
+
+    void clear()
+    {
+        centerX.clear(); centerY.clear(); centerZ.clear();
+        extentX.clear(); extentY.clear(); extentZ.clear();
+    }
+
+    void reserve(size_t count)
+    {
+        centerX.reserve(count); centerY.reserve(count); centerZ.reserve(count);
+        extentX.reserve(count); extentY.reserve(count); extentZ.reserve(count);
+    }
+
+    void push(const glm::vec3 &center, const glm::vec3 &extent)
+    {
+        centerX.push_back(center.x); centerY.push_back(center.y); centerZ.push_back(center.z);
+        extentX.push_back(extent.x); extentY.push_back(extent.y); extentZ.push_back(extent.z);
+    }
+
+    // the box of a model space AABB after an affine transform: the centre is transformed, the extent along each
+    // world axis is the extent projected onto the absolute values of the matrix' rows
+    void pushTransformed(const glm::vec3 &localMin, const glm::vec3 &localMax, const glm::mat4 &transform)
+    {
+        glm::vec3 center = (localMin + localMax) * 0.5f;
+        glm::vec3 extent = (localMax - localMin) * 0.5f;
+        glm::vec3 worldCenter = glm::vec3(transform * glm::vec4(center, 1.0f));
+        glm::mat3 absolute = glm::mat3(glm::abs(glm::vec3(transform[0])), glm::abs(glm::vec3(transform[1])), glm::abs(glm::vec3(transform[2])));
+        push(worldCenter, absolute * extent);
+    }
+};
+
+// Writes 1 to visible[i] for every box i that intersects the frustum, 0 otherwise, and returns how many did.
+// The kernels give the same answers; cullBoxes picks the widest one the build targets.
+inline size_t cullBoxesScalar(const Frustum &frustum, const BoxesSoA &boxes, size_t first, size_t count, uint8_t *visible)
+{
+    size_t inside = 0;
+    for (size_t i = first; i < first + count; i++)
+    {
+        bool in = frustum.intersects(glm::vec3(boxes.centerX[i], boxes.centerY[i], boxes.centerZ[i]),
+                                     glm::vec3(boxes.extentX[i], boxes.extentY[i], boxes.extentZ[i]));
+        visible[i] = in ? 1 : 0;
+        inside += in ? 1 : 0;
+    }
+    return inside;
+}
+
+#ifdef FRUSTUM_CULLER_SSE
+// four boxes per iteration
+inline size_t cullBoxesSSE(const Frustum &frustum, const BoxesSoA &boxes, uint8_t *visible)
+{
+    const size_t count = boxes.size();
+    const __m128 zero = _mm_setzero_ps();
+    __m128 nx[6], ny[6], nz[6], nw[6], ax[6], ay[6], az[6];
+    for (int p = 0; p < 6; p++)
+    {
+        const glm::vec4 &plane = frustum.planes[p];
+        nx[p] = _mm_set1_ps(plane.x); ny[p] = _mm_set1_ps(plane.y); nz[p] = _mm_set1_ps(plane.z); nw[p] = _mm_set1_ps(plane.w);
+        ax[p] = _mm_set1_ps(std::abs(plane.x)); ay[p] = _mm_set1_ps(std::abs(plane.y)); az[p] = _mm_set1_ps(std::abs(plane.z));
+    }
+    size_t inside = 0, i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 cx = _mm_loadu_ps(&boxes.centerX[i]), cy = _mm_loadu_ps(&boxes.centerY[i]), cz = _mm_loadu_ps(&boxes.centerZ[i]);
+        __m128 ex = _mm_loadu_ps(&boxes.extentX[i]), ey = _mm_loadu_ps(&boxes.extentY[i]), ez = _mm_loadu_ps(&boxes.extentZ[i]);
+        __m128 in = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int p = 0; p < 6; p++)
+        {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx[p], cx), _mm_mul_ps(ny[p], cy)), _mm_add_ps(_mm_mul_ps(nz[p], cz), nw[p]));
+            __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax[p], ex), _mm_mul_ps(ay[p], ey)), _mm_mul_ps(az[p], ez));
+            in = _mm_and_ps(in, _mm_cmpge_ps(_mm_add_ps(distance, radius), zero));
+        }
+        int mask = _mm_movemask_ps(in);
+        for (int lane = 0; lane < 4; lane++)
+        {
+            visible[i + lane] = static_cast<uint8_t>((mask >> lane) & 1);
+            inside += visible[i + lane];
+        }
+    }
+    return inside + cullBoxesScalar(frustum, boxes, i, count - i, visible);
+}
+#endif
+
+#ifdef FRUSTUM_CULLER_AVX
+// eight boxes per iteration
+inline size_t cullBoxesAVX(const Frustum &frustum, const BoxesSoA &boxes, uint8_t *visible)
+{
+    const size_t count = boxes.size();
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 nx[6], ny[6], nz[6], nw[6], ax[6], ay[6], az[6];
+    for (int p = 0; p < 6; p++)
+    {
+        const glm::vec4 &plane = frustum.planes[p];
+        nx[p] = _mm256_set1_ps(plane.x); ny[p] = _mm256_set1_ps(plane.y); nz[p] = _mm256_set1_ps(plane.z); nw[p] = _mm256_set1_ps(plane.w);
+        ax[p] = _mm256_set1_ps(std::abs(plane.x)); ay[p] = _mm256_set1_ps(std::abs(plane.y)); az[p] = _mm256_set1_ps(std::abs(plane.z));
+    }
+    size_t inside = 0, i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 cx = _mm256_loadu_ps(&boxes.centerX[i]), cy = _mm256_loadu_ps(&boxes.centerY[i]), cz = _mm256_loadu_ps(&boxes.centerZ[i]);
+        __m256 ex = _mm256_loadu_ps(&boxes.extentX[i]), ey = _mm256_loadu_ps(&boxes.extentY[i]), ez = _mm256_loadu_ps(&boxes.extentZ[i]);
+        __m256 in = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (int p = 0; p < 6; p++)
+        {
+            __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx[p], cx), _mm256_mul_ps(ny[p], cy)), _mm256_add_ps(_mm256_mul_ps(nz[p], cz), nw[p]));
+            __m256 radius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax[p], ex), _mm256_mul_ps(ay[p], ey)), _mm256_mul_ps(az[p], ez));
+            in = _mm256_and_ps(in, _mm256_cmp_ps(_mm256_add_ps(distance, radius), zero, _CMP_GE_OQ));
+        }
+        int mask = _mm256_movemask_ps(in);
+        for (int lane = 0; lane < 8; lane++)
+        {
+            visible[i + lane] = static_cast<uint8_t>((mask >> lane) & 1);
+            inside += visible[i + lane];
+        }
+    }
+    return inside + cullBoxesScalar(frustum, boxes, i, count - i, visible);
+}
+#endif
+
+inline size_t cullBoxes(const Frustum &frustum, const BoxesSoA &boxes, uint8_t *visible)
+{
+#if defined(FRUSTUM_CULLER_AVX)
+    return cullBoxesAVX(frustum, boxes, visible);
+#elif defined(FRUSTUM_CULLER_SSE)
+    return cullBoxesSSE(frustum, boxes, visible);
+#else
+    return cullBoxesScalar(frustum, boxes, 0, boxes.size(), visible);
+#endif
+}
+
+// name of the kernel cullBoxes uses, for logs
+inline const char* cullBoxesKernel()
+{
+#if defined(FRUSTUM_CULLER_AVX)
+    return "AVX";
+#elif defined(FRUSTUM_CULLER_SSE)
+    return "SSE";
+#else
+    return "scalar";
+#endif
+}
+
+// Culls the objects of a frame against the camera frustum. Counts what it tested and what survived.
+class FrustumCuller
+{
+public:
+    bool enabled = true;
+
+    // statistics of the current frame
+    unsigned int tested = 0;
+    unsigned int visible = 0;
+
+    void beginFrame(const glm::mat4 &viewProjection)
+    {
+        frustum = Frustum(viewProjection);
+        tested = 0;
+        visible = 0;
+    }
+
+    unsigned int culled() const { return tested - visible; }
+
+    const Frustum &planes() const { return frustum; }
+
+    // one object: the model space AABB under its model matrix
+    bool isVisible(const glm::vec3 &localMin, const glm::vec3 &localMax, const glm::mat4 &transform)
+    {
+        tested++;
+        glm::vec3 center = glm::vec3(transform * glm::vec4((localMin + localMax) * 0.5f, 1.0f));
+        glm::vec3 extent = glm::mat3(glm::abs(glm::vec3(transform[0])), glm::abs(glm::vec3(transform[1])), glm::abs(glm::vec3(transform[2])))
+                         * ((localMax - localMin) * 0.5f);
+        bool in = !enabled || frustum.intersects(center, extent);
+        visible += in ? 1 : 0;
+        return in;
+    }
+
+    // Copies the transforms whose box (the same model space AABB for all of them) intersects the frustum into
+    // visibleTransforms, all of them at once through the SoA kernel.
+    void cullInstances(const glm::vec3 &localMin, const glm::vec3 &localMax, const vector<glm::mat4> &transforms,
+                       vector<glm::mat4> &visibleTransforms)
+    {
+        tested += static_cast<unsigned int>(transforms.size());
+        if (!enabled)
+        {
+            visibleTransforms = transforms;
+            visible += static_cast<unsigned int>(transforms.size());
+            return;
+        }
+        boxes.clear();
+        boxes.reserve(transforms.size());
+        for (const glm::mat4 &transform : transforms)
+            boxes.pushTransformed(localMin, localMax, transform);
+        flags.resize(transforms.size());
+        visible += static_cast<unsigned int>(cullBoxes(frustum, boxes, flags.data()));
+
+        visibleTransforms.clear();
+        for (size_t i = 0; i < transforms.size(); i++)
+            if (flags[i])
+                visibleTransforms.push_back(transforms[i]);
+    }
+
+private:
+    Frustum frustum;
+    // scratch space of cullInstances, kept between frames
+    BoxesSoA boxes;
+    vector<uint8_t> flags;
+};
+#endif
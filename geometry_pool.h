@@ -0,0 +1,179 @@
+#ifndef GEOMETRY_POOL_H
+#define GEOMETRY_POOL_H
+
+#include <glad/glad.h>
+
+#include "vertex_format.h"
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+using namespace std;
+
+// first size of each shared buffer; they double whenever they fill up
+const size_t GEOMETRY_POOL_VERTEX_BYTES = 4u << 20;
+const size_t GEOMETRY_POOL_INDEX_BYTES = 4u << 20;
+
+// A GL buffer handed out front to back in aligned ranges. Meshes live as long as the scene, so ranges are never
+// given back. When a range doesn't fit, the contents move to a buffer twice the size with glCopyBufferSubData and
+// allocate() says so: VAOs capture the buffer their attributes and indices point at, and have to be set up again.
+class BufferArena
+{
+public:
+    GLuint buffer = 0;
+    size_t used = 0;
+    size_t capacity = 0;
+
+    explicit BufferArena(size_t initialCapacity) : initialCapacity(initialCapacity) {}
+
+    // copies 'bytes' to the next multiple of 'alignment' and returns that offset
+    size_t allocate(const void *data, size_t bytes, size_t alignment, bool &moved)
+    {
+        size_t offset = (used + alignment - 1) / alignment * alignment;
+        moved = offset + bytes > capacity;
+        if (moved)
+            grow(std::max(std::max(capacity * 2, offset + bytes), initialCapacity));
+        // the copy binding points leave the element array binding of whatever VAO is bound alone
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        if (bytes > 0)
+            glBufferSubData(GL_COPY_WRITE_BUFFER, offset, bytes, data);
+        used = offset + bytes;
+        return offset;
+    }
+
+    void release()
+    {
+        if (buffer != 0)
+            glDeleteBuffers(1, &buffer);
+        buffer = 0;
+        used = capacity = 0;
+    }
+
+private:
+    size_t initialCapacity;
+
+    void grow(size_t size)
+    {
+        GLuint grown;
+        glGenBuffers(1, &grown);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+        glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STATIC_DRAW);
+        if (buffer != 0)
+        {
+            glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used);
+            glDeleteBuffers(1, &buffer);
+        }
+        buffer = grown;
+        capacity = size;
+    }
+};
+
+// What a stream's per-instance attributes read: the constant values (non-instanced draws, placed by uniforms), an
+// instance buffer of a model, or the frame's multi-draw stream (multi_draw.h).
+enum InstanceSource { INSTANCES_CONSTANT, INSTANCES_BUFFER, INSTANCES_MULTI_DRAW };
+
+// The vertices of one layout: a VAO over its own arena and the pool's shared index buffer
+struct GeometryStream {
+    const VertexLayout *layout = nullptr;
+    GLuint vertexArray = 0;
+    BufferArena vertices{ GEOMETRY_POOL_VERTEX_BYTES };
+    InstanceSource instanceSource = INSTANCES_CONSTANT;
+};
+
+// All static geometry, packed into one vertex buffer per vertex layout and one index buffer. A mesh is a base vertex
+// in its layout's stream and a first index, and every mesh of a layout draws with the same VAO bound
+// (glDrawElementsBaseVertex, or one indirect multi-draw for many meshes).
+class GeometryPool
+{
+public:
+    static GeometryPool& instance()
+    {
+        static GeometryPool pool;
+        return pool;
+    }
+
+    // copies vertices packed in 'layout' into its stream; baseVertex is where they start in it
+    GeometryStream &addVertices(const VertexLayout &layout, const vector<unsigned char> &packed, GLint &baseVertex)
+    {
+        GeometryStream &stream = streams[&layout - VERTEX_LAYOUTS];
+        stream.layout = &layout;
+        bool moved;
+        size_t offset = stream.vertices.allocate(packed.data(), packed.size(), layout.stride, moved);
+        baseVertex = static_cast<GLint>(offset / layout.stride);
+        if (stream.vertexArray == 0)
+            glGenVertexArrays(1, &stream.vertexArray);
+        if (moved)
+            pointAttributes(stream);
+        return stream;
+    }
+
+    // copies a mesh's indices into the shared index buffer, returns the first one
+    GLuint addIndices(const vector<unsigned int> &meshIndices)
+    {
+        bool moved;
+        size_t offset = indices.allocate(meshIndices.data(), meshIndices.size() * sizeof(unsigned int), sizeof(unsigned int), moved);
+        if (moved)
+        {
+            for (GeometryStream &stream : streams)
+            {
+                if (stream.vertexArray == 0)
+                    continue;
+                glBindVertexArray(stream.vertexArray);
+                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices.buffer);
+            }
+            glBindVertexArray(0);
+        }
+        return static_cast<GLuint>(offset / sizeof(unsigned int));
+    }
+
+    size_t vertexBytes() const
+    {
+        size_t bytes = 0;
+        for (const GeometryStream &stream : streams)
+            bytes += stream.vertices.used;
+        return bytes;
+    }
+
+    size_t indexBytes() const { return indices.used; }
+
+    unsigned int streamCount() const
+    {
+        unsigned int count = 0;
+        for (const GeometryStream &stream : streams)
+            count += stream.vertexArray != 0 ? 1 : 0;
+        return count;
+    }
+
+    // the buffers outlive nothing but the context; delete them while it still exists
+    void clear()
+    {
+        for (GeometryStream &stream : streams)
+        {
+            if (stream.vertexArray != 0)
+                glDeleteVertexArrays(1, &stream.vertexArray);
+            stream.vertexArray = 0;
+            stream.vertices.release();
+            stream.instanceSource = INSTANCES_CONSTANT;
+        }
+        indices.release();
+    }
+
+private:
+    GeometryStream streams[VERTEX_LAYOUT_COUNT];
+    BufferArena indices{ GEOMETRY_POOL_INDEX_BYTES };
+
+    GeometryPool() = default;
+
+    // points the stream's VAO at its (new) vertex buffer and the index buffer
+    void pointAttributes(GeometryStream &stream)
+    {
+        glBindVertexArray(stream.vertexArray);
+        glBindBuffer(GL_ARRAY_BUFFER, stream.vertices.buffer);
+        setupVertexAttributes(*stream.layout);
+        if (indices.buffer != 0)
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices.buffer);
+        glBindVertexArray(0);
+    }
+};
+#endif
@@ -0,0 +1,36 @@
+#ifndef GL_EXTENSIONS_H
+#define GL_EXTENSIONS_H
+
+#include <glad/glad.h>
+
+#include <string>
+#include <unordered_set>
+
+// Extension tokens that aren't part of the GL 3.3 core loader
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT  0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// returns true if the current context advertises the extension. The list is read once, on first use.
+inline bool hasGLExtension(const std::string &name)
+{
+    static std::unordered_set<std::string> extensions;
+    static bool loaded = false;
+    if (!loaded)
+    {
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            const GLubyte *extension = glGetStringi(GL_EXTENSIONS, i);
+            if (extension)
+                extensions.insert(reinterpret_cast<const char*>(extension));
+        }
+        loaded = true;
+    }
+    return extensions.count(name) > 0;
+}
+#endif
@@ -0,0 +1,280 @@
+#ifndef GOLDEN_IMAGES_H
+#define GOLDEN_IMAGES_H
+
+#include <glad/glad.h>
+#include <stb_image.h>
+
+#include "camera_path.h"
+#include "png_writer.h"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <filesystem>
+#include <algorithm>
+#include <cmath>
+using namespace std;
+
+const char GOLDEN_DEFAULT_TESTS[] = "golden/scene.golden";
+// where failing tests leave the image they got and its difference heat map
+const char GOLDEN_OUTPUT_DIRECTORY[] = "golden/out";
+// frames drawn at a pose before it is read back, and the most it waits for textures and shader variants
+const int GOLDEN_SETTLE_FRAMES = 3;
+const int GOLDEN_MAX_FRAMES = 600;
+// CIE76 colour difference from which a pixel counts as changed (about twice a just noticeable difference), and the
+// difference the heat map saturates at
+const float GOLDEN_CHANGED_DELTA_E = 5.0f;
+const float GOLDEN_HEATMAP_DELTA_E = 25.0f;
+
+// One pose of a golden image list, one per line:
+//   name  time  x y z  yaw pitch  min-ssim  max-changed-percent
+// The reference is golden/<name>.png. The test passes when the mean SSIM of the luma is at least min-ssim and no
+// more than max-changed-percent of the pixels changed by GOLDEN_CHANGED_DELTA_E or more.
+struct GoldenTest {
+    string name;
+    CameraKey pose;
+    float minSsim;
+    float maxChangedPercent;
+};
+
+struct GoldenComparison {
+    double ssim = 0.0;
+    double changedPercent = 0.0;
+    double maxDeltaE = 0.0;
+};
+
+inline bool loadGoldenTests(const string &path, vector<GoldenTest> &tests)
+{
+    ifstream file(path);
+    if (!file)
+    {
+        cout << "ERROR::GOLDEN:: could not open " << path << endl;
+        return false;
+    }
+    string line;
+    unsigned int lineNumber = 0;
+    while (getline(file, line))
+    {
+        lineNumber++;
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == string::npos || line[start] == '#')
+            continue;
+        istringstream values(line);
+        GoldenTest test;
+        if (!(values >> test.name >> test.pose.time >> test.pose.position.x >> test.pose.position.y >> test.pose.position.z >> test.pose.yaw
+                     >> test.pose.pitch >> test.minSsim >> test.maxChangedPercent))
+        {
+            cout << "ERROR::GOLDEN:: " << path << ":" << lineNumber << " is not a test" << endl;
+            return false;
+        }
+        tests.push_back(test);
+    }
+    return true;
+}
+
+// CIELAB of an 8-bit sRGB colour, D65 white
+inline void srgbToLab(const unsigned char *rgb, float lab[3])
+{
+    float linear[3];
+    for (int c = 0; c < 3; c++)
+    {
+        float v = rgb[c] / 255.0f;
+        linear[c] = v <= 0.04045f ? v / 12.92f : powf((v + 0.055f) / 1.055f, 2.4f);
+    }
+    float xyz[3] = {
+        (0.4124f * linear[0] + 0.3576f * linear[1] + 0.1805f * linear[2]) / 0.95047f,
+        0.2126f * linear[0] + 0.7152f * linear[1] + 0.0722f * linear[2],
+        (0.0193f * linear[0] + 0.1192f * linear[1] + 0.9505f * linear[2]) / 1.08883f
+    };
+    for (float &v : xyz)
+        v = v > 0.008856f ? cbrtf(v) : 7.787f * v + 16.0f / 116.0f;
+    lab[0] = 116.0f * xyz[1] - 16.0f;
+    lab[1] = 500.0f * (xyz[0] - xyz[1]);
+    lab[2] = 200.0f * (xyz[1] - xyz[2]);
+}
+
+// Compares two RGB images of the same size: the per-pixel CIE76 difference, and the structural similarity of their
+// luma over 8x8 windows every 4 pixels. Fills heatmap, if given, with the difference over the image's darkened luma.
+inline GoldenComparison compareGoldenImages(const unsigned char *reference, const unsigned char *image, int width, int height,
+                                            vector<unsigned char> *heatmap)
+{
+    GoldenComparison result;
+    size_t pixels = static_cast<size_t>(width) * height;
+    vector<float> luma[2] = { vector<float>(pixels), vector<float>(pixels) };
+    size_t changed = 0;
+    if (heatmap)
+        heatmap->assign(pixels * 3, 0);
+    for (size_t i = 0; i < pixels; i++)
+    {
+        const unsigned char *a = reference + i * 3, *b = image + i * 3;
+        float labA[3], labB[3];
+        srgbToLab(a, labA);
+        srgbToLab(b, labB);
+        float deltaE = sqrtf((labA[0] - labB[0]) * (labA[0] - labB[0]) + (labA[1] - labB[1]) * (labA[1] - labB[1]) + (labA[2] - labB[2]) * (labA[2] - labB[2]));
+        result.maxDeltaE = std::max(result.maxDeltaE, static_cast<double>(deltaE));
+        changed += deltaE >= GOLDEN_CHANGED_DELTA_E ? 1 : 0;
+        luma[0][i] = 0.299f * a[0] + 0.587f * a[1] + 0.114f * a[2];
+        luma[1][i] = 0.299f * b[0] + 0.587f * b[1] + 0.114f * b[2];
+        if (heatmap)
+        {
+            // black through red to yellow; unchanged pixels show the image dimmed
+            float t = std::min(deltaE / GOLDEN_HEATMAP_DELTA_E, 1.0f);
+            float base = deltaE < 1.0f ? luma[1][i] * 0.3f : 0.0f;
+            (*heatmap)[i * 3] = static_cast<unsigned char>(std::min(base + 255.0f * std::min(t * 2.0f, 1.0f), 255.0f));
+            (*heatmap)[i * 3 + 1] = static_cast<unsigned char>(std::min(base + 255.0f * std::max(t * 2.0f - 1.0f, 0.0f), 255.0f));
+            (*heatmap)[i * 3 + 2] = static_cast<unsigned char>(base);
+        }
+    }
+    result.changedPercent = pixels ? 100.0 * changed / pixels : 0.0;
+
+    const int WINDOW = 8, STEP = 4;
+    const double C1 = (0.01 * 255) * (0.01 * 255), C2 = (0.03 * 255) * (0.03 * 255);
+    double ssimSum = 0.0;
+    size_t windows = 0;
+    for (int y = 0; y + WINDOW <= height; y += STEP)
+        for (int x = 0; x + WINDOW <= width; x += STEP)
+        {
+            double meanA = 0, meanB = 0, varA = 0, varB = 0, covariance = 0;
+            for (int wy = 0; wy < WINDOW; wy++)
+                for (int wx = 0; wx < WINDOW; wx++)
+                {
+                    size_t i = static_cast<size_t>(y + wy) * width + x + wx;
+                    meanA += luma[0][i];
+                    meanB += luma[1][i];
+                }
+            const double count = WINDOW * WINDOW;
+            meanA /= count;
+            meanB /= count;
+            for (int wy = 0; wy < WINDOW; wy++)
+                for (int wx = 0; wx < WINDOW; wx++)
+                {
+                    size_t i = static_cast<size_t>(y + wy) * width + x + wx;
+                    double da = luma[0][i] - meanA, db = luma[1][i] - meanB;
+                    varA += da * da;
+                    varB += db * db;
+                    covariance += da * db;
+                }
+            varA /= count - 1;
+            varB /= count - 1;
+            covariance /= count - 1;
+            ssimSum += ((2 * meanA * meanB + C1) * (2 * covariance + C2)) / ((meanA * meanA + meanB * meanB + C1) * (varA + varB + C2));
+            windows++;
+        }
+    result.ssim = windows ? ssimSum / windows : 1.0;
+    return result;
+}
+
+// Runs a --golden session: every test of the list is drawn at its pose and virtual time until the scene has settled
+// (textures streamed in, no shader variant still compiling) and GOLDEN_SETTLE_FRAMES frames have gone by, then read
+// back and compared with its reference, or written as the new reference with --update.
+class GoldenRun
+{
+public:
+    vector<GoldenTest> tests;
+    unsigned int failures = 0;
+
+    GoldenRun(const string &testsPath, bool update)
+        : testsPath(testsPath), update(update)
+    {
+    }
+
+    bool load()
+    {
+        if (!loadGoldenTests(testsPath, tests))
+            return false;
+        if (tests.empty())
+            cout << "ERROR::GOLDEN:: " << testsPath << " has no tests" << endl;
+        directory = filesystem::path(testsPath).parent_path().string();
+        return !tests.empty();
+    }
+
+    bool done() const { return current >= tests.size(); }
+    double time() const { return tests[current].pose.time; }
+    CameraKey camera() const { return tests[current].pose; }
+
+    // Ends a frame drawn into framebuffer; once the test has settled, reads it back and moves on to the next test
+    void endFrame(GLuint framebuffer, int width, int height, bool settled)
+    {
+        frames++;
+        if (frames < GOLDEN_SETTLE_FRAMES || (!settled && frames < GOLDEN_MAX_FRAMES))
+            return;
+        if (!settled)
+            cout << "GOLDEN:: " << tests[current].name << " still loading after " << frames << " frames, comparing anyway" << endl;
+
+        vector<unsigned char> pixels(static_cast<size_t>(width) * height * 3);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        // GL's rows start at the bottom
+        size_t stride = static_cast<size_t>(width) * 3;
+        for (int y = 0; y < height / 2; y++)
+            std::swap_ranges(pixels.begin() + y * stride, pixels.begin() + (y + 1) * stride, pixels.begin() + (height - 1 - y) * stride);
+
+        check(tests[current], pixels, width, height);
+        current++;
+        frames = 0;
+    }
+
+    // prints the summary; the run failed if anything did
+    void report() const
+    {
+        cout << "GOLDEN:: " << tests.size() - failures << " of " << tests.size() << " passed" << (update ? " (references updated)" : "") << endl;
+    }
+
+private:
+    string testsPath;
+    string directory;
+    bool update;
+    size_t current = 0;
+    int frames = 0;
+
+    string referencePath(const GoldenTest &test) const { return (filesystem::path(directory) / (test.name + ".png")).string(); }
+
+    void check(const GoldenTest &test, const vector<unsigned char> &pixels, int width, int height)
+    {
+        if (update)
+        {
+            if (!pngWrite(referencePath(test), pixels.data(), width, height, 3))
+            {
+                cout << "ERROR::GOLDEN:: could not write " << referencePath(test) << endl;
+                failures++;
+            }
+            else
+                cout << "GOLDEN:: wrote " << referencePath(test) << endl;
+            return;
+        }
+
+        int referenceWidth = 0, referenceHeight = 0, channels = 0;
+        unsigned char *reference = stbi_load(referencePath(test).c_str(), &referenceWidth, &referenceHeight, &channels, 3);
+        bool passed = false;
+        vector<unsigned char> heatmap;
+        if (!reference)
+            cout << "GOLDEN:: " << test.name << " FAILED, no reference " << referencePath(test) << " (run with --update to write it)" << endl;
+        else if (referenceWidth != width || referenceHeight != height)
+            cout << "GOLDEN:: " << test.name << " FAILED, reference is " << referenceWidth << "x" << referenceHeight << ", drawn " << width << "x" << height << endl;
+        else
+        {
+            GoldenComparison comparison = compareGoldenImages(reference, pixels.data(), width, height, &heatmap);
+            passed = comparison.ssim >= test.minSsim && comparison.changedPercent <= test.maxChangedPercent;
+            cout << "GOLDEN:: " << test.name << (passed ? " passed" : " FAILED") << ", SSIM " << comparison.ssim << " (min " << test.minSsim << "), "
+                 << comparison.changedPercent << "% changed (max " << test.maxChangedPercent << "%), max dE " << comparison.maxDeltaE << endl;
+        }
+        if (reference)
+            stbi_image_free(reference);
+        if (passed)
+            return;
+
+        failures++;
+        std::error_code error;
+        filesystem::create_directories(GOLDEN_OUTPUT_DIRECTORY, error);
+        string base = string(GOLDEN_OUTPUT_DIRECTORY) + "/" + test.name;
+        pngWrite(base + ".png", pixels.data(), width, height, 3);
+        if (!heatmap.empty())
+            pngWrite(base + ".diff.png", heatmap.data(), width, height, 3);
+        cout << "GOLDEN:: wrote " << base << ".png" << (heatmap.empty() ? "" : " and .diff.png") << endl;
+    }
+};
+#endif
@@ -0,0 +1,230 @@
+#ifndef GPU_CULLER_H
+#define GPU_CULLER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "compute_shader.h"
+#include "mesh.h"
+#include "instance_buffer.h"
+#include "multi_draw.h"
+#include "frustum_culler.h"
+#include "lod_selector.h"
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+using namespace std;
+
+// what one model may have for its instances to be culled on the GPU (the arrays in shaders/gpu_cull.comp)
+const unsigned int GPU_CULL_MAX_MESHES = 8;
+const unsigned int GPU_CULL_MAX_LODS = 4;
+const unsigned int GPU_CULL_GROUP_SIZE = 64;
+
+// The instances of one model, culled and sorted into detail levels by the compute pass. The render queue fills in
+// where the commands and the model's run of the instance stream ended up; after a readback, visible holds what the
+// compute pass let through.
+struct GpuCullBatch {
+    const Mesh *meshes;
+    unsigned int meshCount;
+    const InstanceBuffer *instances;
+    unsigned int instanceCount;
+    glm::vec3 boundsMin, boundsMax;
+    // the selector's state when the batch was added
+    bool lodEnabled;
+    glm::vec3 cameraPosition;
+    float pixelsPerUnit;
+    float pixelThreshold;
+    // command of every mesh and level in the shading pass and the pre-pass, -1 if none
+    GLint shadingCommands[GPU_CULL_MAX_MESHES][GPU_CULL_MAX_LODS];
+    GLint depthCommands[GPU_CULL_MAX_MESHES][GPU_CULL_MAX_LODS];
+    // the batch's run of the instance stream, instanceCount per mesh
+    size_t firstInstance;
+    unsigned int visible[GPU_CULL_MAX_MESHES][GPU_CULL_MAX_LODS];
+};
+
+// Frustum culling and detail level selection of instanced models in a compute shader (GL 4.3). A model's instance
+// matrices go to the GPU as they are; the compute pass writes the visible ones, dequantization folded in, into the
+// multi-draw instance stream and their counts into the indirect commands, so the CPU never looks at an instance.
+// The tests are the ones FrustumCuller and LodSelector run, on the same inputs. The occlusion culler's depth buffer
+// stays on the CPU, so GPU culled models aren't tested against it.
+class GpuCuller
+{
+public:
+    vector<GpuCullBatch> batches;
+
+    // visible instances of the last readVisible(), summed over the batches' first mesh
+    unsigned int visibleInstances = 0;
+    unsigned int testedInstances = 0;
+
+    ~GpuCuller()
+    {
+        if (countBuffer != 0)
+            glDeleteBuffers(1, &countBuffer);
+    }
+
+    void beginFrame()
+    {
+        batches.clear();
+    }
+
+    // true if the model fits the compute pass' arrays
+    static bool accepts(const vector<Mesh> &meshes)
+    {
+        return !meshes.empty() && meshes.size() <= GPU_CULL_MAX_MESHES;
+    }
+
+    // levels the compute pass may pick for a mesh, and so the packets the queue makes for it
+    static unsigned int levels(const Mesh &mesh)
+    {
+        return std::min<unsigned int>(static_cast<unsigned int>(std::max<size_t>(mesh.lods.size(), 1)), GPU_CULL_MAX_LODS);
+    }
+
+    size_t add(const vector<Mesh> &meshes, const InstanceBuffer &instances, unsigned int instanceCount, const glm::vec3 &boundsMin,
+               const glm::vec3 &boundsMax, const LodSelector &lodSelector)
+    {
+        GpuCullBatch batch;
+        batch.meshes = meshes.data();
+        batch.meshCount = static_cast<unsigned int>(meshes.size());
+        batch.instances = &instances;
+        batch.instanceCount = instanceCount;
+        batch.boundsMin = boundsMin;
+        batch.boundsMax = boundsMax;
+        batch.lodEnabled = lodSelector.enabled;
+        batch.cameraPosition = lodSelector.camera();
+        batch.pixelsPerUnit = lodSelector.projectionScale();
+        batch.pixelThreshold = lodSelector.pixelThreshold;
+        for (unsigned int mesh = 0; mesh < GPU_CULL_MAX_MESHES; mesh++)
+            for (unsigned int lod = 0; lod < GPU_CULL_MAX_LODS; lod++)
+            {
+                batch.shadingCommands[mesh][lod] = batch.depthCommands[mesh][lod] = -1;
+                batch.visible[mesh][lod] = 0;
+            }
+        batch.firstInstance = 0;
+        batches.push_back(batch);
+        return batches.size() - 1;
+    }
+
+    // instances of the stream the batches need after the CPU's, every mesh may draw all of its model's instances
+    size_t reservedInstances() const
+    {
+        size_t count = 0;
+        for (const GpuCullBatch &batch : batches)
+            count += size_t(batch.instanceCount) * batch.meshCount;
+        return count;
+    }
+
+    // Runs both passes over every batch. The commands must already be in commandBuffer with zero instances; the
+    // draws that read them and the instance stream may be issued after this returns.
+    void dispatch(const Frustum &frustum, bool frustumCulling, GLuint commandBuffer, size_t commandCount, GLuint transformBuffer, GLuint texCoordBuffer)
+    {
+        if (batches.empty())
+            return;
+        if (!program)
+            program.reset(new ComputeShader("shaders/gpu_cull.comp"));
+        clearCounts(commandCount);
+        program->use();
+        glUniform4fv(program->location("frustumPlanes"), 6, &frustum.planes[0][0]);
+        glUniform1i(program->location("frustumCulling"), frustumCulling ? 1 : 0);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, commandBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, transformBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, texCoordBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, countBuffer);
+
+        for (int pass = 0; pass < 2; pass++)
+        {
+            glUniform1i(program->location("cullPass"), pass);
+            for (const GpuCullBatch &batch : batches)
+            {
+                setBatchUniforms(batch);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, batch.instances->id());
+                program->dispatch((batch.instanceCount + GPU_CULL_GROUP_SIZE - 1) / GPU_CULL_GROUP_SIZE);
+            }
+            // the write pass reads every count, the draws read the commands and the stream
+            ComputeShader::memoryBarrier(pass == 0 ? GL_SHADER_STORAGE_BARRIER_BIT
+                                                   : GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+        }
+        for (GLuint binding = 0; binding <= 4; binding++)
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+    }
+
+    // Reads the instance counts the compute pass wrote back into every batch. Waits for the GPU, so it is for
+    // statistics and tests, not for every frame.
+    void readVisible(GLuint commandBuffer, size_t commandCount)
+    {
+        visibleInstances = testedInstances = 0;
+        if (batches.empty())
+            return;
+        readback.resize(commandCount);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        glGetBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commandCount * sizeof(DrawElementsIndirectCommand), readback.data());
+        for (GpuCullBatch &batch : batches)
+        {
+            for (unsigned int mesh = 0; mesh < batch.meshCount; mesh++)
+                for (unsigned int lod = 0; lod < GPU_CULL_MAX_LODS; lod++)
+                {
+                    GLint command = batch.shadingCommands[mesh][lod];
+                    batch.visible[mesh][lod] = command >= 0 ? readback[command].instanceCount : 0;
+                }
+            for (unsigned int lod = 0; lod < GPU_CULL_MAX_LODS; lod++)
+                visibleInstances += batch.visible[0][lod];
+            testedInstances += batch.instanceCount;
+        }
+    }
+
+private:
+    unique_ptr<ComputeShader> program;
+    GLuint countBuffer = 0;
+    vector<GLuint> zeros;
+    vector<DrawElementsIndirectCommand> readback;
+
+    // one zeroed counter per command of the frame
+    void clearCounts(size_t commandCount)
+    {
+        if (countBuffer == 0)
+            glGenBuffers(1, &countBuffer);
+        zeros.assign(std::max<size_t>(commandCount, 1), 0);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, countBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, zeros.size() * sizeof(GLuint), zeros.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    void setBatchUniforms(const GpuCullBatch &batch)
+    {
+        glm::vec4 spheres[GPU_CULL_MAX_MESHES], errors[GPU_CULL_MAX_MESHES], texCoords[GPU_CULL_MAX_MESHES];
+        glm::mat4 dequantize[GPU_CULL_MAX_MESHES];
+        GLint lodCounts[GPU_CULL_MAX_MESHES];
+        GLuint firstInstances[GPU_CULL_MAX_MESHES];
+        for (unsigned int i = 0; i < batch.meshCount; i++)
+        {
+            const Mesh &mesh = batch.meshes[i];
+            spheres[i] = glm::vec4(mesh.boundsCenter, mesh.boundsRadius);
+            errors[i] = glm::vec4(0.0f);
+            lodCounts[i] = static_cast<GLint>(levels(mesh));
+            for (GLint lod = 0; lod < lodCounts[i]; lod++)
+                errors[i][lod] = mesh.lods.empty() ? 0.0f : mesh.lods[lod].error;
+            dequantize[i] = glm::scale(glm::translate(glm::mat4(1.0f), mesh.quantization.positionOffset), mesh.quantization.positionScale);
+            texCoords[i] = glm::vec4(mesh.quantization.texCoordOffset, mesh.quantization.texCoordScale);
+            firstInstances[i] = static_cast<GLuint>(batch.firstInstance + size_t(i) * batch.instanceCount);
+        }
+        GLsizei count = static_cast<GLsizei>(batch.meshCount);
+        glUniform1ui(program->location("instanceCount"), batch.instanceCount);
+        glUniform3fv(program->location("boundsMin"), 1, &batch.boundsMin[0]);
+        glUniform3fv(program->location("boundsMax"), 1, &batch.boundsMax[0]);
+        glUniform1i(program->location("lodEnabled"), batch.lodEnabled ? 1 : 0);
+        glUniform3fv(program->location("cameraPosition"), 1, &batch.cameraPosition[0]);
+        glUniform1f(program->location("pixelsPerUnit"), batch.pixelsPerUnit);
+        glUniform1f(program->location("pixelThreshold"), batch.pixelThreshold);
+        glUniform1i(program->location("meshCount"), count);
+        glUniform4fv(program->location("meshSpheres"), count, &spheres[0][0]);
+        glUniform4fv(program->location("meshLodErrors"), count, &errors[0][0]);
+        glUniform1iv(program->location("meshLodCounts"), count, lodCounts);
+        glUniformMatrix4fv(program->location("meshDequantize"), count, GL_FALSE, &dequantize[0][0][0]);
+        glUniform4fv(program->location("meshTexCoords"), count, &texCoords[0][0]);
+        glUniform1uiv(program->location("meshFirstInstances"), count, firstInstances);
+        glUniform4iv(program->location("shadingCommands"), count, &batch.shadingCommands[0][0]);
+        glUniform4iv(program->location("depthCommands"), count, &batch.depthCommands[0][0]);
+    }
+};
+#endif
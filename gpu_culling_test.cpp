@@ -0,0 +1,258 @@
+// Headless check of the GPU culler (gpu_culler.h). Loads the building, places 100000 copies of it in a field around
+// the app's start camera and draws one frame into an offscreen framebuffer through the render queue with GPU
+// culling on. The instance counts the compute pass wrote into the indirect commands are read back and compared,
+// per mesh and detail level, with FrustumCuller and LodSelector run on the CPU over the same transforms. Instances
+// within a rounding error of a frustum plane or a level threshold may land either way and are allowed for. The
+// frame is then drawn again with the CPU path and both must leave the same depth buffer. Exits with a non-zero
+// status on a mismatch, or if the context has no GL 4.3.
+//
+// Needs a GL 4.3 context but no display with a GPU: Mesa's llvmpipe provides one, e.g.
+//   LIBGL_ALWAYS_SOFTWARE=1 xvfb-run ./gpu_culling_test [instances]      (run from the repository root)
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "shader_m.h"
+#include "camera.h"
+#include "model.h"
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+using namespace std;
+
+// the app's window and start camera, see model_loading.cpp
+const unsigned int SCR_WIDTH = 800;
+const unsigned int SCR_HEIGHT = 600;
+const float NEAR_PLANE = 0.1f;
+const float FAR_PLANE = 100.0f;
+
+// relative margin inside which the CPU and GPU may round a test differently
+const float BORDERLINE = 1e-4f;
+
+// a square grid of small buildings centred on the camera, clear around it, turned and stretched so the detail
+// levels and the frustum planes cut through the field at many angles
+static vector<glm::mat4> buildingField(int count, const glm::vec3 &cameraPosition)
+{
+    const float spacing = 8.0f;
+    const float clearRadius = 10.0f;
+    int side = static_cast<int>(std::ceil(std::sqrt(static_cast<float>(count)))) + 2;
+    vector<glm::mat4> buildings;
+    buildings.reserve(count);
+    for (int i = 0; buildings.size() < size_t(count); i++)
+    {
+        int x = i % side, z = i / side;
+        glm::vec3 position(cameraPosition.x + (x - side / 2) * spacing, -1.0f, cameraPosition.z + (z - side / 2) * spacing);
+        if (glm::length(glm::vec2(position.x - cameraPosition.x, position.z - cameraPosition.z)) < clearRadius)
+            continue;
+        glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
+        model = glm::rotate(model, 0.7f * static_cast<float>((x * 7 + z * 3) % 9), glm::vec3(0.0f, 1.0f, 0.0f));
+        model = glm::scale(model, glm::vec3(0.3f + 0.1f * ((x + z) % 4), 0.3f + 0.1f * (z % 3), 0.3f + 0.1f * (x % 3)));
+        buildings.push_back(model);
+    }
+    return buildings;
+}
+
+// the smallest margin by which the box passes or fails a frustum plane, relative to its distance
+static float frustumMargin(const Frustum &frustum, const glm::vec3 &localMin, const glm::vec3 &localMax, const glm::mat4 &transform)
+{
+    glm::vec3 center = glm::vec3(transform * glm::vec4((localMin + localMax) * 0.5f, 1.0f));
+    glm::vec3 extent = glm::mat3(glm::abs(glm::vec3(transform[0])), glm::abs(glm::vec3(transform[1])), glm::abs(glm::vec3(transform[2])))
+                     * ((localMax - localMin) * 0.5f);
+    float margin = 1e30f;
+    for (const glm::vec4 &plane : frustum.planes)
+    {
+        float distance = glm::dot(glm::vec3(plane), center) + plane.w;
+        float radius = glm::dot(glm::abs(glm::vec3(plane)), extent);
+        margin = std::min(margin, std::fabs(distance + radius) / (std::fabs(distance) + radius + 1.0f));
+    }
+    return margin;
+}
+
+// true if one of the mesh's level thresholds is within rounding of the instance's projected error
+static bool lodBorderline(const Mesh &mesh, const glm::mat4 &transform, const glm::vec3 &cameraPosition, float pixelsPerUnit, float threshold)
+{
+    float scale = std::max(glm::length(glm::vec3(transform[0])), std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+    glm::vec3 center = glm::vec3(transform * glm::vec4(mesh.boundsCenter, 1.0f));
+    float distance = glm::length(center - cameraPosition) - mesh.boundsRadius * scale;
+    if (std::fabs(distance) <= BORDERLINE * (mesh.boundsRadius * scale + 1.0f))
+        return true;
+    if (distance <= 0.0f)
+        return false;
+    for (size_t lod = 1; lod < mesh.lods.size(); lod++)
+    {
+        float pixels = mesh.lods[lod].error * scale * pixelsPerUnit / distance;
+        if (std::fabs(pixels - threshold) <= BORDERLINE * threshold)
+            return true;
+    }
+    return false;
+}
+
+// draws the field with the queue into the bound framebuffer and returns its depth buffer
+static vector<float> drawFrame(Shader &shader, Model &building, const vector<glm::mat4> &field, RenderQueue &queue, LodSelector &lodSelector,
+                               const glm::vec3 &cameraPosition, const glm::mat4 &viewProjection)
+{
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    queue.begin(cameraPosition, viewProjection);
+    building.DrawInstanced(shader, field, lodSelector, queue);
+    queue.submit();
+
+    vector<float> depth(size_t(SCR_WIDTH) * SCR_HEIGHT);
+    glReadPixels(0, 0, SCR_WIDTH, SCR_HEIGHT, GL_DEPTH_COMPONENT, GL_FLOAT, depth.data());
+    return depth;
+}
+
+int main(int argc, char **argv)
+{
+    int instanceCount = argc > 1 ? std::atoi(argv[1]) : 100000;
+
+    glfwInit();
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "GPU culling test", NULL, NULL);
+    if (window == NULL)
+    {
+        std::cout << "FAIL: no GL 4.3 core context" << std::endl;
+        glfwTerminate();
+        return 1;
+    }
+    glfwMakeContextCurrent(window);
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+    {
+        std::cout << "FAIL: can't load GL" << std::endl;
+        return 1;
+    }
+    std::cout << glGetString(GL_VERSION) << ", " << glGetString(GL_RENDERER) << std::endl;
+    if (!MultiDraw::load((GLADloadproc)glfwGetProcAddress) || !ComputeShader::load((GLADloadproc)glfwGetProcAddress))
+    {
+        std::cout << "FAIL: no glMultiDrawElementsIndirect or compute shaders" << std::endl;
+        glfwTerminate();
+        return 1;
+    }
+
+    // offscreen target the size of the app's window
+    GLuint framebuffer, colour, depth;
+    glGenRenderbuffers(1, &colour);
+    glBindRenderbuffer(GL_RENDERBUFFER, colour);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, SCR_WIDTH, SCR_HEIGHT);
+    glGenRenderbuffers(1, &depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, SCR_WIDTH, SCR_HEIGHT);
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colour);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+    glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+    glEnable(GL_DEPTH_TEST);
+
+    AssetPack::instance().mount(ASSET_PACK_DEFAULT_PATH);
+    bool passed = true;
+    {
+        Shader shader("shaders/1.model_loading.vs", "shaders/1.model_loading.fs", shaderVariantDefines(SHADER_FEATURES_ALL));
+        Model building("models/buildings/Building01.obj", false, shader.vertexAttributes());
+        if (building.meshes.empty() || !GpuCuller::accepts(building.meshes))
+        {
+            std::cout << "FAIL: Building01 didn't load or has more than " << GPU_CULL_MAX_MESHES << " meshes" << std::endl;
+            return 1;
+        }
+        // main()'s projection and view at the start position
+        Camera camera(glm::vec3(0.0f, 3.0f, 20.0f));
+        vector<glm::mat4> field = buildingField(instanceCount, camera.Position);
+        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, NEAR_PLANE, FAR_PLANE);
+        glm::mat4 viewProjection = projection * camera.GetViewMatrix();
+        LodSelector lodSelector;
+        lodSelector.beginFrame(camera.Position, glm::radians(camera.Zoom), (float)SCR_HEIGHT);
+
+        RenderQueue queue;
+        queue.multiDraw = true;
+        queue.gpuCulling = true;
+        // the compute pass has no occlusion test, the reference mustn't have one either
+        queue.occlusion.enabled = false;
+        vector<float> gpuDepth = drawFrame(shader, building, field, queue, lodSelector, camera.Position, viewProjection);
+        queue.readGpuCulling();
+        if (queue.gpuCuller.batches.size() != 1)
+        {
+            std::cout << "FAIL: expected one GPU culled batch, got " << queue.gpuCuller.batches.size() << std::endl;
+            return 1;
+        }
+        const GpuCullBatch &batch = queue.gpuCuller.batches[0];
+
+        // the CPU reference, with the margins it may differ by
+        Frustum frustum(viewProjection);
+        const size_t meshCount = building.meshes.size();
+        vector<vector<long>> expected(meshCount, vector<long>(GPU_CULL_MAX_LODS, 0)), slack(meshCount, vector<long>(GPU_CULL_MAX_LODS, 0));
+        long visible = 0, borderline = 0;
+        for (const glm::mat4 &transform : field)
+        {
+            bool edge = frustumMargin(frustum, building.boundsMin, building.boundsMax, transform) <= BORDERLINE;
+            bool in = queue.culler.isVisible(building.boundsMin, building.boundsMax, transform);
+            borderline += edge ? 1 : 0;
+            visible += in ? 1 : 0;
+            if (!in && !edge)
+                continue;
+            for (size_t mesh = 0; mesh < meshCount; mesh++)
+            {
+                unsigned int lod = lodSelector.select(building.meshes[mesh], transform);
+                bool lodEdge = lodBorderline(building.meshes[mesh], transform, camera.Position, lodSelector.projectionScale(), lodSelector.pixelThreshold);
+                if (in)
+                    expected[mesh][lod]++;
+                if (edge || lodEdge)
+                    for (unsigned int level = 0; level < GPU_CULL_MAX_LODS; level++)
+                        slack[mesh][level]++;
+            }
+        }
+
+        std::cout << instanceCount << " instances, " << visible << " visible on the CPU (" << borderline << " on a plane), "
+                  << queue.gpuCuller.visibleInstances << " on the GPU" << std::endl;
+        for (size_t mesh = 0; mesh < meshCount; mesh++)
+        {
+            for (unsigned int lod = 0; lod < GPU_CULL_MAX_LODS; lod++)
+            {
+                long gpu = batch.visible[mesh][lod], cpu = expected[mesh][lod];
+                if (gpu == 0 && cpu == 0)
+                    continue;
+                bool match = std::labs(gpu - cpu) <= slack[mesh][lod];
+                std::cout << (match ? "  pass: " : "  FAIL: ") << "mesh " << mesh << " LOD " << lod << ": GPU " << gpu << ", CPU " << cpu
+                          << " (+-" << slack[mesh][lod] << ")" << std::endl;
+                passed &= match;
+            }
+        }
+        if (visible == 0)
+        {
+            std::cout << "  FAIL: nothing in view, the field misses the camera" << std::endl;
+            passed = false;
+        }
+
+        // the same frame with the CPU path must leave the same depth, up to rounding along the silhouettes
+        queue.gpuCulling = false;
+        vector<float> cpuDepth = drawFrame(shader, building, field, queue, lodSelector, camera.Position, viewProjection);
+        size_t covered = 0, different = 0;
+        for (size_t i = 0; i < cpuDepth.size(); i++)
+        {
+            covered += cpuDepth[i] < 1.0f ? 1 : 0;
+            different += std::fabs(gpuDepth[i] - cpuDepth[i]) > 1e-5f ? 1 : 0;
+        }
+        bool sameDepth = covered > 0 && different <= cpuDepth.size() / 1000;
+        std::cout << (sameDepth ? "  pass: " : "  FAIL: ") << "depth: " << covered << " pixels covered, " << different
+                  << " differ between GPU and CPU culling" << std::endl;
+        passed &= sameDepth;
+    }
+
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteRenderbuffers(1, &colour);
+    glDeleteRenderbuffers(1, &depth);
+    TextureRegistry::instance().clear();
+    GeometryPool::instance().clear();
+    MaterialLibrary::instance().clear();
+    AssetPack::instance().unmount();
+    glfwTerminate();
+    std::cout << (passed ? "GPU culling matches the CPU" : "GPU culling differs from the CPU") << std::endl;
+    return passed ? 0 : 1;
+}
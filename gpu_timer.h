@@ -0,0 +1,72 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+
+// how many frames a GpuTimer's results may lag behind
+const int GPU_TIMER_LATENCY = 4;
+
+// GPU time of a stretch of commands with GL_TIME_ELAPSED queries (core since GL 3.3). Every frame uses the next of
+// a small ring of queries and reads back the oldest one, which has finished by then, so reading never stalls.
+// Only one GL_TIME_ELAPSED query can be active at a time; GpuTimers must not nest.
+class GpuTimer
+{
+public:
+    // the last result, and an exponential average of the results
+    double milliseconds = 0.0;
+    double averageMilliseconds = 0.0;
+
+    GpuTimer()
+    {
+        glGenQueries(GPU_TIMER_LATENCY, queries);
+    }
+
+    ~GpuTimer()
+    {
+        glDeleteQueries(GPU_TIMER_LATENCY, queries);
+    }
+
+    // the queries are owned, a copy would delete them twice
+    GpuTimer(const GpuTimer&) = delete;
+    GpuTimer& operator=(const GpuTimer&) = delete;
+
+    void begin()
+    {
+        glBeginQuery(GL_TIME_ELAPSED, queries[next]);
+    }
+
+    void end()
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        issued[next] = true;
+        next = (next + 1) % GPU_TIMER_LATENCY;
+        // the slot begin() uses next was issued GPU_TIMER_LATENCY frames ago
+        if (issued[next])
+        {
+            GLint available = 0;
+            glGetQueryObjectiv(queries[next], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available)
+            {
+                GLuint64 nanoseconds = 0;
+                glGetQueryObjectui64v(queries[next], GL_QUERY_RESULT, &nanoseconds);
+                milliseconds = nanoseconds / 1e6;
+                averageMilliseconds = averageMilliseconds == 0.0 ? milliseconds : averageMilliseconds * 0.95 + milliseconds * 0.05;
+            }
+            issued[next] = false;
+        }
+    }
+
+    // forget the average, e.g. after the measured work changed
+    void reset()
+    {
+        averageMilliseconds = 0.0;
+    }
+
+private:
+    GLuint queries[GPU_TIMER_LATENCY] = {};
+    bool issued[GPU_TIMER_LATENCY] = {};
+    int next = 0;
+};
+#endif
@@ -0,0 +1,84 @@
+#ifndef INSTANCE_BUFFER_H
+#define INSTANCE_BUFFER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "vertex_format.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+// Per-instance model matrices for instanced draws. The mesh shaders read them from four vec4 attributes starting at
+// VERTEX_LOCATION_INSTANCE_MATRIX with a divisor of 1. The buffer grows geometrically and is orphaned on every upload,
+// so it can be refilled several times a frame without waiting for draws that still read the previous contents.
+class InstanceBuffer
+{
+public:
+    InstanceBuffer() = default;
+
+    ~InstanceBuffer()
+    {
+        if (buffer != 0)
+            glDeleteBuffers(1, &buffer);
+    }
+
+    // the buffer is owned, a copy would delete it twice
+    InstanceBuffer(const InstanceBuffer&) = delete;
+    InstanceBuffer& operator=(const InstanceBuffer&) = delete;
+
+    // 'reserve' more matrices are left uninitialized after the uploaded ones, for the GPU to write (gpu_culler.h)
+    void upload(const glm::mat4 *transforms, size_t count, size_t reserve = 0)
+    {
+        if (buffer == 0)
+            glGenBuffers(1, &buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        if (count + reserve > capacity)
+            capacity = std::max<size_t>(std::max<size_t>(count + reserve, capacity * 2), 64);
+        glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(glm::mat4), nullptr, GL_STREAM_DRAW);
+        if (count > 0)
+            glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(glm::mat4), transforms);
+        this->count = count;
+    }
+
+    size_t size() const { return count; }
+
+    GLuint id() const { return buffer; }
+
+    // points the instance matrix attributes of the bound VAO at the matrices from 'first' on
+    void bindAttributes(size_t first) const
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        for (GLuint column = 0; column < 4; column++)
+        {
+            GLuint location = VERTEX_LOCATION_INSTANCE_MATRIX + column;
+            glEnableVertexAttribArray(location);
+            glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+                                  (void*)(uintptr_t)(first * sizeof(glm::mat4) + column * sizeof(glm::vec4)));
+            glVertexAttribDivisor(location, 1);
+        }
+    }
+
+    // Switches the bound VAO back to the constant instance matrix non-instanced draws read
+    static void unbindAttributes()
+    {
+        for (GLuint column = 0; column < 4; column++)
+            glDisableVertexAttribArray(VERTEX_LOCATION_INSTANCE_MATRIX + column);
+    }
+
+    // The constant instance matrix is the identity, so a non-instanced draw is placed by the 'model' uniform alone.
+    // Current attribute values are context state; every Mesh sets it when it creates its buffers.
+    static void setIdentity()
+    {
+        for (GLuint column = 0; column < 4; column++)
+            glVertexAttrib4f(VERTEX_LOCATION_INSTANCE_MATRIX + column, column == 0 ? 1.0f : 0.0f, column == 1 ? 1.0f : 0.0f,
+                             column == 2 ? 1.0f : 0.0f, column == 3 ? 1.0f : 0.0f);
+    }
+
+private:
+    GLuint buffer = 0;
+    size_t capacity = 0;
+    size_t count = 0;
+};
+#endif
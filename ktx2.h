@@ -0,0 +1,177 @@
+#ifndef KTX2_H
+#define KTX2_H
+
+#include "bc_codec.h"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+using namespace std;
+
+// Minimal KTX2 (Khronos texture container 2.0) support for the block compressed textures written by the
+// transcoder: 2D images or cube faces with a precomputed mip chain, no supercompression, no key/value data.
+// Level data is stored smallest level first as the specification asks; the level index lists level 0 first.
+
+const unsigned char KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+// VkFormat values of the formats we write
+const uint32_t KTX2_VK_FORMAT_BC1_RGB_UNORM = 131;
+const uint32_t KTX2_VK_FORMAT_BC3_UNORM     = 137;
+const uint32_t KTX2_VK_FORMAT_BC5_UNORM     = 141;
+
+struct Ktx2Level {
+    int width, height;
+    // offset of the level inside the file and its size, all faces of a cube map level are stored together
+    uint64_t offset;
+    uint64_t size;
+};
+
+// Header fields of a parsed container. Offsets point into the buffer that was parsed.
+struct Ktx2Image {
+    BCFormat format;
+    int width, height;
+    int faceCount;
+    vector<Ktx2Level> levels;
+};
+
+inline bool ktx2FormatFromVk(uint32_t vkFormat, BCFormat &format)
+{
+    if (vkFormat == KTX2_VK_FORMAT_BC1_RGB_UNORM)
+        format = BC_FORMAT_BC1;
+    else if (vkFormat == KTX2_VK_FORMAT_BC3_UNORM)
+        format = BC_FORMAT_BC3;
+    else if (vkFormat == KTX2_VK_FORMAT_BC5_UNORM)
+        format = BC_FORMAT_BC5;
+    else
+        return false;
+    return true;
+}
+
+// Validates a KTX2 file in memory and fills in its layout. Returns false for anything we didn't write.
+inline bool ktx2Parse(const unsigned char *data, size_t size, Ktx2Image &image)
+{
+    const size_t headerSize = 80;
+    if (size < headerSize || memcmp(data, KTX2_IDENTIFIER, 12) != 0)
+        return false;
+
+    uint32_t header[9];
+    memcpy(header, data + 12, sizeof(header));
+    uint32_t vkFormat = header[0], pixelWidth = header[2], pixelHeight = header[3];
+    uint32_t pixelDepth = header[4], layerCount = header[5], faceCount = header[6];
+    uint32_t levelCount = header[7], supercompression = header[8];
+    if (!ktx2FormatFromVk(vkFormat, image.format) || pixelDepth != 0 || layerCount > 1 || supercompression != 0
+        || (faceCount != 1 && faceCount != 6) || levelCount == 0 || pixelWidth == 0 || pixelHeight == 0)
+        return false;
+    if (headerSize + uint64_t(levelCount) * 24 > size)
+        return false;
+
+    image.width = static_cast<int>(pixelWidth);
+    image.height = static_cast<int>(pixelHeight);
+    image.faceCount = static_cast<int>(faceCount);
+    image.levels.resize(levelCount);
+    for (uint32_t i = 0; i < levelCount; i++)
+    {
+        uint64_t entry[3];
+        memcpy(entry, data + headerSize + i * 24, sizeof(entry));
+        Ktx2Level &level = image.levels[i];
+        level.width = std::max(1, image.width >> i);
+        level.height = std::max(1, image.height >> i);
+        level.offset = entry[0];
+        level.size = entry[1];
+        if (level.offset + level.size > size || level.size != bcImageBytes(image.format, level.width, level.height) * faceCount)
+            return false;
+    }
+    return true;
+}
+
+// Writes a container. levels[i] holds the compressed data of level i; for cube maps the six faces are
+// concatenated in +X, -X, +Y, -Y, +Z, -Z order.
+inline bool ktx2Write(const string &path, BCFormat format, int width, int height, int faceCount, const vector<vector<unsigned char>> &levels)
+{
+    uint32_t vkFormat = format == BC_FORMAT_BC1 ? KTX2_VK_FORMAT_BC1_RGB_UNORM
+                      : format == BC_FORMAT_BC3 ? KTX2_VK_FORMAT_BC3_UNORM : KTX2_VK_FORMAT_BC5_UNORM;
+
+    // Basic data format descriptor, one 16 byte sample per 64 bit half of the block
+    const uint32_t KHR_DF_MODEL_BC1A = 128, KHR_DF_MODEL_BC3 = 130, KHR_DF_MODEL_BC5 = 132;
+    struct Sample { uint32_t bitOffset, bitLength, channel; };
+    vector<Sample> samples;
+    uint32_t colourModel;
+    if (format == BC_FORMAT_BC1)
+    {
+        colourModel = KHR_DF_MODEL_BC1A;
+        samples.push_back({ 0, 64, 0 });
+    }
+    else if (format == BC_FORMAT_BC3)
+    {
+        colourModel = KHR_DF_MODEL_BC3;
+        samples.push_back({ 0, 64, 15 });  // alpha
+        samples.push_back({ 64, 64, 0 });  // colour
+    }
+    else
+    {
+        colourModel = KHR_DF_MODEL_BC5;
+        samples.push_back({ 0, 64, 0 });   // red
+        samples.push_back({ 64, 64, 1 });  // green
+    }
+    vector<uint32_t> dfd;
+    uint32_t blockSize = 24 + 16 * static_cast<uint32_t>(samples.size());
+    dfd.push_back(4 + blockSize);                   // dfdTotalSize
+    dfd.push_back(0);                               // vendorId, descriptorType
+    dfd.push_back(2 | (blockSize << 16));           // versionNumber, descriptorBlockSize
+    dfd.push_back(colourModel | (1 << 8) | (1 << 16)); // BT.709 primaries, linear transfer, straight alpha
+    dfd.push_back(3 | (3 << 8));                    // 4x4x1x1 texel blocks
+    dfd.push_back(bcBlockBytes(format));            // bytesPlane0
+    dfd.push_back(0);                               // bytesPlane4-7
+    for (const Sample &sample : samples)
+    {
+        dfd.push_back(sample.bitOffset | ((sample.bitLength - 1) << 16) | (sample.channel << 24));
+        dfd.push_back(0);                           // sample position
+        dfd.push_back(0);                           // sampleLower
+        dfd.push_back(0xFFFFFFFF);                  // sampleUpper
+    }
+
+    uint32_t levelCount = static_cast<uint32_t>(levels.size());
+    uint64_t levelIndexOffset = 80;
+    uint32_t dfdOffset = static_cast<uint32_t>(levelIndexOffset + levelCount * 24);
+    uint32_t dfdLength = static_cast<uint32_t>(dfd.size() * 4);
+
+    // levels go after the descriptor, smallest first, aligned to the block size
+    vector<uint64_t> offsets(levelCount);
+    uint64_t offset = dfdOffset + dfdLength;
+    uint64_t alignment = bcBlockBytes(format);
+    for (int i = static_cast<int>(levelCount) - 1; i >= 0; i--)
+    {
+        offset = (offset + alignment - 1) / alignment * alignment;
+        offsets[i] = offset;
+        offset += levels[i].size();
+    }
+
+    ofstream out(path, ios::binary | ios::trunc);
+    if (!out)
+        return false;
+    out.write(reinterpret_cast<const char*>(KTX2_IDENTIFIER), 12);
+    uint32_t header[9] = { vkFormat, 1, uint32_t(width), uint32_t(height), 0, 0, uint32_t(faceCount), levelCount, 0 };
+    out.write(reinterpret_cast<const char*>(header), sizeof(header));
+    uint32_t index[4] = { dfdOffset, dfdLength, 0, 0 };
+    uint64_t sgd[2] = { 0, 0 };
+    out.write(reinterpret_cast<const char*>(index), sizeof(index));
+    out.write(reinterpret_cast<const char*>(sgd), sizeof(sgd));
+    for (uint32_t i = 0; i < levelCount; i++)
+    {
+        uint64_t entry[3] = { offsets[i], levels[i].size(), levels[i].size() };
+        out.write(reinterpret_cast<const char*>(entry), sizeof(entry));
+    }
+    out.write(reinterpret_cast<const char*>(dfd.data()), dfdLength);
+    for (int i = static_cast<int>(levelCount) - 1; i >= 0; i--)
+    {
+        static const char zeros[16] = {};
+        uint64_t position = static_cast<uint64_t>(out.tellp());
+        out.write(zeros, static_cast<std::streamsize>(offsets[i] - position));
+        out.write(reinterpret_cast<const char*>(levels[i].data()), levels[i].size());
+    }
+    return static_cast<bool>(out);
+}
+#endif
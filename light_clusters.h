@@ -0,0 +1,413 @@
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "material.h"
+#include "worker_pool.h"
+#include "profiler.h"
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LIGHT_CLUSTERS_SSE 1
+#include <immintrin.h>
+#endif
+using namespace std;
+
+// The cluster grid: screen tiles times depth slices, the slices spaced exponentially from the near to the far
+// plane. Must match the constants in shaders/1.model_loading.fs. CLUSTER_TILES is a multiple of 4 for the SSE loop.
+const int CLUSTER_TILES_X = 16;
+const int CLUSTER_TILES_Y = 9;
+const int CLUSTER_SLICES = 24;
+const int CLUSTER_TILES = CLUSTER_TILES_X * CLUSTER_TILES_Y;
+const int CLUSTER_COUNT = CLUSTER_TILES * CLUSTER_SLICES;
+// lights past this many in one cluster are dropped from it (and counted in LightGrid::overflows)
+const int MAX_LIGHTS_PER_CLUSTER = 128;
+// a light's range ends where its brightest channel falls below this
+const float LIGHT_CUTOFF = 1.0f / 256.0f;
+// texels of one light in the light data buffer: position and range, colour, attenuation
+const int LIGHT_TEXELS = 3;
+
+// texture units of the light buffers, after the material slots
+const GLuint LIGHT_TEXTURE_UNIT = MATERIAL_SLOT_COUNT;
+
+struct PointLight {
+    glm::vec3 position;
+    glm::vec3 colour;
+    // attenuation 1 / (constant + linear * d + quadratic * d^2)
+    float constant;
+    float linear;
+    float quadratic;
+};
+
+// distance at which the light's attenuated brightest channel reaches LIGHT_CUTOFF, infinite if it never does
+inline float lightRange(const PointLight &light)
+{
+    float brightest = std::max(light.colour.r, std::max(light.colour.g, light.colour.b));
+    if (brightest <= 0.0f)
+        return 0.0f;
+    // constant + linear * d + quadratic * d^2 = brightest / LIGHT_CUTOFF
+    float c = light.constant - brightest / LIGHT_CUTOFF;
+    if (c >= 0.0f)
+        return 0.0f;
+    if (light.quadratic > 0.0f)
+        return (-light.linear + std::sqrt(light.linear * light.linear - 4.0f * light.quadratic * c)) / (2.0f * light.quadratic);
+    if (light.linear > 0.0f)
+        return -c / light.linear;
+    return numeric_limits<float>::infinity();
+}
+
+// Points the light buffer samplers the program has at their texture units, the same way bindMaterialSamplers does.
+inline void bindLightSamplers(GLuint program)
+{
+    const char *samplers[] = { "pointLightData", "lightClusters", "lightIndices" };
+    GLint previous = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &previous);
+    glUseProgram(program);
+    for (GLuint i = 0; i < 3; i++)
+    {
+        GLint location = glGetUniformLocation(program, samplers[i]);
+        if (location >= 0)
+            glUniform1i(location, static_cast<GLint>(LIGHT_TEXTURE_UNIT + i));
+    }
+    glUseProgram(static_cast<GLuint>(previous));
+}
+
+// Assigns point lights to the clusters of the view frustum on the CPU. Every cluster is a view space box (the
+// tile's corner rays cut at the slice's depths); a light goes into the clusters its range sphere touches. The
+// slices are binned in parallel, one slice per job, and within a slice one light is tested against four tiles at
+// a time with SSE. The results are the arrays the fragment shader reads: the lights (LIGHT_TEXELS vec4s each),
+// offset and count per cluster, and the light indices the offsets point into. Touches no GL state.
+class LightGrid
+{
+public:
+    // for comparing: the kernel without SSE, and all slices on the calling thread
+    bool simd = true;
+    bool parallel = true;
+
+    // statistics of the last assign()
+    unsigned int lights = 0;
+    unsigned int assignments = 0;
+    unsigned int busiestCluster = 0;
+    unsigned int overflows = 0;
+    double assignMs = 0.0;
+
+    LightGrid()
+        : tileMinX(CLUSTER_COUNT), tileMaxX(CLUSTER_COUNT), tileMinY(CLUSTER_COUNT), tileMaxY(CLUSTER_COUNT),
+          clusterLights(CLUSTER_COUNT * MAX_LIGHTS_PER_CLUSTER), clusterCounts(CLUSTER_COUNT), clusterTable(CLUSTER_COUNT * 2)
+    {
+    }
+
+    // rebuilds the cluster boxes when the projection changed
+    void setProjection(const glm::mat4 &projection, float nearPlane, float farPlane)
+    {
+        if (configured && projection == this->projection && nearPlane == zNear && farPlane == zFar)
+            return;
+        this->projection = projection;
+        zNear = nearPlane;
+        zFar = farPlane;
+        configured = true;
+
+        glm::mat4 inverse = glm::inverse(projection);
+        for (int slice = 0; slice <= CLUSTER_SLICES; slice++)
+            sliceDepth[slice] = zNear * std::pow(zFar / zNear, static_cast<float>(slice) / CLUSTER_SLICES);
+        for (int tileY = 0; tileY < CLUSTER_TILES_Y; tileY++)
+        {
+            for (int tileX = 0; tileX < CLUSTER_TILES_X; tileX++)
+            {
+                // the four corner rays of the tile, scaled so that z = -1
+                glm::vec3 rays[4];
+                for (int corner = 0; corner < 4; corner++)
+                {
+                    float x = -1.0f + 2.0f * (tileX + (corner & 1)) / CLUSTER_TILES_X;
+                    float y = -1.0f + 2.0f * (tileY + (corner >> 1)) / CLUSTER_TILES_Y;
+                    glm::vec4 point = inverse * glm::vec4(x, y, -1.0f, 1.0f);
+                    glm::vec3 onNear = glm::vec3(point) / point.w;
+                    rays[corner] = onNear / -onNear.z;
+                }
+                for (int slice = 0; slice < CLUSTER_SLICES; slice++)
+                {
+                    int cluster = slice * CLUSTER_TILES + tileY * CLUSTER_TILES_X + tileX;
+                    float minX = numeric_limits<float>::max(), maxX = -minX, minY = minX, maxY = -minX;
+                    for (const glm::vec3 &ray : rays)
+                    {
+                        for (float depth : { sliceDepth[slice], sliceDepth[slice + 1] })
+                        {
+                            minX = std::min(minX, ray.x * depth); maxX = std::max(maxX, ray.x * depth);
+                            minY = std::min(minY, ray.y * depth); maxY = std::max(maxY, ray.y * depth);
+                        }
+                    }
+                    tileMinX[cluster] = minX; tileMaxX[cluster] = maxX;
+                    tileMinY[cluster] = minY; tileMaxY[cluster] = maxY;
+                }
+            }
+        }
+    }
+
+    // the shader's cluster lookup for a framebuffer of this size: tile = fragment coordinate * xy,
+    // slice = log(view depth) * z + w
+    glm::vec4 gridParameters(float width, float height) const
+    {
+        float scale = CLUSTER_SLICES / std::log(zFar / zNear);
+        return glm::vec4(CLUSTER_TILES_X / width, CLUSTER_TILES_Y / height, scale, -std::log(zNear) * scale);
+    }
+
+    // bins the lights, positions are in world space
+    void assign(const vector<PointLight> &sceneLights, const glm::mat4 &view)
+    {
+        auto start = chrono::steady_clock::now();
+        lights = static_cast<unsigned int>(sceneLights.size());
+        lightTexels.resize(sceneLights.size() * LIGHT_TEXELS);
+        viewLights.resize(sceneLights.size());
+        lightTiles.resize(sceneLights.size());
+        for (size_t i = 0; i < sceneLights.size(); i++)
+        {
+            const PointLight &light = sceneLights[i];
+            float range = lightRange(light);
+            glm::vec3 position = glm::vec3(view * glm::vec4(light.position, 1.0f));
+            // x, y in view space, depth in front of the camera, range
+            viewLights[i] = glm::vec4(position.x, position.y, -position.z, range);
+            lightTiles[i] = tileRectangle(viewLights[i]);
+            lightTexels[i * LIGHT_TEXELS + 0] = glm::vec4(light.position, range);
+            lightTexels[i * LIGHT_TEXELS + 1] = glm::vec4(light.colour, 0.0f);
+            lightTexels[i * LIGHT_TEXELS + 2] = glm::vec4(light.constant, light.linear, light.quadratic, 0.0f);
+        }
+
+        const function<void(unsigned int)> sliceJob = [this](unsigned int slice) { binSlice(static_cast<int>(slice)); };
+        if (parallel)
+            WorkerPool::instance().run(CLUSTER_SLICES, sliceJob);
+        else
+            for (int slice = 0; slice < CLUSTER_SLICES; slice++)
+                binSlice(slice);
+
+        // pack the per-cluster lists back to back
+        indexList.clear();
+        assignments = busiestCluster = overflows = 0;
+        for (int cluster = 0; cluster < CLUSTER_COUNT; cluster++)
+        {
+            unsigned int count = clusterCounts[cluster];
+            if (count > MAX_LIGHTS_PER_CLUSTER)
+            {
+                overflows += count - MAX_LIGHTS_PER_CLUSTER;
+                count = MAX_LIGHTS_PER_CLUSTER;
+            }
+            clusterTable[cluster * 2] = static_cast<uint32_t>(indexList.size());
+            clusterTable[cluster * 2 + 1] = count;
+            const uint32_t *list = &clusterLights[cluster * MAX_LIGHTS_PER_CLUSTER];
+            indexList.insert(indexList.end(), list, list + count);
+            busiestCluster = std::max(busiestCluster, count);
+        }
+        assignments = static_cast<unsigned int>(indexList.size());
+        assignMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+
+    const vector<glm::vec4> &lightData() const { return lightTexels; }
+    // offset into indices() and light count of every cluster
+    const vector<uint32_t> &clusters() const { return clusterTable; }
+    const vector<uint32_t> &indices() const { return indexList; }
+
+private:
+    glm::mat4 projection = glm::mat4(1.0f);
+    float zNear = 0.1f, zFar = 100.0f;
+    bool configured = false;
+    float sliceDepth[CLUSTER_SLICES + 1];
+    // view space xy bounds of every cluster, slice by slice
+    vector<float> tileMinX, tileMaxX, tileMinY, tileMaxY;
+
+    vector<glm::vec4> viewLights;
+    // first and last tile column and row each light can touch, widened to whole groups of four columns
+    vector<glm::ivec4> lightTiles;
+    vector<glm::vec4> lightTexels;
+    // MAX_LIGHTS_PER_CLUSTER entries per cluster, filled by the slice jobs
+    vector<uint32_t> clusterLights;
+    vector<unsigned int> clusterCounts;
+    vector<uint32_t> clusterTable;
+    vector<uint32_t> indexList;
+
+    // every light whose sphere reaches into the slice, against the slice's tiles. Only writes the slice's clusters.
+    void binSlice(int slice)
+    {
+        const float sliceNear = sliceDepth[slice], sliceFar = sliceDepth[slice + 1];
+        const int first = slice * CLUSTER_TILES;
+        unsigned int *counts = &clusterCounts[first];
+        std::fill(counts, counts + CLUSTER_TILES, 0u);
+        for (uint32_t index = 0; index < viewLights.size(); index++)
+        {
+            const glm::vec4 &light = viewLights[index];
+            float depth = light.z, range = light.w;
+            if (depth + range < sliceNear || depth - range > sliceFar || lightTiles[index].x > lightTiles[index].y)
+                continue;
+            // what is left of the range once the sphere reaches the slice
+            float dz = depth < sliceNear ? sliceNear - depth : (depth > sliceFar ? depth - sliceFar : 0.0f);
+            float reach = range * range - dz * dz;
+            if (reach < 0.0f)
+                continue;
+#ifdef LIGHT_CLUSTERS_SSE
+            if (simd)
+            {
+                binLightSSE(first, lightTiles[index], index, light.x, light.y, reach);
+                continue;
+            }
+#endif
+            binLightScalar(first, lightTiles[index], index, light.x, light.y, reach);
+        }
+    }
+
+    // The tiles the light's view space bounding box, cut off at the near plane, projects to. x / depth and
+    // y / depth are extreme at the corners of a box in front of the eye. Columns are rounded out to groups of four
+    // for the SSE kernel, and the scalar one tests the same tiles so that both give the same lists.
+    glm::ivec4 tileRectangle(const glm::vec4 &light) const
+    {
+        float depth = light.z, range = light.w;
+        if (depth + range < zNear)
+            return glm::ivec4(1, 0, 1, 0);
+        if (!std::isfinite(range))
+            return glm::ivec4(0, CLUSTER_TILES_X - 1, 0, CLUSTER_TILES_Y - 1);
+        float minX = numeric_limits<float>::max(), maxX = -minX, minY = minX, maxY = -minX;
+        for (float z : { std::max(depth - range, zNear), depth + range })
+        {
+            // clip w is the depth, so ndc = (p0 * view + p2 * -depth) / depth
+            for (float x : { light.x - range, light.x + range })
+            {
+                float ndc = (projection[0][0] * x - projection[2][0] * z) / z;
+                minX = std::min(minX, ndc); maxX = std::max(maxX, ndc);
+            }
+            for (float y : { light.y - range, light.y + range })
+            {
+                float ndc = (projection[1][1] * y - projection[2][1] * z) / z;
+                minY = std::min(minY, ndc); maxY = std::max(maxY, ndc);
+            }
+        }
+        if (maxX < -1.0f || minX > 1.0f || maxY < -1.0f || minY > 1.0f)
+            return glm::ivec4(1, 0, 1, 0);
+        auto tile = [](float ndc, int tiles) {
+            return std::min(tiles - 1, std::max(0, static_cast<int>(std::floor((ndc * 0.5f + 0.5f) * tiles))));
+        };
+        return glm::ivec4(tile(minX, CLUSTER_TILES_X) & ~3, tile(maxX, CLUSTER_TILES_X) | 3,
+                          tile(minY, CLUSTER_TILES_Y), tile(maxY, CLUSTER_TILES_Y));
+    }
+
+    void addToCluster(int cluster, uint32_t index)
+    {
+        unsigned int &count = clusterCounts[cluster];
+        if (count < MAX_LIGHTS_PER_CLUSTER)
+            clusterLights[cluster * MAX_LIGHTS_PER_CLUSTER + count] = index;
+        count++;
+    }
+
+    void binLightScalar(int first, const glm::ivec4 &tiles, uint32_t index, float x, float y, float reach)
+    {
+        for (int row = tiles.z; row <= tiles.w; row++)
+        for (int cluster = first + row * CLUSTER_TILES_X + tiles.x; cluster <= first + row * CLUSTER_TILES_X + tiles.y; cluster++)
+        {
+            float dx = std::min(std::max(x, tileMinX[cluster]), tileMaxX[cluster]) - x;
+            float dy = std::min(std::max(y, tileMinY[cluster]), tileMaxY[cluster]) - y;
+            if (dx * dx + dy * dy <= reach)
+                addToCluster(cluster, index);
+        }
+    }
+
+#ifdef LIGHT_CLUSTERS_SSE
+    // the distance from the light to four tiles at once, clamped the same way as the scalar kernel
+    void binLightSSE(int first, const glm::ivec4 &tiles, uint32_t index, float x, float y, float reach)
+    {
+        const __m128 lightX = _mm_set1_ps(x), lightY = _mm_set1_ps(y), reach4 = _mm_set1_ps(reach);
+        for (int row = tiles.z; row <= tiles.w; row++)
+        for (int cluster = first + row * CLUSTER_TILES_X + tiles.x; cluster <= first + row * CLUSTER_TILES_X + tiles.y; cluster += 4)
+        {
+            __m128 dx = _mm_sub_ps(_mm_min_ps(_mm_max_ps(lightX, _mm_loadu_ps(&tileMinX[cluster])), _mm_loadu_ps(&tileMaxX[cluster])), lightX);
+            __m128 dy = _mm_sub_ps(_mm_min_ps(_mm_max_ps(lightY, _mm_loadu_ps(&tileMinY[cluster])), _mm_loadu_ps(&tileMaxY[cluster])), lightY);
+            int inside = _mm_movemask_ps(_mm_cmple_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), reach4));
+            for (int lane = 0; inside != 0; lane++, inside >>= 1)
+                if (inside & 1)
+                    addToCluster(cluster + lane, index);
+        }
+    }
+#endif
+};
+
+// The light grid's arrays as buffer textures for the fragment shader (GL 3.3 has no storage buffers): the lights
+// as RGBA32F, the cluster table as RG32UI and the index list as R32UI. update() bins and uploads once per frame,
+// bind() puts them on their texture units after the material slots.
+class LightClusters
+{
+public:
+    LightGrid grid;
+
+    LightClusters()
+    {
+        const GLenum formats[3] = { GL_RGBA32F, GL_RG32UI, GL_R32UI };
+        glGenBuffers(3, buffers);
+        glGenTextures(3, textures);
+        for (int i = 0; i < 3; i++)
+        {
+            capacity[i] = 16;
+            glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+            glBufferData(GL_TEXTURE_BUFFER, capacity[i], nullptr, GL_STREAM_DRAW);
+            glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+            glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+        }
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    ~LightClusters()
+    {
+        glDeleteTextures(3, textures);
+        glDeleteBuffers(3, buffers);
+    }
+
+    // the buffers are owned, a copy would delete them twice
+    LightClusters(const LightClusters&) = delete;
+    LightClusters& operator=(const LightClusters&) = delete;
+
+    void update(const vector<PointLight> &lights, const glm::mat4 &view, const glm::mat4 &projection, float nearPlane, float farPlane)
+    {
+        PROFILE_ZONE("Light clusters");
+        grid.setProjection(projection, nearPlane, farPlane);
+        grid.assign(lights, view);
+        upload(0, grid.lightData().data(), grid.lightData().size() * sizeof(glm::vec4));
+        upload(1, grid.clusters().data(), grid.clusters().size() * sizeof(uint32_t));
+        upload(2, grid.indices().data(), grid.indices().size() * sizeof(uint32_t));
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    // Leaves the active unit on the last light buffer. Call it before the draws of the frame, after
+    // MaterialBinder::beginFrame, which then switches units before it binds anything.
+    void bind() const
+    {
+        for (GLuint i = 0; i < 3; i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + LIGHT_TEXTURE_UNIT + i);
+            glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+        }
+    }
+
+private:
+    GLuint buffers[3] = {};
+    GLuint textures[3] = {};
+    size_t capacity[3] = {};
+
+    // grows the buffer by doubling, otherwise overwrites its start
+    void upload(int i, const void *data, size_t bytes)
+    {
+        glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+        if (bytes > capacity[i])
+        {
+            while (capacity[i] < bytes)
+                capacity[i] *= 2;
+            glBufferData(GL_TEXTURE_BUFFER, capacity[i], nullptr, GL_STREAM_DRAW);
+        }
+        if (bytes > 0)
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data);
+    }
+};
+#endif
@@ -0,0 +1,92 @@
+#ifndef LOD_SELECTOR_H
+#define LOD_SELECTOR_H
+
+#include <glm/glm.hpp>
+
+#include "mesh.h"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+using namespace std;
+
+// Largest on screen error, in pixels, a simplified level may have before the next finer one is drawn instead
+const float LOD_DEFAULT_PIXEL_ERROR = 1.0f;
+
+// What one Model::Draw or Model::DrawInstanced call submitted
+struct LodDrawRecord {
+    string       name;
+    unsigned int instances;
+    unsigned int drawCalls;
+    unsigned int minLod;
+    unsigned int maxLod;
+    unsigned int triangles;
+    unsigned int fullDetailTriangles;
+};
+
+// Picks the detail level of every mesh drawn in a frame and keeps the frame's triangle statistics.
+// A level's error (model units) is scaled by the largest axis of the model matrix and projected to pixels at the
+// distance of the nearest point of the mesh's bounding sphere; the coarsest level that stays under pixelThreshold wins.
+class LodSelector
+{
+public:
+    float pixelThreshold = LOD_DEFAULT_PIXEL_ERROR;
+    bool enabled = true;
+
+    // statistics of the current frame
+    unsigned int trianglesSubmitted = 0;
+    unsigned int fullDetailTriangles = 0;
+    unsigned int objectsDrawn = 0;
+    unsigned int drawCalls = 0;
+    vector<LodDrawRecord> records;
+
+    // call once per frame before drawing. fovY in radians, viewportHeight in pixels.
+    void beginFrame(const glm::vec3 &cameraPosition, float fovY, float viewportHeight)
+    {
+        this->cameraPosition = cameraPosition;
+        pixelsPerUnit = viewportHeight / (2.0f * std::tan(fovY * 0.5f));
+        trianglesSubmitted = 0;
+        fullDetailTriangles = 0;
+        objectsDrawn = 0;
+        drawCalls = 0;
+        records.clear();
+    }
+
+    unsigned int select(const Mesh &mesh, const glm::mat4 &modelMatrix) const
+    {
+        if (!enabled || mesh.lods.size() < 2)
+            return 0;
+
+        float scale = std::max(glm::length(glm::vec3(modelMatrix[0])), std::max(glm::length(glm::vec3(modelMatrix[1])), glm::length(glm::vec3(modelMatrix[2]))));
+        glm::vec3 center = glm::vec3(modelMatrix * glm::vec4(mesh.boundsCenter, 1.0f));
+        float distance = glm::length(center - cameraPosition) - mesh.boundsRadius * scale;
+        // inside the bounds every error is too visible to risk
+        if (distance <= 0.0f)
+            return 0;
+
+        float errorToPixels = scale * pixelsPerUnit / distance;
+        unsigned int lod = 0;
+        while (lod + 1 < mesh.lods.size() && mesh.lods[lod + 1].error * errorToPixels <= pixelThreshold)
+            lod++;
+        return lod;
+    }
+
+    // the frame's inputs of select(), for the GPU culler's copy of it
+    const glm::vec3 &camera() const { return cameraPosition; }
+    float projectionScale() const { return pixelsPerUnit; }
+
+    void submit(const LodDrawRecord &record)
+    {
+        trianglesSubmitted += record.triangles;
+        fullDetailTriangles += record.fullDetailTriangles;
+        objectsDrawn += record.instances;
+        drawCalls += record.drawCalls;
+        records.push_back(record);
+    }
+
+private:
+    glm::vec3 cameraPosition = glm::vec3(0.0f);
+    float pixelsPerUnit = 1.0f;
+};
+#endif
@@ -0,0 +1,138 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+// 64-bit FNV-1a style hash that consumes eight bytes per step, fast enough to run over whole images at load
+// time. Seed with the result of a previous call to hash several buffers as one.
+// ------------------------------------------------------------------------
+const uint64_t FNV_OFFSET_BASIS = 1469598103934665603ULL;
+const uint64_t FNV_PRIME        = 1099511628211ULL;
+
+inline uint64_t hashBytes(const void* data, size_t size, uint64_t seed = FNV_OFFSET_BASIS)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint64_t hash = seed;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        hash ^= word;
+        hash *= FNV_PRIME;
+        hash ^= hash >> 32;
+    }
+    for (; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+// A read-only memory mapping of a whole file. The mapping lives as long as the object does.
+class MappedFile
+{
+public:
+    MappedFile() {}
+    MappedFile(const std::string &path) { open(path); }
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // maps the file at path, returns false if it doesn't exist or can't be mapped
+    bool open(const std::string &path)
+    {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+        {
+            close();
+            return false;
+        }
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping == NULL)
+        {
+            close();
+            return false;
+        }
+        bytes = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        length = static_cast<size_t>(fileSize.QuadPart);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        void* address = mmap(NULL, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        // the mapping keeps its own reference to the file
+        ::close(fd);
+        if (address == MAP_FAILED)
+            return false;
+        bytes = static_cast<const unsigned char*>(address);
+        length = static_cast<size_t>(info.st_size);
+#endif
+        if (bytes == nullptr)
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+        if (bytes)
+            UnmapViewOfFile(bytes);
+        if (mapping != NULL)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+        mapping = NULL;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (bytes)
+            munmap(const_cast<unsigned char*>(bytes), length);
+#endif
+        bytes = nullptr;
+        length = 0;
+    }
+
+    bool isOpen() const { return bytes != nullptr; }
+    const unsigned char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const unsigned char* bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#endif
+};
+#endif
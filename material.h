@@ -0,0 +1,199 @@
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include <glad/glad.h>
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <iostream>
+using namespace std;
+
+// Texture slots of the mesh shaders. Every slot has a fixed texture unit (its index) and a sampler uniform that is
+// pointed at that unit once per program, right after linking, so draws only bind textures.
+enum MaterialSlot {
+    MATERIAL_SLOT_DIFFUSE,
+    MATERIAL_SLOT_SPECULAR,
+    MATERIAL_SLOT_NORMAL,
+    MATERIAL_SLOT_HEIGHT,
+    MATERIAL_SLOT_COUNT
+};
+
+struct MaterialSlotInfo {
+    const char* textureType;   // Texture::type of the imported texture references
+    const char* sampler;       // sampler uniform of the mesh shaders
+};
+const MaterialSlotInfo MATERIAL_SLOTS[MATERIAL_SLOT_COUNT] = {
+    { "texture_diffuse",  "texture_diffuse1" },
+    { "texture_specular", "texture_specular1" },
+    { "texture_normal",   "texture_normal1" },
+    { "texture_height",   "texture_height1" },
+};
+
+// slot of an imported texture type, MATERIAL_SLOT_COUNT if it is none of them
+inline MaterialSlot materialSlot(const string &textureType)
+{
+    for (int slot = 0; slot < MATERIAL_SLOT_COUNT; slot++)
+        if (textureType == MATERIAL_SLOTS[slot].textureType)
+            return static_cast<MaterialSlot>(slot);
+    return MATERIAL_SLOT_COUNT;
+}
+
+// Points every slot sampler the program has at the slot's texture unit. GL 3.3 has no glProgramUniform, so the
+// program is made current for it and the previous one restored.
+inline void bindMaterialSamplers(GLuint program)
+{
+    GLint previous = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &previous);
+    glUseProgram(program);
+    for (int slot = 0; slot < MATERIAL_SLOT_COUNT; slot++)
+    {
+        GLint location = glGetUniformLocation(program, MATERIAL_SLOTS[slot].sampler);
+        if (location >= 0)
+            glUniform1i(location, slot);
+    }
+    glUseProgram(static_cast<GLuint>(previous));
+}
+
+// The textures and scalar parameters of a surface. A slot without a texture is 0 and leaves its unit alone.
+struct Material {
+    GLuint textures[MATERIAL_SLOT_COUNT] = {};
+    float shininess = 20.0f;
+    // index in the MaterialLibrary, not part of the comparison
+    unsigned int id = 0;
+
+    bool operator==(const Material &other) const
+    {
+        for (int slot = 0; slot < MATERIAL_SLOT_COUNT; slot++)
+            if (textures[slot] != other.textures[slot])
+                return false;
+        return shininess == other.shininess;
+    }
+};
+
+// Process-wide set of distinct materials. Meshes whose materials are equal (same textures, which the texture
+// registry already shares, and same parameters) get the same Material, and its address stays valid until clear().
+class MaterialLibrary
+{
+public:
+    static MaterialLibrary &instance()
+    {
+        static MaterialLibrary library;
+        return library;
+    }
+
+    const Material* acquire(const Material &material)
+    {
+        requests++;
+        // a scene has a few dozen materials, a linear search is fine
+        for (const unique_ptr<Material> &existing : materials)
+            if (*existing == material)
+                return existing.get();
+        materials.push_back(unique_ptr<Material>(new Material(material)));
+        materials.back()->id = static_cast<unsigned int>(materials.size() - 1);
+        return materials.back().get();
+    }
+
+    size_t size() const { return materials.size(); }
+
+    void printStats() const
+    {
+        cout << "MATERIAL_LIBRARY:: " << requests << " mesh materials, " << materials.size() << " distinct" << endl;
+    }
+
+    // the materials' textures belong to the texture registry, this only forgets them
+    void clear()
+    {
+        materials.clear();
+        requests = 0;
+    }
+
+private:
+    vector<unique_ptr<Material>> materials;
+    unsigned int requests = 0;
+
+    MaterialLibrary() = default;
+    MaterialLibrary(const MaterialLibrary&) = delete;
+    MaterialLibrary& operator=(const MaterialLibrary&) = delete;
+};
+
+// Remembers which texture every slot unit holds and which material each program's parameters were last set
+// for, so consecutive draws only bind what differs. Anything else that binds 2D textures or switches the active
+// unit (the texture streamer, the skybox, ImGui) runs outside the mesh draws; beginFrame() forgets the state
+// they may have changed.
+class MaterialBinder
+{
+public:
+    // statistics of the current frame
+    unsigned int textureBinds = 0;
+    unsigned int bindsAvoided = 0;
+    unsigned int materialChanges = 0;
+
+    static MaterialBinder &instance()
+    {
+        static MaterialBinder binder;
+        return binder;
+    }
+
+    void beginFrame()
+    {
+        invalidate();
+        textureBinds = 0;
+        bindsAvoided = 0;
+        materialChanges = 0;
+    }
+
+    // the GL state is unknown, the next bind sets everything
+    void invalidate()
+    {
+        for (int slot = 0; slot < MATERIAL_SLOT_COUNT; slot++)
+            bound[slot] = UNKNOWN;
+        activeUnit = UNKNOWN;
+        lastMaterial = nullptr;
+        lastProgram = 0;
+    }
+
+    // Binds the material's textures that aren't bound already. Returns true if the program's material
+    // parameters have to be set, i.e. the last material bound for it was a different one.
+    bool bind(const Material &material, GLuint program)
+    {
+        for (int slot = 0; slot < MATERIAL_SLOT_COUNT; slot++)
+        {
+            GLuint texture = material.textures[slot];
+            if (texture == 0)
+                continue;
+            if (texture == bound[slot])
+            {
+                bindsAvoided++;
+                continue;
+            }
+            if (activeUnit != static_cast<GLuint>(slot))
+            {
+                glActiveTexture(GL_TEXTURE0 + slot);
+                activeUnit = slot;
+            }
+            glBindTexture(GL_TEXTURE_2D, texture);
+            bound[slot] = texture;
+            textureBinds++;
+        }
+        if (&material == lastMaterial && program == lastProgram)
+            return false;
+        lastMaterial = &material;
+        lastProgram = program;
+        materialChanges++;
+        return true;
+    }
+
+private:
+    static const GLuint UNKNOWN = ~0u;
+
+    GLuint bound[MATERIAL_SLOT_COUNT];
+    GLuint activeUnit;
+    const Material *lastMaterial;
+    GLuint lastProgram;
+
+    MaterialBinder() { invalidate(); }
+    MaterialBinder(const MaterialBinder&) = delete;
+    MaterialBinder& operator=(const MaterialBinder&) = delete;
+};
+#endif
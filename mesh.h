@@ -6,138 +6,227 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "shader.h"
+#include "vertex_format.h"
+#include "instance_buffer.h"
+#include "geometry_pool.h"
+#include "material.h"
 
 #include <string>
 #include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
 using namespace std;
 
-#define MAX_BONE_INFLUENCE 4
-
-struct Vertex {
-    glm::vec3 Position;
-    glm::vec3 Normal;
-    glm::vec2 TexCoords;
-    glm::vec3 Tangent;
-    glm::vec3 Bitangent;
-	int m_BoneIDs[MAX_BONE_INFLUENCE];
-	float m_Weights[MAX_BONE_INFLUENCE];
-};
-
 struct Texture {
     unsigned int id;
     string type;
     string path;
 };
 
+// One level of detail: a range of the mesh's index buffer over the shared vertex buffer, and the largest
+// distance (model units) the simplified surface may be off from the full detail one. Level 0 is full detail.
+struct MeshLod {
+    unsigned int indexOffset;
+    unsigned int indexCount;
+    float        error;
+};
+
+// per-mesh uniforms of the mesh shaders, hashed at compile time. The samplers are set at link time, see material.h
+constexpr UniformName UNIFORM_SHININESS = "shininess";
+constexpr UniformName UNIFORM_POSITION_OFFSET = "positionOffset";
+constexpr UniformName UNIFORM_POSITION_SCALE = "positionScale";
+
 class Mesh {
 public:
     // mesh Data
     vector<Vertex>       vertices;
     vector<unsigned int> indices;
-    vector<Texture>      textures;
-    // shininess
-    float shininess;
+    // textures and shininess, shared with every other mesh that has the same ones
+    const Material      *material;
+    // detail levels, finest first; all of them index into 'indices'
+    vector<MeshLod>      lods;
+    // The vertices live in the geometry pool's buffer for their layout, from baseVertex on, and the indices in its
+    // index buffer from firstIndex on; VAO is shared by every mesh of the layout.
+    GeometryStream *geometry;
     unsigned int VAO;
-
-    // constructor
-    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, float shininess)
+    GLint baseVertex;
+    GLuint firstIndex;
+    // positions only, with the same quantization and the same indices: the depth pre-pass reads 8 bytes a vertex
+    GeometryStream *depthGeometry;
+    unsigned int depthVAO;
+    GLint depthBaseVertex;
+    // compact GPU layout of the vertex buffer and how to decode it
+    const VertexLayout *layout;
+    VertexQuantization quantization;
+    size_t vertexBufferBytes;
+    // bounding sphere in model space, for LOD selection
+    glm::vec3 boundsCenter;
+    float boundsRadius;
+    // bounding box in model space, for culling
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+
+    // constructor. The vertex buffer gets the smallest layout that has every attribute in shaderAttributes.
+    // Without lods the whole index buffer is the only level.
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, const Material *material,
+         vector<MeshLod> lods = vector<MeshLod>(), unsigned int shaderAttributes = VERTEX_ATTRIBUTES_ALL)
     {
-        this->vertices = vertices;
-        this->indices = indices;
-        this->textures = textures;
-        this->shininess = shininess;
+        this->vertices = std::move(vertices);
+        this->indices = std::move(indices);
+        this->material = material;
+        this->lods = std::move(lods);
+        this->layout = &selectVertexLayout(shaderAttributes);
+        if (this->lods.empty())
+            this->lods.push_back({ 0, static_cast<unsigned int>(this->indices.size()), 0.0f });
+        computeBounds();
 
         // Set the vertex buffers and its attribute pointers.
         setupMesh();
     }
 
-    // render the mesh
-    void Draw(Shader &shader) 
+    // render the mesh at the given detail level, returns the number of triangles submitted
+    unsigned int Draw(Shader &shader, unsigned int lod = 0)
     {
-        // bind appropriate textures
-        unsigned int diffuseNr  = 1;
-        unsigned int specularNr = 1;
-        unsigned int normalNr   = 1;
-        unsigned int heightNr   = 1;
-        for(unsigned int i = 0; i < textures.size(); i++)
-        {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
-            // retrieve texture number (the N in diffuse_textureN)
-            string number;
-            string name = textures[i].type;
-            if(name == "texture_diffuse")
-                number = std::to_string(diffuseNr++);
-            else if(name == "texture_specular")
-                number = std::to_string(specularNr++); // transfer unsigned int to string
-            else if(name == "texture_normal")
-                number = std::to_string(normalNr++); // transfer unsigned int to string
-             else if(name == "texture_height")
-                number = std::to_string(heightNr++); // transfer unsigned int to string
-
-            // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
-        }
-        
-        // draw mesh
-        // first set shininess value in shader
-        glUniform1f(glGetUniformLocation(shader.ID, "shininess"), shininess);
+        bindMaterial(shader);
+        glBindVertexArray(VAO);
+        unsigned int triangles = drawBound(lod);
+        glBindVertexArray(0);
+        return triangles;
+    }
+
+    // render instanceCount copies of the mesh in one draw call, placed by the matrices of the instance buffer
+    // from firstInstance on. Returns the number of triangles submitted.
+    unsigned int DrawInstanced(Shader &shader, const InstanceBuffer &instances, size_t firstInstance, unsigned int instanceCount, unsigned int lod = 0)
+    {
+        if (instanceCount == 0)
+            return 0;
+        bindMaterial(shader);
         glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0);
+        unsigned int triangles = drawBound(lod, &instances, firstInstance, instanceCount);
         glBindVertexArray(0);
+        return triangles;
+    }
+
+    // binds the textures that aren't bound yet and sets the per-mesh uniforms
+    void bindMaterial(Shader &shader)
+    {
+        bindTextures(shader);
+        // and the transform back from the quantized positions and texture coordinates
+        bindQuantization(shader);
+    }
 
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
+    // the material alone: textures not bound yet, and its parameters when the program last saw another material
+    void bindTextures(Shader &shader)
+    {
+        if (MaterialBinder::instance().bind(*material, shader.ID))
+            glUniform1f(shader.location(UNIFORM_SHININESS), material->shininess);
+    }
+
+    // Sets the transform back from the quantized positions and texture coordinates, all a depth-only draw needs.
+    // The texture coordinate one is the constant value of the per-instance attribute, the same for every instance.
+    void bindQuantization(Shader &shader)
+    {
+        glUniform3fv(shader.location(UNIFORM_POSITION_OFFSET), 1, &quantization.positionOffset[0]);
+        glUniform3fv(shader.location(UNIFORM_POSITION_SCALE), 1, &quantization.positionScale[0]);
+        glVertexAttrib4f(VERTEX_LOCATION_INSTANCE_TEXCOORD, quantization.texCoordOffset.x, quantization.texCoordOffset.y,
+                         quantization.texCoordScale.x, quantization.texCoordScale.y);
+    }
+
+    // the detail level a draw at 'lod' uses; its indexOffset is relative to firstIndex
+    const MeshLod &level(unsigned int lod) const
+    {
+        return lods[std::min<size_t>(lod, lods.size() - 1)];
+    }
+
+    // Issues the draw with the mesh's VAO already bound and its material set, for callers that skip redundant
+    // binds (RenderQueue). Without instances it draws once, placed by the 'model' uniform alone.
+    unsigned int drawBound(unsigned int lod, const InstanceBuffer *instances = nullptr, size_t firstInstance = 0, unsigned int instanceCount = 1)
+    {
+        return drawLevel(lod, instances, firstInstance, instanceCount, *geometry, baseVertex);
+    }
+
+    // the same with depthVAO bound
+    unsigned int drawDepthBound(unsigned int lod, const InstanceBuffer *instances = nullptr, size_t firstInstance = 0, unsigned int instanceCount = 1)
+    {
+        return drawLevel(lod, instances, firstInstance, instanceCount, *depthGeometry, depthBaseVertex);
     }
 
 private:
-    // render data 
-    unsigned int VBO, EBO;
+    // draws from one of the pool streams with its VAO bound, switching its instance attributes to what the draw reads
+    unsigned int drawLevel(unsigned int lod, const InstanceBuffer *instances, size_t firstInstance, unsigned int instanceCount,
+                           GeometryStream &stream, GLint streamBaseVertex)
+    {
+        const MeshLod &drawn = level(lod);
+        const void *offset = (void*)(uintptr_t)((firstIndex + drawn.indexOffset) * sizeof(unsigned int));
+        if (instances)
+        {
+            // the texture coordinate transform stays the constant one
+            if (stream.instanceSource == INSTANCES_MULTI_DRAW)
+                glDisableVertexAttribArray(VERTEX_LOCATION_INSTANCE_TEXCOORD);
+            instances->bindAttributes(firstInstance);
+            stream.instanceSource = INSTANCES_BUFFER;
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, drawn.indexCount, GL_UNSIGNED_INT, offset, instanceCount, streamBaseVertex);
+            return drawn.indexCount / 3 * instanceCount;
+        }
+        if (stream.instanceSource != INSTANCES_CONSTANT)
+        {
+            InstanceBuffer::unbindAttributes();
+            if (stream.instanceSource == INSTANCES_MULTI_DRAW)
+                glDisableVertexAttribArray(VERTEX_LOCATION_INSTANCE_TEXCOORD);
+            stream.instanceSource = INSTANCES_CONSTANT;
+        }
+        glDrawElementsBaseVertex(GL_TRIANGLES, drawn.indexCount, GL_UNSIGNED_INT, offset, streamBaseVertex);
+        return drawn.indexCount / 3;
+    }
 
-    // initializes all the buffer objects/arrays
+    // copies the mesh into the geometry pool
     void setupMesh()
     {
-        // create buffers/arrays
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &EBO);
+        // the vertices are packed into the mesh's compact layout, see vertex_format.h
+        vector<unsigned char> packed = packVertices(vertices, *layout, quantization);
+        vertexBufferBytes = packed.size();
+        firstIndex = GeometryPool::instance().addIndices(indices);
+        geometry = &GeometryPool::instance().addVertices(*layout, packed, baseVertex);
+        VAO = geometry->vertexArray;
+
+        // the position stream of the depth pre-pass; the quantization comes out the same as above
+        const VertexLayout &positions = selectVertexLayout(VERTEX_ATTRIBUTE_POSITION);
+        if (layout == &positions)
+        {
+            depthGeometry = geometry;
+            depthBaseVertex = baseVertex;
+        }
+        else
+        {
+            VertexQuantization positionQuantization;
+            vector<unsigned char> packedPositions = packVertices(vertices, positions, positionQuantization);
+            depthGeometry = &GeometryPool::instance().addVertices(positions, packedPositions, depthBaseVertex);
+        }
+        depthVAO = depthGeometry->vertexArray;
+        // until an instanced draw, the shader's instance matrix reads as identity
+        InstanceBuffer::setIdentity();
+    }
 
-        glBindVertexArray(VAO);
-        // load data into vertex buffers
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        // A great thing about structs is that their memory layout is sequential for all its items.
-        // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-        // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);  
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-
-        // set the vertex attribute pointers
-        // vertex Positions
-        glEnableVertexAttribArray(0);	
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-        // vertex normals
-        glEnableVertexAttribArray(1);	
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-        // vertex texture coords
-        glEnableVertexAttribArray(2);	
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-        // vertex tangent
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-        // vertex bitangent
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
-		// ids
-		glEnableVertexAttribArray(5);
-		glVertexAttribIPointer(5, 4, GL_INT, sizeof(Vertex), (void*)offsetof(Vertex, m_BoneIDs));
-
-		// weights
-		glEnableVertexAttribArray(6);
-		glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, m_Weights));
-        glBindVertexArray(0);
+    // the vertex bounds, their centre and the distance to the farthest vertex from it
+    void computeBounds()
+    {
+        boundsCenter = glm::vec3(0.0f);
+        boundsRadius = 0.0f;
+        boundsMin = boundsMax = glm::vec3(0.0f);
+        if (vertices.empty())
+            return;
+        glm::vec3 minimum = vertices[0].Position, maximum = vertices[0].Position;
+        for (const Vertex &vertex : vertices)
+        {
+            minimum = glm::min(minimum, vertex.Position);
+            maximum = glm::max(maximum, vertex.Position);
+        }
+        boundsMin = minimum;
+        boundsMax = maximum;
+        boundsCenter = (minimum + maximum) * 0.5f;
+        for (const Vertex &vertex : vertices)
+            boundsRadius = std::max(boundsRadius, glm::length(vertex.Position - boundsCenter));
     }
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,296 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include "mesh.h"
+#include "mesh_importer.h"
+#include "mapped_file.h"
+#include "asset_pack.h"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+using namespace std;
+
+// Binary cache of post-processed meshes, stored next to the source asset as '<asset>.meshcache'.
+// Layout (all offsets from the start of the file, payloads 16-byte aligned):
+//   MeshCacheHeader
+//   MeshCacheRecord[meshCount]
+//   MeshCacheTextureRef[textureRefCount]
+//   MeshCacheLod[lodCount]
+//   per mesh: Vertex[vertexCount], unsigned int[indexCount] (every detail level of the mesh back to back)
+// Bump MESH_CACHE_VERSION whenever the layout, the Vertex struct or the import processing changes.
+const uint32_t MESH_CACHE_VERSION = 3;
+const char MESH_CACHE_MAGIC[4] = { 'M', 'S', 'H', 'C' };
+
+struct MeshCacheHeader {
+    char     magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t vertexStride;
+    uint32_t meshCount;
+    uint32_t textureRefCount;
+    uint32_t lodCount;
+};
+
+struct MeshCacheRecord {
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t firstTexture;
+    uint32_t textureCount;
+    uint32_t firstLod;
+    uint32_t lodCount;
+    float    shininess;
+    uint32_t padding;
+};
+
+struct MeshCacheTextureRef {
+    char type[32];
+    char path[224];
+};
+
+// index range relative to the mesh's own indices
+struct MeshCacheLod {
+    uint32_t indexOffset;
+    uint32_t indexCount;
+    float    error;
+    uint32_t padding;
+};
+
+class MeshCache
+{
+public:
+    // cache file that belongs to a source asset
+    static string cachePath(const string &sourcePath)
+    {
+        return sourcePath + ".meshcache";
+    }
+
+    // Hashes the source file, the material libraries it references and the import flags.
+    // Returns 0 if the source file can't be read.
+    static uint64_t sourceKey(const string &sourcePath, unsigned int importFlags)
+    {
+        MappedFile source(sourcePath);
+        if (!source.isOpen())
+            return 0;
+
+        uint64_t key = hashBytes(&MESH_CACHE_VERSION, sizeof(MESH_CACHE_VERSION));
+        key = hashBytes(&importFlags, sizeof(importFlags), key);
+        key = hashBytes(source.data(), source.size(), key);
+
+        // OBJ files pull their materials (and so texture references) from 'mtllib' files, fold those in too
+        string directory = sourcePath.substr(0, sourcePath.find_last_of('/'));
+        const char* text = reinterpret_cast<const char*>(source.data());
+        size_t size = source.size();
+        for (size_t lineStart = 0; lineStart < size; )
+        {
+            size_t lineEnd = lineStart;
+            while (lineEnd < size && text[lineEnd] != '\n')
+                lineEnd++;
+            if (lineEnd - lineStart > 7 && strncmp(text + lineStart, "mtllib ", 7) == 0)
+            {
+                string library(text + lineStart + 7, lineEnd - lineStart - 7);
+                while (!library.empty() && (library.back() == '\r' || library.back() == ' '))
+                    library.pop_back();
+                MappedFile material(directory + '/' + library);
+                if (material.isOpen())
+                    key = hashBytes(material.data(), material.size(), key);
+            }
+            lineStart = lineEnd + 1;
+        }
+        return key;
+    }
+
+    // Maps a cache file and validates it against the expected key. On success the accessors below
+    // point straight into the mapping, which stays valid until this object is destroyed.
+    bool open(const string &path, uint64_t key)
+    {
+        if (key == 0 || !file.open(path))
+            return false;
+        return validate(key, true);
+    }
+
+    // Opens a cache from the cooked asset pack. The cooker checked its key against the sources, so
+    // the sources don't have to be read again here.
+    bool openCooked(const string &path)
+    {
+        if (!file.open(path))
+            return false;
+        return validate(0, false);
+    }
+
+    unsigned int meshCount() const { return header ? header->meshCount : 0; }
+    const MeshCacheRecord &record(unsigned int i) const { return records[i]; }
+    const Vertex* vertices(unsigned int i) const { return reinterpret_cast<const Vertex*>(file.data() + records[i].vertexOffset); }
+    const unsigned int* indices(unsigned int i) const { return reinterpret_cast<const unsigned int*>(file.data() + records[i].indexOffset); }
+    const MeshCacheTextureRef &textureRef(unsigned int i) const { return textureRefs[i]; }
+    const MeshCacheLod &lod(unsigned int i) const { return lods[i]; }
+
+    // Writes the processed meshes of a model. Goes through a temporary file so a crash never leaves a
+    // half written cache behind.
+    static bool write(const string &path, uint64_t key, const vector<ImportedMesh> &meshes)
+    {
+        if (key == 0)
+            return false;
+
+        MeshCacheHeader fileHeader;
+        memcpy(fileHeader.magic, MESH_CACHE_MAGIC, 4);
+        fileHeader.version = MESH_CACHE_VERSION;
+        fileHeader.key = key;
+        fileHeader.vertexStride = sizeof(Vertex);
+        fileHeader.meshCount = static_cast<uint32_t>(meshes.size());
+        fileHeader.textureRefCount = 0;
+        fileHeader.lodCount = 0;
+
+        vector<MeshCacheRecord> meshRecords(meshes.size());
+        vector<MeshCacheTextureRef> refs;
+        vector<MeshCacheLod> levels;
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            meshRecords[i].firstLod = static_cast<uint32_t>(levels.size());
+            meshRecords[i].lodCount = static_cast<uint32_t>(meshes[i].lods.size());
+            for (const MeshLod &lod : meshes[i].lods)
+                levels.push_back({ lod.indexOffset, lod.indexCount, lod.error, 0 });
+
+            meshRecords[i].firstTexture = static_cast<uint32_t>(refs.size());
+            meshRecords[i].textureCount = static_cast<uint32_t>(meshes[i].textures.size());
+            for (const Texture &texture : meshes[i].textures)
+            {
+                MeshCacheTextureRef ref;
+                memset(&ref, 0, sizeof(ref));
+                if (texture.type.size() >= sizeof(ref.type) || texture.path.size() >= sizeof(ref.path))
+                {
+                    cout << "ERROR::MESH_CACHE:: texture reference too long to cache: " << texture.path << endl;
+                    return false;
+                }
+                memcpy(ref.type, texture.type.data(), texture.type.size());
+                memcpy(ref.path, texture.path.data(), texture.path.size());
+                refs.push_back(ref);
+            }
+        }
+        fileHeader.textureRefCount = static_cast<uint32_t>(refs.size());
+        fileHeader.lodCount = static_cast<uint32_t>(levels.size());
+
+        // lay out the payloads after the tables
+        uint64_t offset = sizeof(MeshCacheHeader) + meshRecords.size() * sizeof(MeshCacheRecord) + refs.size() * sizeof(MeshCacheTextureRef)
+            + levels.size() * sizeof(MeshCacheLod);
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            MeshCacheRecord &r = meshRecords[i];
+            r.vertexCount = static_cast<uint32_t>(meshes[i].vertices.size());
+            r.indexCount = static_cast<uint32_t>(meshes[i].indices.size());
+            r.shininess = meshes[i].shininess;
+            r.padding = 0;
+            r.vertexOffset = align(offset);
+            r.indexOffset = align(r.vertexOffset + uint64_t(r.vertexCount) * sizeof(Vertex));
+            offset = r.indexOffset + uint64_t(r.indexCount) * sizeof(unsigned int);
+        }
+
+        string tempPath = path + ".tmp";
+        ofstream out(tempPath, ios::binary | ios::trunc);
+        if (!out)
+        {
+            cout << "ERROR::MESH_CACHE:: could not write " << tempPath << endl;
+            return false;
+        }
+        out.write(reinterpret_cast<const char*>(&fileHeader), sizeof(fileHeader));
+        out.write(reinterpret_cast<const char*>(meshRecords.data()), meshRecords.size() * sizeof(MeshCacheRecord));
+        out.write(reinterpret_cast<const char*>(refs.data()), refs.size() * sizeof(MeshCacheTextureRef));
+        out.write(reinterpret_cast<const char*>(levels.data()), levels.size() * sizeof(MeshCacheLod));
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            pad(out, meshRecords[i].vertexOffset);
+            out.write(reinterpret_cast<const char*>(meshes[i].vertices.data()), meshes[i].vertices.size() * sizeof(Vertex));
+            pad(out, meshRecords[i].indexOffset);
+            out.write(reinterpret_cast<const char*>(meshes[i].indices.data()), meshes[i].indices.size() * sizeof(unsigned int));
+        }
+        out.close();
+        if (!out)
+        {
+            cout << "ERROR::MESH_CACHE:: could not write " << tempPath << endl;
+            std::remove(tempPath.c_str());
+            return false;
+        }
+
+        // rename doesn't replace an existing file on every platform
+        std::remove(path.c_str());
+        if (std::rename(tempPath.c_str(), path.c_str()) != 0)
+        {
+            std::remove(tempPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+private:
+    AssetFile file;
+    const MeshCacheHeader* header = nullptr;
+    const MeshCacheRecord* records = nullptr;
+    const MeshCacheTextureRef* textureRefs = nullptr;
+    const MeshCacheLod* lods = nullptr;
+
+    bool validate(uint64_t key, bool checkKey)
+    {
+        if (file.size() < sizeof(MeshCacheHeader))
+            return invalidate();
+        header = reinterpret_cast<const MeshCacheHeader*>(file.data());
+        if (memcmp(header->magic, MESH_CACHE_MAGIC, 4) != 0 || header->version != MESH_CACHE_VERSION
+            || (checkKey && header->key != key) || header->vertexStride != sizeof(Vertex))
+            return invalidate();
+
+        uint64_t tableEnd = sizeof(MeshCacheHeader)
+            + uint64_t(header->meshCount) * sizeof(MeshCacheRecord)
+            + uint64_t(header->textureRefCount) * sizeof(MeshCacheTextureRef)
+            + uint64_t(header->lodCount) * sizeof(MeshCacheLod);
+        if (tableEnd > file.size())
+            return invalidate();
+        records = reinterpret_cast<const MeshCacheRecord*>(file.data() + sizeof(MeshCacheHeader));
+        textureRefs = reinterpret_cast<const MeshCacheTextureRef*>(records + header->meshCount);
+        lods = reinterpret_cast<const MeshCacheLod*>(textureRefs + header->textureRefCount);
+
+        // make sure no record points outside of the file before anyone dereferences it
+        for (uint32_t i = 0; i < header->meshCount; i++)
+        {
+            const MeshCacheRecord &r = records[i];
+            if (r.vertexOffset + uint64_t(r.vertexCount) * sizeof(Vertex) > file.size()
+                || r.indexOffset + uint64_t(r.indexCount) * sizeof(unsigned int) > file.size()
+                || uint64_t(r.firstTexture) + r.textureCount > header->textureRefCount
+                || uint64_t(r.firstLod) + r.lodCount > header->lodCount)
+                return invalidate();
+            for (uint32_t l = r.firstLod; l < r.firstLod + r.lodCount; l++)
+                if (uint64_t(lods[l].indexOffset) + lods[l].indexCount > r.indexCount)
+                    return invalidate();
+        }
+        return true;
+    }
+
+    bool invalidate()
+    {
+        file.close();
+        header = nullptr;
+        records = nullptr;
+        textureRefs = nullptr;
+        lods = nullptr;
+        return false;
+    }
+
+    static uint64_t align(uint64_t offset)
+    {
+        return (offset + 15) & ~uint64_t(15);
+    }
+
+    // zero fill the stream up to the given offset
+    static void pad(ofstream &out, uint64_t offset)
+    {
+        static const char zeros[16] = {};
+        uint64_t position = static_cast<uint64_t>(out.tellp());
+        if (offset > position)
+            out.write(zeros, static_cast<std::streamsize>(offset - position));
+    }
+};
+#endif
@@ -0,0 +1,188 @@
+#ifndef MESH_IMPORTER_H
+#define MESH_IMPORTER_H
+
+#include <glm/glm.hpp>
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+
+#include "mesh.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <cstring>
+using namespace std;
+
+// Post-processing applied to every imported model. Part of the mesh cache key, so changing it invalidates the caches.
+const unsigned int MODEL_IMPORT_FLAGS = aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace;
+
+// CPU side result of importing one mesh. Texture ids stay 0, only type and path (relative to the model) are filled in.
+// indices holds every detail level back to back, lods says where each one starts.
+struct ImportedMesh {
+    vector<Vertex>       vertices;
+    vector<unsigned int> indices;
+    vector<MeshLod>      lods;
+    vector<Texture>      textures;
+    float                shininess;
+};
+
+// Runs Assimp over a model file, flattens its node tree into ImportedMeshes, optimizes each of them
+// with the MeshOptimizer and builds their detail levels with the MeshSimplifier. Touches no GL state, so the asset cooker shares it with Model.
+class MeshImporter
+{
+public:
+    static bool load(const string &path, vector<ImportedMesh> &meshes)
+    {
+        // Read file via ASSIMP
+        Assimp::Importer importer;
+        const aiScene* scene = importer.ReadFile(path, MODEL_IMPORT_FLAGS);
+        if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+        {
+            cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+            return false;
+        }
+
+        // Process ASSIMP's root node recursively
+        processNode(scene->mRootNode, scene, meshes);
+
+        // Weld and reorder for the GPU and simplify, the mesh cache stores the result
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            ImportedMesh &mesh = meshes[i];
+            string name = path + " #" + to_string(i);
+            MeshOptimizer::optimize(mesh.vertices, mesh.indices, name);
+            mesh.lods.assign(1, { 0, static_cast<unsigned int>(mesh.indices.size()), 0.0f });
+            MeshSimplifier::buildLods(mesh.vertices, mesh.indices, mesh.lods, name);
+        }
+        return true;
+    }
+
+private:
+    // Processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
+    static void processNode(aiNode *node, const aiScene *scene, vector<ImportedMesh> &meshes)
+    {
+        // process each mesh located at the current node
+        for(unsigned int i = 0; i < node->mNumMeshes; i++)
+        {
+            // the node object only contains indices to index the actual objects in the scene.
+            // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
+            aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
+            meshes.push_back(processMesh(mesh, scene));
+        }
+        // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
+        for(unsigned int i = 0; i < node->mNumChildren; i++)
+        {
+            processNode(node->mChildren[i], scene, meshes);
+        }
+
+    }
+
+    static ImportedMesh processMesh(aiMesh *mesh, const aiScene *scene)
+    {
+        // data to fill
+        ImportedMesh result;
+        vector<Vertex> &vertices = result.vertices;
+        vector<unsigned int> &indices = result.indices;
+        vector<Texture> &textures = result.textures;
+
+        // walk through each of the mesh's vertices
+        for(unsigned int i = 0; i < mesh->mNumVertices; i++)
+        {
+            // zeroed so attributes the mesh doesn't have and the bone slots compare equal when welding
+            Vertex vertex;
+            memset(&vertex, 0, sizeof(vertex));
+            glm::vec3 vector; // we declare a placeholder vector since assimp uses its own vector class that doesn't directly convert to glm's vec3 class so we transfer the data to this placeholder glm::vec3 first.
+            // positions
+            vector.x = mesh->mVertices[i].x;
+            vector.y = mesh->mVertices[i].y;
+            vector.z = mesh->mVertices[i].z;
+            vertex.Position = vector;
+            // normals
+            if (mesh->HasNormals())
+            {
+                vector.x = mesh->mNormals[i].x;
+                vector.y = mesh->mNormals[i].y;
+                vector.z = mesh->mNormals[i].z;
+                vertex.Normal = vector;
+            }
+            // texture coordinates
+            if(mesh->mTextureCoords[0]) // does the mesh contain texture coordinates?
+            {
+                glm::vec2 vec;
+                // a vertex can contain up to 8 different texture coordinates. We thus make the assumption that we won't
+                // use models where a vertex can have multiple texture coordinates so we always take the first set (0).
+                vec.x = mesh->mTextureCoords[0][i].x;
+                vec.y = mesh->mTextureCoords[0][i].y;
+                vertex.TexCoords = vec;
+                // tangent
+                vector.x = mesh->mTangents[i].x;
+                vector.y = mesh->mTangents[i].y;
+                vector.z = mesh->mTangents[i].z;
+                vertex.Tangent = vector;
+                // bitangent
+                vector.x = mesh->mBitangents[i].x;
+                vector.y = mesh->mBitangents[i].y;
+                vector.z = mesh->mBitangents[i].z;
+                vertex.Bitangent = vector;
+            }
+            else
+                vertex.TexCoords = glm::vec2(0.0f, 0.0f);
+
+            vertices.push_back(vertex);
+        }
+        // now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
+        for(unsigned int i = 0; i < mesh->mNumFaces; i++)
+        {
+            aiFace face = mesh->mFaces[i];
+            // retrieve all indices of the face and store them in the indices vector
+            for(unsigned int j = 0; j < face.mNumIndices; j++)
+                indices.push_back(face.mIndices[j]);
+        }
+        // process materials
+        aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
+
+        float shininess;
+        if(AI_SUCCESS != aiGetMaterialFloat(material, AI_MATKEY_SHININESS, &shininess))
+        {
+            // if unsuccessful set a default
+            shininess = 20.f;
+        }
+        result.shininess = shininess;
+        // we assume a convention for sampler names in the shaders. Each diffuse texture should be named
+        // as 'texture_diffuseN' where N is a sequential number ranging from 1 to MAX_SAMPLER_NUMBER.
+        // Same applies to other texture as the following list summarizes:
+        // diffuse: texture_diffuseN
+        // specular: texture_specularN
+        // normal: texture_normalN
+
+        // 1. diffuse maps
+        materialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse", textures);
+        // 2. specular maps
+        materialTextures(material, aiTextureType_SPECULAR, "texture_specular", textures);
+        // 3. normal maps
+        materialTextures(material, aiTextureType_HEIGHT, "texture_normal", textures);
+        // 4. height maps
+        materialTextures(material, aiTextureType_AMBIENT, "texture_height", textures);
+
+        return result;
+    }
+
+    // collects the texture references of a given type. The textures themselves are loaded by the Model.
+    static void materialTextures(aiMaterial *mat, aiTextureType type, const string &typeName, vector<Texture> &textures)
+    {
+        for(unsigned int i = 0; i < mat->GetTextureCount(type); i++)
+        {
+            aiString str;
+            mat->GetTexture(type, i, &str);
+            Texture texture;
+            texture.id = 0;
+            texture.type = typeName;
+            texture.path = str.C_Str();
+            textures.push_back(texture);
+        }
+    }
+};
+#endif
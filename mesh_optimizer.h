@@ -0,0 +1,353 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include "mesh.h"
+#include "mapped_file.h"
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <iostream>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+using namespace std;
+
+// Post-transform cache the statistics are measured against, a FIFO of this many vertices
+const unsigned int VERTEX_CACHE_FIFO_SIZE = 16;
+// Cache size the triangle order is optimized for (Forsyth's LRU model)
+const unsigned int VERTEX_CACHE_LRU_SIZE = 32;
+// A cluster may be split for overdraw ordering as long as its ACMR stays within this factor of the whole mesh
+const float OVERDRAW_CACHE_THRESHOLD = 1.05f;
+
+struct VertexCacheStats {
+    // average cache miss ratio, transformed vertices per triangle (0.5 is ideal on a regular grid, 3 is no reuse)
+    float acmr;
+    // average transformed vertex ratio, transformed vertices per unique vertex (1 is ideal)
+    float atvr;
+};
+
+// Import-time optimization of indexed triangle lists, run on every mesh between Assimp and the mesh cache:
+//   1. weld bit identical vertices, Assimp leaves OBJ meshes with one vertex per triangle corner
+//   2. order triangles for the post-transform vertex cache (Forsyth's linear-speed algorithm)
+//   3. order clusters of those triangles front to back from the mesh centre to cut overdraw, keeping the
+//      clusters intact so the cache efficiency barely changes
+//   4. order vertices by first use so vertex fetch walks the buffer linearly
+class MeshOptimizer
+{
+public:
+    // runs all stages in place and logs the vertex count and cache statistics before and after
+    static void optimize(vector<Vertex> &vertices, vector<unsigned int> &indices, const string &name)
+    {
+        if (indices.size() < 3 || vertices.empty())
+            return;
+        size_t vertexCountBefore = vertices.size();
+        VertexCacheStats before = analyzeVertexCache(indices, vertices.size());
+
+        weld(vertices, indices);
+        optimizeVertexCache(indices, vertices.size());
+        optimizeOverdraw(indices, vertices);
+        optimizeVertexFetch(vertices, indices);
+
+        VertexCacheStats after = analyzeVertexCache(indices, vertices.size());
+        cout << "MESH_OPTIMIZER:: " << name << ": " << indices.size() / 3 << " triangles, vertices "
+             << vertexCountBefore << " -> " << vertices.size() << ", ACMR " << before.acmr << " -> " << after.acmr
+             << ", ATVR " << before.atvr << " -> " << after.atvr << endl;
+    }
+
+    // simulates a FIFO post-transform cache over the index buffer
+    static VertexCacheStats analyzeVertexCache(const vector<unsigned int> &indices, size_t vertexCount)
+    {
+        VertexCacheStats stats = { 0.0f, 0.0f };
+        if (indices.size() < 3 || vertexCount == 0)
+            return stats;
+
+        // a vertex is in the cache while fewer than VERTEX_CACHE_FIFO_SIZE misses happened since it was loaded
+        vector<size_t> loadedAt(vertexCount, 0);
+        size_t misses = 0;
+        for (unsigned int index : indices)
+        {
+            if (loadedAt[index] == 0 || misses - loadedAt[index] + 1 > VERTEX_CACHE_FIFO_SIZE)
+            {
+                misses++;
+                loadedAt[index] = misses;
+            }
+        }
+        stats.acmr = float(misses) / float(indices.size() / 3);
+        stats.atvr = float(misses) / float(vertexCount);
+        return stats;
+    }
+
+    // merges vertices whose attributes are bit identical and drops the ones no triangle uses
+    static void weld(vector<Vertex> &vertices, vector<unsigned int> &indices)
+    {
+        unordered_map<uint64_t, vector<unsigned int>> buckets;
+        buckets.reserve(vertices.size());
+        vector<Vertex> welded;
+        welded.reserve(vertices.size());
+        vector<unsigned int> remap(vertices.size(), ~0u);
+
+        for (unsigned int &index : indices)
+        {
+            if (remap[index] == ~0u)
+            {
+                const Vertex &vertex = vertices[index];
+                vector<unsigned int> &bucket = buckets[hashBytes(&vertex, sizeof(Vertex))];
+                unsigned int target = ~0u;
+                for (unsigned int candidate : bucket)
+                {
+                    if (memcmp(&welded[candidate], &vertex, sizeof(Vertex)) == 0)
+                    {
+                        target = candidate;
+                        break;
+                    }
+                }
+                if (target == ~0u)
+                {
+                    target = static_cast<unsigned int>(welded.size());
+                    welded.push_back(vertex);
+                    bucket.push_back(target);
+                }
+                remap[index] = target;
+            }
+            index = remap[index];
+        }
+        vertices.swap(welded);
+    }
+
+    // Forsyth, "Linear-Speed Vertex Cache Optimisation". Greedily emits the triangle with the best score, where
+    // vertices score high when they're recently used (but not in the last triangle) or have few triangles left.
+    static void optimizeVertexCache(vector<unsigned int> &indices, size_t vertexCount)
+    {
+        size_t triangleCount = indices.size() / 3;
+
+        // triangles using each vertex
+        vector<unsigned int> firstTriangle(vertexCount + 1, 0);
+        for (unsigned int index : indices)
+            firstTriangle[index + 1]++;
+        for (size_t i = 0; i < vertexCount; i++)
+            firstTriangle[i + 1] += firstTriangle[i];
+        vector<unsigned int> adjacency(indices.size());
+        vector<unsigned int> fill(firstTriangle.begin(), firstTriangle.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++)
+            adjacency[fill[indices[i]]++] = static_cast<unsigned int>(i / 3);
+
+        vector<unsigned int> liveTriangles(vertexCount);
+        for (size_t i = 0; i < vertexCount; i++)
+            liveTriangles[i] = firstTriangle[i + 1] - firstTriangle[i];
+
+        vector<int> cachePosition(vertexCount, -1);
+        vector<float> vertexScore(vertexCount);
+        for (size_t i = 0; i < vertexCount; i++)
+            vertexScore[i] = forsythScore(-1, liveTriangles[i]);
+
+        vector<float> triangleScore(triangleCount);
+        vector<bool> emitted(triangleCount, false);
+        for (size_t t = 0; t < triangleCount; t++)
+            triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+
+        vector<unsigned int> result;
+        result.reserve(indices.size());
+        vector<unsigned int> cache, newCache;
+        cache.reserve(VERTEX_CACHE_LRU_SIZE + 3);
+        newCache.reserve(VERTEX_CACHE_LRU_SIZE + 3);
+        size_t scanStart = 0;
+        size_t best = nextTriangle(emitted, scanStart);
+
+        while (best != SIZE_MAX)
+        {
+            emitted[best] = true;
+            const unsigned int *triangle = &indices[best * 3];
+
+            // move the triangle's vertices to the front of the LRU cache
+            newCache.assign(triangle, triangle + 3);
+            for (unsigned int vertex : cache)
+                if (vertex != triangle[0] && vertex != triangle[1] && vertex != triangle[2])
+                    newCache.push_back(vertex);
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int vertex = triangle[k];
+                result.push_back(vertex);
+                liveTriangles[vertex]--;
+                // take the triangle out of the vertex's list
+                unsigned int *begin = &adjacency[firstTriangle[vertex]];
+                unsigned int *end = begin + liveTriangles[vertex] + 1;
+                *std::find(begin, end, static_cast<unsigned int>(best)) = *(end - 1);
+            }
+
+            // rescore everything in the cache and whatever fell out of it
+            for (size_t i = 0; i < newCache.size(); i++)
+                cachePosition[newCache[i]] = i < VERTEX_CACHE_LRU_SIZE ? int(i) : -1;
+            for (unsigned int vertex : cache)
+                if (cachePosition[vertex] >= int(VERTEX_CACHE_LRU_SIZE))
+                    cachePosition[vertex] = -1;
+
+            best = SIZE_MAX;
+            float bestScore = -1.0f;
+            for (size_t i = 0; i < newCache.size(); i++)
+            {
+                unsigned int vertex = newCache[i];
+                float score = forsythScore(cachePosition[vertex], liveTriangles[vertex]);
+                float delta = score - vertexScore[vertex];
+                vertexScore[vertex] = score;
+                for (unsigned int j = 0; j < liveTriangles[vertex]; j++)
+                {
+                    unsigned int t = adjacency[firstTriangle[vertex] + j];
+                    triangleScore[t] += delta;
+                    if (i < VERTEX_CACHE_LRU_SIZE && triangleScore[t] > bestScore)
+                    {
+                        bestScore = triangleScore[t];
+                        best = t;
+                    }
+                }
+            }
+            if (newCache.size() > VERTEX_CACHE_LRU_SIZE)
+                newCache.resize(VERTEX_CACHE_LRU_SIZE);
+            cache.swap(newCache);
+
+            // nothing left around the cache, carry on with the next triangle in input order
+            if (best == SIZE_MAX)
+                best = nextTriangle(emitted, scanStart);
+        }
+        indices.swap(result);
+    }
+
+    // Splits the cache optimized triangle order into clusters and sorts the clusters so the ones facing away
+    // from the mesh centre (usually in front) are drawn first. After Sander et al., "Fast Triangle Reordering
+    // for Vertex Locality and Reduced Overdraw".
+    static void optimizeOverdraw(vector<unsigned int> &indices, const vector<Vertex> &vertices)
+    {
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount < 2)
+            return;
+
+        // Each cluster is simulated with a cold cache, as it may end up after any other cluster. A cluster ends
+        // where the cache starts over anyway (a triangle with three misses) or as soon as its own cache efficiency
+        // is within OVERDRAW_CACHE_THRESHOLD of the whole mesh's, so splitting there costs next to nothing.
+        float meshAcmr = analyzeVertexCache(indices, vertices.size()).acmr;
+        vector<size_t> clusterStarts(1, 0);
+        vector<size_t> loadedAt(vertices.size(), 0);
+        size_t misses = 0, clusterBase = 0;
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            unsigned int triangleMisses = 0;
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int index = indices[t * 3 + k];
+                if (loadedAt[index] <= clusterBase || misses - loadedAt[index] + 1 > VERTEX_CACHE_FIFO_SIZE)
+                {
+                    misses++;
+                    loadedAt[index] = misses;
+                    triangleMisses++;
+                }
+            }
+            size_t clusterTriangles = t + 1 - clusterStarts.back();
+            bool hardBoundary = triangleMisses == 3 && clusterTriangles > 1;
+            if (hardBoundary)
+            {
+                // this triangle opens the next cluster, its misses count there
+                clusterStarts.push_back(t);
+                clusterBase = misses - 3;
+                for (int k = 0; k < 3; k++)
+                    loadedAt[indices[t * 3 + k]] = clusterBase + k + 1;
+            }
+            else if (float(misses - clusterBase) / float(clusterTriangles) <= meshAcmr * OVERDRAW_CACHE_THRESHOLD && t + 1 < triangleCount)
+            {
+                clusterStarts.push_back(t + 1);
+                clusterBase = misses;
+            }
+        }
+        if (clusterStarts.size() < 2)
+            return;
+
+        glm::vec3 meshCentre(0.0f);
+        for (const Vertex &vertex : vertices)
+            meshCentre += vertex.Position;
+        meshCentre /= float(vertices.size());
+
+        // area weighted centroid and normal of every cluster
+        struct Cluster { size_t start, end; float sortKey; };
+        vector<Cluster> clusters(clusterStarts.size());
+        for (size_t c = 0; c < clusterStarts.size(); c++)
+        {
+            Cluster &cluster = clusters[c];
+            cluster.start = clusterStarts[c];
+            cluster.end = c + 1 < clusterStarts.size() ? clusterStarts[c + 1] : triangleCount;
+
+            glm::vec3 centroid(0.0f), normal(0.0f);
+            float area = 0.0f;
+            for (size_t t = cluster.start; t < cluster.end; t++)
+            {
+                const glm::vec3 &a = vertices[indices[t * 3]].Position;
+                const glm::vec3 &b = vertices[indices[t * 3 + 1]].Position;
+                const glm::vec3 &c2 = vertices[indices[t * 3 + 2]].Position;
+                glm::vec3 n = glm::cross(b - a, c2 - a);
+                float triangleArea = glm::length(n);
+                centroid += (a + b + c2) * (triangleArea / 3.0f);
+                normal += n;
+                area += triangleArea;
+            }
+            float normalLength = glm::length(normal);
+            if (area > 0.0f)
+                centroid /= area;
+            if (normalLength > 0.0f)
+                normal /= normalLength;
+            cluster.sortKey = glm::dot(centroid - meshCentre, normal);
+        }
+        std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster &a, const Cluster &b) { return a.sortKey > b.sortKey; });
+
+        vector<unsigned int> result;
+        result.reserve(indices.size());
+        for (const Cluster &cluster : clusters)
+            result.insert(result.end(), indices.begin() + cluster.start * 3, indices.begin() + cluster.end * 3);
+        indices.swap(result);
+    }
+
+    // renumbers vertices in the order the index buffer first uses them
+    static void optimizeVertexFetch(vector<Vertex> &vertices, vector<unsigned int> &indices)
+    {
+        vector<unsigned int> remap(vertices.size(), ~0u);
+        vector<Vertex> ordered;
+        ordered.reserve(vertices.size());
+        for (unsigned int &index : indices)
+        {
+            if (remap[index] == ~0u)
+            {
+                remap[index] = static_cast<unsigned int>(ordered.size());
+                ordered.push_back(vertices[index]);
+            }
+            index = remap[index];
+        }
+        vertices.swap(ordered);
+    }
+
+private:
+    static float forsythScore(int cachePosition, unsigned int liveTriangles)
+    {
+        if (liveTriangles == 0)
+            return -1.0f;
+        float score = 0.0f;
+        if (cachePosition >= 0)
+        {
+            // the last triangle's vertices get a fixed score so the next triangle isn't always a neighbour of it
+            if (cachePosition < 3)
+                score = 0.75f;
+            else
+                score = std::pow(1.0f - float(cachePosition - 3) / float(VERTEX_CACHE_LRU_SIZE - 3), 1.5f);
+        }
+        // favour vertices with few triangles left so they can leave the working set
+        return score + 2.0f / std::sqrt(float(liveTriangles));
+    }
+
+    // next triangle in input order that hasn't been emitted, keeps dead ends linear instead of rescanning scores
+    static size_t nextTriangle(const vector<bool> &emitted, size_t &scanStart)
+    {
+        while (scanStart < emitted.size() && emitted[scanStart])
+            scanStart++;
+        return scanStart < emitted.size() ? scanStart : SIZE_MAX;
+    }
+};
+#endif
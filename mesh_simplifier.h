@@ -0,0 +1,361 @@
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+#include "mesh.h"
+#include "mesh_optimizer.h"
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <iostream>
+#include <cmath>
+#include <cstdint>
+using namespace std;
+
+// Triangle count of each generated LOD relative to the previous one
+const float LOD_REDUCTION = 0.5f;
+// LODs generated on top of the full detail mesh
+const unsigned int LOD_MAX_EXTRA_LEVELS = 3;
+// A level that doesn't get below this fraction of the previous one isn't worth its index data
+const float LOD_MIN_PROGRESS = 0.85f;
+
+// Builds a chain of simplified index buffers over a mesh's existing vertices with quadric error metric edge
+// collapses (Garland and Heckbert, "Surface Simplification Using Quadric Error Metrics"). Vertices only ever
+// collapse onto a neighbour, so every LOD shares the full detail vertex buffer.
+//   - vertices are grouped by position; attribute seams (one position, several vertices) may only collapse along
+//     the seam so every corner finds a matching vertex on the other end of the edge
+//   - open borders only collapse along the border, so silhouettes and holes keep their outline
+//   - collapses that would flip a triangle are rejected
+// The error of a level is the square root of the largest quadric cost accepted so far, a conservative distance in
+// model units the renderer projects to pixels when choosing the level.
+class MeshSimplifier
+{
+public:
+    // Appends up to LOD_MAX_EXTRA_LEVELS simplified copies of the indices of lods[0] (which must describe the whole
+    // index buffer) to indices and describes them in lods. Each level is optimized for the vertex cache.
+    static void buildLods(const vector<Vertex> &vertices, vector<unsigned int> &indices, vector<MeshLod> &lods, const string &name)
+    {
+        if (lods.empty() || indices.size() < 3 * 8)
+            return;
+
+        MeshSimplifier simplifier(vertices, vector<unsigned int>(indices.begin() + lods[0].indexOffset,
+                                                                 indices.begin() + lods[0].indexOffset + lods[0].indexCount));
+        cout << "MESH_SIMPLIFIER:: " << name << ": LOD0 " << lods[0].indexCount / 3 << " triangles";
+        size_t previousTriangles = lods[0].indexCount / 3;
+        for (unsigned int level = 1; level <= LOD_MAX_EXTRA_LEVELS; level++)
+        {
+            size_t target = static_cast<size_t>(previousTriangles * LOD_REDUCTION);
+            size_t reached = simplifier.simplify(target);
+            if (reached == 0 || reached > previousTriangles * LOD_MIN_PROGRESS)
+                break;
+
+            vector<unsigned int> lodIndices = simplifier.currentIndices();
+            MeshOptimizer::optimizeVertexCache(lodIndices, vertices.size());
+            MeshLod lod;
+            lod.indexOffset = static_cast<unsigned int>(indices.size());
+            lod.indexCount = static_cast<unsigned int>(lodIndices.size());
+            lod.error = simplifier.error();
+            indices.insert(indices.end(), lodIndices.begin(), lodIndices.end());
+            lods.push_back(lod);
+            previousTriangles = reached;
+            cout << ", LOD" << level << " " << reached << " (error " << lod.error << ")";
+        }
+        cout << endl;
+    }
+
+private:
+    // symmetric 4x4 quadric, stored as its 10 unique coefficients
+    struct Quadric {
+        double a2 = 0, ab = 0, ac = 0, ad = 0, b2 = 0, bc = 0, bd = 0, c2 = 0, cd = 0, d2 = 0;
+
+        static Quadric plane(const glm::dvec3 &n, double d)
+        {
+            Quadric q;
+            q.a2 = n.x * n.x; q.ab = n.x * n.y; q.ac = n.x * n.z; q.ad = n.x * d;
+            q.b2 = n.y * n.y; q.bc = n.y * n.z; q.bd = n.y * d;
+            q.c2 = n.z * n.z; q.cd = n.z * d;
+            q.d2 = d * d;
+            return q;
+        }
+
+        void add(const Quadric &o)
+        {
+            a2 += o.a2; ab += o.ab; ac += o.ac; ad += o.ad; b2 += o.b2;
+            bc += o.bc; bd += o.bd; c2 += o.c2; cd += o.cd; d2 += o.d2;
+        }
+
+        // sum of squared distances of p to the planes in the quadric
+        double error(const glm::dvec3 &p) const
+        {
+            double e = a2 * p.x * p.x + 2 * ab * p.x * p.y + 2 * ac * p.x * p.z + 2 * ad * p.x
+                     + b2 * p.y * p.y + 2 * bc * p.y * p.z + 2 * bd * p.y
+                     + c2 * p.z * p.z + 2 * cd * p.z + d2;
+            return std::max(0.0, e);
+        }
+    };
+
+    struct Collapse {
+        unsigned int from, to;
+        double cost;
+    };
+
+    const vector<Vertex> &vertices;
+    vector<unsigned int> triangles;       // vertex indices, 3 per triangle, degenerate ones removed
+    vector<unsigned int> positionOf;      // vertex -> canonical vertex with the same position
+    vector<Quadric> quadrics;             // per canonical position
+    vector<bool> border;                  // per canonical position, on an open edge
+    double maxCost = 0.0;
+
+    MeshSimplifier(const vector<Vertex> &vertices, vector<unsigned int> indices) : vertices(vertices), triangles(std::move(indices))
+    {
+        // positions shared by several vertices (attribute seams) collapse as one
+        positionOf.resize(vertices.size());
+        unordered_map<uint64_t, vector<unsigned int>> buckets;
+        for (unsigned int i = 0; i < vertices.size(); i++)
+        {
+            vector<unsigned int> &bucket = buckets[hashBytes(&vertices[i].Position, sizeof(glm::vec3))];
+            positionOf[i] = i;
+            for (unsigned int candidate : bucket)
+                if (vertices[candidate].Position == vertices[i].Position)
+                {
+                    positionOf[i] = candidate;
+                    break;
+                }
+            if (positionOf[i] == i)
+                bucket.push_back(i);
+        }
+
+        // every position starts with the planes of the triangles around it
+        quadrics.resize(vertices.size());
+        for (size_t t = 0; t < triangles.size(); t += 3)
+        {
+            glm::dvec3 p0 = position(triangles[t]), p1 = position(triangles[t + 1]), p2 = position(triangles[t + 2]);
+            glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+            double length = glm::length(n);
+            if (length <= 0.0)
+                continue;
+            n /= length;
+            Quadric q = Quadric::plane(n, -glm::dot(n, p0));
+            for (int k = 0; k < 3; k++)
+                quadrics[positionOf[triangles[t + k]]].add(q);
+        }
+        findBorders();
+    }
+
+    glm::dvec3 position(unsigned int vertex) const
+    {
+        return glm::dvec3(vertices[vertex].Position);
+    }
+
+    float error() const
+    {
+        return static_cast<float>(std::sqrt(maxCost));
+    }
+
+    vector<unsigned int> currentIndices() const
+    {
+        return triangles;
+    }
+
+    // an edge between two positions is open when only one triangle uses it
+    void findBorders()
+    {
+        border.assign(vertices.size(), false);
+        unordered_map<uint64_t, int> edgeUse;
+        edgeUse.reserve(triangles.size());
+        for (size_t t = 0; t < triangles.size(); t += 3)
+            for (int k = 0; k < 3; k++)
+                edgeUse[edgeKey(positionOf[triangles[t + k]], positionOf[triangles[t + (k + 1) % 3]])]++;
+        for (const auto &edge : edgeUse)
+        {
+            if (edge.second == 1)
+            {
+                border[static_cast<unsigned int>(edge.first >> 32)] = true;
+                border[static_cast<unsigned int>(edge.first & 0xFFFFFFFFu)] = true;
+            }
+        }
+    }
+
+    static uint64_t edgeKey(unsigned int a, unsigned int b)
+    {
+        if (a > b)
+            std::swap(a, b);
+        return (uint64_t(a) << 32) | b;
+    }
+
+    // Collapses edges in passes of independent collapses, cheapest first, until the mesh has at most
+    // targetTriangles triangles or nothing can collapse any more. Returns the triangle count reached.
+    size_t simplify(size_t targetTriangles)
+    {
+        while (triangles.size() / 3 > targetTriangles)
+        {
+            // triangles around each position
+            vector<unsigned int> firstTriangle(vertices.size() + 1, 0);
+            for (unsigned int vertex : triangles)
+                firstTriangle[positionOf[vertex] + 1]++;
+            for (size_t i = 0; i < vertices.size(); i++)
+                firstTriangle[i + 1] += firstTriangle[i];
+            vector<unsigned int> around(triangles.size());
+            vector<unsigned int> fill(firstTriangle.begin(), firstTriangle.end() - 1);
+            for (size_t i = 0; i < triangles.size(); i++)
+                around[fill[positionOf[triangles[i]]]++] = static_cast<unsigned int>(i / 3);
+
+            unordered_map<uint64_t, int> edgeUse;
+            edgeUse.reserve(triangles.size());
+            for (size_t t = 0; t < triangles.size(); t += 3)
+                for (int k = 0; k < 3; k++)
+                    edgeUse[edgeKey(positionOf[triangles[t + k]], positionOf[triangles[t + (k + 1) % 3]])]++;
+
+            // cheapest collapse out of every position
+            vector<Collapse> candidates;
+            for (unsigned int u = 0; u < vertices.size(); u++)
+            {
+                if (positionOf[u] != u || firstTriangle[u] == firstTriangle[u + 1])
+                    continue;
+                Collapse best = { u, u, 1e300 };
+                for (unsigned int i = firstTriangle[u]; i < firstTriangle[u + 1]; i++)
+                {
+                    unsigned int t = around[i];
+                    for (int k = 0; k < 3; k++)
+                    {
+                        unsigned int v = positionOf[triangles[t * 3 + k]];
+                        if (v == u)
+                            continue;
+                        // border positions stay on the border
+                        if (border[u] && edgeUse[edgeKey(u, v)] != 1)
+                            continue;
+                        double cost = quadrics[u].error(position(v));
+                        if (cost < best.cost)
+                            best = { u, v, cost };
+                    }
+                }
+                if (best.to != u)
+                    candidates.push_back(best);
+            }
+            std::sort(candidates.begin(), candidates.end(), [](const Collapse &a, const Collapse &b) { return a.cost < b.cost; });
+
+            // apply as many as possible, none of them touching the same triangles
+            vector<bool> touched(vertices.size(), false);
+            vector<bool> deadTriangle(triangles.size() / 3, false);
+            size_t liveTriangles = triangles.size() / 3;
+            size_t applied = 0;
+            for (const Collapse &collapse : candidates)
+            {
+                if (liveTriangles <= targetTriangles)
+                    break;
+                if (touched[collapse.from] || touched[collapse.to])
+                    continue;
+                size_t removed = 0;
+                if (!tryCollapse(collapse, firstTriangle, around, deadTriangle, touched, removed))
+                    continue;
+                liveTriangles -= removed;
+                maxCost = std::max(maxCost, collapse.cost);
+                applied++;
+            }
+            if (applied == 0)
+                break;
+
+            vector<unsigned int> remaining;
+            remaining.reserve(liveTriangles * 3);
+            for (size_t t = 0; t < deadTriangle.size(); t++)
+                if (!deadTriangle[t])
+                    remaining.insert(remaining.end(), triangles.begin() + t * 3, triangles.begin() + t * 3 + 3);
+            triangles.swap(remaining);
+        }
+        return triangles.size() / 3;
+    }
+
+    // moves position 'from' onto position 'to' if every corner can be remapped and nothing flips
+    bool tryCollapse(const Collapse &collapse, const vector<unsigned int> &firstTriangle, const vector<unsigned int> &around,
+                     vector<bool> &deadTriangle, vector<bool> &touched, size_t &removed)
+    {
+        unsigned int u = collapse.from, v = collapse.to;
+
+        // the corners of 'from' in the triangles on the edge tell which vertex of 'to' replaces each of them
+        unordered_map<unsigned int, unsigned int> replacement;
+        for (unsigned int i = firstTriangle[u]; i < firstTriangle[u + 1]; i++)
+        {
+            unsigned int t = around[i];
+            if (deadTriangle[t])
+                return false;
+            unsigned int fromVertex = ~0u, toVertex = ~0u;
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int vertex = triangles[t * 3 + k];
+                if (positionOf[vertex] == u)
+                    fromVertex = vertex;
+                else if (positionOf[vertex] == v)
+                    toVertex = vertex;
+            }
+            if (toVertex == ~0u)
+                continue;
+            auto it = replacement.find(fromVertex);
+            if (it != replacement.end() && it->second != toVertex)
+                return false;
+            replacement[fromVertex] = toVertex;
+        }
+
+        // every other triangle must find its corner in the map and keep facing the same way
+        glm::dvec3 target = position(v);
+        for (unsigned int i = firstTriangle[u]; i < firstTriangle[u + 1]; i++)
+        {
+            unsigned int t = around[i];
+            bool onEdge = false;
+            int corner = -1;
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int p = positionOf[triangles[t * 3 + k]];
+                if (p == v)
+                    onEdge = true;
+                else if (p == u)
+                    corner = k;
+            }
+            if (onEdge)
+                continue;
+            if (replacement.find(triangles[t * 3 + corner]) == replacement.end())
+                return false;
+
+            glm::dvec3 p[3] = { position(triangles[t * 3]), position(triangles[t * 3 + 1]), position(triangles[t * 3 + 2]) };
+            glm::dvec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+            p[corner] = target;
+            glm::dvec3 after = glm::cross(p[1] - p[0], p[2] - p[0]);
+            if (glm::dot(before, after) <= 0.0)
+                return false;
+        }
+
+        // apply: triangles on the edge disappear, the rest move their corner
+        for (unsigned int i = firstTriangle[u]; i < firstTriangle[u + 1]; i++)
+        {
+            unsigned int t = around[i];
+            bool onEdge = false;
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int &vertex = triangles[t * 3 + k];
+                if (positionOf[vertex] == v)
+                    onEdge = true;
+                for (int m = 0; m < 3; m++)
+                    touched[positionOf[triangles[t * 3 + m]]] = true;
+            }
+            if (onEdge)
+            {
+                deadTriangle[t] = true;
+                removed++;
+                continue;
+            }
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int &vertex = triangles[t * 3 + k];
+                if (positionOf[vertex] == u)
+                    vertex = replacement[vertex];
+            }
+        }
+        quadrics[v].add(quadrics[u]);
+        touched[u] = true;
+        touched[v] = true;
+        return true;
+    }
+};
+#endif
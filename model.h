@@ -1,19 +1,21 @@
 #ifndef MODEL_H
 #define MODEL_H
 
-#define STB_IMAGE_IMPLEMENTATION
-#include <stb_image.h>
-
 #include <glad/glad.h> 
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
-#include <assimp/Importer.hpp>
-#include <assimp/scene.h>
-#include <assimp/postprocess.h>
 
 #include "mesh.h"
+#include "mesh_importer.h"
+#include "mesh_cache.h"
+#include "lod_selector.h"
+#include "render_queue.h"
+#include "occlusion_culler.h"
+#include "asset_pack.h"
+#include "texture_registry.h"
 #include "shader.h"
+#include "profiler.h"
 
 #include <string>
 #include <fstream>
@@ -21,234 +23,339 @@
 #include <iostream>
 #include <map>
 #include <vector>
+#include <chrono>
+#include <limits>
 using namespace std;
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
+unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false, const unsigned char placeholder[4] = DEFAULT_PLACEHOLDER);
 
 class Model 
 {
 public:
     // model data 
-    vector<Texture> textures_loaded;	// Stores loaded textures once
+    vector<Texture> textures_loaded;	// Textures this model holds a registry reference to
     vector<Mesh>    meshes;
     string directory;
+    // file name of the model, for statistics
+    string name;
     bool gammaCorrection;
+    // true if the meshes came from the binary mesh cache instead of Assimp
+    bool loadedFromCache = false;
+    // true if the meshes came from the cooked asset pack
+    bool loadedFromPack = false;
+    // wall clock time spent in loadModel, in milliseconds
+    double loadTimeMs = 0.0;
+    // bounds of all meshes together in model space: box for culling, sphere around it
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+    glm::vec3 boundsCenter = glm::vec3(0.0f);
+    float boundsRadius = 0.0f;
+    // low-poly stand-in that hides what is behind the model, see AddOccluders
+    OccluderMesh occluder;
+
+    // vertex attributes the model's shader reads, picks the vertex layout of every mesh
+    unsigned int vertexAttributes;
 
     // Constructor, expects a filepath to a 3D model.
-    Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
+    Model(string const &path, bool gamma = false, unsigned int vertexAttributes = VERTEX_ATTRIBUTES_ALL)
+        : gammaCorrection(gamma), vertexAttributes(vertexAttributes)
     {
         loadModel(path);
     }
 
-    // Draws the model
+    // Gives the textures back to the registry, which deletes them once no other model uses them
+    ~Model()
+    {
+        for (unsigned int i = 0; i < textures_loaded.size(); i++)
+            TextureRegistry::instance().release(textures_loaded[i].id);
+    }
+
+    // Every copy would release the same textures again
+    Model(const Model&) = delete;
+    Model& operator=(const Model&) = delete;
+
+    size_t vertexCount() const
+    {
+        size_t count = 0;
+        for (const Mesh &mesh : meshes)
+            count += mesh.vertices.size();
+        return count;
+    }
+
+    // GPU memory of the vertex buffers in their compact layouts
+    size_t vertexBufferBytes() const
+    {
+        size_t bytes = 0;
+        for (const Mesh &mesh : meshes)
+            bytes += mesh.vertexBufferBytes;
+        return bytes;
+    }
+
+    // Draws the model at full detail
     void Draw(Shader &shader)
     {
         for(unsigned int i = 0; i < meshes.size(); i++)
             meshes[i].Draw(shader);
     }
-    
-private:
-    // Loads model using Assimp extensions and stores the models meshes
-    void loadModel(string const &path)
+
+    // Queues every mesh at the level of detail the selector picks for it and reports what was submitted, unless
+    // the model is outside the view frustum or occluded. The queue sets the 'model' uniform to modelMatrix when it
+    // draws.
+    void Draw(Shader &shader, const glm::mat4 &modelMatrix, LodSelector &lodSelector, RenderQueue &queue)
     {
-        // Read file via ASSIMP
-        Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
-        if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
-        {
-            cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+        PROFILE_ZONE("Queue model");
+        if (!queue.culler.isVisible(boundsMin, boundsMax, modelMatrix) || queue.occlusion.isOccluded(boundsMin, boundsMax, modelMatrix))
             return;
+        LodDrawRecord record = { name, 1, static_cast<unsigned int>(meshes.size()), ~0u, 0, 0, 0 };
+        for(unsigned int i = 0; i < meshes.size(); i++)
+        {
+            unsigned int lod = lodSelector.select(meshes[i], modelMatrix);
+            queue.add(shader, meshes[i], lod, modelMatrix);
+            record.triangles += meshes[i].lods[lod].indexCount / 3;
+            record.fullDetailTriangles += meshes[i].lods[0].indexCount / 3;
+            record.minLod = std::min(record.minLod, lod);
+            record.maxLod = std::max(record.maxLod, lod);
         }
-        // Retrieve the directory path of the filepath
-        directory = path.substr(0, path.find_last_of('/'));
-
-        // Process ASSIMP's root node recursively
-        processNode(scene->mRootNode, scene);
+        if (meshes.empty())
+            record.minLod = 0;
+        lodSelector.submit(record);
     }
 
-    // Processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-    void processNode(aiNode *node, const aiScene *scene)
+    // Queues one copy of the model per transform inside the view frustum and not occluded as one instanced draw per
+    // mesh and detail level in use. The instance buffer is refilled on every call, so call it at most once per model
+    // and frame. With the queue's GPU culling on, every transform goes to the compute pass instead, which tests them
+    // against the frustum only and picks their levels itself; the record then has no triangle counts.
+    void DrawInstanced(Shader &shader, const vector<glm::mat4> &allTransforms, LodSelector &lodSelector, RenderQueue &queue)
     {
-        // process each mesh located at the current node
-        for(unsigned int i = 0; i < node->mNumMeshes; i++)
+        PROFILE_ZONE("Queue instances");
+        if (queue.gpuCullingActive() && GpuCuller::accepts(meshes))
         {
-            // the node object only contains indices to index the actual objects in the scene. 
-            // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
-            aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            meshes.push_back(processMesh(mesh, scene));
+            if (allTransforms.empty())
+                return;
+            instances.upload(allTransforms.data(), allTransforms.size());
+            queue.addGpuCulled(shader, meshes, instances, static_cast<unsigned int>(allTransforms.size()), boundsMin, boundsMax, lodSelector);
+            lodSelector.submit({ name, static_cast<unsigned int>(allTransforms.size()), static_cast<unsigned int>(meshes.size()), 0, 0, 0, 0 });
+            return;
         }
-        // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
-        for(unsigned int i = 0; i < node->mNumChildren; i++)
+        queue.culler.cullInstances(boundsMin, boundsMax, allTransforms, visibleTransforms);
+        queue.occlusion.cullInstances(boundsMin, boundsMax, visibleTransforms);
+        const vector<glm::mat4> &transforms = visibleTransforms;
+        if (transforms.empty())
+            return;
+        size_t count = transforms.size();
+        LodDrawRecord record = { name, static_cast<unsigned int>(count), 0, ~0u, 0, 0, 0 };
+
+        // every mesh gets its own run of the instance buffer, grouped by detail level
+        instanceLods.resize(count);
+        instanceTransforms.resize(meshes.size() * count);
+        levelInstances.assign(meshes.size(), vector<unsigned int>());
+        levelDistances.assign(meshes.size(), vector<float>());
+        for (unsigned int i = 0; i < meshes.size(); i++)
         {
-            processNode(node->mChildren[i], scene);
+            vector<unsigned int> &levelCount = levelInstances[i];
+            levelCount.assign(meshes[i].lods.size(), 0);
+            // the nearest instance of each level places its draw in the queue's front to back order
+            vector<float> &levelDistance = levelDistances[i];
+            levelDistance.assign(meshes[i].lods.size(), numeric_limits<float>::max());
+            for (size_t j = 0; j < count; j++)
+            {
+                instanceLods[j] = lodSelector.select(meshes[i], transforms[j]);
+                levelCount[instanceLods[j]]++;
+                float distance = queue.depth(glm::vec3(transforms[j] * glm::vec4(meshes[i].boundsCenter, 1.0f)));
+                levelDistance[instanceLods[j]] = std::min(levelDistance[instanceLods[j]], distance);
+            }
+            vector<size_t> next(levelCount.size(), i * count);
+            for (size_t lod = 1; lod < levelCount.size(); lod++)
+                next[lod] = next[lod - 1] + levelCount[lod - 1];
+            for (size_t j = 0; j < count; j++)
+                instanceTransforms[next[instanceLods[j]]++] = transforms[j];
         }
+        instances.upload(instanceTransforms.data(), instanceTransforms.size());
 
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            size_t first = i * count;
+            for (unsigned int lod = 0; lod < levelInstances[i].size(); lod++)
+            {
+                unsigned int levelCount = levelInstances[i][lod];
+                if (levelCount == 0)
+                    continue;
+                queue.addInstanced(shader, meshes[i], lod, instances, first, levelCount, &instanceTransforms[first], levelDistances[i][lod]);
+                record.triangles += meshes[i].lods[lod].indexCount / 3 * levelCount;
+                record.drawCalls++;
+                record.minLod = std::min(record.minLod, lod);
+                record.maxLod = std::max(record.maxLod, lod);
+                first += levelCount;
+            }
+            record.fullDetailTriangles += meshes[i].lods[0].indexCount / 3 * static_cast<unsigned int>(count);
+        }
+        if (record.drawCalls == 0)
+            record.minLod = 0;
+        lodSelector.submit(record);
     }
 
+    // Adds one copy of the model's occluder per transform to the frame's occlusion buffer. Call it for the models
+    // that hide most of the scene (the buildings) after RenderQueue::begin and before OcclusionCuller::rasterize.
+    void AddOccluders(OcclusionCuller &occlusion, const vector<glm::mat4> &transforms) const
+    {
+        for (const glm::mat4 &transform : transforms)
+            occlusion.addOccluder(occluder, transform);
+    }
+    
+private:
+    // per-instance matrices of DrawInstanced and the scratch space to cull them and sort them by detail level
+    InstanceBuffer instances;
+    vector<glm::mat4> visibleTransforms;
+    vector<glm::mat4> instanceTransforms;
+    vector<unsigned int> instanceLods;
+    vector<vector<unsigned int>> levelInstances;
+    vector<vector<float>> levelDistances;
 
-    Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+    // Loads model using Assimp extensions and stores the models meshes
+    void loadModel(string const &path)
     {
-        // data to fill
-        vector<Vertex> vertices;
-        vector<unsigned int> indices;
-        vector<Texture> textures;
+        PROFILE_ZONE("Load model");
+        auto start = chrono::steady_clock::now();
 
-        // walk through each of the mesh's vertices
-        for(unsigned int i = 0; i < mesh->mNumVertices; i++)
-        {
-            Vertex vertex;
-            glm::vec3 vector; // we declare a placeholder vector since assimp uses its own vector class that doesn't directly convert to glm's vec3 class so we transfer the data to this placeholder glm::vec3 first.
-            // positions
-            vector.x = mesh->mVertices[i].x;
-            vector.y = mesh->mVertices[i].y;
-            vector.z = mesh->mVertices[i].z;
-            vertex.Position = vector;
-            // normals
-            if (mesh->HasNormals())
-            {
-                vector.x = mesh->mNormals[i].x;
-                vector.y = mesh->mNormals[i].y;
-                vector.z = mesh->mNormals[i].z;
-                vertex.Normal = vector;
-            }
-            // texture coordinates
-            if(mesh->mTextureCoords[0]) // does the mesh contain texture coordinates?
-            {
-                glm::vec2 vec;
-                // a vertex can contain up to 8 different texture coordinates. We thus make the assumption that we won't 
-                // use models where a vertex can have multiple texture coordinates so we always take the first set (0).
-                vec.x = mesh->mTextureCoords[0][i].x; 
-                vec.y = mesh->mTextureCoords[0][i].y;
-                vertex.TexCoords = vec;
-                // tangent
-                vector.x = mesh->mTangents[i].x;
-                vector.y = mesh->mTangents[i].y;
-                vector.z = mesh->mTangents[i].z;
-                vertex.Tangent = vector;
-                // bitangent
-                vector.x = mesh->mBitangents[i].x;
-                vector.y = mesh->mBitangents[i].y;
-                vector.z = mesh->mBitangents[i].z;
-                vertex.Bitangent = vector;
-            }
-            else
-                vertex.TexCoords = glm::vec2(0.0f, 0.0f);
+        // Retrieve the directory path of the filepath
+        directory = path.substr(0, path.find_last_of('/'));
+        name = path.substr(path.find_last_of('/') + 1);
 
-            vertices.push_back(vertex);
-        }
-        // now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
-        for(unsigned int i = 0; i < mesh->mNumFaces; i++)
+        // Cooked start: the mounted asset pack holds the processed meshes, the source files aren't touched
+        string cachePath = MeshCache::cachePath(path);
+        MeshCache cache;
+        if (AssetPack::instance().contains(cachePath))
+            loadedFromPack = cache.openCooked(cachePath);
+
+        // Warm start: build the meshes straight from the cache if it matches the source file
+        uint64_t key = 0;
+        if (!loadedFromPack)
         {
-            aiFace face = mesh->mFaces[i];
-            // retrieve all indices of the face and store them in the indices vector
-            for(unsigned int j = 0; j < face.mNumIndices; j++)
-                indices.push_back(face.mIndices[j]);        
+            key = MeshCache::sourceKey(path, MODEL_IMPORT_FLAGS);
+            loadedFromCache = cache.open(cachePath, key);
         }
-        // process materials
-        aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];    
 
-        float shininess;
-        if(AI_SUCCESS != aiGetMaterialFloat(material, AI_MATKEY_SHININESS, &shininess))
+        if (loadedFromPack || loadedFromCache)
+            loadFromCache(cache);
+        else
         {
-            // if unsuccessful set a default
-            shininess = 20.f;
-        } 
-        // we assume a convention for sampler names in the shaders. Each diffuse texture should be named
-        // as 'texture_diffuseN' where N is a sequential number ranging from 1 to MAX_SAMPLER_NUMBER. 
-        // Same applies to other texture as the following list summarizes:
-        // diffuse: texture_diffuseN
-        // specular: texture_specularN
-        // normal: texture_normalN
-
-        // 1. diffuse maps
-        vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-        textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
-        // 2. specular maps
-        vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-        textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
-        // 3. normal maps
-        std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
-        textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
-        // 4. height maps
-        std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
-        textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
-        
-        // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures, shininess);
+            vector<ImportedMesh> imported;
+            if (!MeshImporter::load(path, imported))
+                return;
+
+            // Store the processed meshes for the next start
+            MeshCache::write(cachePath, key, imported);
+
+            meshes.reserve(imported.size());
+            for (ImportedMesh &mesh : imported)
+            {
+                Material material;
+                material.shininess = mesh.shininess;
+                for (const Texture &texture : mesh.textures)
+                    loadMaterialTexture(material, texture.path.c_str(), texture.type);
+                meshes.push_back(Mesh(std::move(mesh.vertices), std::move(mesh.indices), MaterialLibrary::instance().acquire(material),
+                                      std::move(mesh.lods), vertexAttributes));
+            }
+        }
+
+        computeBounds();
+
+        loadTimeMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        cout << "MODEL::LOADED " << path << " (" << (loadedFromPack ? "cooked, asset pack" : loadedFromCache ? "warm, mesh cache" : "cold, assimp") << ") in " << loadTimeMs << " ms" << endl;
     }
 
-    // checks all material textures of a given type and loads the textures if they're not loaded yet.
-    // the required info is returned as a Texture struct.
-    vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName)
+    // Builds the meshes from an opened mesh cache
+    void loadFromCache(const MeshCache &cache)
     {
-        vector<Texture> textures;
-        for(unsigned int i = 0; i < mat->GetTextureCount(type); i++)
+        meshes.reserve(cache.meshCount());
+        for (unsigned int i = 0; i < cache.meshCount(); i++)
         {
-            aiString str;
-            mat->GetTexture(type, i, &str);
-            // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            bool skip = false;
-            for(unsigned int j = 0; j < textures_loaded.size(); j++)
+            const MeshCacheRecord &record = cache.record(i);
+            const Vertex* vertices = cache.vertices(i);
+            const unsigned int* indices = cache.indices(i);
+
+            Material material;
+            material.shininess = record.shininess;
+            for (unsigned int j = 0; j < record.textureCount; j++)
             {
-                if(std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-                {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
-                }
+                const MeshCacheTextureRef &ref = cache.textureRef(record.firstTexture + j);
+                loadMaterialTexture(material, ref.path, ref.type);
             }
-            if(!skip)
-            {   // if texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
-                texture.type = typeName;
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
+            vector<MeshLod> lods;
+            for (unsigned int j = 0; j < record.lodCount; j++)
+            {
+                const MeshCacheLod &lod = cache.lod(record.firstLod + j);
+                lods.push_back({ lod.indexOffset, lod.indexCount, lod.error });
             }
+            meshes.push_back(Mesh(vector<Vertex>(vertices, vertices + record.vertexCount),
+                                  vector<unsigned int>(indices, indices + record.indexCount),
+                                  MaterialLibrary::instance().acquire(material), std::move(lods), vertexAttributes));
         }
-        return textures;
     }
-};
-
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma)
-{
-    string filename = string(path);
-    filename = directory + '/' + filename;
-
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
+    // the union of the meshes' boxes, a sphere around it that holds every mesh's sphere, and the box occluder inside
+    void computeBounds()
+    {
+        if (meshes.empty())
+            return;
+        boundsMin = meshes[0].boundsMin;
+        boundsMax = meshes[0].boundsMax;
+        for (const Mesh &mesh : meshes)
+        {
+            boundsMin = glm::min(boundsMin, mesh.boundsMin);
+            boundsMax = glm::max(boundsMax, mesh.boundsMax);
+        }
+        boundsCenter = (boundsMin + boundsMax) * 0.5f;
+        boundsRadius = 0.0f;
+        for (const Mesh &mesh : meshes)
+            boundsRadius = std::max(boundsRadius, glm::length(mesh.boundsCenter - boundsCenter) + mesh.boundsRadius);
+        occluder = OccluderMesh::innerBox(boundsMin, boundsMax);
+    }
 
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
+    // Loads a texture into its material slot. The shaders sample one texture per slot, so textures without a slot
+    // and further ones of a filled slot are never loaded.
+    void loadMaterialTexture(Material &material, const char *path, const string &typeName)
     {
-        GLenum format = GL_RED;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
+        MaterialSlot slot = materialSlot(typeName);
+        if (slot == MATERIAL_SLOT_COUNT || material.textures[slot] != 0)
+            return;
+        material.textures[slot] = loadTexture(path, typeName).id;
     }
-    else
+
+    // loads a texture relative to the model directory. The registry shares it with every other model using the same image.
+    Texture loadTexture(const char *path, const string &typeName)
     {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
+        // a path this model already holds is reused without asking the registry again, so the registry's savings
+        // only count loads that a model on its own would have done
+        for (const Texture &loaded : textures_loaded)
+            if (loaded.path == path)
+                return loaded;
+
+        // placeholders that light the surface sensibly until the real texture has streamed in
+        static const unsigned char flatNormal[4] = { 128, 128, 255, 255 };
+        static const unsigned char noSpecular[4] = { 0, 0, 0, 255 };
+        const unsigned char *placeholder = DEFAULT_PLACEHOLDER;
+        if (typeName == "texture_normal")
+            placeholder = flatNormal;
+        else if (typeName == "texture_specular")
+            placeholder = noSpecular;
+
+        Texture texture;
+        texture.id = TextureFromFile(path, this->directory, false, placeholder);
+        texture.type = typeName;
+        texture.path = path;
+        textures_loaded.push_back(texture);  // remember the reference so the destructor can release it
+        return texture;
     }
+};
+
+
+unsigned int TextureFromFile(const char *path, const string &directory, bool gamma, const unsigned char placeholder[4])
+{
+    string filename = string(path);
+    filename = directory + '/' + filename;
 
-    return textureID;
+    // Streams the image in only if no model has loaded an identical one yet. The caller owns a reference.
+    return TextureRegistry::instance().acquire(filename, placeholder);
 }
 #endif
\ No newline at end of file
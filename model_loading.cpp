@@ -12,18 +12,28 @@
 #include "shader_m.h"
 #include "camera.h"
 #include "model.h"
+#include "gpu_timer.h"
+#include "overdraw_view.h"
+#include "profiler_view.h"
+#include "benchmark.h"
 
 #include <iostream>
+#include <memory>
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void processInput(GLFWwindow *window);
 unsigned int loadCubemap(vector<std::string> faces);
+void appendStressBuildings(int count, vector<glm::mat4> &buildings);
+void appendStressRobots(int count, float time, vector<glm::mat4> &bodies, vector<glm::mat4> &heads, vector<glm::mat4> &leftArms, vector<glm::mat4> &rightArms);
+void appendCityLights(int count, float time, vector<PointLight> &lights);
 
 // Consts
 const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 600;
+const float NEAR_PLANE = 0.1f;
+const float FAR_PLANE = 100.0f;
 
 // Camera
 Camera camera(glm::vec3(0.0f, 3.0f, 20.0f));
@@ -41,8 +51,14 @@ bool imgui_visible = false;
 // Boolean: If true, don't update imgui control pref. If false, do.
 bool shift_active = false;
 
-int main()
+int main(int argc, char **argv)
 {
+    PROFILE_THREAD("Main");
+    // --bench renders a camera path offscreen on a fixed clock and reports frame times, see benchmark.h; --golden
+    // compares fixed poses with reference images, see golden_images.h
+    BenchmarkOptions benchmarkOptions;
+    if (!parseBenchmarkArguments(argc, argv, benchmarkOptions))
+        return -1;
     // glfw: initialize and configure
     // ------------------------------
     glfwInit();
@@ -53,6 +69,8 @@ int main()
     #ifdef __APPLE__
         glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     #endif
+    if (benchmarkOptions.offscreen())
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
 
     // glfw window creation
     // --------------------
@@ -63,6 +81,7 @@ int main()
         glfwTerminate();
         return -1;
     }
+    double windowCreated = glfwGetTime();
     glfwMakeContextCurrent(window);
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
     glfwSetCursorPosCallback(window, mouse_callback);
@@ -78,6 +97,17 @@ int main()
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
+    // indirect multi-draws if the driver gave us more than the GL 3.3 asked for
+    bool multiDrawIndirect = MultiDraw::load((GLADloadproc)glfwGetProcAddress);
+    std::cout << "MULTI_DRAW:: " << glGetString(GL_VERSION) << (multiDrawIndirect ? ", drawing with glMultiDrawElementsIndirect"
+              : ", no glMultiDrawElementsIndirect, drawing with glDrawElementsBaseVertex") << std::endl;
+    // compute shaders for culling instances on the GPU, GL 4.3 as well
+    bool computeCulling = ComputeShader::load((GLADloadproc)glfwGetProcAddress);
+    std::cout << "GPU_CULLING:: " << (computeCulling ? "compute shaders available" : "no compute shaders, culling on the CPU") << std::endl;
+    // linked programs are kept on disk between runs (GL 4.1), and compile on the driver's threads where it has them
+    bool programCache = ProgramCache::instance().load((GLADloadproc)glfwGetProcAddress);
+    std::cout << "PROGRAM_CACHE:: " << (programCache ? std::string("program binaries in ") + PROGRAM_CACHE_DIRECTORY + "/" : std::string("no program binaries"))
+              << (ProgramCache::instance().parallelCompile() ? ", parallel shader compile" : "") << std::endl;
 
     // Initialize ImGUI
     IMGUI_CHECKVERSION();
@@ -94,26 +124,14 @@ int main()
     glm::vec3 lightDirection(0.1f, -1.0f, 0.7f);
     glm::vec3 dirLightColour = glm::vec3(1.0f, 0.1f, 0.1f);
 
-    // Point Light 1
-    glm::vec3 pointLight1Colour = glm::vec3(1.0f, 1.0f, 1.0f);
-    glm::vec3 pointLight1Position = glm::vec3(-15.0f, 4.0f, 0.0f);
-    float pointLight1Constant = 0.170f;
-    float pointLight1Linear = 0.103f;
-    float pointLight1Quadratic = 0.064f;
-
-    // Point Light 2
-    glm::vec3 pointLight2Colour = glm::vec3(1.0f, 1.0f, 1.0f);
-    glm::vec3 pointLight2Position = glm::vec3(6.0f, 9.0f, 0.0f);
-    float pointLight2Constant = 0.170f;
-    float pointLight2Linear = 0.103f;
-    float pointLight2Quadratic = 0.064f;
-
-    // Point Light 3
-    glm::vec3 pointLight3Colour = glm::vec3(1.0f, 1.0f, 1.0f);
-    glm::vec3 pointLight3Position = glm::vec3(-12.0f, 10.0f, 0.0f);
-    float pointLight3Constant = 0.170f;
-    float pointLight3Linear = 0.103f;
-    float pointLight3Quadratic = 0.064f;
+    // Point lights: the three with their own controls, then the city's fires and street lamps (light_clusters.h)
+    const int CONTROLLED_POINT_LIGHTS = 3;
+    vector<PointLight> pointLights = {
+        { glm::vec3(-15.0f, 4.0f, 0.0f), glm::vec3(1.0f, 1.0f, 1.0f), 0.170f, 0.103f, 0.064f },
+        { glm::vec3(6.0f, 9.0f, 0.0f), glm::vec3(1.0f, 1.0f, 1.0f), 0.170f, 0.103f, 0.064f },
+        { glm::vec3(-12.0f, 10.0f, 0.0f), glm::vec3(1.0f, 1.0f, 1.0f), 0.170f, 0.103f, 0.064f },
+    };
+    int cityLights = 0;
 
     // Fog
     glm::vec3 fogColour = glm::vec3(1.0f, 0.25f, 0.25f);
@@ -187,56 +205,230 @@ int main()
     
     glEnable(GL_DEPTH_TEST);
 
+    // Mount the cooked asset pack if there is one. Shaders, models, textures and the cubemap are looked up
+    // in it first and fall back to the loose files.
+    // -------------------------
+    if (AssetPack::instance().mount(ASSET_PACK_DEFAULT_PATH))
+        std::cout << "ASSET_PACK:: mounted " << ASSET_PACK_DEFAULT_PATH << " (" << AssetPack::instance().entryCount() << " assets, "
+                  << AssetPack::instance().size() / (1024.0 * 1024.0) << " MB)" << std::endl;
+
     // Build/Compile Shaders
     // -------------------------
-    Shader ourShader("shaders/1.model_loading.vs", "shaders/1.model_loading.fs");
-    Shader skyboxShader("shaders/skybox.vs", "shaders/skybox.fs");
+    // Everything but the model shader, which the models need linked to pick their vertex layouts, compiles while
+    // the models load; programs linked in an earlier run come straight from the program cache
+    double shaderStart = glfwGetTime();
+    Shader skyboxShader("shaders/skybox.vs", "shaders/skybox.fs", ShaderDefines(), SHADER_BUILD_ASYNC);
+    // depth-only pre-pass, and the overdraw view's fragment counter in place of the lighting
+    Shader depthShader("shaders/depth_prepass.vs", "shaders/depth_prepass.fs", ShaderDefines(), SHADER_BUILD_ASYNC);
+    Shader overdrawShader("shaders/1.model_loading.vs", "shaders/overdraw.fs", shaderVariantDefines(SHADER_FEATURE_INSTANCED), SHADER_BUILD_ASYNC);
+    // The model shader is compiled per feature set (shader_variants.h); models queue the variant with every feature
+    // and the render queue switches each packet to the one its material needs
+    ShaderVariants modelShaders("shaders/1.model_loading.vs", "shaders/1.model_loading.fs");
+    Shader &ourShader = modelShaders.variant(shaderVariantKey(SHADER_FEATURES_ALL, 0));
+    double shaderMilliseconds = (glfwGetTime() - shaderStart) * 1000.0;
     
+    // Models are built from their mesh caches when they're up to date, time both cases
+    double modelLoadStart = glfwGetTime();
+    // every mesh gets the smallest vertex layout that has what the model shader reads
+    unsigned int modelAttributes = ourShader.vertexAttributes();
+
     // Loading Robot1 (all parts)
     // Robot1Body is the main model, the rest are objects attached
-    Model robotBody("models/robot/robot_body.obj");
+    Model robotBody("models/robot/robot_body.obj", false, modelAttributes);
     
     // Adding child parts
-    Model robotLeftArm("models/robot/robot_armL.obj");
-    Model robotRightArm("models/robot/robot_armR.obj");
-    Model robotHead("models/robot/robot_head.obj");
+    Model robotLeftArm("models/robot/robot_armL.obj", false, modelAttributes);
+    Model robotRightArm("models/robot/robot_armR.obj", false, modelAttributes);
+    Model robotHead("models/robot/robot_head.obj", false, modelAttributes);
 
     // Loading Spire Base
-    Model spireBase("models/spirebase/spirebase.obj");
+    Model spireBase("models/spirebase/spirebase.obj", false, modelAttributes);
 
     // Loading Spire Top
-    Model spireTop("models/spiretop/spiretop.obj");
+    Model spireTop("models/spiretop/spiretop.obj", false, modelAttributes);
 
     // Loading Buildings
-    Model building("models/buildings/Building01.obj");
+    Model building("models/buildings/Building01.obj", false, modelAttributes);
 
     // Loading Floor Plane
-    Model floor("models/floor/floor.obj");
+    Model floor("models/floor/floor.obj", false, modelAttributes);
+
+    const Model* sceneModels[] = { &robotBody, &robotLeftArm, &robotRightArm, &robotHead, &spireBase, &spireTop, &building, &floor };
+    bool warmStart = true, cookedStart = true;
+    for (const Model* model : sceneModels)
+    {
+        warmStart = warmStart && (model->loadedFromCache || model->loadedFromPack);
+        cookedStart = cookedStart && model->loadedFromPack;
+    }
+    std::cout << "Scene models loaded in " << (glfwGetTime() - modelLoadStart) * 1000.0 << " ms ("
+              << (cookedStart ? "cooked start" : warmStart ? "warm start" : "cold start") << ")" << std::endl;
+    TextureRegistry::instance().printStats();
+    MaterialLibrary::instance().printStats();
+
+    shaderStart = glfwGetTime();
+    skyboxShader.finish();
+    depthShader.finish();
+    overdrawShader.finish();
+    shaderMilliseconds += (glfwGetTime() - shaderStart) * 1000.0;
+    std::cout << "Shaders ready after " << shaderMilliseconds << " ms on the main thread ("
+              << (ProgramCache::instance().misses == 0 ? "warm" : ProgramCache::instance().hits == 0 ? "cold" : "partly warm") << ")" << std::endl;
+    ProgramCache::instance().printStats();
+
+    size_t sceneVertices = 0, sceneVertexBytes = 0;
+    for (const Model* model : sceneModels)
+    {
+        sceneVertices += model->vertexCount();
+        sceneVertexBytes += model->vertexBufferBytes();
+    }
+    std::cout << "VERTEX_FORMAT:: " << sceneVertices << " vertices, " << selectVertexLayout(modelAttributes).name << " layout, "
+              << sizeof(Vertex) << " -> " << (sceneVertices ? double(sceneVertexBytes) / sceneVertices : 0.0) << " bytes per vertex, VBOs "
+              << sceneVertices * sizeof(Vertex) / 1024.0 << " KB -> " << sceneVertexBytes / 1024.0 << " KB" << std::endl;
+    std::cout << "GEOMETRY_POOL:: " << GeometryPool::instance().vertexBytes() / 1024.0 << " KB of vertices in " << GeometryPool::instance().streamCount()
+              << " shared buffers, " << GeometryPool::instance().indexBytes() / 1024.0 << " KB of indices in one" << std::endl;
 
     ourShader.use();
-    ourShader.setFloat("ambientStrength", ambientStrength);
-    ourShader.setVec3("ambientColour", ambientColour);
     ourShader.setInt("main", 0);
 
     skyboxShader.use();
     skyboxShader.setInt("skybox", 0);
 
+    // Per-frame and light uniform blocks, each written at most once a frame (uniform_blocks.h). Camera, fog and
+    // the ambient and directional lights live there, shared by every program; the per-draw matrices are set by the
+    // render queue.
+    FrameUniformData frameData;
+    LightUniformData lightData;
+    UniformBlock<FrameUniformData> frameBlock(UNIFORM_BINDING_FRAME);
+    UniformBlock<LightUniformData> lightBlock(UNIFORM_BINDING_LIGHTS);
+    // and the point lights, assigned to view frustum clusters every frame
+    LightClusters lightClusters;
+
+    // Collects the frame's draws and submits them sorted by state, see render_queue.h
+    RenderQueue renderQueue;
+    renderQueue.depthShader = &depthShader;
+    renderQueue.multiDraw = multiDrawIndirect;
+    renderQueue.gpuCulling = computeCulling;
+    renderQueue.variants = &modelShaders;
+
+    // GPU time of the scene pass with the depth pre-pass off [0] and on [1], and the frame times to go with them
+    GpuTimer sceneTimers[2];
+    float frameMilliseconds[2] = { 0.0f, 0.0f };
+    // fragments shaded per pixel, instead of the lit scene
+    OverdrawView overdrawView;
+    bool showOverdraw = false;
+    // read the GPU culled instance counts back every frame
+    bool readGpuCulling = false;
+    // scene GPU and frame times with the shader variants off [0] and on [1]
+    double variantSceneMilliseconds[2] = { 0.0, 0.0 };
+    float variantFrameMilliseconds[2] = { 0.0f, 0.0f };
+
     //Load cube map
     unsigned int cubemapTexture = loadCubemap(faces);
+#ifdef PROFILER_ENABLED
+    // flame graph and frame time histogram, see profiler_view.h
+    ProfilerView profilerView;
+#endif
+
+    // Picks the detail level of every model drawn, see lod_selector.h
+    LodSelector lodSelector;
+
+    // Per-frame instance transforms. Stress mode adds a field of extra buildings and a crowd of extra robots.
+    vector<glm::mat4> robotBodies, robotHeads, robotLeftArms, robotRightArms, buildings;
+    bool stressMode = false;
+    int stressInstances = 1000;
+
+    // Textures stream in over the first frames, report when the first frame is out and when they're all in
+    bool firstFrame = true;
+    bool texturesStreamed = false;
+
+    // Benchmarks and golden image runs draw into their own framebuffer, the window is never shown
+    Benchmark benchmark(benchmarkOptions);
+    GoldenRun goldenRun(benchmarkOptions.goldenTests, benchmarkOptions.updateGolden);
+    unique_ptr<BenchmarkTarget> benchmarkTarget;
+    if (benchmarkOptions.offscreen())
+    {
+        int width, height;
+        glfwGetFramebufferSize(window, &width, &height);
+        benchmarkTarget.reset(new BenchmarkTarget(std::max(width, 1), std::max(height, 1)));
+    }
+    if (benchmarkOptions.golden && !goldenRun.load())
+        return -1;
+    if (benchmarkOptions.enabled)
+    {
+        if (!benchmark.load())
+            return -1;
+        stressMode = benchmarkOptions.stressInstances > 0;
+        stressInstances = std::max(benchmarkOptions.stressInstances, 1);
+        cityLights = benchmarkOptions.cityLights;
+        std::cout << "BENCHMARK:: " << benchmarkOptions.cameraPath << " (" << benchmark.path.duration() << " s), " << benchmarkOptions.warmupFrames
+                  << " warm-up and " << benchmarkOptions.measuredFrames << " measured frames at " << benchmarkTarget->width << "x"
+                  << benchmarkTarget->height << std::endl;
+    }
+
+    // Frames are read back and written to disk behind the render loop, see frame_recorder.h; --record starts right
+    // away, the Recording window any time
+    FrameRecorder recorder;
+    RecordFormat recordFormat = benchmarkOptions.recordFormat;
+    if (!benchmarkOptions.recordDirectory.empty())
+    {
+        int width, height;
+        glfwGetFramebufferSize(window, &width, &height);
+        int framesPerSecond = benchmarkOptions.offscreen() ? static_cast<int>(std::lround(1.0 / benchmarkOptions.timeStep)) : 60;
+        if (!recorder.start(benchmarkOptions.recordDirectory, recordFormat, std::max(width, 1), std::max(height, 1), std::max(framesPerSecond, 1)))
+            return -1;
+    }
 
     // render loop
     // -----------
     while (!glfwWindowShouldClose(window))
     {
-        // per-frame time logic
+        // everything recorded since the last time through is one frame, and the first one holds the startup
+        PROFILE_FRAME();
+        PROFILE_ZONE("Frame");
+
+        // per-frame time logic: the wall clock, or a benchmark's virtual one and its camera
         // --------------------
-        float currentFrame = static_cast<float>(glfwGetTime());
+        double sceneTime = glfwGetTime();
+        if (benchmarkOptions.enabled)
+        {
+            benchmark.beginFrame(texturesStreamed);
+            if (benchmark.done())
+                break;
+            sceneTime = benchmark.time();
+            CameraKey key = benchmark.camera();
+            camera.SetPose(key.position, key.yaw, key.pitch);
+        }
+        else if (benchmarkOptions.golden)
+        {
+            if (goldenRun.done())
+                break;
+            sceneTime = goldenRun.time();
+            CameraKey key = goldenRun.camera();
+            camera.SetPose(key.position, key.yaw, key.pitch);
+        }
+        if (benchmarkTarget)
+            benchmarkTarget->bind();
+        float currentFrame = static_cast<float>(sceneTime);
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
         // input
         // -----
-        processInput(window);
+        if (!benchmarkOptions.offscreen())
+            processInput(window);
+
+        // upload whatever the texture decode workers have finished, within the per-frame budget
+        {
+            PROFILE_ZONE("Texture uploads");
+            TextureStreamer::instance().update(TEXTURE_UPLOAD_BUDGET);
+        }
+        if (!texturesStreamed && TextureStreamer::instance().pending() == 0)
+        {
+            texturesStreamed = true;
+            std::cout << "Textures streamed in " << (glfwGetTime() - windowCreated) * 1000.0 << " ms ("
+                      << TextureStreamer::instance().totalBytesUploaded() / (1024.0 * 1024.0) << " MB)" << std::endl;
+        }
+        // the uploads above bound textures behind the material binder's back
+        MaterialBinder::instance().beginFrame();
 
         // render
         // ------
@@ -259,39 +451,24 @@ int main()
         ImGui::SliderFloat("Directional Light Z", &lightDirection.z, -1.0f, 1.0f);
         ImGui::End();
 
-        // Point Light 1 Controller
-        pointLight1Colour = glm::vec3(sin(glfwGetTime() * 1.0f), 0.0f, 0.0f);
-        ImGui::Begin("Point Light 1");
-        ImGui::ColorEdit3("Point Light 1 Colour", (float*)&pointLight1Colour);
-        ImGui::SliderFloat("Light X", &pointLight1Position.x, -200.0f, 200.0f);
-        ImGui::SliderFloat("Light Y", &pointLight1Position.y, -200.0f, 200.0f);
-        ImGui::SliderFloat("Light Z", &pointLight1Position.z, -200.0f, 200.0f);
-        ImGui::SliderFloat("Point Light 1 Constant", &pointLight1Constant, 0.0f, 1.0f);
-        ImGui::SliderFloat("Point Light 1 Linear", &pointLight1Linear, 0.0f, 1.0f);
-        ImGui::SliderFloat("Point Light 1 Quadratic", &pointLight1Quadratic, 0.0f, 1.0f);
-        ImGui::End();
-
-        // Point Light 2 Controller
-        ImGui::Begin("Point Light 2");
-        ImGui::ColorEdit3("Point Light 2 Colour", (float*)&pointLight2Colour);
-        ImGui::SliderFloat("Light X", &pointLight2Position.x, -200.0f, 200.0f);
-        ImGui::SliderFloat("Light Y", &pointLight2Position.y, -200.0f, 200.0f);
-        ImGui::SliderFloat("Light Z", &pointLight2Position.z, -200.0f, 200.0f);
-        ImGui::SliderFloat("Point Light 2 Constant", &pointLight2Constant, 0.0f, 1.0f);
-        ImGui::SliderFloat("Point Light 2 Linear", &pointLight2Linear, 0.0f, 1.0f);
-        ImGui::SliderFloat("Point Light 2 Quadratic", &pointLight2Quadratic, 0.0f, 1.0f);
-        ImGui::End();
-
-        // Point Light 3 Controller
-        ImGui::Begin("Point Light 3");
-        ImGui::ColorEdit3("Point Light 3 Colour", (float*)&pointLight3Colour);
-        ImGui::SliderFloat("Light X", &pointLight2Position.x, -200.0f, 200.0f);
-        ImGui::SliderFloat("Light Y", &pointLight2Position.y, -200.0f, 200.0f);
-        ImGui::SliderFloat("Light Z", &pointLight2Position.z, -200.0f, 200.0f);
-        ImGui::SliderFloat("Point Light 3 Constant", &pointLight3Constant, 0.0f, 1.0f);
-        ImGui::SliderFloat("Point Light 3 Linear", &pointLight3Linear, 0.0f, 1.0f);
-        ImGui::SliderFloat("Point Light 3 Quadratic", &pointLight3Quadratic, 0.0f, 1.0f);
-        ImGui::End();
+        // Point Light Controllers
+        pointLights.resize(CONTROLLED_POINT_LIGHTS);
+        pointLights[0].colour = glm::vec3(sin(sceneTime * 1.0f), 0.0f, 0.0f);
+        for (int i = 0; i < CONTROLLED_POINT_LIGHTS; i++)
+        {
+            PointLight &light = pointLights[i];
+            string title = "Point Light " + std::to_string(i + 1);
+            ImGui::Begin(title.c_str());
+            ImGui::ColorEdit3((title + " Colour").c_str(), (float*)&light.colour);
+            ImGui::SliderFloat("Light X", &light.position.x, -200.0f, 200.0f);
+            ImGui::SliderFloat("Light Y", &light.position.y, -200.0f, 200.0f);
+            ImGui::SliderFloat("Light Z", &light.position.z, -200.0f, 200.0f);
+            ImGui::SliderFloat((title + " Constant").c_str(), &light.constant, 0.0f, 1.0f);
+            ImGui::SliderFloat((title + " Linear").c_str(), &light.linear, 0.0f, 1.0f);
+            ImGui::SliderFloat((title + " Quadratic").c_str(), &light.quadratic, 0.0f, 1.0f);
+            ImGui::End();
+        }
+        appendCityLights(cityLights, static_cast<float>(sceneTime), pointLights);
 
         // Fog Controller
         ImGui::Begin("Fog Controls");
@@ -304,42 +481,34 @@ int main()
         // Enable shaders
         ourShader.use();
        
-        //Set Shader uniforms 
-        ourShader.setFloat("ambientStrength", ambientStrength);
-        ourShader.setVec3("ambientColour", ambientColour);
-        ourShader.setVec3("viewPos", camera.Position); 
-
-        ourShader.setVec3("dirColour", dirLightColour);
-        ourShader.setVec3("lightDirection", lightDirection);
-
-        ourShader.setVec3("pointLights[0].colour", pointLight1Colour);
-        ourShader.setVec3("pointLights[0].position", pointLight1Position);
-        ourShader.setFloat("pointLights[0].constant", pointLight1Constant);
-        ourShader.setFloat("pointLights[0].linear", pointLight1Linear);
-        ourShader.setFloat("pointLights[0].quadratic", pointLight1Quadratic);
-
-        ourShader.setVec3("pointLights[1].colour", pointLight2Colour);
-        ourShader.setVec3("pointLights[1].position", pointLight2Position);
-        ourShader.setFloat("pointLights[1].constant", pointLight2Constant);
-        ourShader.setFloat("pointLights[1].linear", pointLight2Linear);
-        ourShader.setFloat("pointLights[1].quadratic", pointLight2Quadratic);
-
-        ourShader.setVec3("pointLights[2].colour", pointLight3Colour);
-        ourShader.setVec3("pointLights[2].position", pointLight3Position);
-        ourShader.setFloat("pointLights[2].constant", pointLight3Constant);
-        ourShader.setFloat("pointLights[2].linear", pointLight3Linear);
-        ourShader.setFloat("pointLights[2].quadratic", pointLight3Quadratic);
-
-        ourShader.setVec3("fogColour", fogColour);
-        ourShader.setFloat("fogDensity", fogDensity);
-        ourShader.setFloat("fogStart", fogStart);
-        ourShader.setFloat("fogEnd", fogEnd);
-
-        // View/projection transformations
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+        // Camera, time and fog
+        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, NEAR_PLANE, FAR_PLANE);
         glm::mat4 view = camera.GetViewMatrix();
-        ourShader.setMat4("projection", projection);
-        ourShader.setMat4("view", view);
+        frameData.view = view;
+        frameData.projection = projection;
+        frameData.viewProjection = projection * view;
+        frameData.skyViewProjection = projection * glm::mat4(glm::mat3(view));
+        frameData.viewPosition = glm::vec4(camera.Position, static_cast<float>(sceneTime));
+        frameData.fogColour = glm::vec4(fogColour, fogDensity);
+        frameData.fogRange = glm::vec4(fogStart, fogEnd, 0.0f, 0.0f);
+        int framebufferWidth, framebufferHeight;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        lightClusters.grid.setProjection(projection, NEAR_PLANE, FAR_PLANE);
+        frameData.clusterGrid = lightClusters.grid.gridParameters(static_cast<float>(std::max(framebufferWidth, 1)),
+                                                                  static_cast<float>(std::max(framebufferHeight, 1)));
+        frameBlock.update(frameData);
+
+        // Lights, unchanged frames skip the write
+        lightData.ambient = glm::vec4(ambientColour, ambientStrength);
+        lightData.directionalColour = glm::vec4(dirLightColour, 0.0f);
+        lightData.directionalDirection = glm::vec4(lightDirection, 0.0f);
+        lightBlock.update(lightData);
+
+        // Point lights binned into the clusters of the view frustum, then bound for the fragment shader
+        lightClusters.update(pointLights, view, projection, NEAR_PLANE, FAR_PLANE);
+        lightClusters.bind();
+
+        lodSelector.beginFrame(camera.Position, glm::radians(camera.Zoom), (float)SCR_HEIGHT);
 
         // Matrix for each loaded model
         glm::mat4 model_robot1 = glm::mat4(1.0f);
@@ -407,10 +576,10 @@ int main()
 
         //Make models 'walk'
         float walkVelocity = 0.6f; //Velocity for model arm rotation
-        model_robot1 = glm::translate(model_robot1, glm::vec3(0.0f, 0.0f, static_cast<float>(glfwGetTime()*walkVelocity))); 
-        model_robot2 = glm::translate(model_robot2, glm::vec3(0.0f, 0.0f, static_cast<float>(glfwGetTime()*walkVelocity)));
-        model_robot3 = glm::translate(model_robot3, glm::vec3(0.0f, 0.0f, static_cast<float>(glfwGetTime()*walkVelocity)));
-        model_robot4 = glm::translate(model_robot4, glm::vec3(0.0f, 0.0f, static_cast<float>(glfwGetTime()*walkVelocity)));
+        model_robot1 = glm::translate(model_robot1, glm::vec3(0.0f, 0.0f, static_cast<float>(sceneTime*walkVelocity))); 
+        model_robot2 = glm::translate(model_robot2, glm::vec3(0.0f, 0.0f, static_cast<float>(sceneTime*walkVelocity)));
+        model_robot3 = glm::translate(model_robot3, glm::vec3(0.0f, 0.0f, static_cast<float>(sceneTime*walkVelocity)));
+        model_robot4 = glm::translate(model_robot4, glm::vec3(0.0f, 0.0f, static_cast<float>(sceneTime*walkVelocity)));
 
         //Move child parts to Beginning positions
         model_head1 = glm::translate(model_robot1, glm::vec3(0.0f, 0.0f, 0.0f));
@@ -430,84 +599,225 @@ int main()
 
         //Swing robot arms
         float armVelocity = 3.0f; //Velocity for model arm rotation
-        model_leftArm1 = glm::rotate(model_leftArm1, static_cast<float>(0.2f *(sin(glfwGetTime()))) * (armVelocity), glm::vec3(0.0f, 1.0f, 0.0f));
-        model_leftArm2 = glm::rotate(model_leftArm2, static_cast<float>(0.2f *(sin(glfwGetTime()))) * (armVelocity), glm::vec3(0.0f, 1.0f, 0.0f));
-        model_leftArm3 = glm::rotate(model_leftArm3, static_cast<float>(0.2f *(sin(glfwGetTime()))) * (armVelocity), glm::vec3(0.0f, 1.0f, 0.0f));
-        model_leftArm4 = glm::rotate(model_leftArm4, static_cast<float>(0.2f *(sin(glfwGetTime()))) * (armVelocity), glm::vec3(0.0f, 1.0f, 0.0f));
-
-        model_rightArm1 = glm::rotate(model_rightArm1, static_cast<float>(0.2f *(sin(glfwGetTime()))) * (armVelocity), glm::vec3(0.0f, 1.0f, 0.0f));
-        model_rightArm2 = glm::rotate(model_rightArm2, static_cast<float>(0.2f *(sin(glfwGetTime()))) * (armVelocity), glm::vec3(0.0f, 1.0f, 0.0f));
-        model_rightArm3 = glm::rotate(model_rightArm3, static_cast<float>(0.2f *(sin(glfwGetTime()))) * (armVelocity), glm::vec3(0.0f, 1.0f, 0.0f));
-        model_rightArm4 = glm::rotate(model_rightArm4, static_cast<float>(0.2f *(sin(glfwGetTime()))) * (armVelocity), glm::vec3(0.0f, 1.0f, 0.0f));
+        model_leftArm1 = glm::rotate(model_leftArm1, static_cast<float>(0.2f *(sin(sceneTime))) * (armVelocity), glm::vec3(0.0f, 1.0f, 0.0f));
+        model_leftArm2 = glm::rotate(model_leftArm2, static_cast<float>(0.2f *(sin(sceneTime))) * (armVelocity), glm::vec3(0.0f, 1.0f, 0.0f));
+        model_leftArm3 = glm::rotate(model_leftArm3, static_cast<float>(0.2f *(sin(sceneTime))) * (armVelocity), glm::vec3(0.0f, 1.0f, 0.0f));
+        model_leftArm4 = glm::rotate(model_leftArm4, static_cast<float>(0.2f *(sin(sceneTime))) * (armVelocity), glm::vec3(0.0f, 1.0f, 0.0f));
+
+        model_rightArm1 = glm::rotate(model_rightArm1, static_cast<float>(0.2f *(sin(sceneTime))) * (armVelocity), glm::vec3(0.0f, 1.0f, 0.0f));
+        model_rightArm2 = glm::rotate(model_rightArm2, static_cast<float>(0.2f *(sin(sceneTime))) * (armVelocity), glm::vec3(0.0f, 1.0f, 0.0f));
+        model_rightArm3 = glm::rotate(model_rightArm3, static_cast<float>(0.2f *(sin(sceneTime))) * (armVelocity), glm::vec3(0.0f, 1.0f, 0.0f));
+        model_rightArm4 = glm::rotate(model_rightArm4, static_cast<float>(0.2f *(sin(sceneTime))) * (armVelocity), glm::vec3(0.0f, 1.0f, 0.0f));
         
 
-        // Set the shaders for models
-        ourShader.setMat4("model", model_robot1);
-        robotBody.Draw(ourShader);
-        ourShader.setMat4("model", model_leftArm1);
-        robotLeftArm.Draw(ourShader);
-        ourShader.setMat4("model", model_rightArm1);
-        robotRightArm.Draw(ourShader);
-        ourShader.setMat4("model", model_head1);
-        robotHead.Draw(ourShader);
-
-        ourShader.setMat4("model", model_robot2);
-        robotBody.Draw(ourShader);
-        ourShader.setMat4("model", model_leftArm2);
-        robotLeftArm.Draw(ourShader);
-        ourShader.setMat4("model", model_rightArm2);
-        robotRightArm.Draw(ourShader);
-        ourShader.setMat4("model", model_head2);
-        robotHead.Draw(ourShader);
-
-        ourShader.setMat4("model", model_robot3);
-        robotBody.Draw(ourShader);
-        ourShader.setMat4("model", model_leftArm3);
-        robotLeftArm.Draw(ourShader);
-        ourShader.setMat4("model", model_rightArm3);
-        robotRightArm.Draw(ourShader);
-        ourShader.setMat4("model", model_head3);
-        robotHead.Draw(ourShader);
-
-        ourShader.setMat4("model", model_robot4);
-        robotBody.Draw(ourShader);
-        ourShader.setMat4("model", model_leftArm4);
-        robotLeftArm.Draw(ourShader);
-        ourShader.setMat4("model", model_rightArm4);
-        robotRightArm.Draw(ourShader);
-        ourShader.setMat4("model", model_head4);
-        robotHead.Draw(ourShader);
-
-        ourShader.setMat4("model", model_spiretop);
-        spireTop.Draw(ourShader);
-
-        ourShader.setMat4("model", model_spirebase);
-        spireBase.Draw(ourShader);
-
-        ourShader.setMat4("model", model_building1);
-        building.Draw(ourShader);
-        ourShader.setMat4("model", model_building2);
-        building.Draw(ourShader);
-        ourShader.setMat4("model", model_building3);
-        building.Draw(ourShader);
-        ourShader.setMat4("model", model_building4);
-        building.Draw(ourShader);
-
-        ourShader.setMat4("model", model_floor);
-        floor.Draw(ourShader);
-
-        // Draw skybox
-        glDepthFunc(GL_LEQUAL);
-        skyboxShader.use();
-        view = glm::mat4(glm::mat3(camera.GetViewMatrix()));
-        skyboxShader.setMat4("view", view);
-        skyboxShader.setMat4("projection", projection);
-        glBindVertexArray(skyboxVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-        glBindVertexArray(0);
-        glDepthFunc(GL_LESS);
+        // Robots and buildings are drawn instanced, one draw call per mesh and detail level however many there are
+        robotBodies.assign({ model_robot1, model_robot2, model_robot3, model_robot4 });
+        robotHeads.assign({ model_head1, model_head2, model_head3, model_head4 });
+        robotLeftArms.assign({ model_leftArm1, model_leftArm2, model_leftArm3, model_leftArm4 });
+        robotRightArms.assign({ model_rightArm1, model_rightArm2, model_rightArm3, model_rightArm4 });
+        buildings.assign({ model_building1, model_building2, model_building3, model_building4 });
+        if (stressMode)
+        {
+            appendStressBuildings(stressInstances, buildings);
+            appendStressRobots(stressInstances, static_cast<float>(sceneTime), robotBodies, robotHeads, robotLeftArms, robotRightArms);
+        }
+
+        // the model shader variants skip the fog while it's off and loop over no more lights than the busiest cluster has
+        renderQueue.shaderFeatures = fogDensity > 0.0f ? SHADER_FEATURE_FOG : 0;
+        renderQueue.pointLights = lightClusters.grid.busiestCluster;
+        renderQueue.begin(camera.Position, frameData.viewProjection);
+        // the buildings hide the rest of the scene: their boxes go into the software depth buffer first
+        building.AddOccluders(renderQueue.occlusion, buildings);
+        renderQueue.occlusion.rasterize();
+        robotBody.DrawInstanced(ourShader, robotBodies, lodSelector, renderQueue);
+        robotLeftArm.DrawInstanced(ourShader, robotLeftArms, lodSelector, renderQueue);
+        robotRightArm.DrawInstanced(ourShader, robotRightArms, lodSelector, renderQueue);
+        robotHead.DrawInstanced(ourShader, robotHeads, lodSelector, renderQueue);
+        building.DrawInstanced(ourShader, buildings, lodSelector, renderQueue);
+
+        spireTop.Draw(ourShader, model_spiretop, lodSelector, renderQueue);
+        spireBase.Draw(ourShader, model_spirebase, lodSelector, renderQueue);
+        floor.Draw(ourShader, model_floor, lodSelector, renderQueue);
+
+        // sorted front to back, then by program, material and mesh. The overdraw view reads back its counts and
+        // stalls, so only the normal view is timed.
+        if (showOverdraw)
+        {
+            overdrawView.begin(framebufferWidth, framebufferHeight);
+            renderQueue.submit(&overdrawShader);
+            overdrawView.end();
+            overdrawView.resolve();
+        }
+        else
+        {
+            GpuTimer &sceneTimer = sceneTimers[renderQueue.depthPrepass ? 1 : 0];
+            sceneTimer.begin();
+            {
+                PROFILE_ZONE("Submit");
+                PROFILE_GPU_ZONE("Scene");
+                renderQueue.submit();
+            }
+            sceneTimer.end();
+            float &frameTime = frameMilliseconds[renderQueue.depthPrepass ? 1 : 0];
+            frameTime = frameTime == 0.0f ? deltaTime * 1000.0f : frameTime * 0.95f + deltaTime * 1000.0f * 0.05f;
+            double &variantScene = variantSceneMilliseconds[modelShaders.enabled ? 1 : 0];
+            variantScene = variantScene == 0.0 ? sceneTimer.milliseconds : variantScene * 0.95 + sceneTimer.milliseconds * 0.05;
+            float &variantFrame = variantFrameMilliseconds[modelShaders.enabled ? 1 : 0];
+            variantFrame = variantFrame == 0.0f ? deltaTime * 1000.0f : variantFrame * 0.95f + deltaTime * 1000.0f * 0.05f;
+        }
+        if (readGpuCulling && renderQueue.gpuCullingActive())
+            renderQueue.readGpuCulling();
+
+        // Instancing readout and the synthetic stress scene
+        ImGui::Begin("Instancing");
+        ImGui::Checkbox("Stress Mode", &stressMode);
+        ImGui::SliderInt("Extra Buildings/Robots", &stressInstances, 1, 10000);
+        ImGui::Checkbox("Frustum Culling", &renderQueue.culler.enabled);
+        ImGui::Text("Objects: %u visible, %u culled", renderQueue.culler.visible, renderQueue.culler.culled());
+        ImGui::Checkbox("Occlusion Culling", &renderQueue.occlusion.enabled);
+        ImGui::Text("Occluded: %u of %u (%u occluders, %u triangles)", renderQueue.occlusion.occluded, renderQueue.occlusion.tested,
+                    renderQueue.occlusion.occluders, renderQueue.occlusion.trianglesRasterized);
+        ImGui::Text("Occlusion cost: %.3f ms rasterize, %.3f ms test", renderQueue.occlusion.rasterizeMs, renderQueue.occlusion.testMs);
+        if (computeCulling && multiDrawIndirect)
+        {
+            ImGui::Checkbox("GPU Culling", &renderQueue.gpuCulling);
+            if (renderQueue.gpuCullingActive())
+            {
+                // the readback waits for the frame's compute pass, so it is only done on request
+                ImGui::SameLine();
+                ImGui::Checkbox("Read back", &readGpuCulling);
+                if (readGpuCulling)
+                    ImGui::Text("GPU culled instances: %u visible of %u", renderQueue.gpuCuller.visibleInstances, renderQueue.gpuCuller.testedInstances);
+            }
+        }
+        ImGui::Text("Draw calls: %u", lodSelector.drawCalls);
+        ImGui::Text("Materials: %zu, %u changes", MaterialLibrary::instance().size(), MaterialBinder::instance().materialChanges);
+        ImGui::Text("Texture binds: %u (%u avoided)", MaterialBinder::instance().textureBinds, MaterialBinder::instance().bindsAvoided);
+        ImGui::End();
+
+        // Clustered point lights
+        ImGui::Begin("Clustered Lights");
+        ImGui::SliderInt("City Lights", &cityLights, 0, 4096);
+        ImGui::Text("Point lights: %u, %u cluster assignments", lightClusters.grid.lights, lightClusters.grid.assignments);
+        ImGui::Text("Busiest cluster: %u lights (%u dropped)", lightClusters.grid.busiestCluster, lightClusters.grid.overflows);
+        ImGui::Text("Binning: %.3f ms", lightClusters.grid.assignMs);
+        ImGui::End();
+
+        // Depth pre-pass against shading everything that passes the depth test, and the overdraw it saves
+        ImGui::Begin("Depth Pre-pass");
+        ImGui::Checkbox("Depth Pre-pass", &renderQueue.depthPrepass);
+        ImGui::Checkbox("Overdraw View", &showOverdraw);
+        ImGui::Text("Pre-pass draw calls: %u", renderQueue.depthDrawCalls);
+        ImGui::Text("%-10s %10s %10s", "", "scene GPU", "frame");
+        ImGui::Text("%-10s %7.3f ms %7.3f ms", "Pre-pass", sceneTimers[1].averageMilliseconds, frameMilliseconds[1]);
+        ImGui::Text("%-10s %7.3f ms %7.3f ms", "No pre-pass", sceneTimers[0].averageMilliseconds, frameMilliseconds[0]);
+        if (showOverdraw)
+            ImGui::Text("Shaded fragments per pixel: %.2f average, %u max, %.1f%% of pixels overdrawn", overdrawView.averageFragments,
+                        overdrawView.maxFragments, 100.0 * overdrawView.overdrawnShare);
+        ImGui::End();
+
+        // Model shader variants in use, their size, and the scene and frame times with and without them
+        ImGui::Begin("Shader Variants");
+        ImGui::Checkbox("Per-Material Variants", &modelShaders.enabled);
+        if (modelShaders.pending() > 0)
+            ImGui::Text("%u compiling, drawn with the full variant meanwhile", modelShaders.pending());
+        ImGui::Text("%-44s %6s %7s %8s %7s", "Variant", "stmts", "binary", "ready", "packets");
+        for (const auto &entry : modelShaders.compiled())
+            ImGui::Text("%-44s %6u %7d %5.1f ms %7u", shaderVariantName(entry.first).c_str(), entry.second.statements, entry.second.binaryBytes,
+                        entry.second.compileMs, entry.second.packets);
+        ImGui::Text("%-10s %10s %10s", "", "scene GPU", "frame");
+        ImGui::Text("%-10s %7.3f ms %7.3f ms", "Variants", variantSceneMilliseconds[1], variantFrameMilliseconds[1]);
+        ImGui::Text("%-10s %7.3f ms %7.3f ms", "Uber", variantSceneMilliseconds[0], variantFrameMilliseconds[0]);
+        ImGui::Text("%-10s %+7.3f ms %+7.3f ms", "Delta", variantSceneMilliseconds[1] - variantSceneMilliseconds[0],
+                    variantFrameMilliseconds[1] - variantFrameMilliseconds[0]);
+        ImGui::End();
+
+        // State changes of the frame's draws in the order they were queued and as submitted
+        ImGui::Begin("Render Queue");
+        ImGui::Checkbox("Sort Draws", &renderQueue.sorting);
+        if (multiDrawIndirect)
+        {
+            ImGui::Checkbox("Multi-Draw Indirect", &renderQueue.multiDraw);
+            if (renderQueue.multiDraw)
+                ImGui::Text("glMultiDrawElementsIndirect: %u calls, %u commands", renderQueue.multiDrawCalls, renderQueue.multiDrawCommands);
+        }
+        else
+            ImGui::Text("No multi-draw indirect, base vertex draws");
+        ImGui::Text("Packets: %zu", renderQueue.size());
+        ImGui::Text("%-16s %8s %8s", "", "queued", "submitted");
+        ImGui::Text("%-16s %8u %8u", "Program switches", renderQueue.unsortedStats.programSwitches, renderQueue.submittedStats.programSwitches);
+        ImGui::Text("%-16s %8u %8u", "Texture binds", renderQueue.unsortedStats.textureBinds, renderQueue.submittedStats.textureBinds);
+        ImGui::Text("%-16s %8u %8u", "VAO binds", renderQueue.unsortedStats.vaoBinds, renderQueue.submittedStats.vaoBinds);
+        ImGui::Text("%-16s %8u %8u", "Draw calls", renderQueue.unsortedStats.drawCalls, renderQueue.submittedStats.drawCalls);
+        ImGui::End();
+
+        // Level of detail readout, for what was just drawn
+        ImGui::Begin("Level of Detail");
+        ImGui::Checkbox("Enable LOD", &lodSelector.enabled);
+        ImGui::SliderFloat("Pixel Error", &lodSelector.pixelThreshold, 0.25f, 16.0f);
+        ImGui::Text("Triangles: %u of %u (%.1f%%)", lodSelector.trianglesSubmitted, lodSelector.fullDetailTriangles,
+                    lodSelector.fullDetailTriangles ? 100.0f * lodSelector.trianglesSubmitted / lodSelector.fullDetailTriangles : 0.0f);
+        for (const LodDrawRecord &record : lodSelector.records)
+        {
+            if (record.minLod == record.maxLod)
+                ImGui::Text("%-16s x%-5u LOD %u  %6u tris", record.name.c_str(), record.instances, record.minLod, record.triangles);
+            else
+                ImGui::Text("%-16s x%-5u LOD %u-%u  %6u tris", record.name.c_str(), record.instances, record.minLod, record.maxLod, record.triangles);
+        }
+        ImGui::End();
+
+        // Recording of the scene, without the UI
+        ImGui::Begin("Recording");
+        bool recording = recorder.recording();
+        if (ImGui::Checkbox("Record", &recording))
+        {
+            if (recording)
+            {
+                int width, height;
+                glfwGetFramebufferSize(window, &width, &height);
+                recorder.start(nextRecordingDirectory(), recordFormat, std::max(width, 1), std::max(height, 1), 60);
+            }
+            else
+                recorder.stop();
+        }
+        int format = recordFormat;
+        if (!recorder.recording() && (ImGui::RadioButton("PNG", &format, RECORD_PNG) || ImGui::RadioButton("Y4M", &format, RECORD_Y4M)))
+            recordFormat = static_cast<RecordFormat>(format);
+        if (recorder.recording())
+            ImGui::Text("%s", recorder.outputPath().c_str());
+        ImGui::Text("Captured %u, written %u, dropped %u", recorder.captured, recorder.written.load(), recorder.dropped);
+        ImGui::Text("Capture: %.3f ms, %.3f ms worst", recorder.captureMs, recorder.maxCaptureMs);
+        ImGui::End();
+
+#ifdef PROFILER_ENABLED
+        profilerView.draw();
+#endif
+
+        // Draw skybox, not over the heat map
+        if (!showOverdraw)
+        {
+            PROFILE_GPU_ZONE("Skybox");
+            glDepthFunc(GL_LEQUAL);
+            skyboxShader.use();
+            glBindVertexArray(skyboxVAO);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+            glDrawArrays(GL_TRIANGLES, 0, 36);
+            glBindVertexArray(0);
+            glDepthFunc(GL_LESS);
+        }
+
+        // Record the finished scene before the UI goes over it; a resized window ends the recording
+        if (recorder.recording())
+        {
+            int width, height;
+            glfwGetFramebufferSize(window, &width, &height);
+            if (!benchmarkTarget && (width != recorder.frameWidth() || height != recorder.frameHeight()))
+                recorder.stop();
+            recorder.capture(benchmarkTarget ? benchmarkTarget->framebufferId() : 0);
+            if (benchmarkTarget)
+                benchmarkTarget->bind();
+        }
 
         // If user holds shift button imgui window is visible, else invisible
         if (imgui_visible == false) {
@@ -519,13 +829,40 @@ int main()
 
         // Rendering Imgui
         // (Your code clears your framebuffer, renders your other stuff etc.)
-        ImGui::Render();
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        {
+            PROFILE_ZONE("ImGui render");
+            PROFILE_GPU_ZONE("ImGui");
+            ImGui::Render();
+            if (!benchmarkOptions.offscreen())
+                ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        }
 
-        glfwSwapBuffers(window);
+        // a benchmark or golden image run has nothing to show
+        if (benchmarkOptions.enabled)
+            benchmark.endFrame(renderQueue.drawCalls(), lodSelector.trianglesSubmitted, renderQueue.gpuCullingActive());
+        else if (benchmarkOptions.golden)
+            goldenRun.endFrame(benchmarkTarget->framebufferId(), benchmarkTarget->width, benchmarkTarget->height,
+                               texturesStreamed && modelShaders.pending() == 0);
+        else
+        {
+            PROFILE_ZONE("Swap buffers");
+            glfwSwapBuffers(window);
+        }
         glfwPollEvents(); // polling IO events
+
+        if (firstFrame)
+        {
+            firstFrame = false;
+            std::cout << "First frame after " << (glfwGetTime() - windowCreated) * 1000.0 << " ms" << std::endl;
+        }
     }
 
+    if (benchmarkOptions.enabled)
+        benchmark.report(reinterpret_cast<const char*>(glGetString(GL_RENDERER)), benchmarkTarget->width, benchmarkTarget->height);
+    if (benchmarkOptions.golden)
+        goldenRun.report();
+    recorder.stop();
+
     // Shutdown Imgui
 	ImGui_ImplOpenGL3_Shutdown();
 	ImGui_ImplGlfw_Shutdown();
@@ -533,9 +870,86 @@ int main()
 
     glDeleteVertexArrays(1, &skyboxVAO);
     glDeleteBuffers(1, &skyboxVBO);
+    // Models outlive the context, free their textures while it still exists
+    TextureRegistry::instance().clear();
+    GeometryPool::instance().clear();
+    MaterialLibrary::instance().clear();
+    AssetPack::instance().unmount();
 
     glfwTerminate();
-    return 0;
+    return benchmarkOptions.golden && goldenRun.failures > 0 ? 1 : 0;
+}
+
+// stress mode: a square grid of buildings around the scene, leaving the middle free
+// ---------------------------------------------------------------------------------
+void appendStressBuildings(int count, vector<glm::mat4> &buildings)
+{
+    const float spacing = 40.0f;
+    const float clearRadius = 120.0f;
+    int side = static_cast<int>(std::ceil(std::sqrt(static_cast<float>(count)))) + 8;
+    for (int z = 0, placed = 0; z < side && placed < count; z++)
+    {
+        for (int x = 0; x < side && placed < count; x++)
+        {
+            glm::vec3 position((x - side / 2) * spacing, -1.0f, (z - side / 2) * spacing);
+            if (std::fabs(position.x) < clearRadius && std::fabs(position.z) < clearRadius)
+                continue;
+            glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
+            model = glm::rotate(model, 1.5708f * static_cast<float>((x + z) % 4), glm::vec3(0.0f, 1.0f, 0.0f));
+            model = glm::scale(model, glm::vec3(4.0f, 2.0f, 2.0f));
+            buildings.push_back(model);
+            placed++;
+        }
+    }
+}
+
+// stress mode: rows of robots walking and swinging their arms like the four in the scene
+// ---------------------------------------------------------------------------------------
+void appendStressRobots(int count, float time, vector<glm::mat4> &bodies, vector<glm::mat4> &heads, vector<glm::mat4> &leftArms, vector<glm::mat4> &rightArms)
+{
+    const float spacing = 4.0f;
+    const float walkVelocity = 0.6f;
+    const float armVelocity = 3.0f;
+    int columns = static_cast<int>(std::ceil(std::sqrt(static_cast<float>(count))));
+    float swing = 0.2f * std::sin(time) * armVelocity;
+    for (int i = 0; i < count; i++)
+    {
+        int column = i % columns, row = i / columns;
+        // wrap the walk so the crowd stays in view
+        float walked = std::fmod(time * walkVelocity + row * spacing, columns * spacing);
+        glm::mat4 body = glm::translate(glm::mat4(1.0f), glm::vec3(20.0f + column * spacing, 0.0f, -40.0f + walked));
+        bodies.push_back(body);
+        heads.push_back(body);
+        leftArms.push_back(glm::rotate(body, swing, glm::vec3(0.0f, 1.0f, 0.0f)));
+        rightArms.push_back(glm::rotate(body, swing, glm::vec3(0.0f, 1.0f, 0.0f)));
+    }
+}
+
+// city lights: fires flickering on the ground and steady street lamps, scattered over the city
+// -------------------------------------------------------------------------------------------
+void appendCityLights(int count, float time, vector<PointLight> &lights)
+{
+    const float extent = 150.0f;
+    // a fixed pseudo random number in [0, 1) per light and purpose
+    auto hash = [](int i, float salt) {
+        float x = std::sin(i * 12.9898f + salt * 78.233f) * 43758.5453f;
+        return x - std::floor(x);
+    };
+    for (int i = 0; i < count; i++)
+    {
+        glm::vec3 position((hash(i, 1.0f) * 2.0f - 1.0f) * extent, 0.0f, (hash(i, 2.0f) * 2.0f - 1.0f) * extent);
+        if (i % 4 == 0)
+        {
+            position.y = 6.0f;
+            lights.push_back({ position, glm::vec3(1.0f, 0.85f, 0.6f), 1.0f, 0.35f, 0.44f });
+        }
+        else
+        {
+            position.y = 0.5f + hash(i, 3.0f);
+            float flicker = 0.75f + 0.25f * std::sin(time * (6.0f + 4.0f * hash(i, 4.0f)) + i);
+            lights.push_back({ position, glm::vec3(1.0f, 0.45f, 0.1f) * flicker, 1.0f, 0.7f, 1.8f });
+        }
+    }
 }
 
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
@@ -644,10 +1058,39 @@ unsigned int loadCubemap(vector<std::string> faces)
     glGenTextures(1, &textureID);
     glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 
+    // use the transcoded faces if all six are there and the driver can sample them
+    vector<AssetFile> compressedFaces(faces.size());
+    vector<Ktx2Image> layouts(faces.size());
+    bool compressed = !faces.empty();
+    for (unsigned int i = 0; i < faces.size() && compressed; i++)
+    {
+        compressed = compressedFaces[i].open(faces[i] + ".ktx2")
+                     && ktx2Parse(compressedFaces[i].data(), compressedFaces[i].size(), layouts[i])
+                     && layouts[i].faceCount == 1 && compressedFormatSupported(layouts[i].format)
+                     && layouts[i].format == layouts[0].format && layouts[i].levels.size() == layouts[0].levels.size();
+    }
+    if (compressed)
+    {
+        GLenum format = compressedGLFormat(layouts[0].format);
+        for (unsigned int i = 0; i < faces.size(); i++)
+        {
+            for (unsigned int level = 0; level < layouts[i].levels.size(); level++)
+            {
+                const Ktx2Level &data = layouts[i].levels[level];
+                glCompressedTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level, format, data.width, data.height, 0,
+                                       static_cast<GLsizei>(data.size), compressedFaces[i].data() + data.offset);
+            }
+        }
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(layouts[0].levels.size()) - 1);
+    }
+
     int width, height, nrChannels;
-    for (unsigned int i = 0; i < faces.size(); i++)
+    for (unsigned int i = 0; i < faces.size() && !compressed; i++)
     {
-        unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
+        AssetFile file(faces[i]);
+        unsigned char *data = nullptr;
+        if (file.isOpen())
+            data = stbi_load_from_memory(file.data(), static_cast<int>(file.size()), &width, &height, &nrChannels, 0);
         if (data)
         {
             glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
@@ -659,7 +1102,9 @@ unsigned int loadCubemap(vector<std::string> faces)
             stbi_image_free(data);
         }
     }
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    // sample the transcoded mips when there are any
+    bool mipmapped = compressed && layouts[0].levels.size() > 1;
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, mipmapped ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
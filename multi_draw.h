@@ -0,0 +1,124 @@
+#ifndef MULTI_DRAW_H
+#define MULTI_DRAW_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "vertex_format.h"
+#include "instance_buffer.h"
+#include "gl_extensions.h"
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+using namespace std;
+
+// GL 4.3 / GL_ARB_multi_draw_indirect, which the GL 3.3 loader doesn't know
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+typedef void (APIENTRYP MultiDrawElementsIndirectProc)(GLenum mode, GLenum type, const void *indirect, GLsizei drawcount, GLsizei stride);
+
+// one draw of glMultiDrawElementsIndirect, laid out the way GL reads it
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint  baseVertex;
+    GLuint baseInstance;
+};
+
+// Indirect multi-draws over the geometry pool (geometry_pool.h). A frame's draws become commands in one buffer and
+// their transforms one instance stream. Each command's baseInstance is where its instances start in the stream, and
+// instanced attributes are fetched from baseInstance on, so the mesh shaders get their per-draw transform through
+// the ordinary instance attributes and stay GLSL 3.30 (no gl_DrawID needed).
+class MultiDraw
+{
+public:
+    // Loads glMultiDrawElementsIndirect if the context has GL 4.3, or the multi-draw and base instance extensions.
+    // Without it everything draws with glDrawElementsBaseVertex, as on the GL 3.3 the app asks for.
+    static bool load(GLADloadproc loader)
+    {
+        bool core = GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 3);
+        if (core || (hasGLExtension("GL_ARB_multi_draw_indirect") && hasGLExtension("GL_ARB_base_instance")))
+            entry() = reinterpret_cast<MultiDrawElementsIndirectProc>(loader("glMultiDrawElementsIndirect"));
+        return supported();
+    }
+
+    static bool supported() { return entry() != nullptr; }
+
+    MultiDraw() = default;
+
+    ~MultiDraw()
+    {
+        if (commandBuffer != 0)
+            glDeleteBuffers(1, &commandBuffer);
+        if (texCoordBuffer != 0)
+            glDeleteBuffers(1, &texCoordBuffer);
+    }
+
+    // the buffers are owned, a copy would delete them twice
+    MultiDraw(const MultiDraw&) = delete;
+    MultiDraw& operator=(const MultiDraw&) = delete;
+
+    // uploads a frame's commands and its per-instance transforms and texture coordinate transforms, orphaning
+    // the previous frame's like InstanceBuffer does. 'reserve' more instances after the uploaded ones are left for
+    // the GPU culler to write. Leaves the command buffer bound for draw().
+    void upload(const vector<DrawElementsIndirectCommand> &commands, const vector<glm::mat4> &transforms, const vector<glm::vec4> &texCoords,
+                size_t reserve = 0)
+    {
+        instances.upload(transforms.data(), transforms.size(), reserve);
+        if (texCoordBuffer == 0)
+            glGenBuffers(1, &texCoordBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, texCoordBuffer);
+        if (texCoords.size() + reserve > texCoordCapacity)
+            texCoordCapacity = std::max<size_t>(std::max(texCoords.size() + reserve, texCoordCapacity * 2), 64);
+        glBufferData(GL_ARRAY_BUFFER, texCoordCapacity * sizeof(glm::vec4), nullptr, GL_STREAM_DRAW);
+        if (!texCoords.empty())
+            glBufferSubData(GL_ARRAY_BUFFER, 0, texCoords.size() * sizeof(glm::vec4), texCoords.data());
+
+        if (commandBuffer == 0)
+            glGenBuffers(1, &commandBuffer);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        if (commands.size() > commandCapacity)
+            commandCapacity = std::max<size_t>(std::max(commands.size(), commandCapacity * 2), 64);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, commandCapacity * sizeof(DrawElementsIndirectCommand), nullptr, GL_STREAM_DRAW);
+        if (!commands.empty())
+            glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data());
+    }
+
+    // Points the bound VAO's per-instance attributes at the stream. The buffers keep their names when they are
+    // refilled, so a VAO stays pointed at them until something else binds its instance attributes.
+    void bindAttributes() const
+    {
+        instances.bindAttributes(0);
+        glBindBuffer(GL_ARRAY_BUFFER, texCoordBuffer);
+        glEnableVertexAttribArray(VERTEX_LOCATION_INSTANCE_TEXCOORD);
+        glVertexAttribPointer(VERTEX_LOCATION_INSTANCE_TEXCOORD, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+        glVertexAttribDivisor(VERTEX_LOCATION_INSTANCE_TEXCOORD, 1);
+    }
+
+    // the buffers of the last upload, for the compute passes that fill in the rest
+    GLuint commandsId() const { return commandBuffer; }
+    GLuint transformsId() const { return instances.id(); }
+    GLuint texCoordsId() const { return texCoordBuffer; }
+
+    // draws commands [first, first + count) of the last upload with the bound program and VAO
+    void draw(size_t first, size_t count) const
+    {
+        entry()(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(uintptr_t)(first * sizeof(DrawElementsIndirectCommand)),
+                static_cast<GLsizei>(count), 0);
+    }
+
+private:
+    InstanceBuffer instances;
+    GLuint texCoordBuffer = 0, commandBuffer = 0;
+    size_t texCoordCapacity = 0, commandCapacity = 0;
+
+    static MultiDrawElementsIndirectProc &entry()
+    {
+        static MultiDrawElementsIndirectProc proc = nullptr;
+        return proc;
+    }
+};
+#endif
@@ -0,0 +1,134 @@
+// CPU benchmark and self-check for the software occlusion culler. Builds a street of box buildings in front of the
+// app's camera, scatters objects between and behind them, and per frame rasterizes the buildings into the depth
+// buffer and tests every object against the depth pyramid. Prints the occluded objects and the time of both steps
+// at 1000 and 10000 objects (or the counts given on the command line). Before that it checks a few cases with a
+// known answer and exits with a non-zero status if one fails, so it can run headless as a test.
+//
+// usage: ./occlusion_benchmark [objects...]
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "occlusion_culler.h"
+
+#include <iostream>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+using namespace std;
+
+// the app's camera: 45 degrees, 800x600, 0.1 to 100, at eye height looking down -z
+static glm::mat4 cameraViewProjection()
+{
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 100.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 1.7f, 0.0f), glm::vec3(0.0f, 1.7f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    return projection * view;
+}
+
+static bool check(const char *name, bool passed)
+{
+    cout << (passed ? "  pass: " : "  FAIL: ") << name << endl;
+    return passed;
+}
+
+// one 8x4 wall facing the camera at z = -10
+static bool selfTest(OcclusionCuller &culler)
+{
+    OccluderMesh wall = OccluderMesh::innerBox(glm::vec3(-4.0f, 0.0f, -0.5f), glm::vec3(4.0f, 4.0f, 0.5f), 1.0f);
+    culler.beginFrame(cameraViewProjection());
+    culler.addOccluder(wall, glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -10.0f)));
+    culler.rasterize();
+
+    glm::vec3 unitMin(-0.5f, 0.0f, -0.5f), unitMax(0.5f, 2.0f, 0.5f);
+    auto at = [](float x, float z) { return glm::translate(glm::mat4(1.0f), glm::vec3(x, 0.0f, z)); };
+    bool passed = true;
+    passed &= check("box behind the wall is occluded", culler.isOccluded(unitMin, unitMax, at(0.0f, -20.0f)));
+    passed &= check("box far behind the wall is occluded", culler.isOccluded(unitMin, unitMax, at(1.0f, -60.0f)));
+    passed &= check("box in front of the wall is visible", !culler.isOccluded(unitMin, unitMax, at(0.0f, -5.0f)));
+    passed &= check("box beside the wall is visible", !culler.isOccluded(unitMin, unitMax, at(10.0f, -20.0f)));
+    passed &= check("box half behind the wall's edge is visible", !culler.isOccluded(unitMin, unitMax, at(4.0f, -11.0f)));
+    passed &= check("box around the camera is visible", !culler.isOccluded(glm::vec3(-1.0f), glm::vec3(1.0f), at(0.0f, 0.0f)));
+    passed &= check("tall box rising above the wall is visible", !culler.isOccluded(unitMin, glm::vec3(0.5f, 10.0f, 0.5f), at(0.0f, -20.0f)));
+    passed &= check("counters", culler.tested == 7 && culler.occluded == 2 && culler.occluders == 1 && culler.trianglesRasterized == 12);
+
+    // the same wall seen from behind (back faces) hides the same box
+    culler.beginFrame(cameraViewProjection());
+    culler.addOccluder(wall, glm::rotate(at(0.0f, -10.0f), glm::radians(180.0f), glm::vec3(0.0f, 1.0f, 0.0f)));
+    culler.rasterize();
+    passed &= check("rotated wall occludes too", culler.isOccluded(unitMin, unitMax, at(0.0f, -20.0f)));
+
+    // nothing rasterized, nothing occluded
+    culler.beginFrame(cameraViewProjection());
+    culler.rasterize();
+    passed &= check("no occluders, nothing occluded", !culler.isOccluded(unitMin, unitMax, at(0.0f, -20.0f)));
+    return passed;
+}
+
+int main(int argc, char* argv[])
+{
+    vector<size_t> counts;
+    for (int i = 1; i < argc; i++)
+        if (size_t count = strtoul(argv[i], nullptr, 10))
+            counts.push_back(count);
+    if (counts.empty())
+        counts = { 1000, 10000 };
+
+    OcclusionCuller culler;
+    cout << "OCCLUSION_BENCHMARK:: " << OCCLUSION_WIDTH << "x" << OCCLUSION_HEIGHT << " depth buffer, "
+         << (OCCLUSION_WIDTH / OCCLUSION_TILE_WIDTH) * (OCCLUSION_HEIGHT / OCCLUSION_TILE_HEIGHT) << " tiles on "
+         << WorkerPool::instance().size() + 1 << " threads" << endl;
+    cout << "self test" << endl;
+    if (!selfTest(culler))
+        return 1;
+
+    // Building01-sized blocks (8.5 x 12.3 x 6) down both sides of the street and across its far end every 40 units
+    OccluderMesh building = OccluderMesh::innerBox(glm::vec3(-4.25f, 0.23f, -3.04f), glm::vec3(4.25f, 12.52f, 3.04f));
+    vector<glm::mat4> buildings;
+    for (float z = -8.0f; z > -100.0f; z -= 7.0f)
+        for (float x : { -7.0f, 7.0f, -16.0f, 16.0f })
+            buildings.push_back(glm::translate(glm::mat4(1.0f), glm::vec3(x, 0.0f, z)));
+    for (float z = -40.0f; z > -100.0f; z -= 40.0f)
+        for (float x = -2.0f; x <= 2.0f; x += 4.0f)
+            buildings.push_back(glm::translate(glm::mat4(1.0f), glm::vec3(x * 2.0f, 0.0f, z)));
+
+    // robot-sized boxes anywhere on the ground in front of the camera
+    glm::vec3 robotMin(-0.5f, 0.0f, -0.5f), robotMax(0.5f, 2.0f, 0.5f);
+    const int frames = 50;
+    for (size_t count : counts)
+    {
+        mt19937 random(1234);
+        uniform_real_distribution<float> x(-40.0f, 40.0f), z(-100.0f, -2.0f);
+        vector<glm::mat4> objects(count);
+        for (glm::mat4 &object : objects)
+            object = glm::translate(glm::mat4(1.0f), glm::vec3(x(random), 0.0f, z(random)));
+
+        // the instanced path the app uses for the robots, filtering a copy of the transforms every frame
+        vector<glm::mat4> kept;
+        double rasterizeMs = 0.0, testMs = 0.0;
+        auto start = chrono::steady_clock::now();
+        for (int frame = 0; frame < frames; frame++)
+        {
+            culler.beginFrame(cameraViewProjection());
+            for (const glm::mat4 &transform : buildings)
+                culler.addOccluder(building, transform);
+            culler.rasterize();
+            kept = objects;
+            culler.cullInstances(robotMin, robotMax, kept);
+            rasterizeMs += culler.rasterizeMs;
+            testMs += culler.testMs;
+        }
+        double frameMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / frames;
+
+        // one object at a time, the way Model::Draw tests, has to agree
+        unsigned int occluded = culler.occluded;
+        size_t agree = 0;
+        for (const glm::mat4 &object : objects)
+            agree += culler.isOccluded(robotMin, robotMax, object) ? 1 : 0;
+
+        cout << count << " objects: " << occluded << " occluded, " << kept.size() << " kept (isOccluded: " << agree
+             << " occluded), " << culler.occluders << " occluders, " << culler.trianglesRasterized << " triangles, "
+             << rasterizeMs / frames << " ms rasterize + " << testMs / frames << " ms test = " << frameMs << " ms per frame" << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,373 @@
+#ifndef OCCLUSION_CULLER_H
+#define OCCLUSION_CULLER_H
+
+#include <glm/glm.hpp>
+
+#include "worker_pool.h"
+
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OCCLUSION_CULLER_SSE 1
+#include <immintrin.h>
+#endif
+using namespace std;
+
+// Resolution of the software depth buffer, and the tiles the rasterizer hands to its threads. The widths are
+// multiples of 4 so the SSE loop never straddles a tile or the buffer's edge.
+const int OCCLUSION_WIDTH = 256;
+const int OCCLUSION_HEIGHT = 192;
+const int OCCLUSION_TILE_WIDTH = 64;
+const int OCCLUSION_TILE_HEIGHT = 32;
+// occluder triangles with a vertex closer to the eye than this (clip space w) are skipped rather than clipped
+const float OCCLUSION_NEAR_W = 0.1f;
+// The box occluder of a model is its bounding box scaled by this much about its centre, so that it stays inside
+// the real geometry of boxy buildings with balconies, cornices and recessed tops.
+const float OCCLUDER_BOX_SCALE = 0.85f;
+
+// A low-poly stand-in for a model that hides what is behind it. Its triangles must lie inside the model.
+struct OccluderMesh {
+    vector<glm::vec3> vertices;
+    vector<uint32_t> indices;
+
+    bool empty() const { return indices.empty(); }
+
+    // the 12 triangles of the model space box, scaled about its centre
+    static OccluderMesh innerBox(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, float scale = OCCLUDER_BOX_SCALE)
+    {
+        glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+        glm::vec3 extent = (boundsMax - boundsMin) * 0.5f * scale;
+        OccluderMesh mesh;
+        for (int corner = 0; corner < 8; corner++)
+            mesh.vertices.push_back(center + extent * glm::vec3(corner & 1 ? 1.0f : -1.0f, corner & 2 ? 1.0f : -1.0f, corner & 4 ? 1.0f : -1.0f));
+        // winding doesn't matter, the rasterizer draws both sides
+        mesh.indices = { 0, 1, 3, 0, 3, 2,   4, 6, 7, 4, 7, 5,   0, 4, 5, 0, 5, 1,
+                         2, 3, 7, 2, 7, 6,   0, 2, 6, 0, 6, 4,   1, 5, 7, 1, 7, 3 };
+        return mesh;
+    }
+};
+
+// Software occlusion culling. Each frame the occluders are rasterized into a small depth buffer (nearest depth per
+// pixel, tiles in parallel, four pixels at a time with SSE), which is then reduced to a pyramid whose texels hold
+// the farthest depth below them. An object is occluded when the nearest depth of its screen space bounds is behind
+// the farthest depth of every pyramid texel those bounds cover. Depth is window depth, 0 at the near plane and 1 at
+// the far plane. Touches no GL state.
+class OcclusionCuller
+{
+public:
+    bool enabled = true;
+
+    // statistics of the current frame
+    unsigned int occluders = 0;
+    unsigned int trianglesRasterized = 0;
+    unsigned int tested = 0;
+    unsigned int occluded = 0;
+    double rasterizeMs = 0.0;
+    double testMs = 0.0;
+
+    OcclusionCuller()
+    {
+        tilesX = OCCLUSION_WIDTH / OCCLUSION_TILE_WIDTH;
+        tilesY = OCCLUSION_HEIGHT / OCCLUSION_TILE_HEIGHT;
+        bins.resize(tilesX * tilesY);
+        int width = OCCLUSION_WIDTH, height = OCCLUSION_HEIGHT;
+        while (true)
+        {
+            levels.push_back({ width, height, vector<float>(width * height, 1.0f) });
+            if (width == 1 && height == 1)
+                break;
+            width = (width + 1) / 2;
+            height = (height + 1) / 2;
+        }
+    }
+
+    // call once per frame, before adding occluders
+    void beginFrame(const glm::mat4 &viewProjection)
+    {
+        this->viewProjection = viewProjection;
+        triangles.clear();
+        for (vector<uint32_t> &bin : bins)
+            bin.clear();
+        occluders = trianglesRasterized = tested = occluded = 0;
+        rasterizeMs = testMs = 0.0;
+        rasterized = false;
+    }
+
+    // transforms the occluder's triangles to the screen and bins them by tile. Nothing is drawn until rasterize().
+    void addOccluder(const OccluderMesh &mesh, const glm::mat4 &transform)
+    {
+        if (!enabled || mesh.empty())
+            return;
+        auto start = chrono::steady_clock::now();
+        glm::mat4 toClip = viewProjection * transform;
+        clipVertices.resize(mesh.vertices.size());
+        for (size_t i = 0; i < mesh.vertices.size(); i++)
+            clipVertices[i] = toClip * glm::vec4(mesh.vertices[i], 1.0f);
+        if (outsideOnePlane(clipVertices.data(), clipVertices.size()))
+            return;
+        occluders++;
+        for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+            setupTriangle(clipVertices[mesh.indices[i]], clipVertices[mesh.indices[i + 1]], clipVertices[mesh.indices[i + 2]]);
+        rasterizeMs += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+
+    // draws the binned occluders tile by tile on the worker threads and builds the depth pyramid
+    void rasterize()
+    {
+        auto start = chrono::steady_clock::now();
+        const function<void(unsigned int)> tileJob = [this](unsigned int tile) { rasterizeTile(tile); };
+        WorkerPool::instance().run(static_cast<unsigned int>(bins.size()), tileJob);
+        buildPyramid();
+        rasterized = true;
+        rasterizeMs += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+
+    // true if the model space box under transform is hidden behind the occluders
+    bool isOccluded(const glm::vec3 &localMin, const glm::vec3 &localMax, const glm::mat4 &transform)
+    {
+        if (!enabled || !rasterized)
+            return false;
+        auto start = chrono::steady_clock::now();
+        bool hidden = testBox(localMin, localMax, viewProjection * transform);
+        tested++;
+        occluded += hidden ? 1 : 0;
+        testMs += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        return hidden;
+    }
+
+    // removes the transforms whose box (the same model space box for all of them) is occluded
+    void cullInstances(const glm::vec3 &localMin, const glm::vec3 &localMax, vector<glm::mat4> &transforms)
+    {
+        if (!enabled || !rasterized)
+            return;
+        auto start = chrono::steady_clock::now();
+        size_t kept = 0;
+        for (size_t i = 0; i < transforms.size(); i++)
+        {
+            if (!testBox(localMin, localMax, viewProjection * transforms[i]))
+                transforms[kept++] = transforms[i];
+        }
+        tested += static_cast<unsigned int>(transforms.size());
+        occluded += static_cast<unsigned int>(transforms.size() - kept);
+        transforms.resize(kept);
+        testMs += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+
+    // the full resolution depth buffer, row 0 at the bottom of the screen
+    const vector<float> &depth() const { return levels[0].depth; }
+
+private:
+    // a triangle in screen space: edge functions a*x + b*y + c >= 0 inside, depth z = zx*x + zy*y + z0
+    struct ScreenTriangle {
+        float edgeA[3], edgeB[3], edgeC[3];
+        float zx, zy, z0;
+        int minX, minY, maxX, maxY;
+    };
+
+    struct DepthLevel {
+        int width, height;
+        vector<float> depth;
+    };
+
+    glm::mat4 viewProjection = glm::mat4(1.0f);
+    int tilesX, tilesY;
+    vector<ScreenTriangle> triangles;
+    vector<vector<uint32_t>> bins;
+    vector<DepthLevel> levels;
+    vector<glm::vec4> clipVertices;
+    bool rasterized = false;
+
+    // true if all points are outside the same clip plane
+    static bool outsideOnePlane(const glm::vec4 *points, size_t count)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            bool allBelow = true, allAbove = true;
+            for (size_t i = 0; i < count; i++)
+            {
+                allBelow = allBelow && points[i][axis] < -points[i].w;
+                allAbove = allAbove && points[i][axis] > points[i].w;
+            }
+            if (allBelow || allAbove)
+                return true;
+        }
+        return false;
+    }
+
+    void setupTriangle(const glm::vec4 &c0, const glm::vec4 &c1, const glm::vec4 &c2)
+    {
+        // clipping against the near plane would be exact, skipping is conservative: less is hidden
+        if (c0.w < OCCLUSION_NEAR_W || c1.w < OCCLUSION_NEAR_W || c2.w < OCCLUSION_NEAR_W)
+            return;
+        glm::vec3 v[3];
+        const glm::vec4 *clip[3] = { &c0, &c1, &c2 };
+        for (int i = 0; i < 3; i++)
+        {
+            float inverseW = 1.0f / clip[i]->w;
+            v[i] = glm::vec3((clip[i]->x * inverseW * 0.5f + 0.5f) * OCCLUSION_WIDTH,
+                             (clip[i]->y * inverseW * 0.5f + 0.5f) * OCCLUSION_HEIGHT,
+                             clip[i]->z * inverseW * 0.5f + 0.5f);
+        }
+        float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y);
+        if (std::abs(area) < 1e-6f)
+            return;
+        // both windings are drawn, counter-clockwise from here on
+        if (area < 0.0f)
+        {
+            std::swap(v[1], v[2]);
+            area = -area;
+        }
+
+        ScreenTriangle triangle;
+        float minX = std::min(v[0].x, std::min(v[1].x, v[2].x)), maxX = std::max(v[0].x, std::max(v[1].x, v[2].x));
+        float minY = std::min(v[0].y, std::min(v[1].y, v[2].y)), maxY = std::max(v[0].y, std::max(v[1].y, v[2].y));
+        triangle.minX = std::max(0, static_cast<int>(std::floor(minX)));
+        triangle.minY = std::max(0, static_cast<int>(std::floor(minY)));
+        triangle.maxX = std::min(OCCLUSION_WIDTH - 1, static_cast<int>(std::ceil(maxX)));
+        triangle.maxY = std::min(OCCLUSION_HEIGHT - 1, static_cast<int>(std::ceil(maxY)));
+        if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+            return;
+        for (int edge = 0; edge < 3; edge++)
+        {
+            const glm::vec3 &a = v[edge], &b = v[(edge + 1) % 3];
+            triangle.edgeA[edge] = a.y - b.y;
+            triangle.edgeB[edge] = b.x - a.x;
+            triangle.edgeC[edge] = a.x * b.y - b.x * a.y;
+        }
+        triangle.zx = ((v[1].z - v[0].z) * (v[2].y - v[0].y) - (v[2].z - v[0].z) * (v[1].y - v[0].y)) / area;
+        triangle.zy = ((v[2].z - v[0].z) * (v[1].x - v[0].x) - (v[1].z - v[0].z) * (v[2].x - v[0].x)) / area;
+        triangle.z0 = v[0].z - triangle.zx * v[0].x - triangle.zy * v[0].y;
+
+        uint32_t index = static_cast<uint32_t>(triangles.size());
+        triangles.push_back(triangle);
+        trianglesRasterized++;
+        for (int tileY = triangle.minY / OCCLUSION_TILE_HEIGHT; tileY <= triangle.maxY / OCCLUSION_TILE_HEIGHT; tileY++)
+            for (int tileX = triangle.minX / OCCLUSION_TILE_WIDTH; tileX <= triangle.maxX / OCCLUSION_TILE_WIDTH; tileX++)
+                bins[tileY * tilesX + tileX].push_back(index);
+    }
+
+    // clears the tile and draws its bin. Tiles don't overlap, so the threads never write the same pixel.
+    void rasterizeTile(unsigned int tile)
+    {
+        const int tileX0 = static_cast<int>(tile % tilesX) * OCCLUSION_TILE_WIDTH;
+        const int tileY0 = static_cast<int>(tile / tilesX) * OCCLUSION_TILE_HEIGHT;
+        const int tileX1 = tileX0 + OCCLUSION_TILE_WIDTH - 1, tileY1 = tileY0 + OCCLUSION_TILE_HEIGHT - 1;
+        float *depth = levels[0].depth.data();
+        for (int y = tileY0; y <= tileY1; y++)
+            std::fill(depth + y * OCCLUSION_WIDTH + tileX0, depth + y * OCCLUSION_WIDTH + tileX1 + 1, 1.0f);
+
+        for (uint32_t index : bins[tile])
+        {
+            const ScreenTriangle &t = triangles[index];
+            // whole groups of four, the edge functions reject the extra pixels
+            const int x0 = std::max(t.minX, tileX0) & ~3, x1 = std::min(t.maxX, tileX1);
+            const int y0 = std::max(t.minY, tileY0), y1 = std::min(t.maxY, tileY1);
+            for (int y = y0; y <= y1; y++)
+            {
+                const float py = y + 0.5f;
+                float *row = depth + y * OCCLUSION_WIDTH;
+#ifdef OCCLUSION_CULLER_SSE
+                const __m128 zero = _mm_setzero_ps();
+                const __m128 laneX = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+                __m128 a[3], rowC[3];
+                for (int e = 0; e < 3; e++)
+                {
+                    a[e] = _mm_set1_ps(t.edgeA[e]);
+                    rowC[e] = _mm_set1_ps(t.edgeB[e] * py + t.edgeC[e]);
+                }
+                const __m128 zx = _mm_set1_ps(t.zx), rowZ = _mm_set1_ps(t.zy * py + t.z0);
+                for (int x = x0; x <= x1; x += 4)
+                {
+                    __m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), laneX);
+                    __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[0], px), rowC[0]), zero);
+                    inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[1], px), rowC[1]), zero));
+                    inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[2], px), rowC[2]), zero));
+                    if (_mm_movemask_ps(inside) == 0)
+                        continue;
+                    __m128 z = _mm_add_ps(_mm_mul_ps(zx, px), rowZ);
+                    __m128 current = _mm_loadu_ps(row + x);
+                    __m128 nearest = _mm_min_ps(current, z);
+                    _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, current)));
+                }
+#else
+                for (int x = x0; x <= x1; x++)
+                {
+                    const float px = x + 0.5f;
+                    bool inside = true;
+                    for (int e = 0; e < 3; e++)
+                        inside = inside && t.edgeA[e] * px + t.edgeB[e] * py + t.edgeC[e] >= 0.0f;
+                    if (inside)
+                        row[x] = std::min(row[x], t.zx * px + t.zy * py + t.z0);
+                }
+#endif
+            }
+        }
+    }
+
+    // every level holds the farthest depth of the 2x2 texels below it
+    void buildPyramid()
+    {
+        for (size_t l = 1; l < levels.size(); l++)
+        {
+            const DepthLevel &fine = levels[l - 1];
+            DepthLevel &coarse = levels[l];
+            for (int y = 0; y < coarse.height; y++)
+            {
+                int y0 = 2 * y, y1 = std::min(2 * y + 1, fine.height - 1);
+                for (int x = 0; x < coarse.width; x++)
+                {
+                    int x0 = 2 * x, x1 = std::min(2 * x + 1, fine.width - 1);
+                    coarse.depth[y * coarse.width + x] = std::max(std::max(fine.depth[y0 * fine.width + x0], fine.depth[y0 * fine.width + x1]),
+                                                                  std::max(fine.depth[y1 * fine.width + x0], fine.depth[y1 * fine.width + x1]));
+                }
+            }
+        }
+    }
+
+    bool testBox(const glm::vec3 &localMin, const glm::vec3 &localMax, const glm::mat4 &toClip) const
+    {
+        // the corners are the minimum corner plus any of the three transformed edges
+        glm::vec3 size = localMax - localMin;
+        glm::vec4 base = toClip * glm::vec4(localMin, 1.0f);
+        glm::vec4 edgeX = toClip[0] * size.x, edgeY = toClip[1] * size.y, edgeZ = toClip[2] * size.z;
+        float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f, nearest = 1.0f;
+        for (int corner = 0; corner < 8; corner++)
+        {
+            glm::vec4 clip = base;
+            if (corner & 1) clip += edgeX;
+            if (corner & 2) clip += edgeY;
+            if (corner & 4) clip += edgeZ;
+            // reaches behind the eye, can't be behind anything
+            if (clip.w < OCCLUSION_NEAR_W)
+                return false;
+            float inverseW = 1.0f / clip.w;
+            float x = (clip.x * inverseW * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+            float y = (clip.y * inverseW * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+            minX = std::min(minX, x); maxX = std::max(maxX, x);
+            minY = std::min(minY, y); maxY = std::max(maxY, y);
+            nearest = std::min(nearest, clip.z * inverseW * 0.5f + 0.5f);
+        }
+        int x0 = std::max(0, static_cast<int>(std::floor(minX))), x1 = std::min(OCCLUSION_WIDTH - 1, static_cast<int>(std::floor(maxX)));
+        int y0 = std::max(0, static_cast<int>(std::floor(minY))), y1 = std::min(OCCLUSION_HEIGHT - 1, static_cast<int>(std::floor(maxY)));
+        // off screen is the frustum culler's business
+        if (x0 > x1 || y0 > y1)
+            return false;
+
+        // the finest level where the bounds cover at most 4x4 texels
+        size_t level = 0;
+        while (level + 1 < levels.size() && (((x1 >> level) - (x0 >> level)) > 3 || ((y1 >> level) - (y0 >> level)) > 3))
+            level++;
+        const DepthLevel &hiz = levels[level];
+        for (int y = y0 >> level; y <= (y1 >> level); y++)
+            for (int x = x0 >> level; x <= (x1 >> level); x++)
+                if (hiz.depth[y * hiz.width + x] >= nearest)
+                    return false;
+        return true;
+    }
+};
+#endif
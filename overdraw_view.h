@@ -0,0 +1,143 @@
+#ifndef OVERDRAW_VIEW_H
+#define OVERDRAW_VIEW_H
+
+#include <glad/glad.h>
+
+#include "shader.h"
+
+#include <vector>
+#include <algorithm>
+#include <iostream>
+using namespace std;
+
+// Overdraw visualization. The scene is drawn into an offscreen R16F target with a program whose fragments all
+// write 1 and additive blending, so every pixel ends up holding the number of times the shading pass ran the
+// fragment shader for it (the depth pre-pass, when on, writes depth only and isn't counted). resolve() draws the
+// counts as a heat map over the screen and reads them back for the average and maximum; the readback stalls, so
+// this is a debugging view, not something to leave on while measuring frame times.
+class OverdrawView
+{
+public:
+    // statistics of the last resolve()
+    double averageFragments = 0.0;
+    unsigned int maxFragments = 0;
+    // share of the covered pixels that were shaded more than once
+    double overdrawnShare = 0.0;
+
+    OverdrawView()
+        : heatmap("shaders/overdraw_heatmap.vs", "shaders/overdraw_heatmap.fs")
+    {
+        // the heat map is a full screen triangle made up in the vertex shader, core profile still wants a VAO bound
+        glGenVertexArrays(1, &emptyVAO);
+    }
+
+    ~OverdrawView()
+    {
+        release();
+        glDeleteVertexArrays(1, &emptyVAO);
+    }
+
+    // the GL objects are owned, a copy would delete them twice
+    OverdrawView(const OverdrawView&) = delete;
+    OverdrawView& operator=(const OverdrawView&) = delete;
+
+    // redirects drawing into the counting target, cleared, with additive blending on
+    void begin(int width, int height)
+    {
+        // the window's framebuffer, or a benchmark's offscreen one, to go back to in end()
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+        if (width != this->width || height != this->height)
+            allocate(width, height);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE);
+    }
+
+    // back to the framebuffer bound before begin() and blending off
+    void end()
+    {
+        glDisable(GL_BLEND);
+        glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+    }
+
+    // draws the heat map over the whole bound framebuffer and updates the statistics
+    void resolve()
+    {
+        readCounts();
+        glDisable(GL_DEPTH_TEST);
+        heatmap.use();
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, counts);
+        glBindVertexArray(emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+        glEnable(GL_DEPTH_TEST);
+    }
+
+private:
+    Shader heatmap;
+    GLuint emptyVAO = 0;
+    GLuint framebuffer = 0, counts = 0, depth = 0;
+    GLint previousFramebuffer = 0;
+    int width = 0, height = 0;
+    vector<float> pixels;
+
+    void allocate(int width, int height)
+    {
+        release();
+        this->width = width;
+        this->height = height;
+        glGenTextures(1, &counts);
+        glBindTexture(GL_TEXTURE_2D, counts);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R16F, width, height, 0, GL_RED, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glGenRenderbuffers(1, &depth);
+        glBindRenderbuffer(GL_RENDERBUFFER, depth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, counts, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "OVERDRAW::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    void release()
+    {
+        if (framebuffer != 0)
+        {
+            glDeleteFramebuffers(1, &framebuffer);
+            glDeleteRenderbuffers(1, &depth);
+            glDeleteTextures(1, &counts);
+            framebuffer = depth = counts = 0;
+        }
+    }
+
+    void readCounts()
+    {
+        pixels.resize(static_cast<size_t>(width) * height);
+        GLint readFramebuffer = 0;
+        glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+        glReadPixels(0, 0, width, height, GL_RED, GL_FLOAT, pixels.data());
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+        double total = 0.0;
+        size_t covered = 0, overdrawn = 0;
+        maxFragments = 0;
+        for (float count : pixels)
+        {
+            total += count;
+            covered += count > 0.0f ? 1 : 0;
+            overdrawn += count > 1.0f ? 1 : 0;
+            maxFragments = std::max(maxFragments, static_cast<unsigned int>(count));
+        }
+        averageFragments = covered ? total / covered : 0.0;
+        overdrawnShare = covered ? static_cast<double>(overdrawn) / covered : 0.0;
+    }
+};
+#endif
@@ -0,0 +1,252 @@
+#ifndef PNG_WRITER_H
+#define PNG_WRITER_H
+
+#include <string>
+#include <vector>
+#include <array>
+#include <fstream>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+using namespace std;
+
+// Minimal PNG encoder for the golden images (8-bit RGB or RGBA, top row first), small enough to live next to the
+// stb_image reader the app already has. Each row gets the filter with the smallest sum of residuals; the stream is
+// deflated with the fixed Huffman codes and a hash chain LZ77 search, which gets rendered frames to a fraction of
+// their raw size without a zlib dependency.
+
+inline uint32_t pngCrc(const unsigned char *data, size_t size, uint32_t crc = 0)
+{
+    // built once, the initialization of a function-local static is thread safe for the recorder's encoders
+    static const array<uint32_t, 256> table = [] {
+        array<uint32_t, 256> entries{};
+        for (uint32_t n = 0; n < 256; n++)
+        {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            entries[n] = c;
+        }
+        return entries;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// LSB first bit writer of a deflate stream
+struct DeflateBits {
+    vector<unsigned char> &out;
+    uint32_t buffer = 0;
+    int count = 0;
+
+    explicit DeflateBits(vector<unsigned char> &out) : out(out) {}
+
+    void put(uint32_t bits, int length)
+    {
+        buffer |= bits << count;
+        count += length;
+        while (count >= 8)
+        {
+            out.push_back(static_cast<unsigned char>(buffer));
+            buffer >>= 8;
+            count -= 8;
+        }
+    }
+
+    // a Huffman code, which deflate stores most significant bit first
+    void code(uint32_t bits, int length)
+    {
+        uint32_t reversed = 0;
+        for (int i = 0; i < length; i++)
+            reversed |= ((bits >> i) & 1) << (length - 1 - i);
+        put(reversed, length);
+    }
+
+    void flush()
+    {
+        if (count > 0)
+            out.push_back(static_cast<unsigned char>(buffer));
+        buffer = 0;
+        count = 0;
+    }
+};
+
+// literal or length symbol with the fixed Huffman code of RFC 1951 3.2.6
+inline void deflateFixedSymbol(DeflateBits &bits, unsigned int symbol)
+{
+    if (symbol < 144)
+        bits.code(0x30 + symbol, 8);
+    else if (symbol < 256)
+        bits.code(0x190 + symbol - 144, 9);
+    else if (symbol < 280)
+        bits.code(symbol - 256, 7);
+    else
+        bits.code(0xC0 + symbol - 280, 8);
+}
+
+// zlib stream (RFC 1950) of one fixed Huffman deflate block
+inline vector<unsigned char> zlibCompress(const vector<unsigned char> &data)
+{
+    static const unsigned short lengthBase[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115,
+                                                 131, 163, 195, 227, 258 };
+    static const unsigned char lengthExtra[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    static const unsigned short distanceBase[] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537,
+                                                   2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+    static const unsigned char distanceExtra[] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+    const size_t WINDOW = 32768, HASH_SIZE = 1 << 15, MAX_CHAIN = 32, MIN_MATCH = 3, MAX_MATCH = 258;
+
+    vector<unsigned char> out = { 0x78, 0x01 };
+    DeflateBits bits(out);
+    bits.put(1, 1);   // final block
+    bits.put(1, 2);   // fixed Huffman codes
+
+    vector<int32_t> head(HASH_SIZE, -1), previous(data.size(), -1);
+    auto hash = [&](size_t i) { return ((data[i] << 10) ^ (data[i + 1] << 5) ^ data[i + 2]) & (HASH_SIZE - 1); };
+    auto insert = [&](size_t i) {
+        if (i + MIN_MATCH > data.size())
+            return;
+        uint32_t h = hash(i);
+        previous[i] = head[h];
+        head[h] = static_cast<int32_t>(i);
+    };
+
+    size_t i = 0;
+    while (i < data.size())
+    {
+        size_t bestLength = 0, bestDistance = 0;
+        if (i + MIN_MATCH <= data.size())
+        {
+            int32_t candidate = head[hash(i)];
+            size_t limit = std::min(MAX_MATCH, data.size() - i);
+            for (size_t chain = 0; candidate >= 0 && i - candidate <= WINDOW && chain < MAX_CHAIN; chain++, candidate = previous[candidate])
+            {
+                size_t length = 0;
+                while (length < limit && data[candidate + length] == data[i + length])
+                    length++;
+                if (length > bestLength)
+                {
+                    bestLength = length;
+                    bestDistance = i - candidate;
+                    if (length == limit)
+                        break;
+                }
+            }
+        }
+        if (bestLength >= MIN_MATCH)
+        {
+            int code = 0;
+            while (code < 28 && lengthBase[code + 1] <= bestLength)
+                code++;
+            deflateFixedSymbol(bits, 257 + code);
+            bits.put(static_cast<uint32_t>(bestLength - lengthBase[code]), lengthExtra[code]);
+            int distanceCode = 0;
+            while (distanceCode < 29 && distanceBase[distanceCode + 1] <= bestDistance)
+                distanceCode++;
+            bits.code(distanceCode, 5);
+            bits.put(static_cast<uint32_t>(bestDistance - distanceBase[distanceCode]), distanceExtra[distanceCode]);
+            for (size_t end = i + bestLength; i < end; i++)
+                insert(i);
+        }
+        else
+        {
+            deflateFixedSymbol(bits, data[i]);
+            insert(i);
+            i++;
+        }
+    }
+    deflateFixedSymbol(bits, 256);
+    bits.flush();
+
+    uint32_t a = 1, b = 0;
+    for (unsigned char byte : data)
+    {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    uint32_t adler = (b << 16) | a;
+    for (int shift = 24; shift >= 0; shift -= 8)
+        out.push_back(static_cast<unsigned char>(adler >> shift));
+    return out;
+}
+
+// Writes 8-bit pixels with 3 (RGB) or 4 (RGBA) channels as a PNG; false if the file can't be written
+inline bool pngWrite(const string &path, const unsigned char *pixels, int width, int height, int channels)
+{
+    size_t stride = static_cast<size_t>(width) * channels;
+    vector<unsigned char> filtered;
+    filtered.reserve((stride + 1) * height);
+    vector<unsigned char> candidate(stride), best(stride);
+    for (int y = 0; y < height; y++)
+    {
+        const unsigned char *row = pixels + y * stride;
+        const unsigned char *above = y > 0 ? row - stride : nullptr;
+        long bestCost = -1;
+        int bestFilter = 0;
+        for (int filter = 0; filter < 5; filter++)
+        {
+            long cost = 0;
+            for (size_t x = 0; x < stride; x++)
+            {
+                int left = x >= static_cast<size_t>(channels) ? row[x - channels] : 0;
+                int up = above ? above[x] : 0;
+                int upLeft = above && x >= static_cast<size_t>(channels) ? above[x - channels] : 0;
+                int predicted = 0;
+                if (filter == 1)
+                    predicted = left;
+                else if (filter == 2)
+                    predicted = up;
+                else if (filter == 3)
+                    predicted = (left + up) / 2;
+                else if (filter == 4)
+                {
+                    int p = left + up - upLeft, pa = abs(p - left), pb = abs(p - up), pc = abs(p - upLeft);
+                    predicted = pa <= pb && pa <= pc ? left : pb <= pc ? up : upLeft;
+                }
+                candidate[x] = static_cast<unsigned char>(row[x] - predicted);
+                cost += abs(static_cast<signed char>(candidate[x]));
+            }
+            if (bestCost < 0 || cost < bestCost)
+            {
+                bestCost = cost;
+                bestFilter = filter;
+                best.swap(candidate);
+            }
+        }
+        filtered.push_back(static_cast<unsigned char>(bestFilter));
+        filtered.insert(filtered.end(), best.begin(), best.end());
+    }
+
+    ofstream out(path, ios::binary | ios::trunc);
+    if (!out)
+        return false;
+    auto chunk = [&](const char *type, const vector<unsigned char> &data) {
+        unsigned char length[4] = { static_cast<unsigned char>(data.size() >> 24), static_cast<unsigned char>(data.size() >> 16),
+                                    static_cast<unsigned char>(data.size() >> 8), static_cast<unsigned char>(data.size()) };
+        out.write(reinterpret_cast<const char*>(length), 4);
+        out.write(type, 4);
+        out.write(reinterpret_cast<const char*>(data.data()), data.size());
+        uint32_t crc = pngCrc(reinterpret_cast<const unsigned char*>(type), 4);
+        crc = pngCrc(data.data(), data.size(), crc);
+        unsigned char crcBytes[4] = { static_cast<unsigned char>(crc >> 24), static_cast<unsigned char>(crc >> 16),
+                                      static_cast<unsigned char>(crc >> 8), static_cast<unsigned char>(crc) };
+        out.write(reinterpret_cast<const char*>(crcBytes), 4);
+    };
+    const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    out.write(reinterpret_cast<const char*>(signature), 8);
+    vector<unsigned char> header(13, 0);
+    for (int i = 0; i < 4; i++)
+    {
+        header[i] = static_cast<unsigned char>(width >> (24 - 8 * i));
+        header[4 + i] = static_cast<unsigned char>(height >> (24 - 8 * i));
+    }
+    header[8] = 8;
+    header[9] = channels == 4 ? 6 : 2;
+    chunk("IHDR", header);
+    chunk("IDAT", zlibCompress(filtered));
+    chunk("IEND", vector<unsigned char>());
+    out.close();
+    return static_cast<bool>(out);
+}
+#endif
@@ -0,0 +1,416 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+// Profiling zones are compiled in unless PROFILER_DISABLED is defined; then every PROFILE_ macro is empty and nothing
+// below is built, so the zones cost nothing.
+#ifndef PROFILER_DISABLED
+#define PROFILER_ENABLED
+#endif
+
+#ifdef PROFILER_ENABLED
+#include <glad/glad.h>
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
+using namespace std;
+
+// events a thread may record between two endFrame() calls before the oldest are dropped
+const size_t PROFILER_RING_SIZE = 1 << 13;
+// steady state frames kept for the trace, and frame times kept for the histogram
+const size_t PROFILER_HISTORY_FRAMES = 300;
+const size_t PROFILER_FRAME_TIMES = 240;
+// GPU zones per frame, and sets of queries in flight (as GPU_TIMER_LATENCY): a frame's timestamps are read back when
+// its set comes round again, PROFILER_GPU_FRAMES - 1 frames later
+const unsigned int PROFILER_GPU_ZONES = 32;
+const unsigned int PROFILER_GPU_FRAMES = 4;
+// the thread id GPU zones are reported under
+const uint32_t PROFILER_GPU_THREAD = 0xFFFF;
+
+// One zone: a name (a string literal, only the pointer is kept), start and end in nanoseconds since the profiler
+// started, and how many zones of its thread were open around it
+struct ProfileEvent {
+    const char *name;
+    uint64_t start;
+    uint64_t end;
+    uint32_t thread;
+    uint32_t depth;
+};
+
+// One thread's events. Only the thread itself writes; endFrame() on the main thread reads what was written since it
+// last looked. The write count is published with release after the event is in place, so the reader never sees a
+// half written event, and neither side takes a lock.
+struct ProfileRing {
+    ProfileEvent events[PROFILER_RING_SIZE];
+    atomic<uint64_t> written{ 0 };
+    // writer side
+    uint32_t depth = 0;
+    // reader side
+    uint64_t read = 0;
+    uint32_t thread = 0;
+    string name;
+};
+
+// the events of one frame, from the end of the one before; GPU zones arrive PROFILER_GPU_FRAMES - 1 frames late
+struct ProfileFrame {
+    uint64_t index = 0;
+    uint64_t start = 0;
+    uint64_t end = 0;
+    vector<ProfileEvent> events;
+    vector<ProfileEvent> gpuEvents;
+};
+
+// Process-wide CPU and GPU zone recorder. CPU zones (PROFILE_ZONE) go into the recording thread's ring; endFrame()
+// (PROFILE_FRAME, once per frame on the GL thread) collects every ring into the finished frame. Everything collected
+// before the first frame is kept as the startup, the last PROFILER_HISTORY_FRAMES frames after it as the steady state;
+// writeChromeTrace() writes both. GPU zones (PROFILE_GPU_ZONE, GL thread only) are pairs of GL_TIMESTAMP queries,
+// which unlike GL_TIME_ELAPSED may nest and run alongside GpuTimer; a frame's queries are only read once available,
+// so the profiler never waits for the GPU and drops a frame's GPU zones instead.
+class Profiler
+{
+public:
+    // frames since the first endFrame()
+    uint64_t frameCount = 0;
+    // CPU events lost to full rings and GPU frames dropped because the GPU was too far behind
+    uint64_t droppedEvents = 0;
+    uint64_t droppedGpuFrames = 0;
+
+    static Profiler &instance()
+    {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    uint64_t now() const
+    {
+        return static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - epoch).count());
+    }
+
+    // the calling thread's ring, registered on first use
+    ProfileRing &ring()
+    {
+        thread_local ProfileRing *threadRing = nullptr;
+        if (!threadRing)
+        {
+            lock_guard<mutex> lock(ringsMutex);
+            threadRing = new ProfileRing();
+            threadRing->thread = static_cast<uint32_t>(rings.size());
+            threadRing->name = "Thread " + to_string(rings.size());
+            rings.push_back(threadRing);
+        }
+        return *threadRing;
+    }
+
+    void setThreadName(const char *name)
+    {
+        ProfileRing &own = ring();
+        lock_guard<mutex> lock(ringsMutex);
+        own.name = name;
+    }
+
+    string threadName(uint32_t thread)
+    {
+        if (thread == PROFILER_GPU_THREAD)
+            return "GPU";
+        lock_guard<mutex> lock(ringsMutex);
+        return thread < rings.size() ? rings[thread]->name : string("?");
+    }
+
+    // depth of the zone about to open on this thread
+    uint32_t enter()
+    {
+        return ring().depth++;
+    }
+
+    void leave(const char *name, uint64_t start, uint32_t depth)
+    {
+        ProfileRing &own = ring();
+        uint64_t slot = own.written.load(memory_order_relaxed);
+        own.events[slot % PROFILER_RING_SIZE] = { name, start, now(), own.thread, depth };
+        own.written.store(slot + 1, memory_order_release);
+        own.depth = depth;
+    }
+
+    // Ends the frame: collects every thread's new events and the GPU zones that are ready, and starts the next.
+    // Call on the GL thread.
+    void endFrame()
+    {
+        uint64_t frameEnd = now();
+        ProfileFrame frame;
+        frame.index = frameCount;
+        frame.start = frameStart;
+        frame.end = frameEnd;
+        collect(frame.events);
+        endGpuFrame();
+
+        if (frameCount == 0)
+            startup = std::move(frame.events);
+        else
+        {
+            frameTimes.push_back(static_cast<float>((frameEnd - frameStart) / 1e6));
+            if (frameTimes.size() > PROFILER_FRAME_TIMES)
+                frameTimes.pop_front();
+            frames.push_back(std::move(frame));
+            if (frames.size() > PROFILER_HISTORY_FRAMES)
+                frames.pop_front();
+        }
+        frameStart = frameEnd;
+        frameCount++;
+    }
+
+    void beginGpuZone(const char *name)
+    {
+        createGpuQueries();
+        GpuFrame &frame = gpuFrames[gpuFrame];
+        if (frame.count >= PROFILER_GPU_ZONES)
+        {
+            gpuStack.push_back(-1);
+            return;
+        }
+        unsigned int zone = frame.count++;
+        frame.names[zone] = name;
+        frame.depths[zone] = static_cast<uint32_t>(gpuStack.size());
+        glQueryCounter(frame.queries[zone * 2], GL_TIMESTAMP);
+        gpuStack.push_back(static_cast<int>(zone));
+    }
+
+    void endGpuZone()
+    {
+        if (gpuStack.empty())
+            return;
+        int zone = gpuStack.back();
+        gpuStack.pop_back();
+        if (zone >= 0)
+        {
+            GpuFrame &frame = gpuFrames[gpuFrame];
+            glQueryCounter(frame.queries[zone * 2 + 1], GL_TIMESTAMP);
+            frame.last = frame.queries[zone * 2 + 1];
+        }
+    }
+
+    // the last steady state frame, and the last one whose GPU zones came back
+    const ProfileFrame *lastFrame() const { return frames.empty() ? nullptr : &frames.back(); }
+    const ProfileFrame *lastGpuFrame() const
+    {
+        for (auto frame = frames.rbegin(); frame != frames.rend(); ++frame)
+            if (!frame->gpuEvents.empty())
+                return &*frame;
+        return nullptr;
+    }
+    const deque<float> &recentFrameTimes() const { return frameTimes; }
+    const vector<ProfileEvent> &startupEvents() const { return startup; }
+
+    // Writes the startup and the kept frames as Chrome trace event JSON (chrome://tracing, Perfetto), one track per
+    // thread and one for the GPU
+    bool writeChromeTrace(const string &path)
+    {
+        ofstream out(path, ios::trunc);
+        if (!out)
+        {
+            cout << "ERROR::PROFILER:: could not write " << path << endl;
+            return false;
+        }
+        out << "{\"traceEvents\":[\n";
+        bool first = true;
+        auto separator = [&]() -> ofstream& { if (!first) out << ",\n"; first = false; return out; };
+        {
+            lock_guard<mutex> lock(ringsMutex);
+            for (const ProfileRing *threadRing : rings)
+                separator() << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << threadRing->thread << ",\"args\":{\"name\":\""
+                            << threadRing->name << "\"}}";
+        }
+        separator() << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << PROFILER_GPU_THREAD << ",\"args\":{\"name\":\"GPU\"}}";
+        auto event = [&](const ProfileEvent &e) {
+            separator() << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.thread << ",\"ts\":" << e.start / 1000.0
+                        << ",\"dur\":" << (e.end - e.start) / 1000.0 << "}";
+        };
+        for (const ProfileEvent &e : startup)
+            event(e);
+        for (const ProfileFrame &frame : frames)
+        {
+            separator() << "{\"name\":\"Frame " << frame.index << "\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":0,\"ts\":" << frame.start / 1000.0 << "}";
+            for (const ProfileEvent &e : frame.events)
+                event(e);
+            for (const ProfileEvent &e : frame.gpuEvents)
+                event(e);
+        }
+        out << "\n]}\n";
+        out.close();
+        if (!out)
+            return false;
+        cout << "PROFILER:: wrote " << startup.size() << " startup events and " << frames.size() << " frames to " << path << endl;
+        return true;
+    }
+
+private:
+    // one frame's timestamp queries, a start and an end per zone
+    struct GpuFrame {
+        GLuint queries[PROFILER_GPU_ZONES * 2] = {};
+        const char *names[PROFILER_GPU_ZONES] = {};
+        uint32_t depths[PROFILER_GPU_ZONES] = {};
+        unsigned int count = 0;
+        uint64_t index = 0;
+        // the query issued last, the GPU has the rest once it has this one
+        GLuint last = 0;
+    };
+
+    chrono::steady_clock::time_point epoch = chrono::steady_clock::now();
+    mutex ringsMutex;
+    vector<ProfileRing*> rings;
+    uint64_t frameStart = 0;
+    vector<ProfileEvent> startup;
+    deque<ProfileFrame> frames;
+    deque<float> frameTimes;
+
+    GpuFrame gpuFrames[PROFILER_GPU_FRAMES];
+    unsigned int gpuFrame = 0;
+    vector<int> gpuStack;
+    bool gpuCreated = false;
+    // CPU minus GPU clock, from the last calibration
+    int64_t gpuOffset = 0;
+
+    Profiler() {}
+
+    // the new events of every ring, skipping what a full ring has overwritten
+    void collect(vector<ProfileEvent> &events)
+    {
+        lock_guard<mutex> lock(ringsMutex);
+        for (ProfileRing *threadRing : rings)
+        {
+            uint64_t written = threadRing->written.load(memory_order_acquire);
+            // keep clear of the slots the writer may be filling while this runs
+            uint64_t oldest = written > PROFILER_RING_SIZE * 3 / 4 ? written - PROFILER_RING_SIZE * 3 / 4 : 0;
+            if (threadRing->read < oldest)
+            {
+                droppedEvents += oldest - threadRing->read;
+                threadRing->read = oldest;
+            }
+            for (; threadRing->read < written; threadRing->read++)
+                events.push_back(threadRing->events[threadRing->read % PROFILER_RING_SIZE]);
+        }
+    }
+
+    void createGpuQueries()
+    {
+        if (gpuCreated)
+            return;
+        for (GpuFrame &frame : gpuFrames)
+            glGenQueries(PROFILER_GPU_ZONES * 2, frame.queries);
+        gpuFrames[gpuFrame].index = frameCount;
+        calibrate();
+        gpuCreated = true;
+    }
+
+    // lines the GPU clock up with now(); GL_TIMESTAMP read this way doesn't wait for queued work
+    void calibrate()
+    {
+        GLint64 gpuTime = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+        gpuOffset = static_cast<int64_t>(now()) - static_cast<int64_t>(gpuTime);
+    }
+
+    // moves on to the next set of queries, reading back the one it reuses if the GPU has finished it
+    void endGpuFrame()
+    {
+        if (!gpuCreated)
+            return;
+        gpuStack.clear();
+        gpuFrame = (gpuFrame + 1) % PROFILER_GPU_FRAMES;
+        GpuFrame &frame = gpuFrames[gpuFrame];
+        if (frame.count > 0 && frame.last != 0)
+        {
+            GLint available = 0;
+            glGetQueryObjectiv(frame.last, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available)
+                resolveGpuFrame(frame);
+            else
+                droppedGpuFrames++;
+        }
+        frame.count = 0;
+        frame.last = 0;
+        frame.index = frameCount + 1;
+        // the clocks drift apart, line them up again now and then
+        if (frameCount % 120 == 0)
+            calibrate();
+    }
+
+    void resolveGpuFrame(const GpuFrame &frame)
+    {
+        ProfileFrame *target = nullptr;
+        for (ProfileFrame &candidate : frames)
+            if (candidate.index == frame.index)
+                target = &candidate;
+        if (!target)
+            return;
+        for (unsigned int zone = 0; zone < frame.count; zone++)
+        {
+            GLuint64 begin = 0, end = 0;
+            glGetQueryObjectui64v(frame.queries[zone * 2], GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(frame.queries[zone * 2 + 1], GL_QUERY_RESULT, &end);
+            uint64_t start = static_cast<uint64_t>(std::max<int64_t>(static_cast<int64_t>(begin) + gpuOffset, 0));
+            target->gpuEvents.push_back({ frame.names[zone], start, start + (end - begin), PROFILER_GPU_THREAD, frame.depths[zone] });
+        }
+    }
+};
+
+// Records the enclosing scope as a zone of the calling thread
+class ProfileZone
+{
+public:
+    explicit ProfileZone(const char *name)
+        : name(name), depth(Profiler::instance().enter()), start(Profiler::instance().now())
+    {
+    }
+
+    ~ProfileZone()
+    {
+        Profiler::instance().leave(name, start, depth);
+    }
+
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+
+private:
+    const char *name;
+    uint32_t depth;
+    uint64_t start;
+};
+
+// Times the GL commands issued in the enclosing scope, GL thread only
+class GpuProfileZone
+{
+public:
+    explicit GpuProfileZone(const char *name)
+    {
+        Profiler::instance().beginGpuZone(name);
+    }
+
+    ~GpuProfileZone()
+    {
+        Profiler::instance().endGpuZone();
+    }
+
+    GpuProfileZone(const GpuProfileZone&) = delete;
+    GpuProfileZone& operator=(const GpuProfileZone&) = delete;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_GPU_ZONE(name) GpuProfileZone PROFILE_CONCAT(gpuProfileZone, __LINE__)(name)
+#define PROFILE_THREAD(name) Profiler::instance().setThreadName(name)
+#define PROFILE_FRAME() Profiler::instance().endFrame()
+#else
+#define PROFILE_ZONE(name)
+#define PROFILE_GPU_ZONE(name)
+#define PROFILE_THREAD(name)
+#define PROFILE_FRAME()
+#endif
+#endif
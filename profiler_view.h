@@ -0,0 +1,129 @@
+#ifndef PROFILER_VIEW_H
+#define PROFILER_VIEW_H
+
+#include "profiler.h"
+
+#ifdef PROFILER_ENABLED
+#include <imgui/imgui.h>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include <cstdint>
+#include <cstdio>
+#include <cfloat>
+using namespace std;
+
+// file the "Write Chrome Trace" button writes
+const char PROFILER_TRACE_PATH[] = "profile_trace.json";
+// frame time histogram buckets of 1 ms
+const int PROFILER_HISTOGRAM_BUCKETS = 50;
+
+// The profiler's ImGui window: the rolling frame times and their histogram, and a flame graph of the last frame,
+// one band of rows per thread (nested zones below their parents) and one for the GPU. The GPU zones are those of
+// an earlier frame, the latest that came back, drawn against its own frame's start.
+class ProfilerView
+{
+public:
+    bool paused = false;
+
+    void draw()
+    {
+        Profiler &profiler = Profiler::instance();
+        if (!paused)
+        {
+            if (const ProfileFrame *frame = profiler.lastFrame())
+                shown = *frame;
+            if (const ProfileFrame *frame = profiler.lastGpuFrame())
+                shownGpu = *frame;
+            times.assign(profiler.recentFrameTimes().begin(), profiler.recentFrameTimes().end());
+        }
+
+        ImGui::Begin("Profiler");
+        ImGui::Checkbox("Pause", &paused);
+        ImGui::SameLine();
+        if (ImGui::Button("Write Chrome Trace"))
+            profiler.writeChromeTrace(PROFILER_TRACE_PATH);
+        ImGui::Text("Frame %llu: %.3f ms, %zu zones (%llu events, %llu GPU frames dropped)", static_cast<unsigned long long>(shown.index),
+                    (shown.end - shown.start) / 1e6, shown.events.size(), static_cast<unsigned long long>(profiler.droppedEvents),
+                    static_cast<unsigned long long>(profiler.droppedGpuFrames));
+
+        if (!times.empty())
+        {
+            vector<float> sorted = times;
+            std::sort(sorted.begin(), sorted.end());
+            auto percentile = [&](float p) { return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))]; };
+            ImGui::Text("p50 %.2f ms  p95 %.2f ms  p99 %.2f ms  max %.2f ms", percentile(0.50f), percentile(0.95f), percentile(0.99f), sorted.back());
+            ImGui::PlotLines("Frame ms", times.data(), static_cast<int>(times.size()), 0, nullptr, 0.0f, sorted.back() * 1.1f, ImVec2(0.0f, 60.0f));
+            float histogram[PROFILER_HISTOGRAM_BUCKETS] = {};
+            for (float time : times)
+                histogram[std::min(static_cast<int>(time), PROFILER_HISTOGRAM_BUCKETS - 1)] += 1.0f;
+            ImGui::PlotHistogram("Histogram", histogram, PROFILER_HISTOGRAM_BUCKETS, 0, "0 - 50 ms", 0.0f, FLT_MAX, ImVec2(0.0f, 60.0f));
+        }
+
+        drawFlameGraph();
+        ImGui::End();
+    }
+
+private:
+    ProfileFrame shown;
+    ProfileFrame shownGpu;
+    vector<float> times;
+
+    static ImU32 colour(const char *name)
+    {
+        uint32_t hash = static_cast<uint32_t>(std::hash<string>()(name));
+        return IM_COL32(80 + (hash & 0x7F), 80 + ((hash >> 8) & 0x7F), 80 + ((hash >> 16) & 0x7F), 255);
+    }
+
+    void drawFlameGraph()
+    {
+        if (shown.end <= shown.start)
+            return;
+        const float rowHeight = ImGui::GetTextLineHeightWithSpacing();
+        const float width = std::max(ImGui::GetContentRegionAvail().x, 100.0f);
+        const double duration = static_cast<double>(shown.end - shown.start);
+        ImDrawList *drawList = ImGui::GetWindowDrawList();
+
+        // the threads with zones this frame, in order of registration, then the GPU
+        vector<uint32_t> threads;
+        for (const ProfileEvent &event : shown.events)
+            if (std::find(threads.begin(), threads.end(), event.thread) == threads.end())
+                threads.push_back(event.thread);
+        std::sort(threads.begin(), threads.end());
+
+        auto band = [&](const string &label, const vector<ProfileEvent> &events, uint32_t thread, uint64_t frameStart) {
+            uint32_t depth = 0;
+            for (const ProfileEvent &event : events)
+                if (event.thread == thread)
+                    depth = std::max(depth, event.depth + 1);
+            ImGui::TextUnformatted(label.c_str());
+            ImVec2 origin = ImGui::GetCursorScreenPos();
+            ImGui::InvisibleButton(label.c_str(), ImVec2(width, std::max(depth, 1u) * rowHeight));
+            for (const ProfileEvent &event : events)
+            {
+                if (event.thread != thread || event.end < frameStart)
+                    continue;
+                float x0 = origin.x + static_cast<float>(std::max(static_cast<double>(event.start) - frameStart, 0.0) / duration * width);
+                float x1 = origin.x + static_cast<float>(std::min((static_cast<double>(event.end) - frameStart) / duration, 1.0) * width);
+                x1 = std::max(x1, x0 + 1.0f);
+                ImVec2 min(x0, origin.y + event.depth * rowHeight);
+                ImVec2 max(x1, min.y + rowHeight - 1.0f);
+                drawList->AddRectFilled(min, max, colour(event.name));
+                drawList->PushClipRect(min, max, true);
+                drawList->AddText(ImVec2(min.x + 2.0f, min.y), IM_COL32(0, 0, 0, 255), event.name);
+                drawList->PopClipRect();
+                if (ImGui::IsMouseHoveringRect(min, max))
+                    ImGui::SetTooltip("%s: %.3f ms", event.name, (event.end - event.start) / 1e6);
+            }
+        };
+
+        for (uint32_t thread : threads)
+            band(Profiler::instance().threadName(thread), shown.events, thread, shown.start);
+        if (!shownGpu.gpuEvents.empty())
+            band("GPU (frame " + to_string(shownGpu.index) + ")", shownGpu.gpuEvents, PROFILER_GPU_THREAD, shownGpu.start);
+    }
+};
+#endif
+#endif
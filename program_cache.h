@@ -0,0 +1,242 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <glad/glad.h>
+
+#include "mapped_file.h"
+#include "gl_extensions.h"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+using namespace std;
+
+// GL 4.1 program binaries and GL_KHR_parallel_shader_compile, which the GL 3.3 loader doesn't know
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+typedef void (APIENTRYP GetProgramBinaryProc)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+typedef void (APIENTRYP ProgramBinaryProc)(GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+typedef void (APIENTRYP ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+typedef void (APIENTRYP MaxShaderCompilerThreadsProc)(GLuint count);
+
+// When a Shader's link is waited for: in its constructor, or later through ready()/finish() so the driver can compile
+// it while the caller goes on
+enum ShaderBuild {
+    SHADER_BUILD_NOW,
+    SHADER_BUILD_ASYNC
+};
+
+// Program binary files, one per program in PROGRAM_CACHE_DIRECTORY named after its key:
+//   ProgramCacheHeader, then the driver's binary
+// Bump PROGRAM_CACHE_VERSION whenever the layout or what goes into the key changes.
+const char PROGRAM_CACHE_DIRECTORY[] = "shadercache";
+const uint32_t PROGRAM_CACHE_VERSION = 1;
+const char PROGRAM_CACHE_MAGIC[4] = { 'P', 'R', 'G', 'B' };
+
+struct ProgramCacheHeader {
+    char     magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t binaryFormat;
+    uint32_t binaryLength;
+};
+
+// Process-wide cache of linked programs. Shader hashes the sources it is about to compile, defines already injected,
+// together with the driver's vendor, renderer and version strings; a hit hands the stored binary to glProgramBinary
+// and skips compiling and linking. A binary the driver refuses (it changed without changing its strings) is a miss,
+// and the program is compiled and stored again. Without program binaries (GL 4.1 or GL_ARB_get_program_binary)
+// everything is a miss and nothing is written.
+class ProgramCache
+{
+public:
+    // programs loaded from the cache, compiled because they weren't in it (or the driver refused the binary), and
+    // the time spent on each, blocking time only
+    unsigned int hits = 0;
+    unsigned int misses = 0;
+    unsigned int rejected = 0;
+    double loadMs = 0.0;
+    double compileMs = 0.0;
+
+    static ProgramCache &instance()
+    {
+        static ProgramCache cache;
+        return cache;
+    }
+
+    // program binaries are core since GL 4.1
+    static bool binariesSupported()
+    {
+        return GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 1) || hasGLExtension("GL_ARB_get_program_binary");
+    }
+
+    // Loads the program binary entry points and, where the driver has GL_KHR_parallel_shader_compile (or the ARB
+    // version), lets it compile on as many threads as it likes. Returns true if binaries can be cached.
+    bool load(GLADloadproc loader)
+    {
+        if (binariesSupported())
+        {
+            getProgramBinary = reinterpret_cast<GetProgramBinaryProc>(loader("glGetProgramBinary"));
+            programBinary = reinterpret_cast<ProgramBinaryProc>(loader("glProgramBinary"));
+            programParameteri = reinterpret_cast<ProgramParameteriProc>(loader("glProgramParameteri"));
+            GLint formats = 0;
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+            // a driver may have the entry points and no format to save in
+            if (formats == 0)
+                getProgramBinary = nullptr;
+        }
+        MaxShaderCompilerThreadsProc maxThreads = nullptr;
+        if (hasGLExtension("GL_KHR_parallel_shader_compile"))
+            maxThreads = reinterpret_cast<MaxShaderCompilerThreadsProc>(loader("glMaxShaderCompilerThreadsKHR"));
+        else if (hasGLExtension("GL_ARB_parallel_shader_compile"))
+            maxThreads = reinterpret_cast<MaxShaderCompilerThreadsProc>(loader("glMaxShaderCompilerThreadsARB"));
+        if (maxThreads)
+            maxThreads(0xFFFFFFFFu);
+        parallel = maxThreads != nullptr;
+
+        if (enabled())
+        {
+            const GLubyte *strings[] = { glGetString(GL_VENDOR), glGetString(GL_RENDERER), glGetString(GL_VERSION) };
+            driverKey = hashBytes(&PROGRAM_CACHE_VERSION, sizeof(PROGRAM_CACHE_VERSION));
+            for (const GLubyte *string : strings)
+                if (string)
+                    driverKey = hashBytes(string, strlen(reinterpret_cast<const char*>(string)), driverKey);
+            std::error_code error;
+            filesystem::create_directories(PROGRAM_CACHE_DIRECTORY, error);
+        }
+        return enabled();
+    }
+
+    bool enabled() const { return getProgramBinary && programBinary && programParameteri; }
+
+    // true if programs can be polled for GL_COMPLETION_STATUS_KHR, so a pending link never has to be waited for
+    bool parallelCompile() const { return parallel; }
+
+    // key of a program built from these stage sources, 0 when the cache is off
+    uint64_t key(const vector<const string*> &sources) const
+    {
+        if (!enabled())
+            return 0;
+        uint64_t key = driverKey;
+        for (const string *source : sources)
+        {
+            uint64_t length = source->size();
+            key = hashBytes(&length, sizeof(length), key);
+            key = hashBytes(source->data(), source->size(), key);
+        }
+        return key;
+    }
+
+    // Puts the stored binary of a key into a new program. Returns false, the program unlinked, if there is none or
+    // the driver doesn't take it.
+    bool load(uint64_t key, GLuint program)
+    {
+        if (key == 0)
+            return false;
+        auto start = chrono::steady_clock::now();
+        MappedFile file(path(key));
+        if (!file.isOpen() || file.size() < sizeof(ProgramCacheHeader))
+            return false;
+        ProgramCacheHeader header;
+        memcpy(&header, file.data(), sizeof(header));
+        if (memcmp(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != PROGRAM_CACHE_VERSION
+            || header.key != key || file.size() < sizeof(header) + header.binaryLength)
+            return false;
+        programBinary(program, header.binaryFormat, file.data() + sizeof(header), static_cast<GLsizei>(header.binaryLength));
+        GLint linked = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        loadMs += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        if (!linked)
+        {
+            rejected++;
+            return false;
+        }
+        hits++;
+        return true;
+    }
+
+    // asks the driver to keep the binary of a program about to be linked
+    void prepare(GLuint program)
+    {
+        if (enabled())
+            programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    // Writes the binary of a linked program under its key, through a temporary file like the mesh cache
+    void store(uint64_t key, GLuint program)
+    {
+        if (key == 0)
+            return;
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+        vector<char> binary(length);
+        ProgramCacheHeader header;
+        memcpy(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic));
+        header.version = PROGRAM_CACHE_VERSION;
+        header.key = key;
+        GLenum format = 0;
+        GLsizei written = 0;
+        getProgramBinary(program, length, &written, &format, binary.data());
+        if (written <= 0)
+            return;
+        header.binaryFormat = format;
+        header.binaryLength = static_cast<uint32_t>(written);
+
+        string finalPath = path(key);
+        string tempPath = finalPath + ".tmp";
+        ofstream out(tempPath, ios::binary | ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(binary.data(), written);
+        out.close();
+        if (!out)
+        {
+            cout << "ERROR::PROGRAM_CACHE:: could not write " << tempPath << endl;
+            std::remove(tempPath.c_str());
+            return;
+        }
+        std::remove(finalPath.c_str());
+        if (std::rename(tempPath.c_str(), finalPath.c_str()) != 0)
+            std::remove(tempPath.c_str());
+    }
+
+    void printStats() const
+    {
+        cout << "PROGRAM_CACHE:: " << (enabled() ? "" : "off, ") << hits << " programs loaded in " << loadMs << " ms, " << misses
+             << " compiled (" << rejected << " binaries rejected), " << compileMs << " ms blocked on compiling"
+             << (parallel ? ", parallel compile" : "") << endl;
+    }
+
+private:
+    GetProgramBinaryProc getProgramBinary = nullptr;
+    ProgramBinaryProc programBinary = nullptr;
+    ProgramParameteriProc programParameteri = nullptr;
+    bool parallel = false;
+    uint64_t driverKey = 0;
+
+    ProgramCache() {}
+
+    static string path(uint64_t key)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.program", static_cast<unsigned long long>(key));
+        return string(PROGRAM_CACHE_DIRECTORY) + "/" + name;
+    }
+};
+#endif
@@ -0,0 +1,507 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "shader.h"
+#include "shader_variants.h"
+#include "mesh.h"
+#include "material.h"
+#include "instance_buffer.h"
+#include "geometry_pool.h"
+#include "multi_draw.h"
+#include "frustum_culler.h"
+#include "occlusion_culler.h"
+#include "gpu_culler.h"
+#include "profiler.h"
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+using namespace std;
+
+// per-draw transforms of the mesh shaders
+constexpr UniformName UNIFORM_MODEL = "model";
+constexpr UniformName UNIFORM_MODEL_VIEW_PROJECTION = "modelViewProjection";
+
+// Layout of a packet's 64-bit sort key, most significant first:
+//   pass (4 bits)  depth bucket (4)  program (16)  material (20)  mesh VAO (20)
+// Everything is opaque for now, so pass is 0 and the depth buckets run front to back. The buckets are log2 of the
+// distance, coarse enough that most of a frame still groups by program, material and mesh inside each one.
+const unsigned int RENDER_KEY_MESH_BITS = 20;
+const unsigned int RENDER_KEY_MATERIAL_BITS = 20;
+const unsigned int RENDER_KEY_PROGRAM_BITS = 16;
+const unsigned int RENDER_KEY_DEPTH_BITS = 4;
+const unsigned int RENDER_KEY_MATERIAL_SHIFT = RENDER_KEY_MESH_BITS;
+const unsigned int RENDER_KEY_PROGRAM_SHIFT = RENDER_KEY_MATERIAL_SHIFT + RENDER_KEY_MATERIAL_BITS;
+const unsigned int RENDER_KEY_DEPTH_SHIFT = RENDER_KEY_PROGRAM_SHIFT + RENDER_KEY_PROGRAM_BITS;
+const unsigned int RENDER_KEY_PASS_SHIFT = RENDER_KEY_DEPTH_SHIFT + RENDER_KEY_DEPTH_BITS;
+
+// One queued draw: a detail level of a mesh with its program and material, placed either by a model matrix or,
+// for instanced draws, by a run of an instance buffer (the model matrix is then the identity). Multi-draws copy the
+// instances' matrices from instanceTransforms, the CPU side of that run. Packets of a GPU culled batch have no
+// instances of their own; the compute pass fills in their command.
+struct RenderPacket {
+    Shader *shader;
+    Mesh *mesh;
+    unsigned int lod;
+    glm::mat4 transform;
+    const InstanceBuffer *instances;
+    size_t firstInstance;
+    unsigned int instanceCount;
+    const glm::mat4 *instanceTransforms;
+    int gpuBatch;
+};
+
+// A run of indirect commands drawn with one glMultiDrawElementsIndirect: same program, material and VAO
+struct MultiDrawBucket {
+    Shader *shader;
+    Mesh *mesh;
+    size_t firstCommand;
+    size_t commandCount;
+};
+
+// The GL state changes an order of packets costs, counted the way RenderQueue::submit and MaterialBinder issue them
+struct RenderQueueStats {
+    unsigned int programSwitches = 0;
+    unsigned int textureBinds = 0;
+    unsigned int vaoBinds = 0;
+    unsigned int drawCalls = 0;
+};
+
+// Collects a frame's draws instead of issuing them in the order main() lists them, sorts them by key and submits
+// them, switching program, textures and VAO only when they differ from the previous packet. The instance buffers
+// packets point at must keep their contents until submit(), so every Model fills its own once per frame.
+// With multiDraw on, each run of packets with the same program, material and VAO is one glMultiDrawElementsIndirect
+// instead, so the whole scene takes a few calls per material.
+class RenderQueue
+{
+public:
+    // when off, packets are submitted in the order they were added
+    bool sorting = true;
+
+    // what the frame's packets would have cost in the order they were added, and what they cost as submitted
+    RenderQueueStats unsortedStats;
+    RenderQueueStats submittedStats;
+
+    // the frame's frustum; models test themselves against it before adding packets
+    FrustumCuller culler;
+    // the frame's occluders; filled and rasterized after begin(), models then test themselves against it too
+    OcclusionCuller occlusion;
+
+    // lay down depth with depthShader before shading (see submit()); draw calls the pre-pass issued last frame
+    bool depthPrepass = false;
+    Shader *depthShader = nullptr;
+    unsigned int depthDrawCalls = 0;
+
+    // draw through glMultiDrawElementsIndirect where the context has it (multi_draw.h), otherwise one base vertex draw
+    // per packet; the glMultiDrawElementsIndirect calls and their commands last frame, pre-pass included
+    bool multiDraw = false;
+    unsigned int multiDrawCalls = 0;
+    unsigned int multiDrawCommands = 0;
+
+    // cull instanced models and pick their detail levels in a compute pass (gpu_culler.h); needs multiDraw
+    bool gpuCulling = false;
+    GpuCuller gpuCuller;
+
+    // Packets queued with one of variants' programs are switched to the variant their material needs, drawn
+    // instanced or not, under the frame's shaderFeatures (SHADER_FEATURE_FOG) and busiest cluster (pointLights)
+    ShaderVariants *variants = nullptr;
+    unsigned int shaderFeatures = 0;
+    unsigned int pointLights = 0;
+
+    void begin(const glm::vec3 &cameraPosition, const glm::mat4 &viewProjection)
+    {
+        this->cameraPosition = cameraPosition;
+        this->viewProjection = viewProjection;
+        culler.beginFrame(viewProjection);
+        occlusion.beginFrame(viewProjection);
+        gpuCuller.beginFrame();
+        if (variants)
+            variants->beginFrame();
+        packets.clear();
+        order.clear();
+    }
+
+    void add(Shader &shader, Mesh &mesh, unsigned int lod, const glm::mat4 &transform)
+    {
+        glm::vec3 center = glm::vec3(transform * glm::vec4(mesh.boundsCenter, 1.0f));
+        push({ &shader, &mesh, lod, transform, nullptr, 0, 1, nullptr, -1 }, glm::length(center - cameraPosition));
+    }
+
+    // distance is the camera distance of the nearest instance, see depth(). transforms are the instances' matrices,
+    // as uploaded to the instance buffer from firstInstance on, and must stay put until submit() too.
+    void addInstanced(Shader &shader, Mesh &mesh, unsigned int lod, const InstanceBuffer &instances, size_t firstInstance,
+                      unsigned int instanceCount, const glm::mat4 *transforms, float distance)
+    {
+        if (instanceCount == 0)
+            return;
+        push({ &shader, &mesh, lod, glm::mat4(1.0f), &instances, firstInstance, instanceCount, transforms, -1 }, distance);
+    }
+
+    // true if this frame's submit() will run the compute pass, so models may hand their instances to addGpuCulled
+    bool gpuCullingActive() const
+    {
+        return gpuCulling && multiDraw && MultiDraw::supported() && ComputeShader::supported();
+    }
+
+    // GL draw calls the last submit() issued, pre-pass included
+    unsigned int drawCalls() const
+    {
+        return multiDraw && MultiDraw::supported() ? multiDrawCalls : submittedStats.drawCalls + depthDrawCalls;
+    }
+
+    // Queues every mesh and detail level of a model for all of its instances (the first instanceCount of the
+    // buffer), to be culled and sorted into the levels on the GPU. The meshes and the buffer must stay put until
+    // submit(). The GPU decides the order inside a level, so the packets sort as if they were nearest.
+    void addGpuCulled(Shader &shader, vector<Mesh> &meshes, const InstanceBuffer &instances, unsigned int instanceCount,
+                      const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, const LodSelector &lodSelector)
+    {
+        if (instanceCount == 0)
+            return;
+        int batch = static_cast<int>(gpuCuller.add(meshes, instances, instanceCount, boundsMin, boundsMax, lodSelector));
+        for (Mesh &mesh : meshes)
+            for (unsigned int lod = 0; lod < GpuCuller::levels(mesh); lod++)
+                push({ &shader, &mesh, lod, glm::mat4(1.0f), &instances, 0, 0, nullptr, batch }, 0.0f);
+    }
+
+    // reads back what the compute pass let through into gpuCuller's batches; stalls, see GpuCuller::readVisible
+    void readGpuCulling()
+    {
+        gpuCuller.readVisible(multiDrawer.commandsId(), commands.size());
+    }
+
+    // camera distance of a world space point
+    float depth(const glm::vec3 &point) const
+    {
+        return glm::length(point - cameraPosition);
+    }
+
+    size_t size() const { return packets.size(); }
+
+    // sorts (unless sorting is off) and draws every packet. With depthPrepass on, the packets are first drawn into
+    // the depth buffer only, with depthShader and each mesh's position-only VAO, and the shading pass then tests
+    // against that depth with GL_LEQUAL and depth writes off, so every pixel runs the lighting shader once.
+    // shadingOverride draws the shading pass with another program (the overdraw view's). Leaves the last program in use.
+    void submit(Shader *shadingOverride = nullptr)
+    {
+        {
+            PROFILE_ZONE("Sort packets");
+            unsortedStats = measure();
+            if (sorting)
+                std::sort(order.begin(), order.end());
+            submittedStats = measure();
+        }
+
+        depthDrawCalls = multiDrawCalls = multiDrawCommands = 0;
+        bool indirect = multiDraw && MultiDraw::supported();
+        if (indirect)
+        {
+            PROFILE_ZONE("Prepare multi-draw");
+            prepareMultiDraw(shadingOverride);
+            if (gpuCullingActive())
+                gpuCuller.dispatch(culler.planes(), culler.enabled, multiDrawer.commandsId(), commands.size(),
+                                   multiDrawer.transformsId(), multiDrawer.texCoordsId());
+        }
+        if (depthPrepass && depthShader)
+        {
+            PROFILE_ZONE("Depth pre-pass");
+            PROFILE_GPU_ZONE("Depth pre-pass");
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            if (indirect)
+                multiDrawDepth();
+            else
+                drawDepth();
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            glDepthFunc(GL_LEQUAL);
+            glDepthMask(GL_FALSE);
+        }
+        {
+            PROFILE_ZONE("Shading pass");
+            PROFILE_GPU_ZONE("Shading pass");
+            if (indirect)
+                multiDrawShaded();
+            else
+                drawShaded(shadingOverride);
+        }
+        if (depthPrepass && depthShader)
+        {
+            glDepthMask(GL_TRUE);
+            glDepthFunc(GL_LESS);
+        }
+        glBindVertexArray(0);
+    }
+
+private:
+    vector<RenderPacket> packets;
+    // sort key and packet index, sorted instead of the packets themselves
+    vector<pair<uint64_t, uint32_t>> order;
+    glm::vec3 cameraPosition = glm::vec3(0.0f);
+    glm::mat4 viewProjection = glm::mat4(1.0f);
+
+    // the frame's indirect commands (shading runs first, then the pre-pass), their instance data and the runs
+    MultiDraw multiDrawer;
+    vector<pair<uint64_t, uint32_t>> bucketOrder;
+    vector<MultiDrawBucket> buckets;
+    vector<DrawElementsIndirectCommand> commands;
+    vector<glm::mat4> drawTransforms;
+    vector<glm::vec4> drawTexCoords;
+    vector<GLuint> packetInstances;
+    size_t firstDepthCommand = 0;
+
+    void drawShaded(Shader *shadingOverride)
+    {
+        Shader *shader = nullptr;
+        GLint modelLocation = -1, modelViewProjectionLocation = -1;
+        unsigned int vertexArray = 0;
+        for (const pair<uint64_t, uint32_t> &entry : order)
+        {
+            RenderPacket &packet = packets[entry.second];
+            Shader *packetShader = shadingOverride ? shadingOverride : packet.shader;
+            if (packetShader != shader)
+            {
+                shader = packetShader;
+                shader->use();
+                modelLocation = shader->location(UNIFORM_MODEL);
+                modelViewProjectionLocation = shader->location(UNIFORM_MODEL_VIEW_PROJECTION);
+            }
+            packet.mesh->bindMaterial(*shader);
+            if (packet.mesh->VAO != vertexArray)
+            {
+                vertexArray = packet.mesh->VAO;
+                glBindVertexArray(vertexArray);
+            }
+            glm::mat4 modelViewProjection = viewProjection * packet.transform;
+            glUniformMatrix4fv(modelLocation, 1, GL_FALSE, &packet.transform[0][0]);
+            glUniformMatrix4fv(modelViewProjectionLocation, 1, GL_FALSE, &modelViewProjection[0][0]);
+            packet.mesh->drawBound(packet.lod, packet.instances, packet.firstInstance, packet.instanceCount);
+        }
+    }
+
+    // the same order, front to back when sorted, with one program, no textures and the position-only VAOs
+    void drawDepth()
+    {
+        depthShader->use();
+        GLint modelViewProjectionLocation = depthShader->location(UNIFORM_MODEL_VIEW_PROJECTION);
+        unsigned int vertexArray = 0;
+        for (const pair<uint64_t, uint32_t> &entry : order)
+        {
+            RenderPacket &packet = packets[entry.second];
+            if (packet.mesh->depthVAO != vertexArray)
+            {
+                vertexArray = packet.mesh->depthVAO;
+                glBindVertexArray(vertexArray);
+            }
+            packet.mesh->bindQuantization(*depthShader);
+            glm::mat4 modelViewProjection = viewProjection * packet.transform;
+            glUniformMatrix4fv(modelViewProjectionLocation, 1, GL_FALSE, &modelViewProjection[0][0]);
+            packet.mesh->drawDepthBound(packet.lod, packet.instances, packet.firstInstance, packet.instanceCount);
+            depthDrawCalls++;
+        }
+    }
+
+    // Groups the sorted packets into runs of program, material and VAO (the depth bucket no longer comes first, but
+    // stays the order inside each run) and writes one command per packet. Its instances' matrices go to the stream
+    // with the mesh's dequantization folded in, so one program state fits every mesh of a run. GPU culled packets get
+    // an empty command; their batch learns which one, and gets its run of the stream after the CPU's instances.
+    void prepareMultiDraw(Shader *shadingOverride)
+    {
+        const uint64_t depthMask = ((uint64_t(1) << RENDER_KEY_DEPTH_BITS) - 1) << RENDER_KEY_DEPTH_SHIFT;
+        bucketOrder = order;
+        std::stable_sort(bucketOrder.begin(), bucketOrder.end(), [depthMask](const pair<uint64_t, uint32_t> &a, const pair<uint64_t, uint32_t> &b) {
+            return (a.first & ~depthMask) < (b.first & ~depthMask);
+        });
+
+        buckets.clear();
+        commands.clear();
+        drawTransforms.clear();
+        drawTexCoords.clear();
+        packetInstances.resize(packets.size());
+        for (const pair<uint64_t, uint32_t> &entry : bucketOrder)
+        {
+            const RenderPacket &packet = packets[entry.second];
+            Mesh &mesh = *packet.mesh;
+            Shader *shader = shadingOverride ? shadingOverride : packet.shader;
+            if (buckets.empty() || buckets.back().shader != shader || buckets.back().mesh->material != mesh.material
+                || buckets.back().mesh->VAO != mesh.VAO)
+                buckets.push_back({ shader, &mesh, commands.size(), 0 });
+            buckets.back().commandCount++;
+
+            const MeshLod &level = mesh.level(packet.lod);
+            if (packet.gpuBatch >= 0)
+            {
+                GpuCullBatch &batch = gpuCuller.batches[packet.gpuBatch];
+                batch.shadingCommands[&mesh - batch.meshes][packet.lod] = static_cast<GLint>(commands.size());
+                commands.push_back({ level.indexCount, 0, mesh.firstIndex + level.indexOffset, mesh.baseVertex, 0 });
+                packetInstances[entry.second] = 0;
+                continue;
+            }
+
+            GLuint baseInstance = static_cast<GLuint>(drawTransforms.size());
+            packetInstances[entry.second] = baseInstance;
+            glm::mat4 dequantize = glm::scale(glm::translate(glm::mat4(1.0f), mesh.quantization.positionOffset), mesh.quantization.positionScale);
+            if (packet.instanceTransforms)
+                for (unsigned int i = 0; i < packet.instanceCount; i++)
+                    drawTransforms.push_back(packet.instanceTransforms[i] * dequantize);
+            else
+                drawTransforms.push_back(packet.transform * dequantize);
+            drawTexCoords.resize(drawTransforms.size(), glm::vec4(mesh.quantization.texCoordOffset, mesh.quantization.texCoordScale));
+            commands.push_back({ level.indexCount, packet.instanceCount, mesh.firstIndex + level.indexOffset, mesh.baseVertex, baseInstance });
+        }
+
+        // the pre-pass keeps the front to back order, from the position-only streams
+        firstDepthCommand = commands.size();
+        if (depthPrepass && depthShader)
+        {
+            for (const pair<uint64_t, uint32_t> &entry : order)
+            {
+                const RenderPacket &packet = packets[entry.second];
+                const MeshLod &level = packet.mesh->level(packet.lod);
+                if (packet.gpuBatch >= 0)
+                {
+                    GpuCullBatch &batch = gpuCuller.batches[packet.gpuBatch];
+                    batch.depthCommands[packet.mesh - batch.meshes][packet.lod] = static_cast<GLint>(commands.size());
+                }
+                commands.push_back({ level.indexCount, packet.instanceCount, packet.mesh->firstIndex + level.indexOffset,
+                                     packet.mesh->depthBaseVertex, packetInstances[entry.second] });
+            }
+        }
+
+        size_t firstGpuInstance = drawTransforms.size();
+        for (GpuCullBatch &batch : gpuCuller.batches)
+        {
+            batch.firstInstance = firstGpuInstance;
+            firstGpuInstance += size_t(batch.instanceCount) * batch.meshCount;
+        }
+        multiDrawer.upload(commands, drawTransforms, drawTexCoords, gpuCuller.reservedInstances());
+    }
+
+    // transforms of a program in a multi-draw: the instance stream places everything, the mesh uniforms are identity
+    void useForMultiDraw(Shader &shader)
+    {
+        static const glm::mat4 identity(1.0f);
+        static const glm::vec3 zero(0.0f), one(1.0f);
+        shader.use();
+        glUniformMatrix4fv(shader.location(UNIFORM_MODEL), 1, GL_FALSE, &identity[0][0]);
+        glUniformMatrix4fv(shader.location(UNIFORM_MODEL_VIEW_PROJECTION), 1, GL_FALSE, &viewProjection[0][0]);
+        glUniform3fv(shader.location(UNIFORM_POSITION_OFFSET), 1, &zero[0]);
+        glUniform3fv(shader.location(UNIFORM_POSITION_SCALE), 1, &one[0]);
+    }
+
+    // binds a stream's VAO and, unless they still do, points its instance attributes at the multi-draw stream
+    void bindForMultiDraw(GeometryStream &stream)
+    {
+        glBindVertexArray(stream.vertexArray);
+        if (stream.instanceSource != INSTANCES_MULTI_DRAW)
+        {
+            multiDrawer.bindAttributes();
+            stream.instanceSource = INSTANCES_MULTI_DRAW;
+        }
+    }
+
+    void multiDrawShaded()
+    {
+        Shader *shader = nullptr;
+        unsigned int vertexArray = 0;
+        for (const MultiDrawBucket &bucket : buckets)
+        {
+            if (bucket.shader != shader)
+            {
+                shader = bucket.shader;
+                useForMultiDraw(*shader);
+            }
+            bucket.mesh->bindTextures(*shader);
+            if (bucket.mesh->VAO != vertexArray)
+            {
+                vertexArray = bucket.mesh->VAO;
+                bindForMultiDraw(*bucket.mesh->geometry);
+            }
+            multiDrawer.draw(bucket.firstCommand, bucket.commandCount);
+            multiDrawCalls++;
+            multiDrawCommands += static_cast<unsigned int>(bucket.commandCount);
+        }
+    }
+
+    // one call per run of the same position-only stream, normally a single one
+    void multiDrawDepth()
+    {
+        useForMultiDraw(*depthShader);
+        size_t first = 0;
+        for (size_t i = 1; i <= order.size(); i++)
+        {
+            if (i < order.size() && packets[order[i].second].mesh->depthVAO == packets[order[first].second].mesh->depthVAO)
+                continue;
+            bindForMultiDraw(*packets[order[first].second].mesh->depthGeometry);
+            multiDrawer.draw(firstDepthCommand + first, i - first);
+            depthDrawCalls++;
+            first = i;
+        }
+        multiDrawCalls += depthDrawCalls;
+        multiDrawCommands += static_cast<unsigned int>(order.size());
+    }
+
+    void push(RenderPacket packet, float distance)
+    {
+        if (variants && variants->owns(*packet.shader))
+        {
+            // a multi-draw places every packet by the instance stream
+            bool instanced = packet.instances != nullptr || (multiDraw && MultiDraw::supported());
+            packet.shader = &variants->select(*packet.mesh->material, instanced, shaderFeatures, pointLights);
+        }
+        order.push_back({ key(packet, distance), static_cast<uint32_t>(packets.size()) });
+        packets.push_back(packet);
+    }
+
+    static uint64_t key(const RenderPacket &packet, float distance)
+    {
+        const uint64_t depthMask = (1u << RENDER_KEY_DEPTH_BITS) - 1;
+        uint64_t depthBucket = std::min<uint64_t>(static_cast<uint64_t>(std::log2(1.0f + std::max(distance, 0.0f))), depthMask);
+        uint64_t program = packet.shader->ID & ((1u << RENDER_KEY_PROGRAM_BITS) - 1);
+        uint64_t material = packet.mesh->material->id & ((1u << RENDER_KEY_MATERIAL_BITS) - 1);
+        uint64_t mesh = packet.mesh->VAO & ((1u << RENDER_KEY_MESH_BITS) - 1);
+        return (depthBucket << RENDER_KEY_DEPTH_SHIFT) | (program << RENDER_KEY_PROGRAM_SHIFT)
+             | (material << RENDER_KEY_MATERIAL_SHIFT) | mesh;
+    }
+
+    // the state changes of the packets in their current order
+    RenderQueueStats measure() const
+    {
+        RenderQueueStats stats;
+        const Shader *shader = nullptr;
+        const Material *material = nullptr;
+        unsigned int vertexArray = 0;
+        GLuint bound[MATERIAL_SLOT_COUNT] = {};
+        for (const pair<uint64_t, uint32_t> &entry : order)
+        {
+            const RenderPacket &packet = packets[entry.second];
+            if (packet.shader != shader)
+            {
+                shader = packet.shader;
+                stats.programSwitches++;
+            }
+            if (packet.mesh->material != material)
+            {
+                material = packet.mesh->material;
+                for (int slot = 0; slot < MATERIAL_SLOT_COUNT; slot++)
+                {
+                    if (material->textures[slot] != 0 && material->textures[slot] != bound[slot])
+                    {
+                        bound[slot] = material->textures[slot];
+                        stats.textureBinds++;
+                    }
+                }
+            }
+            if (packet.mesh->VAO != vertexArray)
+            {
+                vertexArray = packet.mesh->VAO;
+                stats.vaoBinds++;
+            }
+            stats.drawCalls++;
+        }
+        return stats;
+    }
+};
+#endif
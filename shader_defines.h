@@ -0,0 +1,110 @@
+#ifndef SHADER_DEFINES_H
+#define SHADER_DEFINES_H
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+
+// Preprocessor symbols a program is compiled with, turned into #define lines right after the #version line of
+// every stage's source, so one GLSL file builds every variant (see shader_variants.h).
+struct ShaderDefines {
+    std::vector<std::string> names;
+    std::vector<int> values;
+    std::string lines;
+
+    void define(const std::string &name)
+    {
+        names.push_back(name);
+        values.push_back(1);
+        lines += "#define " + name + "\n";
+    }
+
+    void define(const std::string &name, int value)
+    {
+        names.push_back(name);
+        values.push_back(value);
+        lines += "#define " + name + " " + std::to_string(value) + "\n";
+    }
+
+    bool defined(const std::string &name) const
+    {
+        return std::find(names.begin(), names.end(), name) != names.end();
+    }
+
+    // the value of a define, 'otherwise' if there is none
+    int value(const std::string &name, int otherwise) const
+    {
+        auto it = std::find(names.begin(), names.end(), name);
+        return it == names.end() ? otherwise : values[it - names.begin()];
+    }
+
+    bool empty() const { return names.empty(); }
+};
+
+// the source with the defines after its #version line (GLSL wants #version first), unchanged without defines
+inline std::string injectDefines(const std::string &source, const ShaderDefines &defines)
+{
+    if (defines.empty())
+        return source;
+    size_t version = source.find("#version");
+    if (version == std::string::npos)
+        return defines.lines + source;
+    size_t lineEnd = source.find('\n', version);
+    if (lineEnd == std::string::npos)
+        return source + "\n" + defines.lines;
+    // #line keeps the compiler's line numbers those of the file
+    size_t versionLine = std::count(source.begin(), source.begin() + lineEnd, '\n') + 1;
+    return source.substr(0, lineEnd + 1) + defines.lines + "#line " + std::to_string(versionLine + 1) + "\n" + source.substr(lineEnd + 1);
+}
+
+// Source level size estimate of a variant: the statements (semicolons) left once the blocks the defines switch off
+// are dropped. Understands #ifdef, #ifndef, #else, #endif and "#if NAME > value"; any other #if counts as true.
+// Symbols the source defines itself aren't seen. For comparing variants of one file when the driver doesn't give
+// out program binaries.
+inline unsigned int estimateStatements(const std::string &source, const ShaderDefines &defines)
+{
+    std::istringstream in(source);
+    std::string line;
+    // whether each open block is active, and whether the one around it was
+    std::vector<std::pair<bool, bool>> blocks;
+    bool active = true;
+    unsigned int statements = 0;
+    while (std::getline(in, line))
+    {
+        size_t start = line.find_first_not_of(" \t");
+        if (start != std::string::npos && line[start] == '#')
+        {
+            std::istringstream directive(line.substr(start + 1));
+            std::string keyword, name, comparison;
+            int threshold = 0;
+            directive >> keyword >> name >> comparison >> threshold;
+            if (keyword == "ifdef" || keyword == "ifndef" || keyword == "if")
+            {
+                bool condition = (keyword == "ifdef") == defines.defined(name);
+                if (keyword == "if")
+                    condition = comparison != ">" || !defines.defined(name) || defines.value(name, 0) > threshold;
+                blocks.push_back({ condition, active });
+                active = active && condition;
+            }
+            else if (keyword == "else" && !blocks.empty())
+            {
+                blocks.back().first = !blocks.back().first;
+                active = blocks.back().second && blocks.back().first;
+            }
+            else if (keyword == "endif" && !blocks.empty())
+            {
+                active = blocks.back().second;
+                blocks.pop_back();
+            }
+            continue;
+        }
+        if (!active)
+            continue;
+        // nothing after a line comment counts
+        size_t comment = line.find("//");
+        statements += static_cast<unsigned int>(std::count(line.begin(), comment == std::string::npos ? line.end() : line.begin() + comment, ';'));
+    }
+    return statements;
+}
+#endif
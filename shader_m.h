@@ -4,10 +4,21 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include "asset_pack.h"
+#include "shader_uniforms.h"
+#include "shader_defines.h"
+#include "program_cache.h"
+#include "uniform_blocks.h"
+#include "material.h"
+#include "light_clusters.h"
+#include "profiler.h"
+
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
+#include <chrono>
 
 class Shader
 {
@@ -16,59 +27,103 @@ public:
     // constructor generates the shader on the fly
     // ------------------------------------------------------------------------
     Shader(const char* vertexPath, const char* fragmentPath)
+        : Shader(vertexPath, fragmentPath, ShaderDefines())
     {
+    }
+    // the same with the defines of a variant after every stage's #version line
+    // ------------------------------------------------------------------------
+    Shader(const char* vertexPath, const char* fragmentPath, const ShaderDefines &defines, ShaderBuild build = SHADER_BUILD_NOW)
+    {
+        PROFILE_ZONE("Build shader");
         // 1. retrieve the vertex/fragment source code from filePath
         std::string vertexCode;
         std::string fragmentCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
-        // ensure ifstream objects can throw exceptions:
-        vShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
         try 
         {
-            // open files
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
-            // read file's buffer contents into streams
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();		
-            // close file handlers
-            vShaderFile.close();
-            fShaderFile.close();
-            // convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();			
+            // read the sources from the mounted asset pack or from disk
+            vertexCode = injectDefines(readSource(vertexPath), defines);
+            fragmentCode = injectDefines(readSource(fragmentPath), defines);
         }
         catch (std::ifstream::failure& e)
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: " << e.what() << std::endl;
         }
+        // a program linked before with the same sources and driver comes from the program cache
+        ID = glCreateProgram();
+        cacheKey = ProgramCache::instance().key({ &vertexCode, &fragmentCode });
+        if (ProgramCache::instance().load(cacheKey, ID))
+        {
+            setup();
+            return;
+        }
+        ProgramCache::instance().misses++;
+        auto start = std::chrono::steady_clock::now();
         const char* vShaderCode = vertexCode.c_str();
         const char * fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
+        // 2. compile shaders, their status is only asked for in finish() so the driver may still be at it
         unsigned int vertex, fragment;
         // vertex shader
         vertex = glCreateShader(GL_VERTEX_SHADER);
         glShaderSource(vertex, 1, &vShaderCode, NULL);
         glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
         // fragment Shader
         fragment = glCreateShader(GL_FRAGMENT_SHADER);
         glShaderSource(fragment, 1, &fShaderCode, NULL);
         glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
         // shader Program
-        ID = glCreateProgram();
         glAttachShader(ID, vertex);
         glAttachShader(ID, fragment);
+        ProgramCache::instance().prepare(ID);
         glLinkProgram(ID);
+        stages = { vertex, fragment };
+        pending = true;
+        ProgramCache::instance().compileMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (build == SHADER_BUILD_NOW)
+            finish();
+    }
+    // true once the program is linked and set up. A program built with SHADER_BUILD_ASYNC is finished here as soon as
+    // the driver reports it done (GL_COMPLETION_STATUS_KHR), which never waits; without parallel compiling the
+    // first call finishes it and may wait.
+    // ------------------------------------------------------------------------
+    bool ready()
+    {
+        if (!pending)
+            return true;
+        if (ProgramCache::instance().parallelCompile())
+        {
+            GLint done = GL_FALSE;
+            glGetProgramiv(ID, GL_COMPLETION_STATUS_KHR, &done);
+            if (!done)
+                return false;
+        }
+        finish();
+        return true;
+    }
+    // waits for a pending program and sets it up
+    // ------------------------------------------------------------------------
+    void finish()
+    {
+        if (!pending)
+            return;
+        PROFILE_ZONE("Finish shader");
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned int stage : stages)
+        {
+            GLint type = 0;
+            glGetShaderiv(stage, GL_SHADER_TYPE, &type);
+            checkCompileErrors(stage, type == GL_VERTEX_SHADER ? "VERTEX" : type == GL_FRAGMENT_SHADER ? "FRAGMENT" : "GEOMETRY");
+        }
         checkCompileErrors(ID, "PROGRAM");
+        GLint linked = GL_FALSE;
+        glGetProgramiv(ID, GL_LINK_STATUS, &linked);
+        if (linked)
+            ProgramCache::instance().store(cacheKey, ID);
         // delete the shaders as they're linked into our program now and no longer necessery
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
-
+        for (unsigned int stage : stages)
+            glDeleteShader(stage);
+        stages.clear();
+        setup();
+        ProgramCache::instance().compileMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
     }
     // activate the shader
     // ------------------------------------------------------------------------
@@ -76,66 +131,141 @@ public:
     { 
         glUseProgram(ID); 
     }
+    // mask of (1 << location) for every vertex attribute the linked program reads
+    // ------------------------------------------------------------------------
+    unsigned int vertexAttributes() const
+    {
+        GLint count = 0;
+        glGetProgramiv(ID, GL_ACTIVE_ATTRIBUTES, &count);
+        unsigned int mask = 0;
+        for (GLint i = 0; i < count; i++)
+        {
+            GLchar name[64];
+            GLsizei length;
+            GLint size;
+            GLenum type;
+            glGetActiveAttrib(ID, i, sizeof(name), &length, &size, &type, name);
+            GLint location = glGetAttribLocation(ID, name);
+            if (location >= 0 && location < 32)
+                mask |= 1u << location;
+        }
+        return mask;
+    }
+    // location of an active uniform, -1 if the program has none by that name. No GL call.
+    // ------------------------------------------------------------------------
+    GLint location(UniformName name) const
+    {
+        const UniformTable::Entry* entry = uniforms.find(name);
+        return entry ? entry->location : -1;
+    }
+    // resolves a uniform once for set(). Warns if the program doesn't have it or it has another type.
+    // ------------------------------------------------------------------------
+    template <typename T>
+    Uniform<T> uniform(const std::string &name) const
+    {
+        Uniform<T> handle;
+        const UniformTable::Entry* entry = uniforms.find(name);
+        if (!entry)
+            std::cout << "SHADER:: uniform '" << name << "' is not active in program " << ID << std::endl;
+        else if (!shader_uniforms::accepts<T>(entry->type))
+            std::cout << "ERROR::SHADER::UNIFORM_TYPE_MISMATCH '" << name << "' in program " << ID << std::endl;
+        else
+            handle.location = entry->location;
+        return handle;
+    }
+    template <typename T>
+    void set(Uniform<T> handle, const typename Uniform<T>::Type &value) const
+    {
+        shader_uniforms::set(handle.location, value);
+    }
     // utility uniform functions
     // ------------------------------------------------------------------------
-    void setBool(const std::string &name, bool value) const
+    void setBool(UniformName name, bool value) const
     {         
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value); 
+        glUniform1i(location(name), (int)value); 
     }
     // ------------------------------------------------------------------------
-    void setInt(const std::string &name, int value) const
+    void setInt(UniformName name, int value) const
     { 
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value); 
+        glUniform1i(location(name), value); 
     }
     // ------------------------------------------------------------------------
-    void setFloat(const std::string &name, float value) const
+    void setFloat(UniformName name, float value) const
     { 
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value); 
+        glUniform1f(location(name), value); 
     }
     // ------------------------------------------------------------------------
-    void setVec2(const std::string &name, const glm::vec2 &value) const
+    void setVec2(UniformName name, const glm::vec2 &value) const
     { 
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform2fv(location(name), 1, &value[0]); 
     }
-    void setVec2(const std::string &name, float x, float y) const
+    void setVec2(UniformName name, float x, float y) const
     { 
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y); 
+        glUniform2f(location(name), x, y); 
     }
     // ------------------------------------------------------------------------
-    void setVec3(const std::string &name, const glm::vec3 &value) const
+    void setVec3(UniformName name, const glm::vec3 &value) const
     { 
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform3fv(location(name), 1, &value[0]); 
     }
-    void setVec3(const std::string &name, float x, float y, float z) const
+    void setVec3(UniformName name, float x, float y, float z) const
     { 
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z); 
+        glUniform3f(location(name), x, y, z); 
     }
     // ------------------------------------------------------------------------
-    void setVec4(const std::string &name, const glm::vec4 &value) const
+    void setVec4(UniformName name, const glm::vec4 &value) const
     { 
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform4fv(location(name), 1, &value[0]); 
     }
-    void setVec4(const std::string &name, float x, float y, float z, float w) const
+    void setVec4(UniformName name, float x, float y, float z, float w) const
     { 
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w); 
+        glUniform4f(location(name), x, y, z, w); 
     }
     // ------------------------------------------------------------------------
-    void setMat2(const std::string &name, const glm::mat2 &mat) const
+    void setMat2(UniformName name, const glm::mat2 &mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix2fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
-    void setMat3(const std::string &name, const glm::mat3 &mat) const
+    void setMat3(UniformName name, const glm::mat3 &mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix3fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
-    void setMat4(const std::string &name, const glm::mat4 &mat) const
+    void setMat4(UniformName name, const glm::mat4 &mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix4fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
 
 private:
+    UniformTable uniforms;
+    // the program cache key, and the shaders of a link that hasn't been finished yet
+    uint64_t cacheKey = 0;
+    std::vector<unsigned int> stages;
+    bool pending = false;
+
+    // the linked program's uniform table and fixed bindings
+    void setup()
+    {
+        pending = false;
+        // every active uniform's location, looked up by name hash from here on
+        uniforms.reflect(ID);
+        // and the shared uniform blocks at their fixed binding points
+        bindUniformBlocks(ID);
+        // and the material and light buffer samplers at their fixed texture units
+        bindMaterialSamplers(ID);
+        bindLightSamplers(ID);
+    }
+
+    // returns the whole file, throws std::ifstream::failure if it can't be read
+    static std::string readSource(const char* path)
+    {
+        AssetFile file(path);
+        if (!file.isOpen())
+            throw std::ifstream::failure(std::string("can't open ") + path);
+        return std::string(reinterpret_cast<const char*>(file.data()), file.size());
+    }
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(GLuint shader, std::string type)
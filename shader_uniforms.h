@@ -0,0 +1,147 @@
+#ifndef SHADER_UNIFORMS_H
+#define SHADER_UNIFORMS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <cstdint>
+#include <cstddef>
+
+// FNV-1a over a uniform name. constexpr, so names that are literals hash at compile time.
+constexpr uint64_t uniformHash(const char *name, size_t length)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= static_cast<unsigned char>(name[i]);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// length of a name held in a char array: up to its first NUL, the whole array if there is none
+constexpr size_t uniformNameLength(const char *name, size_t capacity)
+{
+    size_t length = 0;
+    while (length < capacity && name[length] != '\0')
+        length++;
+    return length;
+}
+
+// A uniform name as the Shader looks it up: just its hash. Built from a string literal the hash is a constant
+// (guaranteed when the UniformName itself is constexpr, folded by the optimizer otherwise); built from a
+// std::string it is hashed at runtime, still without a GL call or an allocation. A char buffer filled at runtime
+// (snprintf'd "lights[3]") takes the array constructor too and is hashed up to its terminator.
+struct UniformName {
+    uint64_t hash;
+
+    template <size_t N>
+    constexpr UniformName(const char (&name)[N]) : hash(uniformHash(name, uniformNameLength(name, N))) {}
+    UniformName(const std::string &name) : hash(uniformHash(name.data(), name.size())) {}
+};
+
+// A uniform location resolved once through Shader::uniform<T>(). T is the C++ type the uniform is set with.
+template <typename T>
+struct Uniform {
+    using Type = T;
+    GLint location = -1;
+};
+
+namespace shader_uniforms
+{
+    // GL types a uniform set with T may have in the shader
+    template <typename T> inline bool accepts(GLenum type);
+    template <> inline bool accepts<bool>(GLenum type) { return type == GL_BOOL || type == GL_INT; }
+    template <> inline bool accepts<int>(GLenum type)
+    {
+        // samplers are set with their texture unit
+        return type == GL_INT || type == GL_BOOL || type == GL_SAMPLER_2D || type == GL_SAMPLER_CUBE || type == GL_SAMPLER_3D
+            || type == GL_SAMPLER_BUFFER || type == GL_UNSIGNED_INT_SAMPLER_BUFFER;
+    }
+    template <> inline bool accepts<float>(GLenum type) { return type == GL_FLOAT; }
+    template <> inline bool accepts<glm::vec2>(GLenum type) { return type == GL_FLOAT_VEC2; }
+    template <> inline bool accepts<glm::vec3>(GLenum type) { return type == GL_FLOAT_VEC3; }
+    template <> inline bool accepts<glm::vec4>(GLenum type) { return type == GL_FLOAT_VEC4; }
+    template <> inline bool accepts<glm::mat2>(GLenum type) { return type == GL_FLOAT_MAT2; }
+    template <> inline bool accepts<glm::mat3>(GLenum type) { return type == GL_FLOAT_MAT3; }
+    template <> inline bool accepts<glm::mat4>(GLenum type) { return type == GL_FLOAT_MAT4; }
+
+    inline void set(GLint location, bool value) { glUniform1i(location, (int)value); }
+    inline void set(GLint location, int value) { glUniform1i(location, value); }
+    inline void set(GLint location, float value) { glUniform1f(location, value); }
+    inline void set(GLint location, const glm::vec2 &value) { glUniform2fv(location, 1, &value[0]); }
+    inline void set(GLint location, const glm::vec3 &value) { glUniform3fv(location, 1, &value[0]); }
+    inline void set(GLint location, const glm::vec4 &value) { glUniform4fv(location, 1, &value[0]); }
+    inline void set(GLint location, const glm::mat2 &value) { glUniformMatrix2fv(location, 1, GL_FALSE, &value[0][0]); }
+    inline void set(GLint location, const glm::mat3 &value) { glUniformMatrix3fv(location, 1, GL_FALSE, &value[0][0]); }
+    inline void set(GLint location, const glm::mat4 &value) { glUniformMatrix4fv(location, 1, GL_FALSE, &value[0][0]); }
+}
+
+// Every active uniform of a linked program, reflected once with GL_ACTIVE_UNIFORMS and kept sorted by name hash.
+// Array uniforms get an entry for the bare name and one per element ('lights[2]'); members of struct arrays are
+// reported by GL one by one ('pointLights[1].colour') and get theirs that way.
+class UniformTable
+{
+public:
+    struct Entry {
+        uint64_t hash;
+        GLint    location;
+        GLenum   type;
+    };
+
+    void reflect(GLuint program)
+    {
+        entries.clear();
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<GLchar> name(std::max(maxLength, 1) + 16);
+        for (GLint i = 0; i < count; i++)
+        {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(program, static_cast<GLuint>(i), static_cast<GLsizei>(name.size()), &length, &size, &type, name.data());
+            std::string uniform(name.data(), static_cast<size_t>(length));
+            GLint location = glGetUniformLocation(program, uniform.c_str());
+            if (location < 0)
+                continue; // uniform block members have no location
+            add(uniform, location, type);
+
+            // 'name[0]' of an array also answers to 'name', and every element has its own location
+            if (uniform.size() > 3 && uniform.compare(uniform.size() - 3, 3, "[0]") == 0)
+            {
+                std::string base = uniform.substr(0, uniform.size() - 3);
+                add(base, location, type);
+                for (GLint element = 1; element < size; element++)
+                {
+                    std::string elementName = base + "[" + std::to_string(element) + "]";
+                    add(elementName, glGetUniformLocation(program, elementName.c_str()), type);
+                }
+            }
+        }
+        std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.hash < b.hash; });
+    }
+
+    // nullptr if the program has no such active uniform
+    const Entry* find(UniformName name) const
+    {
+        auto it = std::lower_bound(entries.begin(), entries.end(), name.hash, [](const Entry &entry, uint64_t hash) { return entry.hash < hash; });
+        return it != entries.end() && it->hash == name.hash ? &*it : nullptr;
+    }
+
+    size_t size() const { return entries.size(); }
+
+private:
+    std::vector<Entry> entries;
+
+    void add(const std::string &name, GLint location, GLenum type)
+    {
+        entries.push_back({ uniformHash(name.data(), name.size()), location, type });
+    }
+};
+#endif
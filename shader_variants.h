@@ -0,0 +1,222 @@
+#ifndef SHADER_VARIANTS_H
+#define SHADER_VARIANTS_H
+
+#include <glad/glad.h>
+
+#include "shader.h"
+#include "shader_defines.h"
+#include "material.h"
+#include "program_cache.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <chrono>
+#include <iostream>
+using namespace std;
+
+// Features a variant of the model shader is compiled with, each one a #define of 1.model_loading.vs/.fs
+enum ShaderFeature {
+    SHADER_FEATURE_NORMAL_MAP = 1 << 0,    // HAS_NORMAL_MAP
+    SHADER_FEATURE_SPECULAR_MAP = 1 << 1,  // HAS_SPECULAR_MAP
+    SHADER_FEATURE_FOG = 1 << 2,           // FOG
+    SHADER_FEATURE_INSTANCED = 1 << 3      // INSTANCED
+};
+const unsigned int SHADER_FEATURES_ALL = SHADER_FEATURE_NORMAL_MAP | SHADER_FEATURE_SPECULAR_MAP | SHADER_FEATURE_FOG | SHADER_FEATURE_INSTANCED;
+
+// A variant's key: the feature bits, and above them the point light bucket. Bucket 0 leaves NUM_POINT_LIGHTS
+// undefined, so the shader's own cap of MAX_LIGHTS_PER_CLUSTER applies; the others define it as pointLightLimit().
+typedef unsigned int ShaderVariantKey;
+const unsigned int SHADER_VARIANT_LIGHT_SHIFT = 8;
+
+// The point light limits variants are built for: none, then powers of two up to the per-cluster cap. A frame's
+// busiest cluster is rounded up to one of them, so a few programs cover every light count.
+inline int pointLightLimit(unsigned int bucket)
+{
+    return bucket == 0 ? MAX_LIGHTS_PER_CLUSTER : bucket == 1 ? 0 : 1 << (bucket - 2);
+}
+
+// the smallest bucket whose limit holds lights, 0 (all of them) from the cap on
+inline unsigned int pointLightBucket(unsigned int lights)
+{
+    if (lights == 0)
+        return 1;
+    for (unsigned int bucket = 2; pointLightLimit(bucket) < MAX_LIGHTS_PER_CLUSTER; bucket++)
+        if (static_cast<unsigned int>(pointLightLimit(bucket)) >= lights)
+            return bucket;
+    return 0;
+}
+
+inline ShaderVariantKey shaderVariantKey(unsigned int features, unsigned int lightBucket)
+{
+    return features | (lightBucket << SHADER_VARIANT_LIGHT_SHIFT);
+}
+
+inline ShaderDefines shaderVariantDefines(ShaderVariantKey key)
+{
+    ShaderDefines defines;
+    if (key & SHADER_FEATURE_NORMAL_MAP)
+        defines.define("HAS_NORMAL_MAP");
+    if (key & SHADER_FEATURE_SPECULAR_MAP)
+        defines.define("HAS_SPECULAR_MAP");
+    if (key & SHADER_FEATURE_FOG)
+        defines.define("FOG");
+    if (key & SHADER_FEATURE_INSTANCED)
+        defines.define("INSTANCED");
+    unsigned int bucket = key >> SHADER_VARIANT_LIGHT_SHIFT;
+    if (bucket != 0)
+        defines.define("NUM_POINT_LIGHTS", pointLightLimit(bucket));
+    return defines;
+}
+
+// the defines of a key as one line, for the log and the UI
+inline string shaderVariantName(ShaderVariantKey key)
+{
+    ShaderDefines defines = shaderVariantDefines(key);
+    string name;
+    for (size_t i = 0; i < defines.names.size(); i++)
+    {
+        if (!name.empty())
+            name += " ";
+        name += defines.names[i];
+        if (defines.names[i] == "NUM_POINT_LIGHTS")
+            name += "=" + to_string(defines.values[i]);
+    }
+    return name.empty() ? string("(none)") : name;
+}
+
+// A compiled variant and what it costs
+struct ShaderVariant {
+    unique_ptr<Shader> shader;
+    // statements left in both stages after the preprocessor (estimateStatements), and the driver's program binary
+    // size, 0 if the context doesn't give out binaries
+    unsigned int statements = 0;
+    GLint binaryBytes = 0;
+    // from the request until the program could be drawn with, frames spent on the fallback included
+    double compileMs = 0.0;
+    chrono::steady_clock::time_point requested;
+    bool measured = false;
+    // packets drawn with it this frame
+    unsigned int packets = 0;
+};
+
+// Every variant of one vertex/fragment pair, compiled on first use and kept for the lifetime of the cache. select()
+// picks the smallest variant a material and a draw need: no normal or specular sampling where the material has no
+// such map (Mesh::Draw leaves those units as they were), no fog while the fog is off and a point light loop no
+// longer than the frame's busiest cluster. A variant select() asks for the first time compiles in the background
+// (SHADER_BUILD_ASYNC) and the variant with every feature stands in for it until it is linked.
+class ShaderVariants
+{
+public:
+    // when off, select() hands out the variant with every feature, as the shader was before it had variants
+    bool enabled = true;
+
+    ShaderVariants(const char* vertexPath, const char* fragmentPath)
+        : vertexPath(vertexPath), fragmentPath(fragmentPath)
+    {
+    }
+
+    // the variant of a key, compiled now if it hasn't been
+    Shader &variant(ShaderVariantKey key)
+    {
+        ShaderVariant &variant = entry(key, SHADER_BUILD_NOW);
+        variant.shader->finish();
+        measure(key, variant);
+        return *variant.shader;
+    }
+
+    // the variant for a material, drawn instanced or not, under the frame's features (SHADER_FEATURE_FOG) and point
+    // light count, or the one with every feature while that is still compiling; counts the packet on the one returned
+    Shader &select(const Material &material, bool instanced, unsigned int frameFeatures, unsigned int pointLights)
+    {
+        ShaderVariantKey key = enabled ? shaderVariantKey(materialFeatures(material, instanced) | (frameFeatures & SHADER_FEATURE_FOG),
+                                                          pointLightBucket(pointLights))
+                                       : shaderVariantKey(SHADER_FEATURES_ALL, 0);
+        ShaderVariant *selected = &entry(key, SHADER_BUILD_ASYNC);
+        if (selected->shader->ready())
+            measure(key, *selected);
+        else
+        {
+            ShaderVariantKey fallback = shaderVariantKey(SHADER_FEATURES_ALL, 0);
+            variant(fallback);
+            selected = &variants[fallback];
+        }
+        selected->packets++;
+        return *selected->shader;
+    }
+
+    static unsigned int materialFeatures(const Material &material, bool instanced)
+    {
+        unsigned int features = instanced ? SHADER_FEATURE_INSTANCED : 0;
+        if (material.textures[MATERIAL_SLOT_NORMAL] != 0)
+            features |= SHADER_FEATURE_NORMAL_MAP;
+        if (material.textures[MATERIAL_SLOT_SPECULAR] != 0)
+            features |= SHADER_FEATURE_SPECULAR_MAP;
+        return features;
+    }
+
+    // clears the packet counts
+    void beginFrame()
+    {
+        for (auto &entry : variants)
+            entry.second.packets = 0;
+    }
+
+    // true if the program is one of the variants
+    bool owns(const Shader &shader) const
+    {
+        for (const auto &entry : variants)
+            if (entry.second.shader.get() == &shader)
+                return true;
+        return false;
+    }
+
+    const map<ShaderVariantKey, ShaderVariant> &compiled() const { return variants; }
+
+    // variants still compiling
+    unsigned int pending() const
+    {
+        unsigned int count = 0;
+        for (const auto &entry : variants)
+            count += entry.second.measured ? 0 : 1;
+        return count;
+    }
+
+private:
+    string vertexPath, fragmentPath;
+    map<ShaderVariantKey, ShaderVariant> variants;
+
+    ShaderVariant &entry(ShaderVariantKey key, ShaderBuild build)
+    {
+        auto found = variants.find(key);
+        if (found != variants.end())
+            return found->second;
+
+        ShaderVariant &variant = variants[key];
+        variant.requested = chrono::steady_clock::now();
+        variant.shader.reset(new Shader(vertexPath.c_str(), fragmentPath.c_str(), shaderVariantDefines(key), build));
+        return variant;
+    }
+
+    // the statistics of a variant that just became ready
+    void measure(ShaderVariantKey key, ShaderVariant &variant)
+    {
+        if (variant.measured)
+            return;
+        variant.measured = true;
+        variant.compileMs = chrono::duration<double, milli>(chrono::steady_clock::now() - variant.requested).count();
+        ShaderDefines defines = shaderVariantDefines(key);
+        variant.statements = estimateStatements(source(vertexPath), defines) + estimateStatements(source(fragmentPath), defines);
+        if (ProgramCache::binariesSupported())
+            glGetProgramiv(variant.shader->ID, GL_PROGRAM_BINARY_LENGTH, &variant.binaryBytes);
+        std::cout << "SHADER_VARIANTS:: " << fragmentPath << " [" << shaderVariantName(key) << "] " << variant.statements << " statements, "
+                  << variant.binaryBytes << " binary bytes, ready in " << variant.compileMs << " ms" << std::endl;
+    }
+
+    static string source(const string &path)
+    {
+        AssetFile file(path);
+        return file.isOpen() ? string(reinterpret_cast<const char*>(file.data()), file.size()) : string();
+    }
+};
+#endif
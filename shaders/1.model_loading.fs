@@ -1,69 +1,95 @@
 #version 330 core
+// Variants (shader_variants.h), everything off without defines:
+//   HAS_NORMAL_MAP, HAS_SPECULAR_MAP  sample the map; without it the normal is flat and there is no specular
+//   FOG                               blend towards the fog colour with distance
+//   NUM_POINT_LIGHTS=N                light with at most N of the cluster's point lights, none for 0
+#ifndef NUM_POINT_LIGHTS
+#define NUM_POINT_LIGHTS 128           // MAX_LIGHTS_PER_CLUSTER, all of them
+#endif
 out vec4 FragColor;
 
 in vec3 Normal;
 in vec2 TexCoords;
 in vec3 FragPos;
 
+#ifdef HAS_NORMAL_MAP
 uniform sampler2D texture_normal1;
+#endif
 uniform sampler2D texture_diffuse1;
+#ifdef HAS_SPECULAR_MAP
 uniform sampler2D texture_specular1;
+#endif
 
-//Point light Specification
-const int NUM_POINT_LIGHTS = 3;
+// Clustered point lights, LightClusters in light_clusters.h. The grid must match the CLUSTER_ constants there.
+const int CLUSTER_TILES_X = 16;
+const int CLUSTER_TILES_Y = 9;
+const int CLUSTER_SLICES = 24;
+
+// three texels per light: position and range, colour, attenuation
+uniform samplerBuffer pointLightData;
+// offset into lightIndices and light count of every cluster
+uniform usamplerBuffer lightClusters;
+uniform usamplerBuffer lightIndices;
 
 struct PointLight {
-    vec3 position;
-    vec3 colour;
-    // Attenuation parameters
-    float constant;
-    float linear;
-    float quadratic;
+    vec4 position;       // w: range
+    vec4 colour;
+    // Attenuation parameters: constant, linear, quadratic
+    vec4 attenuation;
 };
 
-uniform PointLight pointLights[NUM_POINT_LIGHTS];
+// per frame uniforms, FrameUniformData in uniform_blocks.h
+layout (std140) uniform FrameBlock {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    mat4 skyViewProjection;
+    vec4 viewPosition;   // w: time
+    vec4 fogColour;      // a: density
+    vec4 fogRange;       // x: start, y: end
+    vec4 clusterGrid;    // xy: tiles per pixel, slice = log(view depth) * z + w
+} frame;
+
+// Imported from Main code, LightUniformData in uniform_blocks.h
+layout (std140) uniform LightBlock {
+    vec4 ambient;        // a: strength
+    vec4 directionalColour;
+    vec4 directionalDirection;
+} lights;
 
-//General Specification
-// Imported from Main code
-uniform float ambientStrength;
-uniform vec3 ambientColour;
 uniform float shininess;
 
-// Directional Light Specification
-uniform vec3 dlightDirection;
-uniform vec3 dlColour;
-
-// Camera Position
-uniform vec3 viewPos;
-
-// Fog
-uniform vec3 fogColour;
-uniform float fogDensity;
-uniform float fogStart;
-uniform float fogEnd;
 
+PointLight fetchPointLight(int index) {
+    PointLight light;
+    light.position = texelFetch(pointLightData, index * 3);
+    light.colour = texelFetch(pointLightData, index * 3 + 1);
+    light.attenuation = texelFetch(pointLightData, index * 3 + 2);
+    return light;
+}
 
-vec3 calculatePL(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir) {
-    // Distance between point light and fragment
-    float distance = length(light.position - fragPos);
+vec3 calculatePL(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 diffuseColour, float specularStrength) {
+    // Distance between point light and fragment, nothing past the light's range
+    float distance = length(light.position.xyz - fragPos);
+    if (distance > light.position.w)
+        return vec3(0.0);
     // Attentuation
-    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+    float attenuation = 1.0 / (light.attenuation.x + light.attenuation.y * distance + light.attenuation.z * (distance * distance));
 
     // Diffuse Shading
-    vec3 lightDirection = normalize(light.position - fragPos);
+    vec3 lightDirection = normalize(light.position.xyz - fragPos);
     float diffuseS = max(dot(normal, lightDirection), 0.0);
     diffuseS *= max(dot(normal, lightDirection), 0.0);
 
     // Specular shading
-    float specularStrength = texture(texture_specular1, TexCoords).r;
     vec3 reflectDir = reflect(-lightDirection, normal);
     float specularS = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
 
     // calculate the diffuse and specular components
-    vec3 diffuse = diffuseS * light.colour * attenuation;
-    vec3 specular = specularStrength * specularS * light.colour * attenuation;
+    vec3 diffuse = diffuseS * light.colour.rgb * attenuation;
+    vec3 specular = specularStrength * specularS * light.colour.rgb * attenuation;
 
-    return (diffuse + specular) * texture(texture_diffuse1, TexCoords).rgb;
+    return (diffuse + specular) * diffuseColour;
 }
 
 
@@ -71,37 +97,58 @@ vec3 calculatePL(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir) {
 {    
     // Calculate Ambiant Light
     vec3 diffuseColour = texture(texture_diffuse1, TexCoords).rgb;
-    vec3 ambient = ambientStrength * ambientColour * diffuseColour;
+    vec3 ambient = lights.ambient.a * lights.ambient.rgb * diffuseColour;
 
     // Calculate Directional Light
     vec3 norm = normalize(Normal);
-    vec3 lightDirection = normalize(-dlightDirection);
+    vec3 lightDirection = normalize(-lights.directionalDirection.xyz);
     float diff = max(dot(norm, lightDirection), 0.0);
-    vec3 normal = normalize(texture(texture_normal1, TexCoords).rgb * 2.0 - 1.0);
+#ifdef HAS_NORMAL_MAP
+    // z is rebuilt from x and y so two channel (BC5) normal maps work the same as RGB ones
+    vec2 normalXY = texture(texture_normal1, TexCoords).rg * 2.0 - 1.0;
+    vec3 normal = vec3(normalXY, sqrt(max(1.0 - dot(normalXY, normalXY), 0.0)));
     diff *= max(dot(normal, lightDirection), 0.0);
+#else
+    // a flat normal map, (0, 0, 1)
+    diff *= max(lightDirection.z, 0.0);
+#endif
+#ifdef HAS_SPECULAR_MAP
     float specularStrength = texture(texture_specular1, TexCoords).r;
-    vec3 viewDirection = normalize(viewPos - FragPos);
+#else
+    float specularStrength = 0.0;
+#endif
+    vec3 viewDirection = normalize(frame.viewPosition.xyz - FragPos);
     vec3 reflectDirection = reflect(-lightDirection, norm);
     float spec = pow(max(dot(viewDirection, reflectDirection), 0.0), shininess);
 
     // Combine Directional Light with diffuse and spec
-    vec3 cAmbient = (ambientStrength * ambientColour) * texture(texture_diffuse1, TexCoords).rgb;
-    vec3 cDiffuse = diff * dlColour * texture(texture_diffuse1, TexCoords).rgb;
-    vec3 cSpecular = specularStrength * spec * dlColour;
+    vec3 cAmbient = (lights.ambient.a * lights.ambient.rgb) * texture(texture_diffuse1, TexCoords).rgb;
+    vec3 cDiffuse = diff * lights.directionalColour.rgb * texture(texture_diffuse1, TexCoords).rgb;
+    vec3 cSpecular = specularStrength * spec * lights.directionalColour.rgb;
     vec3 result = (cAmbient + cDiffuse + cSpecular);
 
-    // Calculate all point lights
-    for(int i = 0; i < NUM_POINT_LIGHTS; i++) {
-        result += calculatePL(pointLights[i], norm, FragPos, viewDirection);
+    // Calculate the point lights of this fragment's cluster
+#if NUM_POINT_LIGHTS > 0
+    float viewDepth = -(frame.view * vec4(FragPos, 1.0)).z;
+    ivec3 cell = ivec3(gl_FragCoord.xy * frame.clusterGrid.xy, log(max(viewDepth, 1e-4)) * frame.clusterGrid.z + frame.clusterGrid.w);
+    cell = clamp(cell, ivec3(0), ivec3(CLUSTER_TILES_X - 1, CLUSTER_TILES_Y - 1, CLUSTER_SLICES - 1));
+    uvec2 cluster = texelFetch(lightClusters, cell.x + CLUSTER_TILES_X * (cell.y + CLUSTER_TILES_Y * cell.z)).rg;
+    cluster.y = min(cluster.y, uint(NUM_POINT_LIGHTS));
+    for(uint i = 0u; i < cluster.y; i++) {
+        int light = int(texelFetch(lightIndices, int(cluster.x + i)).r);
+        result += calculatePL(fetchPointLight(light), norm, FragPos, viewDirection, diffuseColour, specularStrength);
     }
+#endif
 
+#ifdef FOG
     // Fog Calculation
     // Distance : Camera to fragment
-    float distance = length(FragPos - viewPos);
+    float distance = length(FragPos - frame.viewPosition.xyz);
     // # fog determined by linear equation * fog density
-    float fogFactor = (fogEnd - distance) / (fogEnd - fogStart);
-    fogFactor = clamp(fogFactor, 0.0, 1.0) * fogDensity;
-    result = mix(result, fogColour, fogFactor);
+    float fogFactor = (frame.fogRange.y - distance) / (frame.fogRange.y - frame.fogRange.x);
+    fogFactor = clamp(fogFactor, 0.0, 1.0) * frame.fogColour.a;
+    result = mix(result, frame.fogColour.rgb, fogFactor);
+#endif
     
     FragColor = vec4(result, 1.0);
     
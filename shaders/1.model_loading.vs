@@ -1,22 +1,50 @@
 #version 330 core
-layout (location = 0) in vec3 position;
-layout (location = 1) in vec3 norm;
-layout (location = 2) in vec2 texcoord;
+// Variants (shader_variants.h): INSTANCED places every vertex by the per-instance matrix as well, without it only the
+// uniforms place it.
+
+// compact vertex layouts, see vertex_format.h
+layout (location = 0) in vec4 position;   // unorm16, relative to the mesh bounds
+layout (location = 1) in vec2 normOct;    // snorm16, octahedral
+layout (location = 2) in vec2 texcoord;   // unorm16, relative to the mesh UV bounds
+#ifdef INSTANCED
+layout (location = 4) in mat4 instanceModel; // per instance, identity for non-instanced draws (instance_buffer.h)
+#endif
+layout (location = 8) in vec4 instanceTexCoord; // texcoord offset.xy and scale.xy, per draw or per instance (mesh.h)
 
 out vec3 Normal;
 out vec2 TexCoords;
 out vec3 FragPos;
 
+// the depth pre-pass (depth_prepass.vs) computes the same position, the shading pass tests against it with GL_LEQUAL
+invariant gl_Position;
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+uniform mat4 modelViewProjection; // composed on the CPU, frame.viewProjection * model
+
+// Dequantization transform of the mesh; in a multi-draw it is folded into instanceModel and these are identity
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
 
 void main()
 {
+    vec3 localPosition = position.xyz * positionScale + positionOffset;
     //TexCoords = mat2(0.0, -1.0, 1.0, 0.0) * texcoord;
-    TexCoords = texcoord;
-    Normal = norm;
-    gl_Position = projection * view * model * vec4(position, 1.0);
-    FragPos = vec3(model * vec4(position, 1.0));
+    TexCoords = texcoord * instanceTexCoord.zw + instanceTexCoord.xy;
+    Normal = octDecode(normOct);
+#ifdef INSTANCED
+    vec4 instancePosition = instanceModel * vec4(localPosition, 1.0);
+#else
+    vec4 instancePosition = vec4(localPosition, 1.0);
+#endif
+    gl_Position = modelViewProjection * instancePosition;
+    FragPos = vec3(model * instancePosition);
 
-}
\ No newline at end of file
+}
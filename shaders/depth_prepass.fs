@@ -0,0 +1,5 @@
+#version 330 core
+// depth only, colour writes are off during the pre-pass
+void main()
+{
+}
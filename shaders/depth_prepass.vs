@@ -0,0 +1,20 @@
+#version 330 core
+// The depth pre-pass reads the position-only stream of every mesh (Mesh::depthVAO). gl_Position is invariant and
+// computed the same way as in 1.model_loading.vs, so the shading pass finds exactly these depths.
+layout (location = 0) in vec4 position;   // unorm16, relative to the mesh bounds
+layout (location = 4) in mat4 instanceModel; // per instance, identity for non-instanced draws (instance_buffer.h)
+
+invariant gl_Position;
+
+uniform mat4 modelViewProjection;
+
+// Dequantization transform of the mesh; in a multi-draw it is folded into instanceModel and these are identity
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+
+void main()
+{
+    vec3 localPosition = position.xyz * positionScale + positionOffset;
+    vec4 instancePosition = instanceModel * vec4(localPosition, 1.0);
+    gl_Position = modelViewProjection * instancePosition;
+}
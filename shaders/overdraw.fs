@@ -0,0 +1,9 @@
+#version 330 core
+out vec4 FragColor;
+
+// Replaces the lighting shader in the overdraw view: every fragment that gets shaded adds one to its pixel
+// (additive blending into an R16F target, see overdraw_view.h).
+void main()
+{
+    FragColor = vec4(1.0);
+}
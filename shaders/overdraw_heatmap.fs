@@ -0,0 +1,24 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+// shaded fragments per pixel, see overdraw_view.h
+uniform sampler2D overdrawCounts;
+
+// black where nothing was drawn, then blue, green and yellow for one to three fragments, red for four and fading
+// to white at eight
+void main()
+{
+    float count = texture(overdrawCounts, TexCoords).r;
+    vec3 colour = vec3(0.0);
+    if (count >= 3.5)
+        colour = mix(vec3(1.0, 0.1, 0.0), vec3(1.0), clamp((count - 4.0) / 4.0, 0.0, 1.0));
+    else if (count >= 2.5)
+        colour = vec3(1.0, 0.9, 0.0);
+    else if (count >= 1.5)
+        colour = vec3(0.0, 0.9, 0.2);
+    else if (count >= 0.5)
+        colour = vec3(0.0, 0.2, 1.0);
+    FragColor = vec4(colour, 1.0);
+}
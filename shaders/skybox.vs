@@ -3,12 +3,21 @@ layout (location = 0) in vec3 aPos;
 
 out vec3 TexCoords;
 
-uniform mat4 projection;
-uniform mat4 view;
+// per frame uniforms, FrameUniformData in uniform_blocks.h
+layout (std140) uniform FrameBlock {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    mat4 skyViewProjection;
+    vec4 viewPosition;
+    vec4 fogColour;
+    vec4 fogRange;
+    vec4 clusterGrid;
+} frame;
 
 void main()
 {
     TexCoords = aPos;
-    vec4 pos = projection * view * vec4(aPos, 1.0);
+    vec4 pos = frame.skyViewProjection * vec4(aPos, 1.0);
     gl_Position = pos.xyww;
 }  
\ No newline at end of file
@@ -0,0 +1,190 @@
+#ifndef TEXTURE_REGISTRY_H
+#define TEXTURE_REGISTRY_H
+
+#include <glad/glad.h>
+
+// all image decoding goes through here, so stb_image is compiled into this header
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+#undef STB_IMAGE_IMPLEMENTATION
+
+#include "mapped_file.h"
+#include "asset_pack.h"
+#include "texture_streamer.h"
+
+#include <string>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+using namespace std;
+
+// neutral grey shown until a texture has streamed in
+const unsigned char DEFAULT_PLACEHOLDER[4] = { 128, 128, 128, 255 };
+
+// Process-wide registry of GL textures, shared by every Model. Textures are found by their resolved path
+// first and by a hash of the file contents second, so identical images in different folders are decoded
+// and uploaded only once. Every acquire must be matched by a release; the texture is deleted with its last reference.
+// New textures start as a 1x1 placeholder and are filled in by the TextureStreamer. If the texture transcoder
+// left a '<image>.ktx2' next to the image it is used instead of the image itself.
+class TextureRegistry
+{
+public:
+    static TextureRegistry &instance()
+    {
+        static TextureRegistry registry;
+        return registry;
+    }
+
+    // Returns the texture for the image file at path, queueing it for streaming if nobody holds it yet.
+    // The texture shows the placeholder colour until its pixels arrive. 0 if the file can't be read.
+    unsigned int acquire(const string &path, const unsigned char placeholder[4] = DEFAULT_PLACEHOLDER)
+    {
+        requests++;
+        string resolved = normalizeAssetPath(path);
+
+        // 1. same file asked for again
+        auto byPathIt = byPath.find(resolved);
+        if (byPathIt != byPath.end())
+            return addReference(byPathIt->second);
+
+        // a block compressed version from the texture transcoder is used when the driver can sample it
+        string source = resolved;
+        Ktx2Image compressed;
+        AssetFile file(resolved + ".ktx2");
+        if (file.isOpen() && ktx2Parse(file.data(), file.size(), compressed) && compressed.faceCount == 1
+            && compressedFormatSupported(compressed.format))
+            source = resolved + ".ktx2";
+        else
+        {
+            compressed.levels.clear();
+            file.open(resolved);
+        }
+        if (!file.isOpen())
+        {
+            std::cout << "Texture failed to load at path: " << path << std::endl;
+            return 0;
+        }
+
+        // 2. a different file with the same contents
+        uint64_t contentHash = hashBytes(file.data(), file.size());
+        auto byContentIt = byContent.find(contentHash);
+        if (byContentIt != byContent.end())
+        {
+            byPath[resolved] = byContentIt->second;
+            return addReference(byContentIt->second);
+        }
+
+        // 3. new image, only the header is read here, the streamer decodes and uploads it
+        TextureRecord record;
+        if (!compressed.levels.empty())
+        {
+            // nothing to decode, the container already holds every level
+            record.decodedBytes = 0;
+            record.vramBytes = 0;
+            for (const Ktx2Level &level : compressed.levels)
+                record.vramBytes += level.size;
+        }
+        else
+        {
+            int width, height, nrComponents;
+            if (!stbi_info_from_memory(file.data(), static_cast<int>(file.size()), &width, &height, &nrComponents))
+            {
+                std::cout << "Texture failed to load at path: " << path << std::endl;
+                return 0;
+            }
+            record.decodedBytes = size_t(width) * height * nrComponents;
+            // full mip chain adds a third on top of the base level
+            record.vramBytes = record.decodedBytes * 4 / 3;
+        }
+        glGenTextures(1, &record.id);
+        record.contentHash = contentHash;
+        record.refCount = 1;
+        TextureStreamer::instance().request(record.id, source, placeholder);
+
+        textures[record.id] = record;
+        byPath[resolved] = record.id;
+        byContent[contentHash] = record.id;
+        decodedBytes += record.decodedBytes;
+        vramBytes += record.vramBytes;
+        return record.id;
+    }
+
+    // drops one reference to a texture, deleting it when it was the last one
+    void release(unsigned int id)
+    {
+        auto it = textures.find(id);
+        if (it == textures.end())
+            return;
+        if (--it->second.refCount > 0)
+            return;
+
+        byContent.erase(it->second.contentHash);
+        for (auto pathIt = byPath.begin(); pathIt != byPath.end(); )
+        {
+            if (pathIt->second == id)
+                pathIt = byPath.erase(pathIt);
+            else
+                ++pathIt;
+        }
+        decodedBytes -= it->second.decodedBytes;
+        vramBytes -= it->second.vramBytes;
+        TextureStreamer::instance().cancel(id);
+        glDeleteTextures(1, &id);
+        textures.erase(it);
+    }
+
+    // deletes every texture regardless of references, call while the GL context is still current
+    void clear()
+    {
+        TextureStreamer::instance().shutdown();
+        for (auto &entry : textures)
+            glDeleteTextures(1, &entry.second.id);
+        textures.clear();
+        byPath.clear();
+        byContent.clear();
+        decodedBytes = 0;
+        vramBytes = 0;
+    }
+
+    // prints how much decoding and texture memory the sharing avoided
+    void printStats() const
+    {
+        std::cout << "TEXTURE_REGISTRY:: " << textures.size() << " textures for " << requests << " requests, "
+                  << decodedBytes / (1024.0 * 1024.0) << " MB decoded, " << vramBytes / (1024.0 * 1024.0) << " MB VRAM. "
+                  << "Sharing saved " << decodeBytesSaved / (1024.0 * 1024.0) << " MB of decoding and "
+                  << vramBytesSaved / (1024.0 * 1024.0) << " MB of VRAM" << std::endl;
+    }
+
+private:
+    struct TextureRecord {
+        unsigned int id;
+        uint64_t contentHash;
+        int refCount;
+        size_t decodedBytes;
+        size_t vramBytes;
+    };
+
+    unordered_map<unsigned int, TextureRecord> textures;
+    unordered_map<string, unsigned int> byPath;
+    unordered_map<uint64_t, unsigned int> byContent;
+
+    size_t requests = 0;
+    size_t decodedBytes = 0;
+    size_t vramBytes = 0;
+    size_t decodeBytesSaved = 0;
+    size_t vramBytesSaved = 0;
+
+    TextureRegistry() {}
+
+    // a hit saves a whole load: models reuse their own textures without coming back here
+    unsigned int addReference(unsigned int id)
+    {
+        TextureRecord &record = textures[id];
+        record.refCount++;
+        decodeBytesSaved += record.decodedBytes;
+        vramBytesSaved += record.vramBytes;
+        return id;
+    }
+};
+#endif
@@ -0,0 +1,390 @@
+#ifndef TEXTURE_STREAMER_H
+#define TEXTURE_STREAMER_H
+
+#include <glad/glad.h>
+#include <stb_image.h>
+
+#include "mapped_file.h"
+#include "asset_pack.h"
+#include "ktx2.h"
+#include "gl_extensions.h"
+#include "profiler.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <unordered_map>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+using namespace std;
+
+// Bytes copied into pixel unpack buffers per frame by default. Large enough for a 1k RGBA level per frame,
+// small enough that a 2k texture is spread over a few frames instead of stalling one.
+const size_t TEXTURE_UPLOAD_BUDGET = 4 * 1024 * 1024;
+
+// GL internal format of a block compressed format
+inline GLenum compressedGLFormat(BCFormat format)
+{
+    if (format == BC_FORMAT_BC1)
+        return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    if (format == BC_FORMAT_BC3)
+        return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    return GL_COMPRESSED_RG_RGTC2;
+}
+
+// BC5 (RGTC2) is core since GL 3.0, BC1 and BC3 need the S3TC extension
+inline bool compressedFormatSupported(BCFormat format)
+{
+    return format == BC_FORMAT_BC5 || hasGLExtension("GL_EXT_texture_compression_s3tc");
+}
+
+// Streams texture contents in the background. Textures are created right away with a 1x1 placeholder,
+// a pool of worker threads decodes the image files and the GL thread copies the pixels into pixel unpack
+// buffers within a per-frame byte budget. Once a whole image is in its buffer it replaces the placeholder
+// and the mip chain is generated. KTX2 files from the texture transcoder skip decoding: their compressed
+// levels, mips included, go into the unpack buffer as they are.
+class TextureStreamer
+{
+public:
+    static TextureStreamer &instance()
+    {
+        static TextureStreamer streamer;
+        return streamer;
+    }
+
+    ~TextureStreamer()
+    {
+        stopWorkers();
+    }
+
+    // gives the texture a 1x1 placeholder and queues the image (or .ktx2 container) at path to replace it
+    void request(unsigned int textureID, const string &path, const unsigned char placeholder[4])
+    {
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        // GL reuses the names of deleted textures, the ticket tells a stale decode apart from a current one
+        uint64_t ticket = ++lastTicket;
+        if (tickets.count(textureID) == 0)
+            outstanding++;
+        tickets[textureID] = ticket;
+
+        startWorkers();
+        {
+            lock_guard<mutex> lock(queueMutex);
+            jobs.push_back(DecodeJob{ textureID, ticket, path });
+        }
+        jobAvailable.notify_one();
+    }
+
+    // the texture is being deleted, drop whatever is still pending for it
+    void cancel(unsigned int textureID)
+    {
+        if (tickets.erase(textureID) > 0)
+            outstanding--;
+    }
+
+    // Call once per frame on the GL thread. Copies at most budgetBytes of decoded pixels into unpack
+    // buffers and finishes every texture whose pixels are complete. Returns the bytes copied.
+    size_t update(size_t budgetBytes = TEXTURE_UPLOAD_BUDGET)
+    {
+        size_t copied = 0;
+        while (copied < budgetBytes)
+        {
+            if (!uploading.active && !takeDecoded())
+                break;
+            if (!isCurrent(uploading.textureID, uploading.ticket))
+            {
+                finishUpload(false);
+                continue;
+            }
+
+            // fill the unpack buffer one budget slice at a time
+            size_t chunk = std::min(uploading.byteSize - uploading.written, budgetBytes - copied);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploading.buffer);
+            glBufferSubData(GL_PIXEL_UNPACK_BUFFER, uploading.written, chunk, uploading.pixels + uploading.written);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            uploading.written += chunk;
+            copied += chunk;
+
+            if (uploading.written == uploading.byteSize)
+                finishUpload(true);
+        }
+        bytesUploaded += copied;
+        return copied;
+    }
+
+    // number of textures still showing their placeholder
+    unsigned int pending() const
+    {
+        return outstanding;
+    }
+
+    size_t totalBytesUploaded() const
+    {
+        return bytesUploaded;
+    }
+
+    // stops the workers and frees the unpack buffers, call while the GL context is still current
+    void shutdown()
+    {
+        stopWorkers();
+        if (uploading.active)
+            finishUpload(false);
+        {
+            lock_guard<mutex> lock(queueMutex);
+            for (DecodedImage &image : decoded)
+                freePixels(image.pixels, image.compressed);
+            decoded.clear();
+            jobs.clear();
+        }
+        if (!freeBuffers.empty())
+            glDeleteBuffers(static_cast<GLsizei>(freeBuffers.size()), freeBuffers.data());
+        freeBuffers.clear();
+        tickets.clear();
+        outstanding = 0;
+    }
+
+private:
+    struct DecodeJob {
+        unsigned int textureID;
+        uint64_t ticket;
+        string path;
+    };
+
+    struct DecodedImage {
+        unsigned int textureID;
+        uint64_t ticket;
+        int width, height, nrComponents;
+        unsigned char *pixels;
+        // bytes at pixels, the whole file for a container
+        size_t byteSize;
+        // pixels hold a whole KTX2 file laid out as described by layout
+        bool compressed;
+        Ktx2Image layout;
+    };
+
+    // the image currently being copied into its unpack buffer
+    struct Upload {
+        bool active = false;
+        unsigned int textureID = 0;
+        uint64_t ticket = 0;
+        int width = 0, height = 0, nrComponents = 0;
+        unsigned char *pixels = nullptr;
+        size_t byteSize = 0;
+        bool compressed = false;
+        Ktx2Image layout;
+        size_t written = 0;
+        unsigned int buffer = 0;
+    };
+
+    vector<thread> workers;
+    bool stopping = false;
+    mutex queueMutex;
+    condition_variable jobAvailable;
+    deque<DecodeJob> jobs;
+    deque<DecodedImage> decoded;
+
+    // GL thread only
+    Upload uploading;
+    vector<unsigned int> freeBuffers;
+    unordered_map<unsigned int, uint64_t> tickets;
+    uint64_t lastTicket = 0;
+    unsigned int outstanding = 0;
+    size_t bytesUploaded = 0;
+
+    TextureStreamer() {}
+
+    void startWorkers()
+    {
+        if (!workers.empty())
+            return;
+        stopping = false;
+        unsigned int count = std::max(1u, std::min(4u, thread::hardware_concurrency() > 1 ? thread::hardware_concurrency() - 1 : 1u));
+        for (unsigned int i = 0; i < count; i++)
+            workers.emplace_back(&TextureStreamer::workerLoop, this);
+    }
+
+    void stopWorkers()
+    {
+        {
+            lock_guard<mutex> lock(queueMutex);
+            stopping = true;
+        }
+        jobAvailable.notify_all();
+        for (thread &worker : workers)
+            worker.join();
+        workers.clear();
+    }
+
+    void workerLoop()
+    {
+        PROFILE_THREAD("Texture decode");
+        while (true)
+        {
+            DecodeJob job;
+            {
+                unique_lock<mutex> lock(queueMutex);
+                jobAvailable.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (stopping)
+                    return;
+                job = jobs.front();
+                jobs.pop_front();
+            }
+
+            PROFILE_ZONE("Decode texture");
+            DecodedImage image = { job.textureID, job.ticket, 0, 0, 0, nullptr, 0, false, Ktx2Image() };
+            AssetFile file(job.path);
+            bool isKtx2 = job.path.size() > 5 && job.path.compare(job.path.size() - 5, 5, ".ktx2") == 0;
+            if (file.isOpen() && isKtx2)
+            {
+                // already compressed, just take a copy the GL thread can own
+                if (ktx2Parse(file.data(), file.size(), image.layout))
+                {
+                    image.compressed = true;
+                    image.width = image.layout.width;
+                    image.height = image.layout.height;
+                    image.byteSize = file.size();
+                    image.pixels = static_cast<unsigned char*>(malloc(file.size()));
+                    if (image.pixels)
+                        memcpy(image.pixels, file.data(), file.size());
+                }
+            }
+            else if (file.isOpen())
+            {
+                // stb_image only shares its failure reason string between threads
+                image.pixels = stbi_load_from_memory(file.data(), static_cast<int>(file.size()), &image.width, &image.height, &image.nrComponents, 0);
+                image.byteSize = size_t(image.width) * image.height * image.nrComponents;
+            }
+            if (!image.pixels)
+                std::cout << "Texture failed to load at path: " << job.path << std::endl;
+
+            lock_guard<mutex> lock(queueMutex);
+            decoded.push_back(image);
+        }
+    }
+
+    // false if the texture was deleted or requested again since this decode was queued
+    bool isCurrent(unsigned int textureID, uint64_t ticket) const
+    {
+        auto it = tickets.find(textureID);
+        return it != tickets.end() && it->second == ticket;
+    }
+
+    // moves the next decoded image into the upload slot, returns false if nothing is ready
+    bool takeDecoded()
+    {
+        DecodedImage image;
+        while (true)
+        {
+            {
+                lock_guard<mutex> lock(queueMutex);
+                if (decoded.empty())
+                    return false;
+                image = decoded.front();
+                decoded.pop_front();
+            }
+            if (image.pixels)
+                break;
+            // keeps its placeholder for good, the upload slot stays empty
+            if (isCurrent(image.textureID, image.ticket))
+            {
+                tickets.erase(image.textureID);
+                outstanding--;
+            }
+        }
+
+        uploading.active = true;
+        uploading.textureID = image.textureID;
+        uploading.ticket = image.ticket;
+        uploading.width = image.width;
+        uploading.height = image.height;
+        uploading.nrComponents = image.nrComponents;
+        uploading.pixels = image.pixels;
+        uploading.byteSize = image.byteSize;
+        uploading.compressed = image.compressed;
+        uploading.layout = image.layout;
+        uploading.written = 0;
+
+        if (freeBuffers.empty())
+        {
+            freeBuffers.push_back(0);
+            glGenBuffers(1, &freeBuffers.back());
+        }
+        uploading.buffer = freeBuffers.back();
+        freeBuffers.pop_back();
+        // orphan the previous contents so the driver never waits on an earlier upload from this buffer
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploading.buffer);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, image.byteSize, NULL, GL_STREAM_DRAW);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return true;
+    }
+
+    // replaces the placeholder with the pixels in the unpack buffer and recycles the buffer
+    void finishUpload(bool apply)
+    {
+        if (!uploading.active)
+            return;
+        if (apply && uploading.compressed)
+        {
+            // every level is in the buffer already, no mipmap generation needed
+            GLenum format = compressedGLFormat(uploading.layout.format);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploading.buffer);
+            glBindTexture(GL_TEXTURE_2D, uploading.textureID);
+            for (unsigned int i = 0; i < uploading.layout.levels.size(); i++)
+            {
+                const Ktx2Level &level = uploading.layout.levels[i];
+                glCompressedTexImage2D(GL_TEXTURE_2D, i, format, level.width, level.height, 0,
+                                       static_cast<GLsizei>(level.size), (void*)(uintptr_t)level.offset);
+            }
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(uploading.layout.levels.size()) - 1);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+        else if (apply)
+        {
+            GLenum format = GL_RED;
+            if (uploading.nrComponents == 1)
+                format = GL_RED;
+            else if (uploading.nrComponents == 3)
+                format = GL_RGB;
+            else if (uploading.nrComponents == 4)
+                format = GL_RGBA;
+
+            // rows are tightly packed, the default 4 byte alignment would read past the end of the buffer for odd RGB widths
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploading.buffer);
+            glBindTexture(GL_TEXTURE_2D, uploading.textureID);
+            glTexImage2D(GL_TEXTURE_2D, 0, format, uploading.width, uploading.height, 0, format, GL_UNSIGNED_BYTE, (void*)0);
+            glGenerateMipmap(GL_TEXTURE_2D);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        }
+        if (apply)
+        {
+            tickets.erase(uploading.textureID);
+            outstanding--;
+        }
+        freeBuffers.push_back(uploading.buffer);
+        freePixels(uploading.pixels, uploading.compressed);
+        uploading.pixels = nullptr;
+        uploading.active = false;
+    }
+
+    static void freePixels(unsigned char *pixels, bool compressed)
+    {
+        if (compressed)
+            free(pixels);
+        else
+            stbi_image_free(pixels);
+    }
+};
+#endif
@@ -0,0 +1,135 @@
+// Headless check of the texture streamer (texture_streamer.h) around images that fail to decode. Requests a path
+// that doesn't exist, then real images, then another missing path after the first upload has recycled its unpack
+// buffer, and streams them in. Every image must end up in its texture byte for byte as stb_image decodes it, with
+// no GL error on the way, and the missing paths must keep their placeholders without holding up the rest. Exits
+// with a non-zero status on a mismatch.
+//
+// Needs a GL 3.3 context but no display with a GPU: Mesa's llvmpipe provides one, e.g.
+//   LIBGL_ALWAYS_SOFTWARE=1 xvfb-run ./texture_streamer_test      (run from the repository root)
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include "texture_registry.h"
+
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <filesystem>
+#include <cstring>
+using namespace std;
+
+const unsigned char PLACEHOLDER[4] = { 255, 0, 255, 255 };
+
+// textures requested together, in order; the first path of each round doesn't exist
+const char *const STREAMED_PATHS[][3] = {
+    { "models/does_not_exist.png", "models/floor/PavingStonesColor.jpg", nullptr },
+    { "models/does_not_exist_either.jpg", "models/spirebase/base.jpg", "cubemap/posx.png" },
+};
+
+// runs the streamer until nothing is pending, false on a GL error or if it takes more than a few seconds
+static bool streamAll()
+{
+    auto start = chrono::steady_clock::now();
+    while (TextureStreamer::instance().pending() > 0)
+    {
+        TextureStreamer::instance().update();
+        GLenum error = glGetError();
+        if (error != GL_NO_ERROR)
+        {
+            std::cout << "FAIL: GL error 0x" << std::hex << error << std::dec << " while streaming" << std::endl;
+            return false;
+        }
+        if (chrono::steady_clock::now() - start > chrono::seconds(10))
+        {
+            std::cout << "FAIL: " << TextureStreamer::instance().pending() << " textures still pending after 10 s" << std::endl;
+            return false;
+        }
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    return true;
+}
+
+// the texture's level 0 against the file as decoded on the CPU, or against the placeholder for a missing file
+static bool matches(unsigned int textureID, const string &path, bool missing)
+{
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    GLint width = 0, height = 0;
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+    vector<unsigned char> texels(static_cast<size_t>(width) * height * 4);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, texels.data());
+    if (missing)
+    {
+        bool placeholder = width == 1 && height == 1 && memcmp(texels.data(), PLACEHOLDER, 4) == 0;
+        if (!placeholder)
+            std::cout << "FAIL: " << path << " doesn't exist but its texture is " << width << "x" << height << std::endl;
+        return placeholder;
+    }
+
+    int imageWidth, imageHeight, components;
+    unsigned char *pixels = stbi_load(path.c_str(), &imageWidth, &imageHeight, &components, 4);
+    if (!pixels)
+    {
+        std::cout << "FAIL: can't read " << path << " for the comparison" << std::endl;
+        return false;
+    }
+    bool same = width == imageWidth && height == imageHeight && memcmp(texels.data(), pixels, texels.size()) == 0;
+    stbi_image_free(pixels);
+    if (!same)
+        std::cout << "FAIL: " << path << " streamed as " << width << "x" << height << " doesn't match the " << imageWidth << "x"
+                  << imageHeight << " image in the file" << std::endl;
+    return same;
+}
+
+int main()
+{
+    glfwInit();
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow* window = glfwCreateWindow(64, 64, "Texture streamer test", NULL, NULL);
+    if (window == NULL)
+    {
+        std::cout << "FAIL: no GL 3.3 core context" << std::endl;
+        glfwTerminate();
+        return 1;
+    }
+    glfwMakeContextCurrent(window);
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+    {
+        std::cout << "FAIL: can't load GL" << std::endl;
+        return 1;
+    }
+    std::cout << glGetString(GL_VERSION) << ", " << glGetString(GL_RENDERER) << std::endl;
+
+    bool passed = true;
+    for (const auto &round : STREAMED_PATHS)
+    {
+        vector<unsigned int> textures;
+        for (const char *path : round)
+        {
+            if (!path)
+                continue;
+            unsigned int textureID;
+            glGenTextures(1, &textureID);
+            TextureStreamer::instance().request(textureID, path, PLACEHOLDER);
+            textures.push_back(textureID);
+            // give the missing file time to fail first, so its decode is taken before the next image's
+            if (!filesystem::exists(path))
+                this_thread::sleep_for(chrono::milliseconds(200));
+        }
+        passed = streamAll() && passed;
+        for (size_t i = 0; i < textures.size(); i++)
+            passed = matches(textures[i], round[i], !filesystem::exists(round[i])) && passed;
+        glDeleteTextures(static_cast<GLsizei>(textures.size()), textures.data());
+    }
+    TextureStreamer::instance().shutdown();
+
+    std::cout << (passed ? "PASS" : "FAIL") << std::endl;
+    glfwTerminate();
+    return passed ? 0 : 1;
+}
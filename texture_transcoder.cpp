@@ -0,0 +1,301 @@
+// Offline texture transcoder. Converts every image under models/ and cubemap/ into a block compressed KTX2
+// file next to it ('<image>.ktx2') with a precomputed mip chain:
+//   normal maps (referenced by map_Bump/bump/norm in an MTL file) -> BC5
+//   images with transparency                                      -> BC3
+//   everything else                                               -> BC1
+// TextureFromFile and loadCubemap pick the KTX2 files up automatically when the GL driver supports the format.
+//
+// Every encoded image is decoded again on the CPU and compared with the source. Images below the PSNR
+// threshold of their format are reported and not written, so the app keeps using the source image.
+// '--selftest' runs the encoders over synthetic images only, no assets or GPU needed.
+//
+// usage: ./transcoder [--force] [--selftest] [directory...]
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include "bc_codec.h"
+#include "ktx2.h"
+#include "mapped_file.h"
+
+#include <filesystem>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <set>
+#include <cmath>
+using namespace std;
+namespace fs = std::filesystem;
+
+// minimum level 0 PSNR in dB for each format
+const double BC1_MIN_PSNR = 30.0;
+const double BC3_MIN_PSNR = 30.0;
+const double BC5_MIN_PSNR = 34.0;
+
+double minimumPSNR(BCFormat format)
+{
+    return format == BC_FORMAT_BC1 ? BC1_MIN_PSNR : format == BC_FORMAT_BC3 ? BC3_MIN_PSNR : BC5_MIN_PSNR;
+}
+
+const char* formatName(BCFormat format)
+{
+    return format == BC_FORMAT_BC1 ? "BC1" : format == BC_FORMAT_BC3 ? "BC3" : "BC5";
+}
+
+// channels the format keeps, the PSNR is measured over these
+int formatChannels(BCFormat format)
+{
+    return format == BC_FORMAT_BC1 ? 3 : format == BC_FORMAT_BC3 ? 4 : 2;
+}
+
+// halves an RGBA8 image with a box filter. Normal maps are renormalised after filtering.
+vector<unsigned char> downsample(const vector<unsigned char> &source, int width, int height, bool normalMap)
+{
+    int newWidth = std::max(1, width / 2), newHeight = std::max(1, height / 2);
+    vector<unsigned char> result(size_t(newWidth) * newHeight * 4);
+    for (int y = 0; y < newHeight; y++)
+    {
+        for (int x = 0; x < newWidth; x++)
+        {
+            float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+            int x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+            int y0 = std::min(y * 2, height - 1), y1 = std::min(y * 2 + 1, height - 1);
+            const int xs[4] = { x0, x1, x0, x1 }, ys[4] = { y0, y0, y1, y1 };
+            for (int i = 0; i < 4; i++)
+                for (int c = 0; c < 4; c++)
+                    sum[c] += source[(size_t(ys[i]) * width + xs[i]) * 4 + c] * 0.25f;
+
+            unsigned char *dst = &result[(size_t(y) * newWidth + x) * 4];
+            if (normalMap)
+            {
+                float n[3] = { sum[0] / 127.5f - 1.0f, sum[1] / 127.5f - 1.0f, sum[2] / 127.5f - 1.0f };
+                float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+                if (length > 1e-6f)
+                    for (int c = 0; c < 3; c++)
+                        sum[c] = (n[c] / length + 1.0f) * 127.5f;
+            }
+            for (int c = 0; c < 4; c++)
+                dst[c] = static_cast<unsigned char>(std::min(255.0f, std::max(0.0f, sum[c] + 0.5f)));
+        }
+    }
+    return result;
+}
+
+// encodes a full mip chain and checks level 0 against the source. Returns the PSNR of level 0.
+double encodeChain(BCFormat format, const vector<unsigned char> &rgba, int width, int height, bool normalMap, vector<vector<unsigned char>> &levels)
+{
+    levels.clear();
+    vector<unsigned char> level = rgba;
+    int w = width, h = height;
+    while (true)
+    {
+        levels.push_back(bcEncode(format, level.data(), w, h));
+        if (w == 1 && h == 1)
+            break;
+        level = downsample(level, w, h, normalMap);
+        w = std::max(1, w / 2);
+        h = std::max(1, h / 2);
+    }
+    vector<unsigned char> decoded = bcDecode(format, levels[0].data(), width, height);
+    return computePSNR(rgba.data(), decoded.data(), width, height, formatChannels(format));
+}
+
+// file names that MTL files use as normal maps. Assimp loads these as the 'texture_normal' type.
+set<string> collectNormalMaps(const vector<string> &roots)
+{
+    set<string> normalMaps;
+    for (const string &root : roots)
+    {
+        if (!fs::exists(root))
+            continue;
+        for (const fs::directory_entry &entry : fs::recursive_directory_iterator(root))
+        {
+            if (entry.path().extension() != ".mtl")
+                continue;
+            ifstream mtl(entry.path());
+            string line;
+            while (getline(mtl, line))
+            {
+                istringstream tokens(line);
+                string keyword, token, last;
+                tokens >> keyword;
+                if (keyword != "map_Bump" && keyword != "map_bump" && keyword != "bump" && keyword != "norm")
+                    continue;
+                while (tokens >> token)
+                    last = token;
+                if (!last.empty())
+                    normalMaps.insert((entry.path().parent_path() / last).lexically_normal().string());
+            }
+        }
+    }
+    return normalMaps;
+}
+
+bool isImage(const fs::path &path)
+{
+    string extension = path.extension().string();
+    for (char &c : extension)
+        c = static_cast<char>(tolower(c));
+    return extension == ".png" || extension == ".jpg" || extension == ".jpeg" || extension == ".tga" || extension == ".bmp";
+}
+
+// transcodes one image, returns false if it failed to load or missed its quality threshold
+bool transcode(const fs::path &source, bool normalMap, bool force)
+{
+    fs::path target = source.string() + ".ktx2";
+    if (!force && fs::exists(target) && fs::last_write_time(target) >= fs::last_write_time(source))
+    {
+        cout << "up to date  " << target.string() << endl;
+        return true;
+    }
+
+    int width, height, nrComponents;
+    unsigned char *data = stbi_load(source.string().c_str(), &width, &height, &nrComponents, 4);
+    if (!data)
+    {
+        cout << "ERROR::TRANSCODER:: failed to load " << source.string() << endl;
+        return false;
+    }
+    vector<unsigned char> rgba(data, data + size_t(width) * height * 4);
+    stbi_image_free(data);
+
+    BCFormat format = BC_FORMAT_BC1;
+    if (normalMap)
+        format = BC_FORMAT_BC5;
+    else if (nrComponents == 4)
+    {
+        for (size_t i = 3; i < rgba.size(); i += 4)
+            if (rgba[i] != 255)
+            {
+                format = BC_FORMAT_BC3;
+                break;
+            }
+    }
+
+    vector<vector<unsigned char>> levels;
+    double psnr = encodeChain(format, rgba, width, height, normalMap, levels);
+    cout << formatName(format) << "  " << width << "x" << height << "  " << levels.size() << " levels  PSNR "
+         << psnr << " dB  " << source.string() << endl;
+    if (psnr < minimumPSNR(format))
+    {
+        cout << "ERROR::TRANSCODER:: " << source.string() << " is below the " << minimumPSNR(format) << " dB threshold, not written" << endl;
+        return false;
+    }
+    if (!ktx2Write(target.string(), format, width, height, 1, levels))
+    {
+        cout << "ERROR::TRANSCODER:: could not write " << target.string() << endl;
+        return false;
+    }
+
+    // read the container back the way the app does and make sure level 0 survived the trip
+    MappedFile written(target.string());
+    Ktx2Image image;
+    if (!written.isOpen() || !ktx2Parse(written.data(), written.size(), image) || image.levels.size() != levels.size()
+        || memcmp(written.data() + image.levels[0].offset, levels[0].data(), levels[0].size()) != 0)
+    {
+        cout << "ERROR::TRANSCODER:: " << target.string() << " does not read back correctly" << endl;
+        written.close();
+        fs::remove(target);
+        return false;
+    }
+    return true;
+}
+
+// Synthetic images for the encoders: a smooth gradient, a noisy texture, a sphere normal map and a gradient
+// with an alpha ramp. Needs nothing but the CPU.
+bool selftest()
+{
+    const int size = 64;
+    vector<unsigned char> gradient(size * size * 4), noise(size * size * 4), normals(size * size * 4), alpha(size * size * 4);
+    unsigned int seed = 12345;
+    for (int y = 0; y < size; y++)
+    {
+        for (int x = 0; x < size; x++)
+        {
+            unsigned char *g = &gradient[(y * size + x) * 4];
+            g[0] = static_cast<unsigned char>(x * 4); g[1] = static_cast<unsigned char>(y * 4); g[2] = 128; g[3] = 255;
+
+            unsigned char *n = &noise[(y * size + x) * 4];
+            for (int c = 0; c < 3; c++)
+            {
+                seed = seed * 1103515245u + 12345u;
+                n[c] = static_cast<unsigned char>(96 + ((seed >> 16) & 31));
+            }
+            n[3] = 255;
+
+            float nx = (x + 0.5f) / size * 2.0f - 1.0f, ny = (y + 0.5f) / size * 2.0f - 1.0f;
+            float nz = std::sqrt(std::max(0.0f, 1.0f - nx * nx - ny * ny));
+            float length = std::sqrt(nx * nx + ny * ny + nz * nz);
+            unsigned char *m = &normals[(y * size + x) * 4];
+            m[0] = static_cast<unsigned char>((nx / length + 1.0f) * 127.5f);
+            m[1] = static_cast<unsigned char>((ny / length + 1.0f) * 127.5f);
+            m[2] = static_cast<unsigned char>((nz / length + 1.0f) * 127.5f);
+            m[3] = 255;
+
+            unsigned char *a = &alpha[(y * size + x) * 4];
+            memcpy(a, g, 3);
+            a[3] = static_cast<unsigned char>(x * 4);
+        }
+    }
+
+    struct Case { const char *name; BCFormat format; const vector<unsigned char> *image; bool normalMap; };
+    const Case cases[] = {
+        { "gradient", BC_FORMAT_BC1, &gradient, false },
+        { "noise", BC_FORMAT_BC1, &noise, false },
+        { "alpha ramp", BC_FORMAT_BC3, &alpha, false },
+        { "sphere normals", BC_FORMAT_BC5, &normals, true }
+    };
+    bool passed = true;
+    for (const Case &test : cases)
+    {
+        vector<vector<unsigned char>> levels;
+        double psnr = encodeChain(test.format, *test.image, size, size, test.normalMap, levels);
+        bool ok = psnr >= minimumPSNR(test.format) && levels.size() == 7;
+        cout << (ok ? "PASS  " : "FAIL  ") << formatName(test.format) << "  " << test.name << "  PSNR " << psnr << " dB" << endl;
+        passed = passed && ok;
+    }
+    return passed;
+}
+
+int main(int argc, char *argv[])
+{
+    bool force = false;
+    vector<string> roots;
+    for (int i = 1; i < argc; i++)
+    {
+        string argument = argv[i];
+        if (argument == "--force")
+            force = true;
+        else if (argument == "--selftest")
+            return selftest() ? 0 : 1;
+        else
+            roots.push_back(argument);
+    }
+    if (roots.empty())
+        roots = { "models", "cubemap" };
+
+    set<string> normalMaps = collectNormalMaps(roots);
+    int failures = 0;
+    for (const string &root : roots)
+    {
+        if (!fs::exists(root))
+        {
+            cout << "ERROR::TRANSCODER:: no such directory " << root << endl;
+            failures++;
+            continue;
+        }
+        for (const fs::directory_entry &entry : fs::recursive_directory_iterator(root))
+        {
+            if (!entry.is_regular_file() || !isImage(entry.path()))
+                continue;
+            string path = entry.path().lexically_normal().string();
+            if (!transcode(entry.path(), normalMaps.count(path) > 0, force))
+                failures++;
+        }
+    }
+    if (failures > 0)
+        cout << failures << " image(s) failed" << endl;
+    return failures > 0 ? 1 : 0;
+}
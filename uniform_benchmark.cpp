@@ -0,0 +1,385 @@
+// CPU microbenchmark for setting uniforms. Replays the uniform traffic of one frame of the scene (lights, fog,
+// camera and 23 objects with three textures each, as drawn before instancing) against counting GL stubs, so no
+// context or GPU is needed, and reports GL calls, glGetUniformLocation calls and heap allocations per frame plus
+// the CPU time:
+//   by name  - the old path: every set*() looks the location up with glGetUniformLocation and a std::string,
+//              and each mesh builds its sampler names with std::to_string
+//   handles  - uniforms reflected once at link time, the frame uses resolved Uniform<T> handles and the meshes
+//              look their uniforms up by compile time hashed name; samplers are set at link time and the
+//              material binder skips textures that are still bound (all objects share one material here)
+//   blocks   - camera, fog and lights in the std140 blocks of uniform_blocks.h, one buffer write each and none
+//              for the light block while the lights stand still; each object sets its model and
+//              model-view-projection matrices
+// The stubbed glGetUniformLocation does a linear strcmp search, real drivers hash; compare the counts first.
+//
+// usage: ./uniform_benchmark [frames]      (run from the repository root, it reads shaders/)
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "shader_m.h"
+#include "mesh.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <new>
+using namespace std;
+
+// heap allocations, counted by the replaced global operator new
+static size_t allocations = 0;
+
+void* operator new(size_t size)
+{
+    allocations++;
+    if (void* p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+namespace stub
+{
+    size_t calls = 0;
+    size_t locationQueries = 0;
+
+    // the model shader's active uniforms as a driver reported them before the uniform blocks, plus the
+    // model-view-projection matrix that came with them, so all three paths run against the same program
+    struct ActiveUniform { const char* name; GLenum type; };
+    const ActiveUniform uniforms[] = {
+        { "model", GL_FLOAT_MAT4 }, { "view", GL_FLOAT_MAT4 }, { "projection", GL_FLOAT_MAT4 }, { "modelViewProjection", GL_FLOAT_MAT4 },
+        { "positionOffset", GL_FLOAT_VEC3 }, { "positionScale", GL_FLOAT_VEC3 },
+        { "texCoordOffset", GL_FLOAT_VEC2 }, { "texCoordScale", GL_FLOAT_VEC2 },
+        { "texture_normal1", GL_SAMPLER_2D }, { "texture_diffuse1", GL_SAMPLER_2D }, { "texture_specular1", GL_SAMPLER_2D },
+        { "pointLights[0].position", GL_FLOAT_VEC3 }, { "pointLights[0].colour", GL_FLOAT_VEC3 },
+        { "pointLights[0].constant", GL_FLOAT }, { "pointLights[0].linear", GL_FLOAT }, { "pointLights[0].quadratic", GL_FLOAT },
+        { "pointLights[1].position", GL_FLOAT_VEC3 }, { "pointLights[1].colour", GL_FLOAT_VEC3 },
+        { "pointLights[1].constant", GL_FLOAT }, { "pointLights[1].linear", GL_FLOAT }, { "pointLights[1].quadratic", GL_FLOAT },
+        { "pointLights[2].position", GL_FLOAT_VEC3 }, { "pointLights[2].colour", GL_FLOAT_VEC3 },
+        { "pointLights[2].constant", GL_FLOAT }, { "pointLights[2].linear", GL_FLOAT }, { "pointLights[2].quadratic", GL_FLOAT },
+        { "ambientStrength", GL_FLOAT }, { "ambientColour", GL_FLOAT_VEC3 }, { "shininess", GL_FLOAT },
+        { "dlightDirection", GL_FLOAT_VEC3 }, { "dlColour", GL_FLOAT_VEC3 }, { "viewPos", GL_FLOAT_VEC3 },
+        { "fogColour", GL_FLOAT_VEC3 }, { "fogDensity", GL_FLOAT }, { "fogStart", GL_FLOAT }, { "fogEnd", GL_FLOAT },
+    };
+    const GLint uniformCount = sizeof(uniforms) / sizeof(uniforms[0]);
+
+    GLint APIENTRY getUniformLocation(GLuint, const GLchar* name)
+    {
+        calls++;
+        locationQueries++;
+        for (GLint i = 0; i < uniformCount; i++)
+            if (strcmp(uniforms[i].name, name) == 0)
+                return i;
+        return -1;
+    }
+    void APIENTRY getActiveUniform(GLuint, GLuint index, GLsizei bufSize, GLsizei* length, GLint* size, GLenum* type, GLchar* name)
+    {
+        calls++;
+        size_t n = std::min(strlen(uniforms[index].name), static_cast<size_t>(bufSize - 1));
+        memcpy(name, uniforms[index].name, n);
+        name[n] = 0;
+        *length = static_cast<GLsizei>(n);
+        *size = 1;
+        *type = uniforms[index].type;
+    }
+    void APIENTRY getProgramiv(GLuint, GLenum pname, GLint* value)
+    {
+        calls++;
+        *value = pname == GL_ACTIVE_UNIFORMS ? uniformCount : pname == GL_ACTIVE_UNIFORM_MAX_LENGTH ? 64 : pname == GL_LINK_STATUS ? 1 : 0;
+    }
+    void APIENTRY getShaderiv(GLuint, GLenum, GLint* value) { calls++; *value = 1; }
+    GLuint APIENTRY create() { calls++; return 1; }
+    GLuint APIENTRY createShader(GLenum) { calls++; return 1; }
+    void APIENTRY shaderSource(GLuint, GLsizei, const GLchar* const*, const GLint*) { calls++; }
+    void APIENTRY u(GLuint) { calls++; }
+    void APIENTRY uu(GLuint, GLuint) { calls++; }
+    void APIENTRY eu(GLenum, GLuint) { calls++; }
+    void APIENTRY e(GLenum) { calls++; }
+    void APIENTRY gen(GLsizei n, GLuint* ids) { calls++; for (GLsizei i = 0; i < n; i++) ids[i] = 1; }
+    void APIENTRY bufferData(GLenum, GLsizeiptr, const void*, GLenum) { calls++; }
+    void APIENTRY bufferSubData(GLenum, GLintptr, GLsizeiptr, const void*) { calls++; }
+    void APIENTRY bindBufferBase(GLenum, GLuint, GLuint) { calls++; }
+    GLuint APIENTRY uniformBlockIndex(GLuint, const GLchar*) { calls++; return GL_INVALID_INDEX; }
+    void APIENTRY uniformBlockBinding(GLuint, GLuint, GLuint) { calls++; }
+    void APIENTRY deleteBuffers(GLsizei, const GLuint*) { calls++; }
+    void APIENTRY getIntegerv(GLenum, GLint* value) { calls++; *value = 0; }
+    void APIENTRY attribPointer(GLuint, GLint, GLenum, GLboolean, GLsizei, const void*) { calls++; }
+    void APIENTRY attrib4f(GLuint, GLfloat, GLfloat, GLfloat, GLfloat) { calls++; }
+    void APIENTRY uniform1i(GLint, GLint) { calls++; }
+    void APIENTRY uniform1f(GLint, GLfloat) { calls++; }
+    void APIENTRY uniformfv(GLint, GLsizei, const GLfloat*) { calls++; }
+    void APIENTRY uniformMatrixfv(GLint, GLsizei, GLboolean, const GLfloat*) { calls++; }
+    void APIENTRY drawElements(GLenum, GLsizei, GLenum, const void*) { calls++; }
+    void APIENTRY drawElementsBaseVertex(GLenum, GLsizei, GLenum, const void*, GLint) { calls++; }
+
+    void install()
+    {
+        glad_glGetUniformLocation = getUniformLocation;
+        glad_glGetActiveUniform = getActiveUniform;
+        glad_glGetProgramiv = getProgramiv;
+        glad_glGetShaderiv = getShaderiv;
+        glad_glCreateProgram = create;
+        glad_glCreateShader = createShader;
+        glad_glShaderSource = shaderSource;
+        glad_glCompileShader = u;
+        glad_glLinkProgram = u;
+        glad_glDeleteShader = u;
+        glad_glUseProgram = u;
+        glad_glAttachShader = uu;
+        glad_glBindVertexArray = u;
+        glad_glEnableVertexAttribArray = u;
+        glad_glBindBuffer = eu;
+        glad_glBindTexture = eu;
+        glad_glActiveTexture = e;
+        glad_glGenVertexArrays = gen;
+        glad_glGenBuffers = gen;
+        glad_glBufferData = bufferData;
+        glad_glBufferSubData = bufferSubData;
+        glad_glBindBufferBase = bindBufferBase;
+        glad_glGetUniformBlockIndex = uniformBlockIndex;
+        glad_glUniformBlockBinding = uniformBlockBinding;
+        glad_glDeleteBuffers = deleteBuffers;
+        glad_glGetIntegerv = getIntegerv;
+        glad_glVertexAttribPointer = attribPointer;
+        glad_glVertexAttrib4f = attrib4f;
+        glad_glUniform1i = uniform1i;
+        glad_glUniform1f = uniform1f;
+        glad_glUniform2fv = uniformfv;
+        glad_glUniform3fv = uniformfv;
+        glad_glUniformMatrix4fv = uniformMatrixfv;
+        glad_glDrawElements = drawElements;
+        glad_glDrawElementsBaseVertex = drawElementsBaseVertex;
+    }
+}
+
+// the values one frame sets
+struct FrameState {
+    glm::mat4 projection = glm::mat4(1.0f), view = glm::mat4(1.0f);
+    glm::vec3 viewPos = glm::vec3(0.0f), ambientColour = glm::vec3(0.2f), dirColour = glm::vec3(1.0f), lightDirection = glm::vec3(0.0f, -1.0f, 0.0f);
+    glm::vec3 lightColour[3], lightPosition[3];
+    float lightConstant[3] = { 1.0f, 1.0f, 1.0f }, lightLinear[3] = {}, lightQuadratic[3] = {};
+    glm::vec3 fogColour = glm::vec3(0.5f);
+    float ambientStrength = 0.3f, fogDensity = 0.5f, fogStart = 10.0f, fogEnd = 90.0f;
+    vector<glm::mat4> objects = vector<glm::mat4>(23, glm::mat4(1.0f));
+};
+
+// the old per-draw material setup of Mesh::Draw, sampler names built from strings every time
+void drawByName(const Shader &shader, const Mesh &mesh, const vector<Texture> &textures)
+{
+    unsigned int diffuseNr = 1, specularNr = 1, normalNr = 1, heightNr = 1;
+    for (unsigned int i = 0; i < textures.size(); i++)
+    {
+        glActiveTexture(GL_TEXTURE0 + i);
+        string number;
+        string name = textures[i].type;
+        if (name == "texture_diffuse")
+            number = std::to_string(diffuseNr++);
+        else if (name == "texture_specular")
+            number = std::to_string(specularNr++);
+        else if (name == "texture_normal")
+            number = std::to_string(normalNr++);
+        else if (name == "texture_height")
+            number = std::to_string(heightNr++);
+        glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
+        glBindTexture(GL_TEXTURE_2D, textures[i].id);
+    }
+    glUniform1f(glGetUniformLocation(shader.ID, "shininess"), mesh.material->shininess);
+    glUniform3fv(glGetUniformLocation(shader.ID, "positionOffset"), 1, &mesh.quantization.positionOffset[0]);
+    glUniform3fv(glGetUniformLocation(shader.ID, "positionScale"), 1, &mesh.quantization.positionScale[0]);
+    glUniform2fv(glGetUniformLocation(shader.ID, "texCoordOffset"), 1, &mesh.quantization.texCoordOffset[0]);
+    glUniform2fv(glGetUniformLocation(shader.ID, "texCoordScale"), 1, &mesh.quantization.texCoordScale[0]);
+    glBindVertexArray(mesh.VAO);
+    glDrawElements(GL_TRIANGLES, mesh.lods[0].indexCount, GL_UNSIGNED_INT, 0);
+    glBindVertexArray(0);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+// the old frame: every uniform looked up by a std::string name
+void frameByName(const Shader &shader, const FrameState &f, const Mesh &mesh, const vector<Texture> &textures)
+{
+    auto location = [&](const std::string &name) { return glGetUniformLocation(shader.ID, name.c_str()); };
+    shader.use();
+    glUniform1f(location("ambientStrength"), f.ambientStrength);
+    glUniform3fv(location("ambientColour"), 1, &f.ambientColour[0]);
+    glUniform3fv(location("viewPos"), 1, &f.viewPos[0]);
+    glUniform3fv(location("dlColour"), 1, &f.dirColour[0]);
+    glUniform3fv(location("dlightDirection"), 1, &f.lightDirection[0]);
+    for (int i = 0; i < 3; i++)
+    {
+        string light = "pointLights[" + std::to_string(i) + "].";
+        glUniform3fv(location(light + "colour"), 1, &f.lightColour[i][0]);
+        glUniform3fv(location(light + "position"), 1, &f.lightPosition[i][0]);
+        glUniform1f(location(light + "constant"), f.lightConstant[i]);
+        glUniform1f(location(light + "linear"), f.lightLinear[i]);
+        glUniform1f(location(light + "quadratic"), f.lightQuadratic[i]);
+    }
+    glUniform3fv(location("fogColour"), 1, &f.fogColour[0]);
+    glUniform1f(location("fogDensity"), f.fogDensity);
+    glUniform1f(location("fogStart"), f.fogStart);
+    glUniform1f(location("fogEnd"), f.fogEnd);
+    glUniformMatrix4fv(location("projection"), 1, GL_FALSE, &f.projection[0][0]);
+    glUniformMatrix4fv(location("view"), 1, GL_FALSE, &f.view[0][0]);
+    for (const glm::mat4 &model : f.objects)
+    {
+        glUniformMatrix4fv(location("model"), 1, GL_FALSE, &model[0][0]);
+        drawByName(shader, mesh, textures);
+    }
+}
+
+struct FrameUniforms {
+    Uniform<float> ambientStrength, fogDensity, fogStart, fogEnd;
+    Uniform<glm::vec3> ambientColour, viewPos, dirColour, lightDirection, fogColour;
+    Uniform<glm::vec3> lightColour[3], lightPosition[3];
+    Uniform<float> lightConstant[3], lightLinear[3], lightQuadratic[3];
+    Uniform<glm::mat4> projection, view, model;
+
+    explicit FrameUniforms(const Shader &shader)
+    {
+        ambientStrength = shader.uniform<float>("ambientStrength");
+        ambientColour = shader.uniform<glm::vec3>("ambientColour");
+        viewPos = shader.uniform<glm::vec3>("viewPos");
+        dirColour = shader.uniform<glm::vec3>("dlColour");
+        lightDirection = shader.uniform<glm::vec3>("dlightDirection");
+        for (int i = 0; i < 3; i++)
+        {
+            string light = "pointLights[" + std::to_string(i) + "].";
+            lightColour[i] = shader.uniform<glm::vec3>(light + "colour");
+            lightPosition[i] = shader.uniform<glm::vec3>(light + "position");
+            lightConstant[i] = shader.uniform<float>(light + "constant");
+            lightLinear[i] = shader.uniform<float>(light + "linear");
+            lightQuadratic[i] = shader.uniform<float>(light + "quadratic");
+        }
+        fogColour = shader.uniform<glm::vec3>("fogColour");
+        fogDensity = shader.uniform<float>("fogDensity");
+        fogStart = shader.uniform<float>("fogStart");
+        fogEnd = shader.uniform<float>("fogEnd");
+        projection = shader.uniform<glm::mat4>("projection");
+        view = shader.uniform<glm::mat4>("view");
+        model = shader.uniform<glm::mat4>("model");
+    }
+};
+
+// the new frame: resolved handles, meshes look theirs up by hash
+void frameWithHandles(Shader &shader, const FrameUniforms &u, const FrameState &f, Mesh &mesh)
+{
+    MaterialBinder::instance().beginFrame();
+    shader.use();
+    shader.set(u.ambientStrength, f.ambientStrength);
+    shader.set(u.ambientColour, f.ambientColour);
+    shader.set(u.viewPos, f.viewPos);
+    shader.set(u.dirColour, f.dirColour);
+    shader.set(u.lightDirection, f.lightDirection);
+    for (int i = 0; i < 3; i++)
+    {
+        shader.set(u.lightColour[i], f.lightColour[i]);
+        shader.set(u.lightPosition[i], f.lightPosition[i]);
+        shader.set(u.lightConstant[i], f.lightConstant[i]);
+        shader.set(u.lightLinear[i], f.lightLinear[i]);
+        shader.set(u.lightQuadratic[i], f.lightQuadratic[i]);
+    }
+    shader.set(u.fogColour, f.fogColour);
+    shader.set(u.fogDensity, f.fogDensity);
+    shader.set(u.fogStart, f.fogStart);
+    shader.set(u.fogEnd, f.fogEnd);
+    shader.set(u.projection, f.projection);
+    shader.set(u.view, f.view);
+    for (const glm::mat4 &model : f.objects)
+    {
+        shader.set(u.model, model);
+        mesh.Draw(shader);
+    }
+}
+
+// the frame with uniform blocks: two block updates, then two matrices per object
+struct FrameBlocks {
+    Uniform<glm::mat4> model, modelViewProjection;
+    FrameUniformData frameData;
+    LightUniformData lightData;
+    UniformBlock<FrameUniformData> frameBlock{ UNIFORM_BINDING_FRAME };
+    UniformBlock<LightUniformData> lightBlock{ UNIFORM_BINDING_LIGHTS };
+    float time = 0.0f;
+
+    explicit FrameBlocks(const Shader &shader)
+    {
+        model = shader.uniform<glm::mat4>("model");
+        modelViewProjection = shader.uniform<glm::mat4>("modelViewProjection");
+    }
+};
+
+void frameWithBlocks(Shader &shader, FrameBlocks &b, const FrameState &f, Mesh &mesh)
+{
+    MaterialBinder::instance().beginFrame();
+    // the time moves every frame, so the frame block is always written
+    b.time += 1.0f / 60.0f;
+    b.frameData.view = f.view;
+    b.frameData.projection = f.projection;
+    b.frameData.viewProjection = f.projection * f.view;
+    b.frameData.skyViewProjection = f.projection * glm::mat4(glm::mat3(f.view));
+    b.frameData.viewPosition = glm::vec4(f.viewPos, b.time);
+    b.frameData.fogColour = glm::vec4(f.fogColour, f.fogDensity);
+    b.frameData.fogRange = glm::vec4(f.fogStart, f.fogEnd, 0.0f, 0.0f);
+    b.frameBlock.update(b.frameData);
+
+    b.lightData.ambient = glm::vec4(f.ambientColour, f.ambientStrength);
+    b.lightData.directionalColour = glm::vec4(f.dirColour, 0.0f);
+    b.lightData.directionalDirection = glm::vec4(f.lightDirection, 0.0f);
+    // the point lights are clustered (light_clusters.h) and no longer part of the block
+    b.lightBlock.update(b.lightData);
+
+    shader.use();
+    for (const glm::mat4 &model : f.objects)
+    {
+        shader.set(b.model, model);
+        shader.set(b.modelViewProjection, b.frameData.viewProjection * model);
+        mesh.Draw(shader);
+    }
+}
+
+template <typename Frame>
+void measure(const char* label, int frames, Frame frame)
+{
+    frame(); // warm up
+    size_t calls = stub::calls, queries = stub::locationQueries, heap = allocations;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < frames; i++)
+        frame();
+    double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / frames;
+    cout << label << ": " << double(stub::calls - calls) / frames << " GL calls, "
+         << double(stub::locationQueries - queries) / frames << " glGetUniformLocation, "
+         << double(allocations - heap) / frames << " allocations, " << ns / 1000.0 << " us per frame" << endl;
+}
+
+int main(int argc, char* argv[])
+{
+    int frames = argc > 1 ? atoi(argv[1]) : 20000;
+    if (frames <= 0)
+        frames = 20000;
+    stub::install();
+
+    Shader shader("shaders/1.model_loading.vs", "shaders/1.model_loading.fs");
+    vector<Vertex> vertices(3);
+    for (Vertex &vertex : vertices)
+        memset(&vertex, 0, sizeof(vertex));
+    vector<Texture> textures = { { 1, "texture_diffuse", "" }, { 2, "texture_specular", "" }, { 3, "texture_normal", "" } };
+    Material material;
+    for (const Texture &texture : textures)
+        material.textures[materialSlot(texture.type)] = texture.id;
+    material.shininess = 32.0f;
+    Mesh mesh(vertices, { 0, 1, 2 }, MaterialLibrary::instance().acquire(material));
+    FrameState state;
+    FrameUniforms uniforms(shader);
+    FrameBlocks blocks(shader);
+
+    cout << "UNIFORM_BENCHMARK:: " << frames << " frames, " << state.objects.size() << " objects with "
+         << textures.size() << " textures" << endl;
+    measure("by name", frames, [&]() { frameByName(shader, state, mesh, textures); });
+    measure("handles", frames, [&]() { frameWithHandles(shader, uniforms, state, mesh); });
+    measure("blocks", frames, [&]() { frameWithBlocks(shader, blocks, state, mesh); });
+    cout << "blocks: " << blocks.frameBlock.writes << " frame block writes, " << blocks.lightBlock.writes << " light block writes, "
+         << blocks.lightBlock.skips << " skipped" << endl;
+    return 0;
+}
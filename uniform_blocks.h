@@ -0,0 +1,109 @@
+#ifndef UNIFORM_BLOCKS_H
+#define UNIFORM_BLOCKS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstring>
+
+// Uniform blocks shared by every program, std140 layout. The GLSL side of each struct is declared in every shader
+// that reads it (GLSL 3.30 has no includes), keep them in sync. Only vec4 and mat4 members, so the C++ layout
+// matches std140 without padding.
+
+// per frame: camera and fog. Binding UNIFORM_BINDING_FRAME, block 'FrameBlock'.
+struct FrameUniformData {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 viewProjection;
+    glm::mat4 skyViewProjection;   // projection * the rotation of view, for the skybox
+    glm::vec4 viewPosition;        // xyz camera position, w time in seconds
+    glm::vec4 fogColour;           // rgb colour, a density
+    glm::vec4 fogRange;            // x start, y end
+    glm::vec4 clusterGrid;         // LightGrid::gridParameters, the fragment's light cluster
+};
+
+// ambient and directional light. Binding UNIFORM_BINDING_LIGHTS, block 'LightBlock'. The point lights are
+// clustered, see light_clusters.h.
+struct LightUniformData {
+    glm::vec4 ambient;             // rgb colour, a strength
+    glm::vec4 directionalColour;
+    glm::vec4 directionalDirection;
+};
+
+static_assert(sizeof(FrameUniformData) % 16 == 0 && sizeof(LightUniformData) % 16 == 0, "std140 blocks are vec4 aligned");
+
+const GLuint UNIFORM_BINDING_FRAME = 0;
+const GLuint UNIFORM_BINDING_LIGHTS = 1;
+
+// Fixed binding point of every block name. GLSL 3.30 can't say 'layout(binding = N)', so Shader assigns them
+// after linking.
+struct UniformBlockBinding {
+    const char* name;
+    GLuint binding;
+};
+const UniformBlockBinding UNIFORM_BLOCK_BINDINGS[] = {
+    { "FrameBlock", UNIFORM_BINDING_FRAME },
+    { "LightBlock", UNIFORM_BINDING_LIGHTS },
+};
+
+inline void bindUniformBlocks(GLuint program)
+{
+    for (const UniformBlockBinding &block : UNIFORM_BLOCK_BINDINGS)
+    {
+        GLuint index = glGetUniformBlockIndex(program, block.name);
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(program, index, block.binding);
+    }
+}
+
+// The buffer behind one block, bound to its binding point for good. update() writes the whole block with one
+// glBufferSubData, and only when it differs from what was written last.
+template <typename T>
+class UniformBlock
+{
+public:
+    // counters since creation
+    unsigned int writes = 0;
+    unsigned int skips = 0;
+
+    explicit UniformBlock(GLuint binding)
+    {
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(T), nullptr, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    ~UniformBlock()
+    {
+        glDeleteBuffers(1, &buffer);
+    }
+
+    // the buffer is owned, a copy would delete it twice
+    UniformBlock(const UniformBlock&) = delete;
+    UniformBlock& operator=(const UniformBlock&) = delete;
+
+    // returns whether it wrote
+    bool update(const T &data)
+    {
+        if (written && memcmp(&shadow, &data, sizeof(T)) == 0)
+        {
+            skips++;
+            return false;
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T), &data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        shadow = data;
+        written = true;
+        writes++;
+        return true;
+    }
+
+private:
+    GLuint buffer = 0;
+    T shadow;
+    bool written = false;
+};
+#endif
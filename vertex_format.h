@@ -0,0 +1,211 @@
+#ifndef VERTEX_FORMAT_H
+#define VERTEX_FORMAT_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+using namespace std;
+
+#define MAX_BONE_INFLUENCE 4
+
+// Full precision vertex as it comes out of the importer. This is what the mesh cache stores; the GPU gets one
+// of the compact layouts below instead.
+struct Vertex {
+    glm::vec3 Position;
+    glm::vec3 Normal;
+    glm::vec2 TexCoords;
+    glm::vec3 Tangent;
+    glm::vec3 Bitangent;
+	int m_BoneIDs[MAX_BONE_INFLUENCE];
+	float m_Weights[MAX_BONE_INFLUENCE];
+};
+
+// Attribute locations shared by every mesh shader. A shader's needs are a mask of (1 << location).
+const GLuint VERTEX_LOCATION_POSITION = 0;
+const GLuint VERTEX_LOCATION_NORMAL   = 1;
+const GLuint VERTEX_LOCATION_TEXCOORD = 2;
+const GLuint VERTEX_LOCATION_TANGENT  = 3;
+
+const unsigned int VERTEX_ATTRIBUTE_POSITION = 1u << VERTEX_LOCATION_POSITION;
+const unsigned int VERTEX_ATTRIBUTE_NORMAL   = 1u << VERTEX_LOCATION_NORMAL;
+const unsigned int VERTEX_ATTRIBUTE_TEXCOORD = 1u << VERTEX_LOCATION_TEXCOORD;
+const unsigned int VERTEX_ATTRIBUTE_TANGENT  = 1u << VERTEX_LOCATION_TANGENT;
+const unsigned int VERTEX_ATTRIBUTES_ALL = VERTEX_ATTRIBUTE_POSITION | VERTEX_ATTRIBUTE_NORMAL | VERTEX_ATTRIBUTE_TEXCOORD | VERTEX_ATTRIBUTE_TANGENT;
+
+// Per-instance model matrix, one column per location (see instance_buffer.h), and the texture coordinate transform
+// (offset.xy, scale.xy), a constant per draw or per instance in a multi-draw (multi_draw.h). Not part of the vertex
+// layouts.
+const GLuint VERTEX_LOCATION_INSTANCE_MATRIX = 4;
+const GLuint VERTEX_LOCATION_INSTANCE_TEXCOORD = 8;
+const unsigned int VERTEX_ATTRIBUTES_INSTANCE = (0xFu << VERTEX_LOCATION_INSTANCE_MATRIX) | (1u << VERTEX_LOCATION_INSTANCE_TEXCOORD);
+
+// How each attribute is encoded. The shader side decoding lives in shaders/1.model_loading.vs.
+//   position: 4 x unorm16, xyz relative to the mesh bounds (positionOffset/positionScale uniforms),
+//             w is the bitangent sign (0 -> -1, 1 -> +1) when the layout has a tangent
+//   normal:   2 x snorm16, octahedral encoding
+//   texcoord: 2 x unorm16, relative to the mesh's UV bounds (instanceTexCoord attribute)
+//   tangent:  2 x snorm16, octahedral encoding; the bitangent is cross(normal, tangent) * sign
+struct VertexAttributeFormat {
+    GLuint location;
+    GLint components;
+    GLenum type;
+    GLboolean normalized;
+    unsigned int offset;
+};
+
+struct VertexLayout {
+    const char *name;
+    unsigned int stride;
+    unsigned int attributes;
+    unsigned int attributeCount;
+    VertexAttributeFormat formats[4];
+};
+
+// The layout family, smallest first. Every layout is a prefix of the next one.
+const VertexLayout VERTEX_LAYOUTS[] = {
+    { "P", 8, VERTEX_ATTRIBUTE_POSITION, 1, {
+        { VERTEX_LOCATION_POSITION, 4, GL_UNSIGNED_SHORT, GL_TRUE, 0 } } },
+    { "PN", 12, VERTEX_ATTRIBUTE_POSITION | VERTEX_ATTRIBUTE_NORMAL, 2, {
+        { VERTEX_LOCATION_POSITION, 4, GL_UNSIGNED_SHORT, GL_TRUE, 0 },
+        { VERTEX_LOCATION_NORMAL,   2, GL_SHORT,          GL_TRUE, 8 } } },
+    { "PNT", 16, VERTEX_ATTRIBUTE_POSITION | VERTEX_ATTRIBUTE_NORMAL | VERTEX_ATTRIBUTE_TEXCOORD, 3, {
+        { VERTEX_LOCATION_POSITION, 4, GL_UNSIGNED_SHORT, GL_TRUE, 0 },
+        { VERTEX_LOCATION_NORMAL,   2, GL_SHORT,          GL_TRUE, 8 },
+        { VERTEX_LOCATION_TEXCOORD, 2, GL_UNSIGNED_SHORT, GL_TRUE, 12 } } },
+    { "PNTT", 20, VERTEX_ATTRIBUTES_ALL, 4, {
+        { VERTEX_LOCATION_POSITION, 4, GL_UNSIGNED_SHORT, GL_TRUE, 0 },
+        { VERTEX_LOCATION_NORMAL,   2, GL_SHORT,          GL_TRUE, 8 },
+        { VERTEX_LOCATION_TEXCOORD, 2, GL_UNSIGNED_SHORT, GL_TRUE, 12 },
+        { VERTEX_LOCATION_TANGENT,  2, GL_SHORT,          GL_TRUE, 16 } } }
+};
+const unsigned int VERTEX_LAYOUT_COUNT = sizeof(VERTEX_LAYOUTS) / sizeof(VERTEX_LAYOUTS[0]);
+
+// smallest layout with every attribute in the mask. Attributes outside the family get the largest layout,
+// the per-instance ones come from their own buffers and are ignored.
+inline const VertexLayout &selectVertexLayout(unsigned int attributes)
+{
+    attributes &= ~VERTEX_ATTRIBUTES_INSTANCE;
+    for (unsigned int i = 0; i < VERTEX_LAYOUT_COUNT; i++)
+        if ((VERTEX_LAYOUTS[i].attributes & attributes) == attributes)
+            return VERTEX_LAYOUTS[i];
+    return VERTEX_LAYOUTS[VERTEX_LAYOUT_COUNT - 1];
+}
+
+// Per-mesh transform back from the unorm16 position and texcoord ranges
+struct VertexQuantization {
+    glm::vec3 positionOffset = glm::vec3(0.0f);
+    glm::vec3 positionScale = glm::vec3(1.0f);
+    glm::vec2 texCoordOffset = glm::vec2(0.0f);
+    glm::vec2 texCoordScale = glm::vec2(1.0f);
+};
+
+namespace vertex_format
+{
+    inline uint16_t quantizeUnorm16(float value)
+    {
+        return static_cast<uint16_t>(std::lround(std::min(1.0f, std::max(0.0f, value)) * 65535.0f));
+    }
+
+    inline int16_t quantizeSnorm16(float value)
+    {
+        return static_cast<int16_t>(std::lround(std::min(1.0f, std::max(-1.0f, value)) * 32767.0f));
+    }
+
+    // octahedral mapping of a unit vector onto [-1, 1]^2
+    inline glm::vec2 octEncode(glm::vec3 n)
+    {
+        float length = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+        if (length == 0.0f)
+            return glm::vec2(0.0f, 0.0f);
+        n /= length;
+        glm::vec2 e(n.x, n.y);
+        if (n.z < 0.0f)
+        {
+            e.x = (1.0f - std::fabs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+            e.y = (1.0f - std::fabs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+        }
+        return e;
+    }
+
+    // offset/scale pair mapping [min, max] onto [0, 1]. Flat axes keep a scale of 1 so nothing divides by 0.
+    template <typename T>
+    inline void bounds(const T &minimum, const T &maximum, T &offset, T &scale)
+    {
+        offset = minimum;
+        scale = maximum - minimum;
+        for (int i = 0; i < T::length(); i++)
+            if (scale[i] <= 0.0f)
+                scale[i] = 1.0f;
+    }
+}
+
+// Encodes vertices into the given layout. Fills in the transform the shader needs to decode them.
+inline vector<unsigned char> packVertices(const vector<Vertex> &vertices, const VertexLayout &layout, VertexQuantization &quantization)
+{
+    using namespace vertex_format;
+    quantization = VertexQuantization();
+    if (!vertices.empty())
+    {
+        glm::vec3 minPosition = vertices[0].Position, maxPosition = vertices[0].Position;
+        glm::vec2 minTexCoord = vertices[0].TexCoords, maxTexCoord = vertices[0].TexCoords;
+        for (const Vertex &vertex : vertices)
+        {
+            minPosition = glm::min(minPosition, vertex.Position);
+            maxPosition = glm::max(maxPosition, vertex.Position);
+            minTexCoord = glm::min(minTexCoord, vertex.TexCoords);
+            maxTexCoord = glm::max(maxTexCoord, vertex.TexCoords);
+        }
+        bounds(minPosition, maxPosition, quantization.positionOffset, quantization.positionScale);
+        bounds(minTexCoord, maxTexCoord, quantization.texCoordOffset, quantization.texCoordScale);
+    }
+
+    bool hasTangent = (layout.attributes & VERTEX_ATTRIBUTE_TANGENT) != 0;
+    vector<unsigned char> packed(vertices.size() * layout.stride, 0);
+    for (size_t v = 0; v < vertices.size(); v++)
+    {
+        const Vertex &vertex = vertices[v];
+        unsigned char *out = &packed[v * layout.stride];
+        for (unsigned int a = 0; a < layout.attributeCount; a++)
+        {
+            const VertexAttributeFormat &format = layout.formats[a];
+            if (format.location == VERTEX_LOCATION_POSITION)
+            {
+                glm::vec3 p = (vertex.Position - quantization.positionOffset) / quantization.positionScale;
+                float sign = glm::dot(glm::cross(vertex.Normal, vertex.Tangent), vertex.Bitangent) < 0.0f ? 0.0f : 1.0f;
+                uint16_t q[4] = { quantizeUnorm16(p.x), quantizeUnorm16(p.y), quantizeUnorm16(p.z), quantizeUnorm16(hasTangent ? sign : 0.0f) };
+                memcpy(out + format.offset, q, sizeof(q));
+            }
+            else if (format.location == VERTEX_LOCATION_TEXCOORD)
+            {
+                glm::vec2 t = (vertex.TexCoords - quantization.texCoordOffset) / quantization.texCoordScale;
+                uint16_t q[2] = { quantizeUnorm16(t.x), quantizeUnorm16(t.y) };
+                memcpy(out + format.offset, q, sizeof(q));
+            }
+            else
+            {
+                glm::vec2 e = octEncode(format.location == VERTEX_LOCATION_NORMAL ? vertex.Normal : vertex.Tangent);
+                int16_t q[2] = { quantizeSnorm16(e.x), quantizeSnorm16(e.y) };
+                memcpy(out + format.offset, q, sizeof(q));
+            }
+        }
+    }
+    return packed;
+}
+
+// points the bound VAO at the bound vertex buffer as the layout describes
+inline void setupVertexAttributes(const VertexLayout &layout)
+{
+    for (unsigned int a = 0; a < layout.attributeCount; a++)
+    {
+        const VertexAttributeFormat &format = layout.formats[a];
+        glEnableVertexAttribArray(format.location);
+        glVertexAttribPointer(format.location, format.components, format.type, format.normalized, layout.stride, (void*)(uintptr_t)format.offset);
+    }
+}
+#endif
@@ -0,0 +1,107 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+#include "profiler.h"
+using namespace std;
+
+// A few persistent threads that run the jobs of one parallel loop together with the calling thread. run() returns
+// when every job is done; jobs are claimed one at a time from a shared counter. The process-wide instance() is
+// shared by the CPU passes of the frame, which run one after another on the main thread.
+class WorkerPool
+{
+public:
+    explicit WorkerPool(unsigned int count)
+    {
+        for (unsigned int i = 0; i < count; i++)
+            threads.emplace_back(&WorkerPool::workerLoop, this);
+    }
+
+    ~WorkerPool()
+    {
+        {
+            lock_guard<mutex> lock(stateMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (thread &worker : threads)
+            worker.join();
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // a few threads, leaving a core for the main thread and the driver
+    static WorkerPool &instance()
+    {
+        static WorkerPool pool(std::min(3u, std::max(1u, thread::hardware_concurrency()) - 1));
+        return pool;
+    }
+
+    size_t size() const { return threads.size(); }
+
+    void run(unsigned int jobs, const function<void(unsigned int)> &job)
+    {
+        {
+            lock_guard<mutex> lock(stateMutex);
+            current = &job;
+            jobCount = jobs;
+            nextJob = 0;
+            busy = static_cast<unsigned int>(threads.size());
+            generation++;
+        }
+        wake.notify_all();
+        work();
+        unique_lock<mutex> lock(stateMutex);
+        done.wait(lock, [this] { return busy == 0; });
+    }
+
+private:
+    vector<thread> threads;
+    mutex stateMutex;
+    condition_variable wake, done;
+    const function<void(unsigned int)> *current = nullptr;
+    unsigned int jobCount = 0;
+    atomic<unsigned int> nextJob{ 0 };
+    unsigned int busy = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+
+    void work()
+    {
+        for (unsigned int i = nextJob++; i < jobCount; i = nextJob++)
+            (*current)(i);
+    }
+
+    void workerLoop()
+    {
+        PROFILE_THREAD("Worker");
+        uint64_t seen = 0;
+        while (true)
+        {
+            {
+                unique_lock<mutex> lock(stateMutex);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping)
+                    return;
+                seen = generation;
+            }
+            {
+                PROFILE_ZONE("Worker jobs");
+                work();
+            }
+            lock_guard<mutex> lock(stateMutex);
+            if (--busy == 0)
+                done.notify_one();
+        }
+    }
+};
+#endif